@@ -0,0 +1,1703 @@
+// Integrator benchmark for the drone dynamics
+// Compile using: ./scripts/build_ocean.sh drone [local|fast], with bench.c as the entry point
+// Run with: ./bench [steps] [drones]
+//
+// Flies the same action sequences through each integrator and reports
+// derivative evaluations per policy step, time per step and position error
+// against a reference solution (RK4 with REF_SUBSTEPS substeps per policy
+// step). Drones are drawn over the same size range as DroneRace.
+//
+// A second table sweeps the policy step size for drones across the
+// init_drone size range, flying a held random command signal, and reports
+// the position error or where an integrator goes unstable.
+//
+// A third table compares the cost and drift of every integrator, float and
+// double, against a double precision RK4 reference with fine substeps.
+//
+// Finally the analytic Jacobians and the taped backward pass are checked
+// against central differences and timed against the forward step, the rate
+// controller's tracking and cost are measured, the downwash grid is timed
+// and checked against visiting every pair, and the geometric expert races
+// DroneRace tracks in each control mode, with and without streaming its
+// play to a dataset. Cloned envs are checked to replay their source exactly,
+// open loop rollouts are timed against c_step and checked against a clone
+// stepping the same actions, and the MPPI planner races the expert's tracks.
+// The expert then races fields of 1, 2 and 8 drones sharing each track,
+// timed in drone steps/s against single drone envs, and last the Drone
+// layout's cache lines and miss cost per step are compared against the
+// layout before its hot/cold split at 4096 drones, and 1024 envs are built,
+// stepped and closed with their buffers on the heap and in the arena.
+
+#include "drone_race.h"
+#include "dronedata.h"
+#include "droneplan.h"
+#include <stddef.h>
+#include <time.h>
+
+// More substeps only add float rounding error to the reference
+#define REF_SUBSTEPS 16
+#define SCENARIO_HOVER 0
+#define SCENARIO_CRUISE 1
+#define SCENARIO_AGGRESSIVE 2
+#define SCENARIO_N 3
+
+const char *SCENARIO_NAMES[SCENARIO_N] = {"hover", "cruise", "aggressive"};
+
+#define BENCH_INTEGRATORS 5
+const int BENCH_INTEGRATOR_IDS[BENCH_INTEGRATORS] = {
+    INTEGRATOR_RK4, INTEGRATOR_RK45, INTEGRATOR_RK23, INTEGRATOR_EXP_RK4, INTEGRATOR_EXP_EULER
+};
+
+// Step size sweep
+#define SWEEP_SIZES 5
+#define SWEEP_DTS 6
+#define SWEEP_DRONES 8
+#define SWEEP_SECONDS 5.0f
+#define SWEEP_HOLD 0.25f    // s between command changes
+#define SWEEP_REF_DT 0.002f // s, reference RK4 step
+const float SWEEP_SIZE_VALUES[SWEEP_SIZES] = {0.05f, 0.1f, 0.2f, 0.4f, 0.8f};
+const float SWEEP_DT_VALUES[SWEEP_DTS] = {0.01f, 0.02f, 0.05f, 0.1f, 0.2f, 0.3f};
+
+// Cost versus drift
+#define DRIFT_DRONES 32
+#define DRIFT_SECONDS 5.0f
+#define DRIFT_REF_SUBSTEPS 64
+#define DRIFT_HORIZONS 3
+const float DRIFT_HORIZON_VALUES[DRIFT_HORIZONS] = {0.5f, 1.0f, 5.0f};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median of n values, reordering them
+static double median(double *v, int n) {
+    qsort(v, n, sizeof(double), compare_doubles);
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// Action that makes the four motors together cancel gravity
+static float hover_action(Params *p) {
+    float rpm = sqrtf(p->mass * p->gravity / (4.0f * p->k_thrust));
+    return 2.0f * rpm / p->max_rpm - 1.0f;
+}
+
+static void make_actions(int scenario, Params *p, float *actions, int steps) {
+    float hover = hover_action(p);
+    float held[4] = {0};
+    for (int t = 0; t < steps; t++) {
+        float *a = &actions[4 * t];
+        float phase = 2.0f * (float)M_PI * t * DT;
+        for (int i = 0; i < 4; i++) {
+            if (scenario == SCENARIO_HOVER) {
+                a[i] = hover;
+            } else if (scenario == SCENARIO_CRUISE) {
+                // Gentle tilt that slowly rotates around the body axes
+                a[i] = hover + 0.02f * sinf(0.25f * phase + 0.5f * (float)M_PI * i);
+            } else {
+                // Full range commands held for a few steps at a time
+                if (t % 5 == 0) {
+                    held[i] = rndf(-1.0f, 1.0f);
+                }
+                a[i] = held[i];
+            }
+        }
+    }
+}
+
+// move_drone with REF_SUBSTEPS RK4 substeps
+static void reference_step(Drone *drone, float *actions) {
+    clamp4(actions, -1.0f, 1.0f);
+    drone->prev_pos = drone->state.pos;
+    for (int s = 0; s < REF_SUBSTEPS; s++) {
+        rk4_step(&drone->state, &drone->params, actions, DT / REF_SUBSTEPS);
+    }
+    clamp3(&drone->state.vel, -drone->params.max_vel, drone->params.max_vel);
+    clamp3(&drone->state.omega, -drone->params.max_omega, drone->params.max_omega);
+}
+
+static void start_drone(Drone *drone, Params *params, float hover) {
+    init_drone(drone, 0.2f, 0.0f);
+    drone->params = *params;
+    for (int i = 0; i < 4; i++) {
+        drone->state.rpms[i] = (hover + 1.0f) * 0.5f * params->max_rpm;
+    }
+}
+
+// Flies the held command signal for SWEEP_SECONDS with steps of dt, using
+// the reference integrator when integrator < 0. Returns false if the drone
+// blew up.
+static bool sweep_fly(Drone *drone, int integrator, const float *commands, float dt, Vec3 *end) {
+    int steps = (int)(SWEEP_SECONDS / dt + 0.5f);
+    int substeps = integrator < 0 ? (int)(dt / SWEEP_REF_DT + 0.5f) : 1;
+    set_integrator(drone, integrator < 0 ? INTEGRATOR_RK4 : integrator);
+    float a[4];
+    for (int t = 0; t < steps; t++) {
+        memcpy(a, &commands[4 * (int)(t * dt / SWEEP_HOLD)], sizeof(a));
+        for (int s = 0; s < substeps; s++) {
+            integrate_drone(drone, a, dt / substeps);
+        }
+        clamp3(&drone->state.vel, -drone->params.max_vel, drone->params.max_vel);
+        clamp3(&drone->state.omega, -drone->params.max_omega, drone->params.max_omega);
+        if (!isfinite(drone->state.pos.x + drone->state.pos.y + drone->state.pos.z)
+                || norm3(drone->state.pos) > 1e3f) {
+            return false;
+        }
+    }
+    *end = drone->state.pos;
+    return true;
+}
+
+static void step_size_sweep(void) {
+    int num_commands = (int)(SWEEP_SECONDS / SWEEP_HOLD) + 2;
+    float *commands = calloc(4 * num_commands, sizeof(float));
+    Drone drone = {0};
+
+    printf("\nMean position error after %.0f s, held random commands, by size and dt\n", SWEEP_SECONDS);
+    printf("%-5s %-6s %9s", "size", "method", "evals/s");
+    for (int k = 0; k < SWEEP_DTS; k++) {
+        printf("  dt=%-5.3f", SWEEP_DT_VALUES[k]);
+    }
+    printf("\n");
+
+    for (int z = 0; z < SWEEP_SIZES; z++) {
+        double err[BENCH_INTEGRATORS][SWEEP_DTS] = {{0}};
+        int unstable[BENCH_INTEGRATORS][SWEEP_DTS] = {{0}};
+        double evals[BENCH_INTEGRATORS] = {0};
+        for (int d = 0; d < SWEEP_DRONES; d++) {
+            init_drone(&drone, SWEEP_SIZE_VALUES[z], 0.1f);
+            Params params = drone.params;
+            float hover = hover_action(&params);
+            for (int i = 0; i < 4 * num_commands; i++) {
+                commands[i] = hover + rndf(-0.2f, 0.2f);
+            }
+
+            for (int k = 0; k < SWEEP_DTS; k++) {
+                float dt = SWEEP_DT_VALUES[k];
+                Vec3 ref, end;
+                start_drone(&drone, &params, hover);
+                bool ref_ok = sweep_fly(&drone, -1, commands, dt, &ref);
+                for (int m = 0; m < BENCH_INTEGRATORS; m++) {
+                    start_drone(&drone, &params, hover);
+                    if (ref_ok && sweep_fly(&drone, BENCH_INTEGRATOR_IDS[m], commands, dt, &end)) {
+                        err[m][k] += norm3(sub3(end, ref)) / SWEEP_DRONES;
+                    } else {
+                        unstable[m][k]++;
+                    }
+                }
+            }
+
+            // Cost at the training step size
+            for (int m = 0; m < BENCH_INTEGRATORS; m++) {
+                start_drone(&drone, &params, hover);
+                set_integrator(&drone, BENCH_INTEGRATOR_IDS[m]);
+                float a[4];
+                for (int t = 0; t < (int)(1.0f / DT); t++) {
+                    memcpy(a, &commands[4 * (int)(t * DT / SWEEP_HOLD)], sizeof(a));
+                    evals[m] += integrate_drone(&drone, a, DT) / (double)SWEEP_DRONES;
+                }
+            }
+        }
+
+        for (int m = 0; m < BENCH_INTEGRATORS; m++) {
+            printf("%-5.2f %-6s %9.0f", SWEEP_SIZE_VALUES[z], INTEGRATORS[BENCH_INTEGRATOR_IDS[m]].name, evals[m]);
+            for (int k = 0; k < SWEEP_DTS; k++) {
+                if (unstable[m][k] > 0) {
+                    printf("  %4d/%-4d", unstable[m][k], SWEEP_DRONES);
+                } else {
+                    printf("  %9.2e", err[m][k]);
+                }
+            }
+            printf("\n");
+        }
+    }
+    printf("n/%d: number of drones that went unstable\n", SWEEP_DRONES);
+    free(commands);
+}
+
+// Fills traj with the position after every policy step, integrating the
+// state in double with fine RK4 substeps and the move_drone clamps
+static void drift_reference(Drone *drone, const float *commands, int steps, Vec3 *traj) {
+    double y[STATE_DIM];
+    float *s = (float *)&drone->state;
+    for (int i = 0; i < STATE_DIM; i++) {
+        y[i] = s[i];
+    }
+    double max_vel = drone->params.max_vel;
+    double max_omega = drone->params.max_omega;
+    for (int t = 0; t < steps; t++) {
+        const float *a = &commands[4 * (int)(t * DT / SWEEP_HOLD)];
+        for (int k = 0; k < DRIFT_REF_SUBSTEPS; k++) {
+            rk4_flat_d(y, &drone->params, a, (double)DT / DRIFT_REF_SUBSTEPS);
+        }
+        for (int i = 0; i < 3; i++) {
+            y[3 + i] = fmax(-max_vel, fmin(max_vel, y[3 + i]));
+            y[10 + i] = fmax(-max_omega, fmin(max_omega, y[10 + i]));
+        }
+        traj[t] = (Vec3){(float)y[0], (float)y[1], (float)y[2]};
+    }
+}
+
+static void cost_drift(void) {
+    int steps = (int)(DRIFT_SECONDS / DT + 0.5f);
+    int num_commands = (int)(DRIFT_SECONDS / SWEEP_HOLD) + 2;
+    float *commands = calloc(4 * num_commands, sizeof(float));
+    Vec3 *ref = calloc(steps, sizeof(Vec3));
+    double evals[INTEGRATOR_N] = {0};
+    double seconds[INTEGRATOR_N] = {0};
+    double err[INTEGRATOR_N][DRIFT_HORIZONS] = {{0}};
+    int unstable[INTEGRATOR_N] = {0};
+    Drone drone = {0};
+    float a[4];
+
+    for (int d = 0; d < DRIFT_DRONES; d++) {
+        init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+        Params params = drone.params;
+        float hover = hover_action(&params);
+        for (int i = 0; i < 4 * num_commands; i++) {
+            commands[i] = hover + rndf(-0.2f, 0.2f);
+        }
+        start_drone(&drone, &params, hover);
+        drift_reference(&drone, commands, steps, ref);
+
+        for (int m = 0; m < INTEGRATOR_N; m++) {
+            start_drone(&drone, &params, hover);
+            set_integrator(&drone, m);
+            int h = 0;
+            double start = now_sec();
+            for (int t = 0; t < steps; t++) {
+                memcpy(a, &commands[4 * (int)(t * DT / SWEEP_HOLD)], sizeof(a));
+                evals[m] += move_drone(&drone, a);
+                if (h < DRIFT_HORIZONS && t + 1 == (int)(DRIFT_HORIZON_VALUES[h] / DT + 0.5f)) {
+                    err[m][h++] += norm3(sub3(drone.state.pos, ref[t])) / DRIFT_DRONES;
+                }
+            }
+            seconds[m] += now_sec() - start;
+            if (!isfinite(drone.state.pos.x + drone.state.pos.y + drone.state.pos.z)) {
+                unstable[m]++;
+            }
+        }
+    }
+
+    printf("\nCost and drift at dt=%.3f, %d drones, reference double RK4 with %d substeps\n",
+        DT, DRIFT_DRONES, DRIFT_REF_SUBSTEPS);
+    printf("%-10s %10s %10s", "method", "evals/step", "ns/step");
+    for (int h = 0; h < DRIFT_HORIZONS; h++) {
+        printf("   err@%.1fs", DRIFT_HORIZON_VALUES[h]);
+    }
+    printf("\n");
+    double n = (double)DRIFT_DRONES * steps;
+    for (int m = 0; m < INTEGRATOR_N; m++) {
+        printf("%-10s %10.2f %10.1f", INTEGRATORS[m].name, evals[m] / n, 1e9 * seconds[m] / n);
+        for (int h = 0; h < DRIFT_HORIZONS; h++) {
+            if (unstable[m] > 0) {
+                printf("  %4d/%-4d", unstable[m], DRIFT_DRONES);
+            } else {
+                printf("  %9.2e", err[m][h]);
+            }
+        }
+        printf("\n");
+    }
+    printf("err in m, rings allow 0.5 m of margin\n");
+    free(commands);
+    free(ref);
+}
+
+#define JAC_DRONES 256
+#define JAC_REPEATS 20
+#define JAC_COLS (STATE_DIM + 4)
+
+static void random_state(double *y, Params *p) {
+    y[0] = rndf(-5.0f, 5.0f);
+    y[1] = rndf(-5.0f, 5.0f);
+    y[2] = rndf(-5.0f, 5.0f);
+    for (int i = 3; i < 6; i++) {
+        y[i] = rndf(-3.0f, 3.0f);
+    }
+    double n = 0.0;
+    for (int i = 6; i < 10; i++) {
+        y[i] = rndf(-1.0f, 1.0f);
+        n += y[i] * y[i];
+    }
+    for (int i = 6; i < 10; i++) {
+        y[i] /= sqrt(n);
+    }
+    for (int i = 10; i < 13; i++) {
+        y[i] = rndf(-5.0f, 5.0f);
+    }
+    for (int i = 13; i < 17; i++) {
+        y[i] = rndf(0.3f, 0.9f) * p->max_rpm;
+    }
+}
+
+// Central differences of f (derivs when dt is 0, else rk4_flat) in double,
+// J is STATE_DIM x JAC_COLS with the action columns last
+static void finite_jacobian(const double *y, Params *p, const float *a, double dt, double *J) {
+    double yp[STATE_DIM], ym[STATE_DIM], fp[STATE_DIM], fm[STATE_DIM];
+    for (int c = 0; c < JAC_COLS; c++) {
+        float ap[4], am[4];
+        memcpy(yp, y, sizeof(yp));
+        memcpy(ym, y, sizeof(ym));
+        memcpy(ap, a, sizeof(ap));
+        memcpy(am, a, sizeof(am));
+        double step;
+        if (c < STATE_DIM) {
+            double e = 1e-6 * fmax(1.0, fabs(y[c]));
+            yp[c] += e;
+            ym[c] -= e;
+            step = yp[c] - ym[c];
+        } else {
+            ap[c - STATE_DIM] += 1e-3f;
+            am[c - STATE_DIM] -= 1e-3f;
+            step = (double)ap[c - STATE_DIM] - am[c - STATE_DIM];
+        }
+        if (dt == 0.0) {
+            derivs_d(yp, p, ap, fp);
+            derivs_d(ym, p, am, fm);
+        } else {
+            memcpy(fp, yp, sizeof(fp));
+            memcpy(fm, ym, sizeof(fm));
+            rk4_flat_d(fp, p, ap, dt);
+            rk4_flat_d(fm, p, am, dt);
+        }
+        for (int i = 0; i < STATE_DIM; i++) {
+            J[i * JAC_COLS + c] = (fp[i] - fm[i]) / step;
+        }
+    }
+}
+
+// Largest entry error relative to the largest entry of its row
+static double jacobian_error(const double *A, const double *B, const double *J) {
+    double worst = 0.0;
+    for (int i = 0; i < STATE_DIM; i++) {
+        double scale = 1e-12, err = 0.0;
+        for (int c = 0; c < JAC_COLS; c++) {
+            double x = c < STATE_DIM ? A[i * STATE_DIM + c] : B[i * 4 + c - STATE_DIM];
+            scale = fmax(scale, fabs(J[i * JAC_COLS + c]));
+            err = fmax(err, fabs(x - J[i * JAC_COLS + c]));
+        }
+        worst = fmax(worst, err / scale);
+    }
+    return worst;
+}
+
+static void jacobian_check(void) {
+    int n = JAC_DRONES;
+    double y[STATE_DIM], J[STATE_DIM * JAC_COLS];
+    double A[STATE_DIM * STATE_DIM], B[STATE_DIM * 4];
+    float *states = calloc(STATE_DIM * n, sizeof(float));
+    float *actions = calloc(4 * n, sizeof(float));
+    float *Af = calloc(STATE_DIM * STATE_DIM * n, sizeof(float));
+    float *Bf = calloc(STATE_DIM * 4 * n, sizeof(float));
+    Params *params = calloc(n, sizeof(Params));
+    Drone drone = {0};
+    // Indexed by still air or wind. Wind is sampled at float positions,
+    // which limits the central differences in wind to about 1e-3.
+    double err_derivs[2] = {0}, err_rk4[2] = {0}, err_float = 0.0;
+    WindField wind;
+    uint32_t wind_rng = rng_seed();
+    init_wind(&wind, 5.0f);
+    reset_wind(&wind, &wind_rng);
+
+    for (int d = 0; d < n; d++) {
+        init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+        params[d] = drone.params;
+        // half the drones fly in wind
+        params[d].wind = d % 2 ? &wind : NULL;
+        random_state(y, &params[d]);
+        float a[4];
+        for (int j = 0; j < 4; j++) {
+            a[j] = rndf(-0.9f, 0.9f);
+            actions[j * n + d] = a[j];
+        }
+        for (int i = 0; i < STATE_DIM; i++) {
+            states[i * n + d] = (float)y[i];
+            y[i] = states[i * n + d];
+        }
+
+        derivs_jac_d(y, &params[d], a, A, B);
+        finite_jacobian(y, &params[d], a, 0.0, J);
+        err_derivs[d % 2] = fmax(err_derivs[d % 2], jacobian_error(A, B, J));
+
+        double y1[STATE_DIM];
+        memcpy(y1, y, sizeof(y1));
+        rk4_jac_flat_d(y1, &params[d], a, DT, A, B);
+        finite_jacobian(y, &params[d], a, DT, J);
+        err_rk4[d % 2] = fmax(err_rk4[d % 2], jacobian_error(A, B, J));
+    }
+
+    // Float batched path against the double analytic Jacobians
+    rk4_jacobians(n, states, params, actions, DT, Af, Bf);
+    double start = now_sec();
+    for (int r = 0; r < JAC_REPEATS; r++) {
+        rk4_jacobians(n, states, params, actions, DT, Af, Bf);
+    }
+    double t_analytic = (now_sec() - start) / JAC_REPEATS;
+    for (int d = 0; d < n; d++) {
+        float a[4];
+        for (int i = 0; i < STATE_DIM; i++) {
+            y[i] = states[i * n + d];
+        }
+        for (int j = 0; j < 4; j++) {
+            a[j] = actions[j * n + d];
+        }
+        rk4_jac_flat_d(y, &params[d], a, DT, A, B);
+        for (int i = 0; i < STATE_DIM * STATE_DIM; i++) {
+            J[i] = Af[i * n + d];
+        }
+        double Bd[STATE_DIM * 4];
+        for (int i = 0; i < STATE_DIM * 4; i++) {
+            Bd[i] = Bf[i * n + d];
+        }
+        double Jd[STATE_DIM * JAC_COLS];
+        for (int i = 0; i < STATE_DIM; i++) {
+            memcpy(&Jd[i * JAC_COLS], &A[i * STATE_DIM], STATE_DIM * sizeof(double));
+            memcpy(&Jd[i * JAC_COLS + STATE_DIM], &B[i * 4], 4 * sizeof(double));
+        }
+        err_float = fmax(err_float, jacobian_error(J, Bd, Jd));
+    }
+
+    // Forward differences through the float step, the cheapest numeric option
+    start = now_sec();
+    volatile float sink = 0.0f;
+    for (int d = 0; d < JAC_REPEATS * n; d++) {
+        State s0, s1;
+        float a[4];
+        for (int i = 0; i < STATE_DIM; i++) {
+            ((float *)&s0)[i] = states[i * n + d % n];
+        }
+        for (int j = 0; j < 4; j++) {
+            a[j] = actions[j * n + d % n];
+        }
+        for (int c = 0; c <= JAC_COLS; c++) {
+            s1 = s0;
+            if (c > 0 && c <= STATE_DIM) {
+                ((float *)&s1)[c - 1] += 1e-3f;
+            }
+            rk4_step(&s1, &params[d % n], a, DT);
+            sink += s1.pos.x;
+        }
+    }
+    double t_finite = (now_sec() - start) / JAC_REPEATS;
+
+    // Accuracy of those forward differences
+    double err_finite = 0.0;
+    for (int d = 0; d < n; d++) {
+        State s0, s1, base;
+        float a[4], ap[4];
+        for (int i = 0; i < STATE_DIM; i++) {
+            ((float *)&s0)[i] = states[i * n + d];
+            y[i] = states[i * n + d];
+        }
+        for (int j = 0; j < 4; j++) {
+            a[j] = actions[j * n + d];
+        }
+        rk4_jac_flat_d(y, &params[d], a, DT, A, B);
+        base = s0;
+        rk4_step(&base, &params[d], a, DT);
+        for (int c = 0; c < JAC_COLS; c++) {
+            s1 = s0;
+            memcpy(ap, a, sizeof(ap));
+            double step = 1e-3;
+            if (c < STATE_DIM) {
+                float *x = &((float *)&s1)[c];
+                float before = *x;
+                *x += 1e-3f * fmaxf(1.0f, fabsf(before));
+                step = (double)*x - before;
+            } else {
+                ap[c - STATE_DIM] += 1e-3f;
+                step = (double)ap[c - STATE_DIM] - a[c - STATE_DIM];
+            }
+            rk4_step(&s1, &params[d], ap, DT);
+            for (int i = 0; i < STATE_DIM; i++) {
+                J[i * JAC_COLS + c] = (((float *)&s1)[i] - ((float *)&base)[i]) / step;
+            }
+        }
+        err_finite = fmax(err_finite, jacobian_error(A, B, J));
+    }
+
+    printf("\nJacobians, %d random drones, half in %.0f m/s wind, dt=%.3f\n", n, wind.strength, DT);
+    printf("  derivs max rel err vs central diff:    %.2e, in wind %.2e\n", err_derivs[0], err_derivs[1]);
+    printf("  rk4 step max rel err vs central diff:  %.2e, in wind %.2e\n", err_rk4[0], err_rk4[1]);
+    printf("  float batched vs double analytic:      %.2e\n", err_float);
+    printf("  float forward diff vs double analytic: %.2e\n", err_finite);
+    printf("  batched analytic rk4: %.2f us/drone, forward diff: %.2f us/drone\n",
+        1e6 * t_analytic / n, 1e6 * t_finite / n);
+    free(states);
+    free(actions);
+    free(Af);
+    free(Bf);
+    free(params);
+    free_wind(&wind);
+}
+
+#define GRAD_STEPS 20
+#define GRAD_DRONES 64
+
+// Loss over a taped rollout: sum of w . pos after every step minus the
+// summed distance rewards to a fixed target. scales, when not NULL, sets
+// thrust_scale before every step as downwash from update_aero would.
+static double rollout_loss(Drone *drone, const State *start, const float *actions, const float *w,
+        const float *scales, float dist_weight, bool tape) {
+    drone->state = *start;
+    if (tape) {
+        clear_tape(&drone->tape);
+    }
+    drone->recording = tape;
+    double loss = 0.0;
+    float a[4];
+    for (int t = 0; t < GRAD_STEPS; t++) {
+        memcpy(a, &actions[4 * t], sizeof(a));
+        if (scales != NULL) {
+            drone->params.thrust_scale = scales[t];
+        }
+        move_drone(drone, a);
+        Vec3 p = drone->state.pos;
+        loss += w[3 * t] * p.x + w[3 * t + 1] * p.y + w[3 * t + 2] * p.z;
+        loss -= dist_weight * (1.0 - norm3(sub3(p, drone->target_pos)) / MAX_DIST);
+    }
+    drone->recording = true;
+    return loss;
+}
+
+static void gradient_check(void) {
+    Drone drone = {0};
+    float actions[4 * GRAD_STEPS], w[3 * GRAD_STEPS], scales[GRAD_STEPS];
+    float grad_states[GRAD_STEPS * STATE_DIM], grad_actions[GRAD_STEPS * 4];
+    float dist_weight = 10.0f;
+    double worst[2] = {0}, t_forward = 0.0, t_backward = 0.0;
+    WindField wind;
+    uint32_t wind_rng = rng_seed();
+    init_wind(&wind, 5.0f);
+    reset_wind(&wind, &wind_rng);
+
+    for (int i = 0; i < GRAD_STEPS; i++) {
+        scales[i] = i % 2 ? 0.6f : 1.0f; // in and out of a wake
+    }
+
+    for (int d = 0; d < GRAD_DRONES; d++) {
+        // every other pair of drones flies through downwash
+        const float *aero = (d / 2) % 2 ? scales : NULL;
+        init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+        drone.params.wind = d % 2 ? &wind : NULL;
+        set_integrator(&drone, INTEGRATOR_RK4_D);
+        init_drone_tape(&drone, GRAD_STEPS);
+        drone.target_pos = (Vec3){rndf(-5.0f, 5.0f), rndf(-5.0f, 5.0f), rndf(-5.0f, 5.0f)};
+        Params params = drone.params;
+        float hover = hover_action(&params);
+        start_drone(&drone, &params, hover);
+        State start = drone.state;
+        for (int i = 0; i < 4 * GRAD_STEPS; i++) {
+            actions[i] = hover + rndf(-0.3f, 0.3f);
+        }
+        memset(grad_states, 0, sizeof(grad_states));
+        for (int t = 0; t < GRAD_STEPS; t++) {
+            for (int i = 0; i < 3; i++) {
+                w[3 * t + i] = rndf(-1.0f, 1.0f);
+                grad_states[t * STATE_DIM + i] = w[3 * t + i];
+            }
+        }
+
+        double start_t = now_sec();
+        rollout_loss(&drone, &start, actions, w, aero, dist_weight, true);
+        t_forward += now_sec() - start_t;
+        start_t = now_sec();
+        tape_backward(&drone, grad_states, dist_weight, grad_actions);
+        t_backward += now_sec() - start_t;
+
+        double scale = 1e-12, err = 0.0;
+        for (int i = 0; i < 4 * GRAD_STEPS; i++) {
+            float saved = actions[i];
+            actions[i] = saved + 1e-3f;
+            double lp = rollout_loss(&drone, &start, actions, w, aero, dist_weight, false);
+            actions[i] = saved - 1e-3f;
+            double lm = rollout_loss(&drone, &start, actions, w, aero, dist_weight, false);
+            actions[i] = saved;
+            double fd = (lp - lm) / 2e-3;
+            scale = fmax(scale, fabs(fd));
+            err = fmax(err, fabs(fd - grad_actions[i]));
+        }
+        worst[aero != NULL] = fmax(worst[aero != NULL], err / scale);
+        free_tape(&drone.tape);
+    }
+
+    // One step in double against g^T of the central difference Jacobian
+    double step_worst[2] = {0};
+    for (int d = 0; d < GRAD_DRONES; d++) {
+        double y[STATE_DIM], g1[STATE_DIM], g0[STATE_DIM], ga[4], J[STATE_DIM * JAC_COLS];
+        float a[4];
+        init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+        drone.params.wind = d % 2 ? &wind : NULL;
+        random_state(y, &drone.params);
+        for (int j = 0; j < 4; j++) {
+            a[j] = rndf(-0.9f, 0.9f);
+        }
+        for (int i = 0; i < STATE_DIM; i++) {
+            g1[i] = rndf(-1.0f, 1.0f);
+        }
+        rk4_vjp_flat_d(y, &drone.params, a, DT, g1, g0, ga);
+        finite_jacobian(y, &drone.params, a, DT, J);
+        double scale = 1e-12, err = 0.0;
+        for (int c = 0; c < JAC_COLS; c++) {
+            double fd = 0.0;
+            for (int i = 0; i < STATE_DIM; i++) {
+                fd += g1[i] * J[i * JAC_COLS + c];
+            }
+            scale = fmax(scale, fabs(fd));
+            err = fmax(err, fabs((c < STATE_DIM ? g0[c] : ga[c - STATE_DIM]) - fd));
+        }
+        step_worst[d % 2] = fmax(step_worst[d % 2], err / scale);
+    }
+
+    free_wind(&wind);
+
+    printf("\nTaped backward, %d drones x %d steps, half in %.0f m/s wind\n",
+        GRAD_DRONES, GRAD_STEPS, wind.strength);
+    printf("  rk4 step vjp in double, max rel err vs central diff: %.2e, in wind %.2e\n",
+        step_worst[0], step_worst[1]);
+    printf("  rollout, max rel err vs central diff of float rollouts: %.2e, in downwash %.2e\n",
+        worst[0], worst[1]);
+    printf("  forward %.2f us/step, backward %.2f us/step\n",
+        1e6 * t_forward / (GRAD_DRONES * GRAD_STEPS), 1e6 * t_backward / (GRAD_DRONES * GRAD_STEPS));
+}
+
+// Rate control mode
+#define RATE_DRONES 32
+#define RATE_HOLDS 8      // held commands per drone
+#define RATE_HOLD_STEPS 10
+#define RATE_SETTLE 5     // policy steps before a hold counts as settled
+#define RATE_COMMAND 0.3f // largest rate action
+#define RATE_MODES 3
+const int RATE_MODE_INTEGRATORS[RATE_MODES] = {INTEGRATOR_RK4, INTEGRATOR_RK4, INTEGRATOR_EXP_EULER};
+const int RATE_MODE_CONTROLS[RATE_MODES] = {CONTROL_RPM, CONTROL_RATE, CONTROL_RATE};
+
+// Holds random body rate commands at hover collective and reports the
+// settled tracking error, with plain rpm control for the cost baseline
+static void rate_check(void) {
+    printf("\nRate control at %.0f Hz, held rate commands up to %.1f rad/s\n", RATE_HZ, RATE_COMMAND * RATE_MAX);
+    printf("%-7s %-8s %14s %12s %10s\n", "control", "method", "roll/pitch err", "yaw err", "us/step");
+    for (int m = 0; m < RATE_MODES; m++) {
+        srand(1);
+        double err_rp = 0.0, err_yaw = 0.0, seconds = 0.0;
+        int settled = 0;
+        Drone drone = {0};
+        for (int d = 0; d < RATE_DRONES; d++) {
+            init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+            Params params = drone.params;
+            start_drone(&drone, &params, hover_action(&params));
+            set_integrator(&drone, RATE_MODE_INTEGRATORS[m]);
+            set_control(&drone, RATE_MODE_CONTROLS[m]);
+            float max_t = params.k_thrust * params.max_rpm * params.max_rpm;
+            float collective = 2.0f * params.mass * params.gravity / (4.0f * max_t) - 1.0f;
+            for (int k = 0; k < RATE_HOLDS; k++) {
+                float command[4] = {collective, rndf(-RATE_COMMAND, RATE_COMMAND),
+                    rndf(-RATE_COMMAND, RATE_COMMAND), rndf(-RATE_COMMAND, RATE_COMMAND)};
+                if (RATE_MODE_CONTROLS[m] == CONTROL_RPM) {
+                    float hover = hover_action(&params);
+                    for (int j = 0; j < 4; j++) {
+                        command[j] = hover;
+                    }
+                }
+                for (int t = 0; t < RATE_HOLD_STEPS; t++) {
+                    float a[4];
+                    memcpy(a, command, sizeof(a));
+                    double start = now_sec();
+                    move_drone(&drone, a);
+                    seconds += now_sec() - start;
+                    if (t >= RATE_SETTLE && RATE_MODE_CONTROLS[m] == CONTROL_RATE) {
+                        Vec3 w = drone.state.omega;
+                        err_rp += fabsf(w.x - RATE_MAX * command[1]) + fabsf(w.y - RATE_MAX * command[2]);
+                        err_yaw += fabsf(w.z - RATE_MAX * command[3]);
+                        settled++;
+                    }
+                }
+            }
+        }
+        double steps = (double)RATE_DRONES * RATE_HOLDS * RATE_HOLD_STEPS;
+        const char *control = RATE_MODE_CONTROLS[m] == CONTROL_RATE ? "rate" : "rpm";
+        if (settled > 0) {
+            printf("%-7s %-8s %14.3f %12.3f %10.2f\n", control, INTEGRATORS[RATE_MODE_INTEGRATORS[m]].name,
+                err_rp / (2.0 * settled), err_yaw / settled, 1e6 * seconds / steps);
+        } else {
+            printf("%-7s %-8s %14s %12s %10.2f\n", control, INTEGRATORS[RATE_MODE_INTEGRATORS[m]].name,
+                "-", "-", 1e6 * seconds / steps);
+        }
+    }
+    printf("errors in rad/s, yaw authority from rotor drag is small\n");
+}
+
+// Downwash and ground effect
+#define AERO_SIZES 4
+#define AERO_REPEATS 20
+const int AERO_SIZE_VALUES[AERO_SIZES] = {64, 256, 1024, 4096};
+
+// Thrust scales by visiting every pair, the reference for update_aero
+static void aero_all_pairs(const Drone *drones, int n, float *scale) {
+    for (int i = 0; i < n; i++) {
+        float loss = 0.0f;
+        for (int j = 0; j < n; j++) {
+            if (j != i) {
+                loss += downwash_loss(&drones[j], &drones[i]);
+            }
+        }
+        scale[i] = (loss < 1.0f - AERO_MIN_SCALE ? 1.0f - loss : AERO_MIN_SCALE) * ground_effect(&drones[i]);
+    }
+}
+
+static void aero_check(void) {
+    printf("\nDownwash and ground effect, hovering drones spread over the arena\n");
+    printf("%8s %14s %16s %10s %12s\n", "drones", "grid us/drone", "pairs us/drone", "affected", "max err");
+    for (int s = 0; s < AERO_SIZES; s++) {
+        int n = AERO_SIZE_VALUES[s];
+        Drone *drones = alloc_drones(n);
+        float *scale = calloc(n, sizeof(float));
+        for (int i = 0; i < n; i++) {
+            init_drone(&drones[i], rndf(0.1f, 0.4f), 0.1f);
+            Params *p = &drones[i].params;
+            float rpm = sqrtf(p->mass * p->gravity / (4.0f * p->k_thrust));
+            for (int k = 0; k < 4; k++) {
+                drones[i].state.rpms[k] = rpm;
+            }
+            drones[i].state.pos = (Vec3){rndf(-GRID_X, GRID_X), rndf(-GRID_Y, GRID_Y), rndf(-GRID_Z, GRID_Z)};
+        }
+        AeroGrid grid;
+        init_aero_grid(&grid, n);
+
+        double start = now_sec();
+        for (int r = 0; r < AERO_REPEATS; r++) {
+            // Drones back in free air, so every repeat does the same work
+            for (int i = 0; i < n; i++) {
+                drones[i].params.thrust_scale = 1.0f;
+            }
+            update_aero(&grid, drones, n);
+        }
+        double t_grid = now_sec() - start;
+        for (int i = 0; i < n; i++) {
+            scale[i] = drones[i].params.thrust_scale;
+            drones[i].params.thrust_scale = 1.0f;
+        }
+
+        float *ref = calloc(n, sizeof(float));
+        start = now_sec();
+        for (int r = 0; r < AERO_REPEATS; r++) {
+            aero_all_pairs(drones, n, ref);
+        }
+        double t_pairs = now_sec() - start;
+
+        int affected = 0;
+        double err = 0.0;
+        for (int i = 0; i < n; i++) {
+            affected += fabsf(scale[i] - 1.0f) > 1e-3f;
+            err = fmax(err, fabs(scale[i] - ref[i]));
+        }
+        printf("%8d %14.3f %16.3f %9.1f%% %12.2e\n", n, 1e6 * t_grid / (AERO_REPEATS * n),
+            1e6 * t_pairs / (AERO_REPEATS * n), 100.0 * affected / n, err);
+
+        free_aero_grid(&grid);
+        arena_free(drones);
+        free(scale);
+        free(ref);
+    }
+}
+
+// Expert demonstrations
+#define EXPERT_ENVS 256
+#define EXPERT_STEPS 1500
+#define EXPERT_OBS 29
+#define EXPERT_MODES 3
+const int EXPERT_MODE_INTEGRATORS[EXPERT_MODES] = {INTEGRATOR_RK4, INTEGRATOR_RK4, INTEGRATOR_EXP_EULER};
+const int EXPERT_MODE_CONTROLS[EXPERT_MODES] = {CONTROL_RPM, CONTROL_RATE, CONTROL_RATE};
+#define DATA_BENCH_SHARD 512
+#define DATA_BENCH_ROUNDS 5
+
+// Races envs under the geometric expert and reports episode outcomes, the
+// cost of one expert action and the demonstration steps per second
+static void expert_check(void) {
+    printf("\nGeometric expert, %d race envs x %d steps\n", EXPERT_ENVS, EXPERT_STEPS);
+    printf("%-7s %-8s %9s %8s %8s %8s %12s %10s\n",
+        "control", "method", "episodes", "perf", "collide", "oob", "us/action", "steps/s");
+    DroneRace *envs = calloc(EXPERT_ENVS, sizeof(DroneRace));
+    float *observations = calloc(EXPERT_ENVS * EXPERT_OBS, sizeof(float));
+    float *actions = calloc(EXPERT_ENVS * 4, sizeof(float));
+    float *rewards = calloc(EXPERT_ENVS, sizeof(float));
+    unsigned char *terminals = calloc(EXPERT_ENVS, sizeof(unsigned char));
+    // Only passing a ring gives a positive step reward, so rings can be
+    // counted from the rewards to check log.rings_passed, which eval reads
+    long rings_logged = 0, rings_flown = 0;
+    for (int m = 0; m < EXPERT_MODES; m++) {
+        srand(2);
+        for (int e = 0; e < EXPERT_ENVS; e++) {
+            DroneRace *env = &envs[e];
+            *env = (DroneRace){0};
+            env->max_rings = 10;
+            env->max_moves = 1000;
+            env->integrator = EXPERT_MODE_INTEGRATORS[m];
+            env->control = EXPERT_MODE_CONTROLS[m];
+            env->observations = &observations[e * EXPERT_OBS];
+            env->actions = &actions[e * 4];
+            env->rewards = &rewards[e];
+            env->terminals = &terminals[e];
+            init(env);
+            c_reset(env);
+        }
+
+        double t_expert = 0.0;
+        double start = now_sec();
+        for (int t = 0; t < EXPERT_STEPS; t++) {
+            double t0 = now_sec();
+            for (int e = 0; e < EXPERT_ENVS; e++) {
+                c_expert(&envs[e]);
+            }
+            t_expert += now_sec() - t0;
+            for (int e = 0; e < EXPERT_ENVS; e++) {
+                c_step(&envs[e]);
+                rings_flown += rewards[e] > 0.0f;
+            }
+        }
+        double elapsed = now_sec() - start;
+
+        Log log = {0};
+        for (int e = 0; e < EXPERT_ENVS; e++) {
+            log.n += envs[e].log.n;
+            log.perf += envs[e].log.perf;
+            log.collision_rate += envs[e].log.collision_rate;
+            log.oob += envs[e].log.oob;
+            // rings of the episode still in flight are not logged yet
+            rings_logged += envs[e].log.rings_passed + envs[e].score[0];
+            c_close(&envs[e]);
+        }
+        double n = (double)EXPERT_ENVS * EXPERT_STEPS;
+        const char *control = EXPERT_MODE_CONTROLS[m] == CONTROL_RATE ? "rate" : "rpm";
+        printf("%-7s %-8s %9.0f %8.3f %8.3f %8.3f %12.3f %10.0f\n", control,
+            INTEGRATORS[EXPERT_MODE_INTEGRATORS[m]].name, log.n, log.perf / log.n,
+            log.collision_rate / log.n, log.oob / log.n, 1e6 * t_expert / n, n / elapsed);
+    }
+    printf("perf is the fraction of rings passed per episode\n");
+    printf("log.rings_passed counts %ld of the %ld rings passed\n", rings_logged, rings_flown);
+    free(envs);
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+// Races EXPERT_ENVS envs under the expert for EXPERT_STEPS steps, streaming
+// every step to writer when set. Returns steps per second.
+static double expert_stream(DataWriter *writer, DroneRace *envs, float *observations) {
+    double start = now_sec();
+    for (int t = 0; t < EXPERT_STEPS; t++) {
+        DataRecord rec;
+        if (writer != NULL && !data_reserve(writer, &rec)) {
+            perror("dataset");
+            return 0.0;
+        }
+        for (int e = 0; e < EXPERT_ENVS; e++) {
+            c_expert(&envs[e]);
+        }
+        if (writer != NULL) {
+            memcpy(rec.observations, observations, EXPERT_ENVS * EXPERT_OBS * sizeof(float));
+            memcpy(rec.actions, envs[0].actions, EXPERT_ENVS * 4 * sizeof(float));
+        }
+        for (int e = 0; e < EXPERT_ENVS; e++) {
+            c_step(&envs[e]);
+        }
+        if (writer != NULL) {
+            memcpy(rec.rewards, envs[0].rewards, EXPERT_ENVS * sizeof(float));
+            memcpy(rec.terminals, envs[0].terminals, EXPERT_ENVS);
+            data_commit(writer);
+        }
+    }
+    return (double)EXPERT_ENVS * EXPERT_STEPS / (now_sec() - start);
+}
+
+// Expert play with and without streaming it to a dataset in a temporary
+// directory, which is removed afterwards
+static void dataset_check(void) {
+    char dir[] = "/tmp/drone_dataXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return;
+    }
+    DroneRace *envs = calloc(EXPERT_ENVS, sizeof(DroneRace));
+    float *observations = calloc(EXPERT_ENVS * EXPERT_OBS, sizeof(float));
+    float *actions = calloc(EXPERT_ENVS * 4, sizeof(float));
+    float *rewards = calloc(EXPERT_ENVS, sizeof(float));
+    unsigned char *terminals = calloc(EXPERT_ENVS, sizeof(unsigned char));
+    srand(3);
+    for (int e = 0; e < EXPERT_ENVS; e++) {
+        DroneRace *env = &envs[e];
+        env->max_rings = 10;
+        env->max_moves = 1000;
+        env->observations = &observations[e * EXPERT_OBS];
+        env->actions = &actions[e * 4];
+        env->rewards = &rewards[e];
+        env->terminals = &terminals[e];
+        init(env);
+        c_reset(env);
+    }
+
+    // One pass to warm caches and branch predictors, then the two alternate
+    // so drift on a busy machine hits both alike
+    expert_stream(NULL, envs, observations);
+    double plain[DATA_BENCH_ROUNDS], streamed[DATA_BENCH_ROUNDS], disk[DATA_BENCH_ROUNDS];
+    long stalls = 0;
+    int err = 0;
+    for (int r = 0; r < DATA_BENCH_ROUNDS; r++) {
+        plain[r] = expert_stream(NULL, envs, observations);
+        double start = now_sec();
+        DataWriter *writer = open_data_writer(dir, EXPERT_OBS, EXPERT_ENVS, DATA_BENCH_SHARD);
+        if (writer == NULL) {
+            perror("dataset");
+            return;
+        }
+        streamed[r] = expert_stream(writer, envs, observations);
+        stalls += writer->stalls;
+        size_t record = 0;
+        for (int s = 0; s < DATA_SECTIONS; s++) {
+            record += writer->record_bytes[s];
+        }
+        int close_err = close_data_writer(writer);
+        err = err != 0 ? err : close_err;
+        disk[r] = 1e-6 * record * EXPERT_STEPS / (now_sec() - start);
+    }
+
+    printf("\nDataset streaming, %d race envs x %d expert steps, %d step shards, median of %d rounds\n",
+        EXPERT_ENVS, EXPERT_STEPS, DATA_BENCH_SHARD, DATA_BENCH_ROUNDS);
+    printf("  without: %.0f steps/s, streaming: %.0f steps/s, %.0f MB/s to disk including the final flush\n",
+        median(plain, DATA_BENCH_ROUNDS), median(streamed, DATA_BENCH_ROUNDS), median(disk, DATA_BENCH_ROUNDS));
+    printf("  producer stalls on a full ring: %ld%s\n", stalls, err != 0 ? ", write failed" : "");
+
+    char path[64];
+    for (int i = 0; (long)i * DATA_BENCH_SHARD < EXPERT_STEPS; i++) {
+        snprintf(path, sizeof(path), "%s/shard_%05d.bin", dir, i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/index.json", dir);
+    unlink(path);
+    rmdir(dir);
+    for (int e = 0; e < EXPERT_ENVS; e++) {
+        c_close(&envs[e]);
+    }
+    free(envs);
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+// Env cloning
+#define CLONE_ENVS 256
+#define CLONE_WARMUP 50    // steps the source flies before it is cloned
+#define CLONE_STEPS 3000   // replay length, several episodes
+#define CLONE_REPEATS 20
+
+// Clones a race env in wind mid-episode, then flies the source and every
+// clone on the same random actions through several resets and counts
+// states that differ at all. Also times clones per second.
+static void clone_check(void) {
+    DroneRace *envs = calloc(CLONE_ENVS + 1, sizeof(DroneRace));
+    float *observations = calloc((CLONE_ENVS + 1) * EXPERT_OBS, sizeof(float));
+    float *actions = calloc((CLONE_ENVS + 1) * 4, sizeof(float));
+    float *rewards = calloc(CLONE_ENVS + 1, sizeof(float));
+    unsigned char *terminals = calloc(CLONE_ENVS + 1, sizeof(unsigned char));
+    srand(4);
+    for (int e = 0; e <= CLONE_ENVS; e++) {
+        DroneRace *env = &envs[e];
+        env->max_rings = 10;
+        env->max_moves = 1000;
+        env->wind_speed = 5.0f;
+        env->observations = &observations[e * EXPERT_OBS];
+        env->actions = &actions[e * 4];
+        env->rewards = &rewards[e];
+        env->terminals = &terminals[e];
+        init(env);
+        c_reset(env);
+    }
+    DroneRace *src = &envs[CLONE_ENVS];
+    for (int t = 0; t < CLONE_WARMUP; t++) {
+        c_expert(src);
+        c_step(src);
+    }
+
+    double start = now_sec();
+    for (int r = 0; r < CLONE_REPEATS; r++) {
+        for (int e = 0; e < CLONE_ENVS; e++) {
+            c_clone(&envs[e], src);
+        }
+    }
+    double per_clone = (now_sec() - start) / (CLONE_REPEATS * CLONE_ENVS);
+
+    long diverged = 0;
+    int episodes = 0;
+    for (int t = 0; t < CLONE_STEPS; t++) {
+        float a[4] = {rndf(-0.2f, 0.6f), rndf(-0.2f, 0.2f), rndf(-0.2f, 0.2f), rndf(-0.2f, 0.2f)};
+        for (int e = 0; e <= CLONE_ENVS; e++) {
+            memcpy(envs[e].actions, a, sizeof(a));
+            c_step(&envs[e]);
+        }
+        episodes += terminals[CLONE_ENVS];
+        for (int e = 0; e < CLONE_ENVS; e++) {
+            diverged += memcmp(&envs[e].agents[0].state, &src->agents[0].state, sizeof(State)) != 0
+                || memcmp(envs[e].observations, src->observations, EXPERT_OBS * sizeof(float)) != 0
+                || rewards[e] != rewards[CLONE_ENVS];
+        }
+    }
+
+    printf("\nCloning a race env in %.0f m/s wind into %d envs\n", src->wind_speed, CLONE_ENVS);
+    printf("  %.2f us/clone (%.0f clones/s)\n", 1e6 * per_clone, 1.0 / per_clone);
+    printf("  replay on shared actions, %d steps over %d episodes: %ld of %ld clone steps diverged\n",
+        CLONE_STEPS, episodes, diverged, (long)CLONE_STEPS * CLONE_ENVS);
+
+    // Envs made with other settings than src's are turned away, each for
+    // the setting it changes
+    const char *settings[] = {"num_drones", "max_rings", "max_moves", "integrator", "control", "tape_len", "wind_speed"};
+    int n_settings = sizeof(settings) / sizeof(settings[0]);
+    int refused = 0;
+    for (int v = 0; v < n_settings; v++) {
+        DroneRace other = {.max_rings = 10, .max_moves = 1000, .wind_speed = 5.0f};
+        switch (v) {
+            case 0: other.num_agents = 2; break;
+            case 1: other.max_rings = 5; break;
+            case 2: other.max_moves = 500; break;
+            case 3: other.integrator = src->integrator + 1; break;
+            case 4: other.control = src->control + 1; break;
+            case 5: other.tape_len = 16; break;
+            case 6: other.wind_speed = 0.0f; break;
+        }
+        init(&other);
+        const char *setting = clone_mismatch(&other, src);
+        refused += setting != NULL && strcmp(setting, settings[v]) == 0;
+        c_close(&other);
+    }
+    printf("  clones between mismatched settings: %d of %d refused\n", refused, n_settings);
+
+    for (int e = 0; e <= CLONE_ENVS; e++) {
+        c_close(&envs[e]);
+    }
+    free(envs);
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+#define ROLLOUT_CANDIDATES 256
+#define ROLLOUT_HORIZON 100
+#define ROLLOUT_NOISE 2.0f // largest uniform noise on the expert's actions
+
+// Costs and final states of a batch of random candidates against clones of
+// the env stepping the same actions, then candidate steps per second against
+// plain c_step
+static void rollout_check(void) {
+    DroneRace envs[2] = {0};
+    float observations[2 * EXPERT_OBS], actions[2 * 4], rewards[2];
+    unsigned char terminals[2];
+    srand(5);
+    for (int e = 0; e < 2; e++) {
+        DroneRace *env = &envs[e];
+        env->max_rings = 10;
+        env->max_moves = 1000;
+        env->wind_speed = 5.0f;
+        env->observations = &observations[e * EXPERT_OBS];
+        env->actions = &actions[e * 4];
+        env->rewards = &rewards[e];
+        env->terminals = &terminals[e];
+        init(env);
+        c_reset(env);
+    }
+    DroneRace *src = &envs[0], *replay = &envs[1];
+    for (int t = 0; t < CLONE_WARMUP; t++) {
+        c_expert(src);
+        c_step(src);
+    }
+
+    // Expert actions with noise rising from none for the first candidate to
+    // ROLLOUT_NOISE for the last, so candidates pass rings as well as crash
+    int B = ROLLOUT_CANDIDATES, H = ROLLOUT_HORIZON;
+    float *candidates = calloc((size_t)B * H * 4, sizeof(float));
+    float *costs = calloc(B, sizeof(float));
+    State *finals = calloc(B, sizeof(State));
+    for (int b = 0; b < B; b++) {
+        c_clone(replay, src);
+        float noise = ROLLOUT_NOISE * b / (B - 1);
+        for (int t = 0; t < H; t++) {
+            c_expert(replay);
+            float *a = &candidates[((size_t)b * H + t) * 4];
+            for (int j = 0; j < 4; j++) {
+                a[j] = clampf(replay->actions[j] + rndf(-noise, noise), -1.0f, 1.0f);
+            }
+            memcpy(replay->actions, a, 4 * sizeof(float));
+            c_step(replay);
+            if (terminals[1]) {
+                break;
+            }
+        }
+    }
+    c_rollout(src, B, H, candidates, 0.0f, costs, finals);
+
+    // A step rewards +1 for a ring passed and -1 for a crash, ring or bounds
+    int mismatched = 0, ended = 0, crashed = 0, passed = 0;
+    float mean_cost = 0.0f;
+    for (int b = 0; b < B; b++) {
+        c_clone(replay, src);
+        float reward = 0.0f;
+        bool done = false, passed_ring = false;
+        for (int t = 0; t < H && !done; t++) {
+            memcpy(replay->actions, &candidates[((size_t)b * H + t) * 4], 4 * sizeof(float));
+            c_step(replay);
+            reward += rewards[1];
+            done = terminals[1];
+            passed_ring |= rewards[1] > 0.0f;
+            crashed += rewards[1] < 0.0f;
+        }
+        ended += done;
+        passed += passed_ring;
+        mean_cost += costs[b] / B;
+        // A finished episode has already reset the replay's drone
+        mismatched += costs[b] != -reward
+            || (!done && memcmp(&finals[b], &replay->agents[0].state, sizeof(State)) != 0);
+    }
+
+    double start = now_sec();
+    for (int r = 0; r < CLONE_REPEATS; r++) {
+        c_rollout(src, B, H, candidates, 1.0f, costs, NULL);
+    }
+    double rollout_rate = (double)CLONE_REPEATS * B * H / (now_sec() - start);
+
+    start = now_sec();
+    for (int r = 0; r < CLONE_REPEATS; r++) {
+        for (int t = 0; t < B * H; t++) {
+            memcpy(replay->actions, &candidates[(size_t)t * 4], 4 * sizeof(float));
+            c_step(replay);
+        }
+    }
+    double step_rate = (double)CLONE_REPEATS * B * H / (now_sec() - start);
+
+    printf("\nOpen loop rollouts, %d candidates x %d steps in %.0f m/s wind\n", B, H, src->wind_speed);
+    printf("  %d of %d candidates end the episode, %d crash, %d pass a ring, mean cost %.3f\n",
+        ended, B, crashed, passed, mean_cost);
+    if (crashed == 0 || passed == 0) {
+        printf("  no candidate %s, that path of c_rollout went unchecked\n",
+            crashed == 0 ? "crashes" : "passes a ring");
+    }
+    printf("  %d of %d differ from a clone stepping the same actions\n", mismatched, B);
+    // Both fly move_drone per step, which is most of a step, so c_rollout
+    // only saves c_step's bookkeeping and observations
+    printf("  %.0f candidate steps/s, c_step %.0f steps/s, %.2fx\n",
+        rollout_rate, step_rate, rollout_rate / step_rate);
+
+    c_close(src);
+    c_close(replay);
+    free(candidates);
+    free(costs);
+    free(finals);
+}
+
+#define PLAN_ENVS 4
+#define PLAN_STEPS 1000
+#define PLAN_HORIZON 30
+#define PLAN_SAMPLES 64
+#define PLAN_THREAD_COUNTS 2
+const int PLAN_THREADS[PLAN_THREAD_COUNTS] = {1, 2};
+
+// Races the same tracks in wind under the expert and under the MPPI planner
+// with each thread count, reporting perf and decisions per second
+static void planner_check(void) {
+    printf("\nMPPI planner, %d race envs x %d steps in 5 m/s wind, horizon %d, %d samples\n",
+        PLAN_ENVS, PLAN_STEPS, PLAN_HORIZON, PLAN_SAMPLES);
+    printf("%-8s %8s %9s %8s %8s %8s %12s\n",
+        "source", "threads", "episodes", "perf", "collide", "oob", "decisions/s");
+    DroneRace envs[PLAN_ENVS];
+    float observations[PLAN_ENVS * EXPERT_OBS], actions[PLAN_ENVS * 4], rewards[PLAN_ENVS];
+    unsigned char terminals[PLAN_ENVS];
+    for (int r = 0; r <= PLAN_THREAD_COUNTS; r++) {
+        srand(6);
+        for (int e = 0; e < PLAN_ENVS; e++) {
+            DroneRace *env = &envs[e];
+            *env = (DroneRace){0};
+            env->max_rings = 10;
+            env->max_moves = 1000;
+            env->wind_speed = 5.0f;
+            env->observations = &observations[e * EXPERT_OBS];
+            env->actions = &actions[e * 4];
+            env->rewards = &rewards[e];
+            env->terminals = &terminals[e];
+            init(env);
+            c_reset(env);
+        }
+        int threads = r > 0 ? PLAN_THREADS[r - 1] : 0;
+        Planner *planner = r > 0 ? open_planner(PLAN_HORIZON, PLAN_SAMPLES, threads, 0.05f, 0.1f, 0.05f) : NULL;
+
+        double t_plan = 0.0;
+        for (int t = 0; t < PLAN_STEPS; t++) {
+            double t0 = now_sec();
+            for (int e = 0; e < PLAN_ENVS; e++) {
+                if (planner != NULL) {
+                    plan_action(planner, &envs[e], envs[e].actions);
+                } else {
+                    c_expert(&envs[e]);
+                }
+            }
+            t_plan += now_sec() - t0;
+            for (int e = 0; e < PLAN_ENVS; e++) {
+                c_step(&envs[e]);
+            }
+        }
+
+        Log log = {0};
+        for (int e = 0; e < PLAN_ENVS; e++) {
+            log.n += envs[e].log.n;
+            log.perf += envs[e].log.perf;
+            log.collision_rate += envs[e].log.collision_rate;
+            log.oob += envs[e].log.oob;
+            c_close(&envs[e]);
+        }
+        if (planner != NULL) {
+            close_planner(planner);
+        }
+        printf("%-8s %8d %9.0f %8.3f %8.3f %8.3f %12.0f\n", r > 0 ? "mppi" : "expert", threads,
+            log.n, log.perf / log.n, log.collision_rate / log.n, log.oob / log.n,
+            PLAN_ENVS * PLAN_STEPS / t_plan);
+    }
+}
+
+#define RACE_DRONES 256
+#define RACE_STEPS 1500
+#define RACE_FIELD_COUNTS 3
+const int RACE_FIELDS[RACE_FIELD_COUNTS] = {1, 2, 8};
+
+// Flies RACE_DRONES drones under the expert as envs of 1, 2 and 8 racers
+// sharing a track, reporting perf, collisions and drone steps per second,
+// also as a fraction of the single racer envs' rate
+static void race_check(void) {
+    printf("\nShared track races, %d drones x %d expert steps\n", RACE_DRONES, RACE_STEPS);
+    printf("%8s %9s %8s %8s %8s %14s %8s\n", "racers", "episodes", "perf", "collide", "oob", "drone steps/s",
+        "vs 1");
+    double single_rate = 0.0;
+    int obs_size = RACE_OBS + RACE_OPP_OBS;
+    float *observations = calloc(RACE_DRONES * obs_size, sizeof(float));
+    float *actions = calloc(RACE_DRONES * 4, sizeof(float));
+    float *rewards = calloc(RACE_DRONES, sizeof(float));
+    unsigned char *terminals = calloc(RACE_DRONES, sizeof(unsigned char));
+    for (int f = 0; f < RACE_FIELD_COUNTS; f++) {
+        int racers = RACE_FIELDS[f];
+        int num_envs = RACE_DRONES / racers;
+        DroneRace *envs = calloc(num_envs, sizeof(DroneRace));
+        srand(7);
+        for (int e = 0; e < num_envs; e++) {
+            DroneRace *env = &envs[e];
+            env->num_agents = racers;
+            env->max_rings = 10;
+            env->max_moves = 1000;
+            init(env);
+            env->observations = &observations[e * racers * race_obs_size(env)];
+            env->actions = &actions[e * racers * 4];
+            env->rewards = &rewards[e * racers];
+            env->terminals = &terminals[e * racers];
+            c_reset(env);
+        }
+
+        double t_step = 0.0;
+        for (int t = 0; t < RACE_STEPS; t++) {
+            for (int e = 0; e < num_envs; e++) {
+                c_expert(&envs[e]);
+            }
+            double t0 = now_sec();
+            for (int e = 0; e < num_envs; e++) {
+                c_step(&envs[e]);
+            }
+            t_step += now_sec() - t0;
+        }
+
+        Log log = {0};
+        for (int e = 0; e < num_envs; e++) {
+            log.n += envs[e].log.n;
+            log.perf += envs[e].log.perf;
+            log.collision_rate += envs[e].log.collision_rate;
+            log.oob += envs[e].log.oob;
+            c_close(&envs[e]);
+        }
+        free(envs);
+        double rate = (double)RACE_DRONES * RACE_STEPS / t_step;
+        single_rate = racers == 1 ? rate : single_rate;
+        printf("%8d %9.0f %8.3f %8.3f %8.3f %14.0f %8.2f\n", racers, log.n, log.perf / log.n,
+            log.collision_rate / log.n, log.oob / log.n, rate, rate / single_rate);
+    }
+    printf("the expert flies blind to the other racers, so collide counts racer contacts too\n");
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+#define LAYOUT_DRONES 4096
+#define LAYOUT_REPEATS 20
+#define LAYOUT_FLUSH (32 << 20) // bytes streamed between passes to empty the caches
+
+// Drone as it was before the hot/cold split, for the layout comparison
+typedef struct {
+    State state;
+    Params params;
+    Vec3 spawn_pos;
+    Vec3 prev_pos;
+    Vec3 target_pos;
+    Vec3 target_vel;
+    float last_abs_reward;
+    float last_target_reward;
+    float last_collision_reward;
+    float episode_return;
+    float collisions;
+    int episode_length;
+    float score;
+    int ring_idx;
+    int integrator;
+    IntegratorStep step;
+    float h;
+    Tape tape;
+    int control;
+    Vec3 rate_integral;
+    uint32_t rng;
+} LegacyDrone;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} FieldSpan;
+
+#define FIELD_SPAN(T, f) {offsetof(T, f), sizeof(((T *)0)->f)}
+
+// Fields move_drone reads or writes, then the ones a reward, target and
+// observation pass uses, for each layout. record is what move_drone checks
+// before taping a step.
+#define LAYOUT_FIELDS(T, record) { \
+    FIELD_SPAN(T, params), FIELD_SPAN(T, state), FIELD_SPAN(T, prev_pos), FIELD_SPAN(T, step), \
+    FIELD_SPAN(T, h), FIELD_SPAN(T, control), FIELD_SPAN(T, rng), FIELD_SPAN(T, rate_integral), \
+    FIELD_SPAN(T, record), \
+    FIELD_SPAN(T, target_pos), FIELD_SPAN(T, target_vel), FIELD_SPAN(T, last_abs_reward), \
+    FIELD_SPAN(T, last_target_reward), FIELD_SPAN(T, last_collision_reward), \
+    FIELD_SPAN(T, episode_return), FIELD_SPAN(T, episode_length), FIELD_SPAN(T, score) \
+}
+#define LAYOUT_FIELD_COUNT 17
+#define LAYOUT_STEP_FIELDS 9 // the first ones, what move_drone touches
+
+// Distinct cache lines the first count spans cover in a drone at base
+static int lines_touched(const FieldSpan *spans, int count, size_t base) {
+    uint64_t lines = 0;
+    for (int k = 0; k < count; k++) {
+        size_t first = (base + spans[k].offset) / 64;
+        size_t last = (base + spans[k].offset + spans[k].size - 1) / 64;
+        for (size_t l = first; l <= last; l++) {
+            lines |= 1ull << l;
+        }
+    }
+    return __builtin_popcountll(lines);
+}
+
+// Mean lines per drone over consecutive drones of the given size, which
+// start at every offset their stride reaches within a line
+static double mean_lines(const FieldSpan *spans, int count, size_t stride) {
+    int total = 0;
+    for (int i = 0; i < 64; i++) {
+        total += lines_touched(spans, count, (i * stride) % 64);
+    }
+    return total / 64.0;
+}
+
+// Reads every word of the spans of each drone in order and writes one back
+// per span, like a step followed by its reward pass
+static float touch_fields(unsigned char *drones, size_t stride, const int *order, int n,
+        const FieldSpan *spans, int count) {
+    float acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        unsigned char *d = drones + (size_t)order[i] * stride;
+        for (int k = 0; k < count; k++) {
+            float *f = (float *)(d + spans[k].offset);
+            float sum = 0.0f;
+            for (size_t w = 0; w < spans[k].size / sizeof(float); w++) {
+                sum += f[w];
+            }
+            f[0] = sum * 0.5f;
+            acc += sum;
+        }
+    }
+    return acc;
+}
+
+// Best of LAYOUT_REPEATS cold passes, ns per drone
+static double time_layout(unsigned char *drones, size_t stride, const int *order, const FieldSpan *spans,
+        int count, unsigned char *flush, volatile float *sink) {
+    double best = 1e30;
+    for (int r = 0; r < LAYOUT_REPEATS; r++) {
+        for (size_t b = 0; b < LAYOUT_FLUSH; b += 64) {
+            flush[b]++;
+        }
+        double start = now_sec();
+        *sink += touch_fields(drones, stride, order, LAYOUT_DRONES, spans, count);
+        double seconds = now_sec() - start;
+        best = seconds < best ? seconds : best;
+    }
+    return 1e9 * best / LAYOUT_DRONES;
+}
+
+// Visits LAYOUT_DRONES drones in a random order from cold caches, the way a
+// vectorized step reaches them once the working set outgrows the cache,
+// touching the fields of a step and its reward pass, and compares the
+// current layout against the one before the hot/cold split. The spans are
+// the fields each step touches, so only their placement differs.
+static void layout_check(void) {
+    const FieldSpan legacy[LAYOUT_FIELD_COUNT] = LAYOUT_FIELDS(LegacyDrone, tape.capacity);
+    const FieldSpan split[LAYOUT_FIELD_COUNT] = LAYOUT_FIELDS(Drone, recording);
+    printf("\nDrone layout, %d drones in random order from cold caches\n", LAYOUT_DRONES);
+    printf("%-8s %6s %12s %12s %14s %14s\n", "layout", "bytes", "step lines", "all lines", "step ns/drone",
+        "all ns/drone");
+
+    int *order = calloc(LAYOUT_DRONES, sizeof(int));
+    for (int i = 0; i < LAYOUT_DRONES; i++) {
+        order[i] = i;
+    }
+    for (int i = LAYOUT_DRONES - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    unsigned char *flush = calloc(LAYOUT_FLUSH, 1);
+    volatile float sink = 0.0f;
+
+    LegacyDrone *old_drones = calloc(LAYOUT_DRONES, sizeof(LegacyDrone));
+    Drone *drones = alloc_drones(LAYOUT_DRONES);
+    const char *names[2] = {"legacy", "split"};
+    const FieldSpan *spans[2] = {legacy, split};
+    unsigned char *storage[2] = {(unsigned char *)old_drones, (unsigned char *)drones};
+    size_t strides[2] = {sizeof(LegacyDrone), sizeof(Drone)};
+    for (int l = 0; l < 2; l++) {
+        double step_ns = time_layout(storage[l], strides[l], order, spans[l], LAYOUT_STEP_FIELDS, flush, &sink);
+        double all_ns = time_layout(storage[l], strides[l], order, spans[l], LAYOUT_FIELD_COUNT, flush, &sink);
+        printf("%-8s %6zu %12.2f %12.2f %14.1f %14.1f\n", names[l], strides[l],
+            mean_lines(spans[l], LAYOUT_STEP_FIELDS, strides[l]),
+            mean_lines(spans[l], LAYOUT_FIELD_COUNT, strides[l]), step_ns, all_ns);
+    }
+    free(old_drones);
+    arena_free(drones);
+    free(flush);
+    free(order);
+}
+
+#define ARENA_ENVS 1024
+#define ARENA_STEPS 500
+
+// Builds ARENA_ENVS single racer envs with their buffers on the heap and then
+// from the arena, and times init, expert stepping and close for each
+static void arena_check(void) {
+    printf("\nEnv buffers, %d envs x %d expert steps\n", ARENA_ENVS, ARENA_STEPS);
+    printf("%-8s %14s %14s %14s\n", "buffers", "init us/env", "steps/s", "close us/env");
+    float *observations = calloc(ARENA_ENVS * RACE_OBS, sizeof(float));
+    float *actions = calloc(ARENA_ENVS * 4, sizeof(float));
+    float *rewards = calloc(ARENA_ENVS, sizeof(float));
+    unsigned char *terminals = calloc(ARENA_ENVS, sizeof(unsigned char));
+    const char *names[2] = {"heap", "arena"};
+    for (int a = 0; a < 2; a++) {
+        arena_heap = a == 0;
+        DroneRace *envs = calloc(ARENA_ENVS, sizeof(DroneRace));
+        srand(7);
+        double start = now_sec();
+        for (int e = 0; e < ARENA_ENVS; e++) {
+            DroneRace *env = &envs[e];
+            env->max_rings = 10;
+            env->max_moves = 1000;
+            init(env);
+            env->observations = &observations[e * RACE_OBS];
+            env->actions = &actions[e * 4];
+            env->rewards = &rewards[e];
+            env->terminals = &terminals[e];
+        }
+        double t_init = now_sec() - start;
+        for (int e = 0; e < ARENA_ENVS; e++) {
+            c_reset(&envs[e]);
+        }
+
+        double t_step = 0.0;
+        for (int t = 0; t < ARENA_STEPS; t++) {
+            for (int e = 0; e < ARENA_ENVS; e++) {
+                c_expert(&envs[e]);
+            }
+            double t0 = now_sec();
+            for (int e = 0; e < ARENA_ENVS; e++) {
+                c_step(&envs[e]);
+            }
+            t_step += now_sec() - t0;
+        }
+
+        start = now_sec();
+        for (int e = 0; e < ARENA_ENVS; e++) {
+            c_close(&envs[e]);
+        }
+        double t_close = now_sec() - start;
+        free(envs);
+        printf("%-8s %14.2f %14.0f %14.2f\n", names[a], 1e6 * t_init / ARENA_ENVS,
+            (double)ARENA_ENVS * ARENA_STEPS / t_step, 1e6 * t_close / ARENA_ENVS);
+    }
+    arena_heap = false;
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+#define WIND_ENVS 1024
+#define WIND_STEPS 200
+#define WIND_ROUNDS 21
+
+// Steps WIND_ENVS single racer envs in still air and in 5 m/s wind on the
+// same random actions in alternating rounds. The cost is the median over
+// rounds of each wind round against the still air round next to it, which
+// cancels the drift in machine speed that swung the medians of the two
+// configurations apart by more than the cost being measured.
+static void wind_check(void) {
+    float *observations = calloc(2 * WIND_ENVS * RACE_OBS, sizeof(float));
+    float *actions = calloc(WIND_STEPS * 4, sizeof(float));
+    float *rewards = calloc(2 * WIND_ENVS, sizeof(float));
+    unsigned char *terminals = calloc(2 * WIND_ENVS, sizeof(unsigned char));
+    DroneRace *envs = calloc(2 * WIND_ENVS, sizeof(DroneRace));
+    srand(9);
+    for (int i = 0; i < WIND_STEPS * 4; i++) {
+        actions[i] = rndf(-1.0f, 1.0f);
+    }
+    for (int e = 0; e < 2 * WIND_ENVS; e++) {
+        DroneRace *env = &envs[e];
+        env->max_rings = 10;
+        env->max_moves = 1000;
+        env->wind_speed = e < WIND_ENVS ? 0.0f : 5.0f;
+        env->observations = &observations[e * RACE_OBS];
+        env->rewards = &rewards[e];
+        env->terminals = &terminals[e];
+        init(env);
+        c_reset(env);
+    }
+
+    double sps[2][WIND_ROUNDS];
+    for (int r = 0; r < WIND_ROUNDS; r++) {
+        for (int w = 0; w < 2; w++) {
+            DroneRace *batch = &envs[w * WIND_ENVS];
+            double start = now_sec();
+            for (int t = 0; t < WIND_STEPS; t++) {
+                for (int e = 0; e < WIND_ENVS; e++) {
+                    batch[e].actions = &actions[4 * ((t + e) % WIND_STEPS)];
+                    c_step(&batch[e]);
+                }
+            }
+            sps[w][r] = (double)WIND_ENVS * WIND_STEPS / (now_sec() - start);
+        }
+    }
+    double ratio[WIND_ROUNDS];
+    for (int r = 0; r < WIND_ROUNDS; r++) {
+        ratio[r] = sps[1][r] / sps[0][r];
+    }
+    double slowdown = 1.0 - median(ratio, WIND_ROUNDS);
+    double still = median(sps[0], WIND_ROUNDS), wind = median(sps[1], WIND_ROUNDS);
+    printf("\nWind cost, %d race envs x %d random steps, %d alternating rounds\n",
+        WIND_ENVS, WIND_STEPS, WIND_ROUNDS);
+    printf("  still air %.0f steps/s, 5 m/s wind %.0f steps/s, %.1f%% slower round for round\n",
+        still, wind, 100.0 * slowdown);
+
+    for (int e = 0; e < 2 * WIND_ENVS; e++) {
+        c_close(&envs[e]);
+    }
+    free(envs);
+    free(observations);
+    free(actions);
+    free(rewards);
+    free(terminals);
+}
+
+int main(int argc, char **argv) {
+    int steps = argc > 1 ? atoi(argv[1]) : 200;
+    int num_drones = argc > 2 ? atoi(argv[2]) : 32;
+    srand(0);
+
+    Params *params = calloc(num_drones, sizeof(Params));
+    Drone drone = {0};
+    for (int d = 0; d < num_drones; d++) {
+        init_drone(&drone, rndf(0.05f, 0.8f), 0.1f);
+        params[d] = drone.params;
+    }
+
+    float *actions = calloc(4 * steps, sizeof(float));
+    float a[4];
+    Vec3 *ref = calloc(steps, sizeof(Vec3));
+
+    printf("%d drones x %d policy steps of %.3f s, reference RK4 with %d substeps\n",
+        num_drones, steps, DT, REF_SUBSTEPS);
+    printf("%-11s %-6s %11s %10s %10s %12s %12s\n",
+        "scenario", "method", "evals/step", "max evals", "us/step", "mean err m", "max err m");
+
+    for (int sc = 0; sc < SCENARIO_N; sc++) {
+        double evals[BENCH_INTEGRATORS] = {0};
+        int max_evals[BENCH_INTEGRATORS] = {0};
+        double seconds[BENCH_INTEGRATORS] = {0};
+        double sum_err[BENCH_INTEGRATORS] = {0};
+        double max_err[BENCH_INTEGRATORS] = {0};
+
+        for (int d = 0; d < num_drones; d++) {
+            float hover = hover_action(&params[d]);
+            make_actions(sc, &params[d], actions, steps);
+
+            start_drone(&drone, &params[d], hover);
+            for (int t = 0; t < steps; t++) {
+                memcpy(a, &actions[4 * t], sizeof(a));
+                reference_step(&drone, a);
+                ref[t] = drone.state.pos;
+            }
+
+            for (int m = 0; m < BENCH_INTEGRATORS; m++) {
+                start_drone(&drone, &params[d], hover);
+                set_integrator(&drone, BENCH_INTEGRATOR_IDS[m]);
+                double start = now_sec();
+                for (int t = 0; t < steps; t++) {
+                    memcpy(a, &actions[4 * t], sizeof(a));
+                    int n = move_drone(&drone, a);
+                    evals[m] += n;
+                    max_evals[m] = n > max_evals[m] ? n : max_evals[m];
+                    double err = norm3(sub3(drone.state.pos, ref[t]));
+                    sum_err[m] += err;
+                    max_err[m] = err > max_err[m] ? err : max_err[m];
+                }
+                seconds[m] += now_sec() - start;
+            }
+        }
+
+        double n = (double)num_drones * steps;
+        for (int m = 0; m < BENCH_INTEGRATORS; m++) {
+            printf("%-11s %-6s %11.2f %10d %10.3f %12.2e %12.2e\n",
+                SCENARIO_NAMES[sc], INTEGRATORS[BENCH_INTEGRATOR_IDS[m]].name, evals[m] / n, max_evals[m],
+                1e6 * seconds[m] / n, sum_err[m] / n, max_err[m]);
+        }
+    }
+
+    step_size_sweep();
+    cost_drift();
+    jacobian_check();
+    gradient_check();
+    rate_check();
+    aero_check();
+    expert_check();
+    dataset_check();
+    clone_check();
+    rollout_check();
+    planner_check();
+    race_check();
+    layout_check();
+    arena_check();
+    wind_check();
+
+    free(params);
+    free(actions);
+    free(ref);
+    return 0;
+}
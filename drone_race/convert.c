@@ -0,0 +1,54 @@
+// Converts raw trainer weights to a memory mapped weight file
+// Compile using: ./scripts/build_ocean.sh drone [local|fast], with convert.c as the entry point
+// Run with: ./convert weights.bin weights.drw [input_dim]
+//
+// The raw file is a flat float32 LinearContLSTM; its observation size is
+// inferred from the length unless given. Tensors are written back to back in
+// trainer order so the result still has a flat puffernet Weights view. Both
+// demos and the eval and quantize tools accept either format.
+
+#include "dronenet.h"
+
+#define ACT_SIZE 4
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s weights.bin weights.drw [input_dim]\n", argv[0]);
+        return 1;
+    }
+    int input_dim = argc > 3 ? atoi(argv[3]) : 0;
+
+    WeightFile *weights = open_policy_weights(argv[1], input_dim, ACT_SIZE);
+    if (weights == NULL) {
+        return 1;
+    }
+    input_dim = policy_input_dim(weights);
+
+    WeightTensor tensors[POLICY_TENSORS];
+    const float *params[POLICY_TENSORS];
+    linearcontlstm_tensors(tensors, input_dim, ACT_SIZE);
+    if (!linearcontlstm_params(weights, params, input_dim, ACT_SIZE)) {
+        return 1;
+    }
+    const void **srcs = (const void **)params;
+    if (write_weight_file(argv[2], tensors, srcs, POLICY_TENSORS, sizeof(float)) != 0) {
+        fprintf(stderr, "Error writing %s\n", argv[2]);
+        return 1;
+    }
+
+    WeightFile *check = open_weight_file(argv[2]);
+    if (check == NULL || check->weights.data == NULL || !verify_weight_file(check, argv[2])) {
+        fprintf(stderr, "Error reading back %s\n", argv[2]);
+        return 1;
+    }
+    printf("Wrote %s: %d tensors, %d weights, %d observations, checksum %08x\n",
+        argv[2], check->header->num_tensors, check->weights.size, input_dim, check->header->checksum);
+    for (uint32_t i = 0; i < check->header->num_tensors; i++) {
+        const WeightTensor *t = &check->tensors[i];
+        printf("  %-16s [%u, %u]\n", t->name, t->shape[0], t->rank > 1 ? t->shape[1] : 0);
+    }
+
+    close_weight_file(check);
+    close_weight_file(weights);
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Native multithreaded policy evaluation. Define Env, include this file the
+// same way binding.c includes env_binding.h, then define the eval_* hooks
+// declared below and call eval_main.
+//
+// Envs are split into contiguous shards, one per worker thread. Each worker
+// owns a batched policy for its shard and steps each env for the same number
+// of rounds, a round ending when reset_episode restarts every agent (tick
+// back to 0). Stopping at a round boundary never cuts an episode short, so
+// short episodes are not over-represented the way they are when envs stop
+// at a global episode count. Confidence intervals treat each env as an
+// independent cluster of episodes (ratio estimator), which stays valid when
+// episodes from one env are correlated or unequal in length.
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dronenet.h"
+
+#ifndef EVAL_ACT_SIZE
+#define EVAL_ACT_SIZE 4
+#endif
+
+#define EVAL_PERF 0
+#define EVAL_RINGS 1
+#define EVAL_COLLISION 2
+#define EVAL_OOB 3
+#define EVAL_TIMEOUT 4
+#define EVAL_RETURN 5
+#define EVAL_LENGTH 6
+#define EVAL_EPISODES 7
+#define EVAL_N 8
+
+const char *EVAL_NAMES[EVAL_N - 1] = {
+    "perf", "rings_passed", "collision_rate", "oob", "timeout",
+    "episode_return", "episode_length"
+};
+
+// Allocates an env with arena_calloc and sets its config, buffers are
+// assigned by the harness. agents is the command line's agent count, 0 for
+// the env's default.
+static Env *eval_make_env(int agents);
+// Number of agents (observation rows) the env steps, after init
+static int eval_num_agents(Env *env);
+// Observation floats per agent, after init
+static int eval_obs_size(Env *env);
+// Writes the EVAL_N per-env sums, indexed by the EVAL_* defines
+static void eval_metrics(Env *env, double *sums);
+
+// Each shard's buffers are separate arena allocations, so workers never
+// write to a shared cache line
+typedef struct {
+    Env **envs;
+    int num_envs;
+    int num_agents;
+    float *observations;
+    float *actions;
+    float *rewards;
+    unsigned char *terminals;
+    LinearContLSTM *net;
+    int *rounds; // finished by each env
+    double *sums; // EVAL_N per env, taken when its last round ends
+    int active; // envs with rounds left
+    long agent_steps;
+} EvalShard;
+
+typedef struct {
+    EvalShard *shard;
+    int rounds; // per env
+} EvalWorker;
+
+static double eval_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Envs that are done sit out the remaining steps, their metrics frozen
+static void *eval_worker(void *arg) {
+    EvalWorker *worker = (EvalWorker *)arg;
+    EvalShard *shard = worker->shard;
+
+    while (shard->active > 0) {
+        forward_linearcontlstm(shard->net, shard->observations, shard->actions);
+        for (int i = 0; i < shard->num_envs; i++) {
+            if (shard->rounds[i] >= worker->rounds) {
+                continue;
+            }
+            Env *env = shard->envs[i];
+            c_step(env);
+            shard->agent_steps += eval_num_agents(env);
+            if (env->tick == 0 && ++shard->rounds[i] == worker->rounds) {
+                eval_metrics(env, &shard->sums[i * EVAL_N]);
+                shard->active--;
+            }
+        }
+    }
+    return NULL;
+}
+
+int eval_main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s weights.bin [num_envs] [episodes] [threads] [agents]\n", argv[0]);
+        return 1;
+    }
+    int num_envs = argc > 2 ? atoi(argv[2]) : 1024;
+    long episodes = argc > 3 ? atol(argv[3]) : 10000;
+    int num_threads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_threads < 1 ? 1 : num_threads;
+    num_threads = num_threads > num_envs ? num_envs : num_threads;
+    int agents = argc > 5 ? atoi(argv[5]) : 0;
+    srand(time(NULL));
+
+    Env **envs = (Env **)calloc(num_envs, sizeof(Env *));
+    int *agent_offset = (int *)calloc(num_envs + 1, sizeof(int));
+    for (int i = 0; i < num_envs; i++) {
+        envs[i] = eval_make_env(agents);
+        init(envs[i]);
+        agent_offset[i + 1] = agent_offset[i] + eval_num_agents(envs[i]);
+    }
+    int total_agents = agent_offset[num_envs];
+    int obs_size = eval_obs_size(envs[0]);
+    // Every agent finishes at least one episode per round
+    int rounds = (int)((episodes + total_agents - 1) / total_agents);
+    rounds = rounds < 1 ? 1 : rounds;
+
+    // One read-only mapping shared by every worker's net
+    WeightFile *weights = open_policy_weights(argv[1], obs_size, EVAL_ACT_SIZE);
+    if (weights == NULL) {
+        return 1;
+    }
+
+    double *env_sums = (double *)calloc(num_envs * EVAL_N, sizeof(double));
+    EvalShard *shards = (EvalShard *)calloc(num_threads, sizeof(EvalShard));
+    for (int t = 0; t < num_threads; t++) {
+        int start = (long)num_envs * t / num_threads;
+        int end = (long)num_envs * (t + 1) / num_threads;
+        EvalShard *shard = &shards[t];
+        shard->envs = &envs[start];
+        shard->num_envs = end - start;
+        shard->num_agents = agent_offset[end] - agent_offset[start];
+        shard->rounds = (int *)arena_calloc(shard->num_envs, sizeof(int));
+        shard->sums = &env_sums[start * EVAL_N];
+        shard->active = shard->num_envs;
+        shard->observations = (float *)arena_calloc(shard->num_agents * obs_size, sizeof(float));
+        shard->actions = (float *)arena_calloc(shard->num_agents * EVAL_ACT_SIZE, sizeof(float));
+        shard->rewards = (float *)arena_calloc(shard->num_agents, sizeof(float));
+        shard->terminals = (unsigned char *)arena_calloc(shard->num_agents, sizeof(unsigned char));
+        for (int i = start; i < end; i++) {
+            Env *env = envs[i];
+            int a = agent_offset[i] - agent_offset[start];
+            env->observations = &shard->observations[a * obs_size];
+            env->actions = &shard->actions[a * EVAL_ACT_SIZE];
+            env->rewards = &shard->rewards[a];
+            env->terminals = &shard->terminals[a];
+            c_reset(env);
+        }
+        shard->net = load_linearcontlstm(weights, shard->num_agents, obs_size, EVAL_ACT_SIZE);
+        if (shard->net == NULL) {
+            return 1;
+        }
+    }
+
+    double start = eval_time();
+    pthread_t *threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+    EvalWorker *workers = (EvalWorker *)calloc(num_threads, sizeof(EvalWorker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = (EvalWorker){&shards[t], rounds};
+        pthread_create(&threads[t], NULL, eval_worker, &workers[t]);
+    }
+    long agent_steps = 0;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        agent_steps += shards[t].agent_steps;
+    }
+    double elapsed = eval_time() - start;
+
+    // Ratio estimate per metric, clustered by env
+    double totals[EVAL_N] = {0};
+    for (int i = 0; i < num_envs; i++) {
+        for (int m = 0; m < EVAL_N; m++) {
+            totals[m] += env_sums[i * EVAL_N + m];
+        }
+    }
+    double n = totals[EVAL_EPISODES];
+    if (n == 0.0) {
+        fprintf(stderr, "No episodes finished\n");
+        return 1;
+    }
+
+    printf("Episodes: %.0f over %d envs x %d rounds, %d threads, %.2f s (%.0f agent steps/s)\n",
+        n, num_envs, rounds, num_threads, elapsed, agent_steps / elapsed);
+    for (int m = 0; m < EVAL_N - 1; m++) {
+        double mean = totals[m] / n;
+        double ss = 0.0;
+        for (int i = 0; i < num_envs; i++) {
+            double r = env_sums[i * EVAL_N + m] - mean * env_sums[i * EVAL_N + EVAL_EPISODES];
+            ss += r * r;
+        }
+        double n_bar = n / num_envs;
+        double se = num_envs > 1 ? sqrt(ss / (num_envs * (num_envs - 1.0))) / n_bar : 0.0;
+        printf("  %-16s %10.4f +/- %.4f (95%% CI)\n", EVAL_NAMES[m], mean, 1.96 * se);
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        EvalShard *shard = &shards[t];
+        free_linearcontlstm(shard->net);
+        arena_free(shard->rounds);
+        arena_free(shard->observations);
+        arena_free(shard->actions);
+        arena_free(shard->rewards);
+        arena_free(shard->terminals);
+    }
+    for (int i = 0; i < num_envs; i++) {
+        c_close(envs[i]);
+        arena_free(envs[i]);
+    }
+    free(env_sums);
+    free(threads);
+    free(workers);
+    free(shards);
+    free(envs);
+    free(agent_offset);
+    close_weight_file(weights);
+    return 0;
+}
@@ -1,93 +1,15 @@
 // Standalone C demo for DroneRace environment
 // Compile using: ./scripts/build_ocean.sh drone [local|fast]
-// Run with: ./drone
+// Run with: ./drone [--int8 weights_int8.bin]
 
 #include "drone_race.h"
-#include "puffernet.h"
+#include "dronenet.h"
 #include <time.h>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
 
-double randn(double mean, double std) {
-    static int has_spare = 0;
-    static double spare;
-
-    if (has_spare) {
-        has_spare = 0;
-        return mean + std * spare;
-    }
-
-    has_spare = 1;
-    double u, v, s;
-    do {
-        u = 2.0 * rand() / RAND_MAX - 1.0;
-        v = 2.0 * rand() / RAND_MAX - 1.0;
-        s = u * u + v * v;
-    } while (s >= 1.0 || s == 0.0);
-
-    s = sqrt(-2.0 * log(s) / s);
-    spare = v * s;
-    return mean + std * (u * s);
-}
-
-typedef struct LinearContLSTM LinearContLSTM;
-struct LinearContLSTM {
-    int num_agents;
-    float *obs;
-    float *log_std;
-    Linear *encoder;
-    GELU *gelu1;
-    LSTM *lstm;
-    Linear *actor;
-    Linear *value_fn;
-    int num_actions;
-};
-
-LinearContLSTM *make_linearcontlstm(Weights *weights, int num_agents, int input_dim,
-                                    int logit_sizes[], int num_actions) {
-    LinearContLSTM *net = calloc(1, sizeof(LinearContLSTM));
-    net->num_agents = num_agents;
-    net->obs = calloc(num_agents * input_dim, sizeof(float));
-    net->num_actions = logit_sizes[0];
-    net->log_std = weights->data;
-    weights->idx += net->num_actions;
-    net->encoder = make_linear(weights, num_agents, input_dim, 128);
-    net->gelu1 = make_gelu(num_agents, 128);
-    int atn_sum = 0;
-    for (int i = 0; i < num_actions; i++) {
-        atn_sum += logit_sizes[i];
-    }
-    net->actor = make_linear(weights, num_agents, 128, atn_sum);
-    net->value_fn = make_linear(weights, num_agents, 128, 1);
-    net->lstm = make_lstm(weights, num_agents, 128, 128);
-    return net;
-}
-
-void free_linearcontlstm(LinearContLSTM *net) {
-    free(net->obs);
-    free(net->encoder);
-    free(net->gelu1);
-    free(net->actor);
-    free(net->value_fn);
-    free(net->lstm);
-    free(net);
-}
-
-void forward_linearcontlstm(LinearContLSTM *net, float *observations, float *actions) {
-    linear(net->encoder, observations);
-    gelu(net->gelu1, net->encoder->output);
-    lstm(net->lstm, net->gelu1->output);
-    linear(net->actor, net->lstm->state_h);
-    linear(net->value_fn, net->lstm->state_h);
-    for (int i = 0; i < net->num_actions; i++) {
-        float std = expf(net->log_std[i]);
-        float mean = net->actor->output[i];
-        actions[i] = randn(mean, std);
-    }
-}
-
 void generate_dummy_actions(DroneRace *env) {
     // Generate random floats in [-1, 1] range
     env->actions[0] = ((float)rand() / (float)RAND_MAX) * 2.0f - 1.0f;
@@ -96,11 +18,22 @@ void generate_dummy_actions(DroneRace *env) {
     env->actions[3] = ((float)rand() / (float)RAND_MAX) * 2.0f - 1.0f;
 }
 
+// Flies with the int8 policy if loaded, else fp32, else random actions
+void policy_step(DroneRace *env, LinearContLSTM *net, QuantLinearContLSTM *qnet) {
+    if (qnet != NULL) {
+        forward_quant_linearcontlstm(qnet, env->observations, env->actions);
+    } else if (net != NULL) {
+        forward_linearcontlstm(net, env->observations, env->actions);
+    } else {
+        generate_dummy_actions(env);
+    }
+}
+
 #ifdef __EMSCRIPTEN__
 typedef struct {
     DroneRace *env;
     LinearContLSTM *net;
-    Weights *weights;
+    WeightFile *weights;
 } WebRenderArgs;
 
 void emscriptenStep(void *e) {
@@ -108,7 +41,7 @@ void emscriptenStep(void *e) {
     DroneRace *env = args->env;
     LinearContLSTM *net = args->net;
 
-    forward_linearcontlstm(net, env->observations, env->actions);
+    policy_step(env, net, NULL);
     c_step(env);
     c_render(env);
     return;
@@ -117,23 +50,43 @@ void emscriptenStep(void *e) {
 WebRenderArgs *web_args = NULL;
 #endif
 
-int main() {
+int main(int argc, char **argv) {
     srand(time(NULL)); // Seed random number generator
 
     DroneRace *env = calloc(1, sizeof(DroneRace));
     env->max_moves = 1000;
     env->max_rings = 10;
 
-    size_t obs_size = 25;
+    size_t obs_size = 29;
     size_t act_size = 4;
     env->observations = (float *)calloc(obs_size, sizeof(float));
     env->actions = (float *)calloc(act_size, sizeof(float));
     env->rewards = (float *)calloc(1, sizeof(float));
     env->terminals = (unsigned char *)calloc(1, sizeof(float));
 
-    Weights *weights = load_weights("resources/drone/drone_weights.bin", 136073);
-    int logit_sizes[1] = {4};
-    LinearContLSTM *net = make_linearcontlstm(weights, 1, 25, logit_sizes, 1);
+    // Weights trained for a different observation size are rejected, in
+    // which case the demo flies with random actions
+    WeightFile *weights = open_policy_weights("resources/drone/drone_weights.bin", obs_size, act_size);
+    LinearContLSTM *net = NULL;
+    if (weights != NULL) {
+        net = load_linearcontlstm(weights, 1, obs_size, act_size);
+    }
+    if (net == NULL) {
+        fprintf(stderr, "No usable policy, using random actions\n");
+    }
+
+    // Optional int8 policy written by quantize.c
+    WeightFile *qweights = NULL;
+    QuantLinearContLSTM *qnet = NULL;
+    if (argc > 2 && strcmp(argv[1], "--int8") == 0) {
+        qweights = open_weight_file(argv[2]);
+        if (qweights != NULL) {
+            qnet = load_quant_linearcontlstm(qweights, 1, obs_size, act_size);
+        }
+        if (qnet == NULL) {
+            return 1;
+        }
+    }
 
     if (!env->observations || !env->actions || !env->rewards) {
         fprintf(stderr, "ERROR: Failed to allocate memory for demo buffers.\n");
@@ -160,13 +113,20 @@ int main() {
     c_render(env);
 
     while (!WindowShouldClose()) {
-        forward_linearcontlstm(net, env->observations, env->actions);
+        policy_step(env, net, qnet);
         c_step(env);
         c_render(env);
     }
 
     c_close(env);
-    free_linearcontlstm(net);
+    if (net != NULL) {
+        free_linearcontlstm(net);
+    }
+    close_weight_file(weights);
+    if (qnet != NULL) {
+        free_quant_linearcontlstm(qnet);
+    }
+    close_weight_file(qweights);
     free(env->observations);
     free(env->actions);
     free(env->rewards);
@@ -13,6 +13,9 @@
 #include "raylib.h"
 #include "dronelib.h"
 
+#define RACE_OBS 29 // per racer, followed by RACE_OPP_OBS when racing others
+#define RACE_OPP_OBS 7 // nearest opponent's relative position, velocity and lead in rings
+
 typedef struct Client Client;
 struct Client {
     Camera3D camera;
@@ -38,43 +41,87 @@ struct DroneRace {
     Log log;
     int tick;
     int report_interval;
-    int score;
-    float episodic_return;
 
     int max_rings;
-    int ring_idx;
     Ring *ring_buffer;
 
     int max_moves;
     int moves_left;
-
-    Drone drone;
+    int integrator;
+    int control; // CONTROL_*, what the actions command
+    int tape_len;
+    float wind_speed; // m/s, 0 for still air
+    WindField wind;
+    uint32_t rng; // rings, spawns and wind, see rng_next
+
+    // Racers sharing the track, each with its own observation, action,
+    // reward and terminal row. 0 is read as 1, the single drone race.
+    int num_agents;
+    Drone *agents;
+    // Per racer progress, one array per field so the step's bookkeeping and
+    // the neighbor search run down contiguous lanes
+    int *ring_idx;
+    int *score;
+    float *episodic_return;
+    int *start_tick; // tick the racer's current run started at
+    int *neighbor; // nearest other racer, see update_neighbors
+    bool *collided; // closer to the nearest than the two arm lengths
+    float *pos_x; // positions gathered for the neighbor search
+    float *pos_y;
+    float *pos_z;
     Client *client;
 };
 
 void init(DroneRace *env) {
     env->log = (Log){0};
     env->tick = 0;
-    env->ring_buffer = (Ring*)malloc((env->max_rings) * sizeof(Ring));
+    log_kernels();
+    env->num_agents = env->num_agents > 0 ? env->num_agents : 1;
+    int n = env->num_agents;
+    env->ring_buffer = (Ring*)arena_calloc(env->max_rings, sizeof(Ring));
+    env->agents = alloc_drones(n);
+    env->ring_idx = (int*)arena_calloc(n, sizeof(int));
+    env->score = (int*)arena_calloc(n, sizeof(int));
+    env->episodic_return = (float*)arena_calloc(n, sizeof(float));
+    env->start_tick = (int*)arena_calloc(n, sizeof(int));
+    env->neighbor = (int*)arena_calloc(n, sizeof(int));
+    env->collided = (bool*)arena_calloc(n, sizeof(bool));
+    env->pos_x = (float*)arena_calloc(n, sizeof(float));
+    env->pos_y = (float*)arena_calloc(n, sizeof(float));
+    env->pos_z = (float*)arena_calloc(n, sizeof(float));
+    for (int i = 0; i < n; i++) {
+        init_drone_tape(&env->agents[i], env->tape_len);
+    }
+    if (env->wind_speed > 0.0f) {
+        init_wind(&env->wind, env->wind_speed);
+    }
+}
+
+// Observation floats per racer
+static inline int race_obs_size(const DroneRace *env) {
+    return RACE_OBS + (env->num_agents > 1 ? RACE_OPP_OBS : 0);
 }
 
-void add_log(DroneRace *env, float oob, float collision, float timeout) {
-    env->log.score += env->score;
-    env->log.episode_return += env->episodic_return;
-    env->log.episode_length += env->tick;
-    env->log.perf += (float)env->ring_idx / (float)env->max_rings;
+// Logs the end of racer i's run
+void add_log(DroneRace *env, int i, float oob, float collision, float timeout) {
+    env->log.score += env->score[i];
+    env->log.rings_passed += env->score[i];
+    env->log.episode_return += env->episodic_return[i];
+    env->log.episode_length += env->tick - env->start_tick[i];
+    env->log.perf += (float)env->ring_idx[i] / (float)env->max_rings;
     env->log.oob += oob;
     env->log.collision_rate += collision;
     env->log.timeout += timeout;
     env->log.n += 1.0f;
 }
 
-void compute_observations(DroneRace *env) {
-    Drone *drone = &env->drone;
+// Racer i's row, opponent features last when racing others
+void compute_racer_observations(DroneRace *env, int i, float *obs) {
+    Drone *drone = &env->agents[i];
 
     Quat q_inv = quat_inverse(drone->state.quat);
-    Ring curr_ring = env->ring_buffer[env->ring_idx];
-    Ring next_ring = env->ring_buffer[env->ring_idx % env->max_rings];
+    Ring curr_ring = env->ring_buffer[env->ring_idx[i]];
+    Ring next_ring = env->ring_buffer[env->ring_idx[i] % env->max_rings];
 
     Vec3 to_curr_ring = quat_rotate(q_inv, sub3(curr_ring.pos, drone->state.pos));
     Vec3 to_next_ring = quat_rotate(q_inv, sub3(next_ring.pos, drone->state.pos));
@@ -85,135 +132,401 @@ void compute_observations(DroneRace *env) {
     Vec3 linear_vel_body = quat_rotate(q_inv, drone->state.vel);
     Vec3 drone_up_world = quat_rotate(drone->state.quat, (Vec3){0.0f, 0.0f, 1.0f});
 
-    env->observations[0] = to_curr_ring.x / GRID_X;
-    env->observations[1] = to_curr_ring.y / GRID_Y;
-    env->observations[2] = to_curr_ring.z / GRID_Z;
-
-    env->observations[3] = curr_ring_norm.x;
-    env->observations[4] = curr_ring_norm.y;
-    env->observations[5] = curr_ring_norm.z;
+    obs[0] = to_curr_ring.x / GRID_X;
+    obs[1] = to_curr_ring.y / GRID_Y;
+    obs[2] = to_curr_ring.z / GRID_Z;
+
+    obs[3] = curr_ring_norm.x;
+    obs[4] = curr_ring_norm.y;
+    obs[5] = curr_ring_norm.z;
+
+    obs[6] = to_next_ring.x / GRID_X;
+    obs[7] = to_next_ring.y / GRID_Y;
+    obs[8] = to_next_ring.z / GRID_Z;
+
+    obs[9] = next_ring_norm.x;
+    obs[10] = next_ring_norm.y;
+    obs[11] = next_ring_norm.z;
+
+    obs[12] = linear_vel_body.x / drone->params.max_vel;
+    obs[13] = linear_vel_body.y / drone->params.max_vel;
+    obs[14] = linear_vel_body.z / drone->params.max_vel;
+
+    obs[15] = drone->state.omega.x / drone->params.max_omega;
+    obs[16] = drone->state.omega.y / drone->params.max_omega;
+    obs[17] = drone->state.omega.z / drone->params.max_omega;
+
+    obs[18] = drone_up_world.x;
+    obs[19] = drone_up_world.y;
+    obs[20] = drone_up_world.z;
+
+    obs[21] = drone->state.quat.w;
+    obs[22] = drone->state.quat.x;
+    obs[23] = drone->state.quat.y;
+    obs[24] = drone->state.quat.z;
+
+    obs[25] = drone->state.rpms[0] / drone->params.max_rpm;
+    obs[26] = drone->state.rpms[1] / drone->params.max_rpm;
+    obs[27] = drone->state.rpms[2] / drone->params.max_rpm;
+    obs[28] = drone->state.rpms[3] / drone->params.max_rpm;
+
+    if (env->num_agents > 1) {
+        Drone *opp = &env->agents[env->neighbor[i]];
+        Vec3 to_opp = quat_rotate(q_inv, sub3(opp->state.pos, drone->state.pos));
+        Vec3 opp_vel = quat_rotate(q_inv, sub3(opp->state.vel, drone->state.vel));
+        obs[29] = to_opp.x / GRID_X;
+        obs[30] = to_opp.y / GRID_Y;
+        obs[31] = to_opp.z / GRID_Z;
+        obs[32] = opp_vel.x / drone->params.max_vel;
+        obs[33] = opp_vel.y / drone->params.max_vel;
+        obs[34] = opp_vel.z / drone->params.max_vel;
+        obs[35] = (float)(env->ring_idx[env->neighbor[i]] - env->ring_idx[i]) / env->max_rings;
+    }
+}
 
-    env->observations[6] = to_next_ring.x / GRID_X;
-    env->observations[7] = to_next_ring.y / GRID_Y;
-    env->observations[8] = to_next_ring.z / GRID_Z;
+// Nearest other racer of every racer into env->neighbor, and whether the two
+// touch into env->collided, from one pass over the gathered positions
+DRONE_KERNEL void update_neighbors(DroneRace *env) {
+    int n = env->num_agents;
+    for (int i = 0; i < n; i++) {
+        env->pos_x[i] = env->agents[i].state.pos.x;
+        env->pos_y[i] = env->agents[i].state.pos.y;
+        env->pos_z[i] = env->agents[i].state.pos.z;
+    }
+    for (int i = 0; i < n; i++) {
+        float best = FLT_MAX;
+        int nearest = -1;
+        for (int j = 0; j < n; j++) {
+            float dx = env->pos_x[j] - env->pos_x[i];
+            float dy = env->pos_y[j] - env->pos_y[i];
+            float dz = env->pos_z[j] - env->pos_z[i];
+            float d2 = j == i ? FLT_MAX : dx*dx + dy*dy + dz*dz;
+            nearest = d2 < best ? j : nearest;
+            best = d2 < best ? d2 : best;
+        }
+        env->neighbor[i] = nearest;
+        float reach = nearest < 0 ? 0.0f : env->agents[i].params.arm_len + env->agents[nearest].params.arm_len;
+        env->collided[i] = nearest >= 0 && best < reach * reach;
+    }
+}
 
-    env->observations[9] = next_ring_norm.x;
-    env->observations[10] = next_ring_norm.y;
-    env->observations[11] = next_ring_norm.z;
+// Needs env->neighbor current, see update_neighbors
+DRONE_KERNEL void compute_observations(DroneRace *env) {
+    for (int i = 0; i < env->num_agents; i++) {
+        compute_racer_observations(env, i, &env->observations[i * race_obs_size(env)]);
+    }
+}
 
-    env->observations[12] = linear_vel_body.x / drone->params.max_vel;
-    env->observations[13] = linear_vel_body.y / drone->params.max_vel;
-    env->observations[14] = linear_vel_body.z / drone->params.max_vel;
+#define RING_RADIUS 2.0f
 
-    env->observations[15] = drone->state.omega.x / drone->params.max_omega;
-    env->observations[16] = drone->state.omega.y / drone->params.max_omega;
-    env->observations[17] = drone->state.omega.z / drone->params.max_omega;
+// Puts racer i back at the start of the current track with a fresh drone at
+// least two ring radii from the first ring, drawn from the env's own streams
+void reset_racer(DroneRace *env, int i) {
+    env->ring_idx[i] = 0;
+    env->score[i] = 0;
+    env->episodic_return[i] = 0.0f;
+    env->start_tick[i] = env->tick;
 
-    env->observations[18] = drone_up_world.x;
-    env->observations[19] = drone_up_world.y;
-    env->observations[20] = drone_up_world.z;
+    Drone *drone = &env->agents[i];
+    float size = rng_uniform(&env->rng, 0.05f, 0.8f);
+    init_drone(drone, size, 0.1f);
+    set_integrator(drone, env->integrator);
+    set_control(drone, env->control);
+    clear_tape(&drone->tape);
+    if (env->wind.nodes != NULL) {
+        drone->params.wind = &env->wind;
+    }
 
-    env->observations[21] = drone->state.quat.w;
-    env->observations[22] = drone->state.quat.x;
-    env->observations[23] = drone->state.quat.y;
-    env->observations[24] = drone->state.quat.z;
+    do {
+        drone->state.pos = (Vec3){
+            rng_uniform(&env->rng, -MARGIN_X, MARGIN_X),
+            rng_uniform(&env->rng, -MARGIN_Y, MARGIN_Y),
+            rng_uniform(&env->rng, -MARGIN_Z, MARGIN_Z)
+        };
+    } while (norm3(sub3(drone->state.pos, env->ring_buffer[0].pos)) < 2.0f*RING_RADIUS);
 
-    env->observations[25] = drone->state.rpms[0] / drone->params.max_rpm;
-    env->observations[26] = drone->state.rpms[1] / drone->params.max_rpm;
-    env->observations[27] = drone->state.rpms[2] / drone->params.max_rpm;
-    env->observations[28] = drone->state.rpms[3] / drone->params.max_rpm;
+    drone->prev_pos = drone->state.pos;
+    drone->target_pos = env->ring_buffer[0].pos;
 }
 
-void c_reset(DroneRace *env) {
+// New race on a new track, drawn from the env's own streams
+void reset_episode(DroneRace *env) {
     env->tick = 0;
-    env->score = 0;
-    env->episodic_return = 0.0f;
     env->moves_left = env->max_moves;
 
     // creates rings
-    env->ring_idx = 0;
-    float ring_radius = 2.0f;
-    reset_rings(env->ring_buffer, env->max_rings, ring_radius);
+    reset_rings(env->ring_buffer, env->max_rings, RING_RADIUS, &env->rng);
+    if (env->wind.nodes != NULL) {
+        reset_wind(&env->wind, &env->rng);
+    }
 
-    // creates drone
-    Drone *drone = &env->drone;
-    float size = rndf(0.05f, 0.8f);
-    init_drone(drone, size, 0.1f);
+    // creates drones
+    for (int i = 0; i < env->num_agents; i++) {
+        reset_racer(env, i);
+    }
+    if (env->num_agents > 1) {
+        update_neighbors(env);
+    }
 
-    do {
-        drone->state.pos = (Vec3){
-            rndf(-MARGIN_X, MARGIN_X), 
-            rndf(-MARGIN_Y, MARGIN_Y), 
-            rndf(-MARGIN_Z, MARGIN_Z)
-        };
-    } while (norm3(sub3(drone->state.pos, env->ring_buffer[0].pos)) < 2.0f*ring_radius);
+    compute_observations(env);
+}
 
-    drone->prev_pos = drone->state.pos;
+// Reseeds the env's streams from rand(), so seeding before a reset keeps
+// working, and starts an episode
+void c_reset(DroneRace *env) {
+    env->rng = rng_seed();
+    for (int i = 0; i < env->num_agents; i++) {
+        env->agents[i].rng = rng_seed();
+    }
+    reset_episode(env);
+}
 
-    compute_observations(env);
+static inline bool out_of_bounds(Vec3 pos) {
+    return pos.x < -GRID_X || pos.x > GRID_X || pos.y < -GRID_Y || pos.y > GRID_Y
+        || pos.z < -GRID_Z || pos.z > GRID_Z;
 }
 
+// Racers fly the shared track on one clock. A racer that leaves the arena,
+// clips a ring or touches another racer gets -1 and a terminal, and starts
+// over on the same track. The race restarts on a new track when the clock
+// runs out, when a racer passes every ring, or when no racer is left flying,
+// which for a single drone is any crash.
+//
+// Sharing a track is not faster per drone. Each racer still flies its own
+// move_drone on its AoS Drone, which is most of the step, and the neighbor
+// search is all pairs, so a field of n racers costs n single drone steps
+// or a little more: the bench has 8 racer fields at 0.8 to 1.04 of the
+// single racer rate, depending on the run.
 void c_step(DroneRace *env) {
     env->tick++;
-    env->rewards[0] = 0;
-    env->terminals[0] = 0;
     env->log.score = 0;
+    int n = env->num_agents;
 
-    Drone *drone = &env->drone;
-    move_drone(drone, env->actions);
-
-    // check out of bounds
-    bool out_of_bounds = drone->state.pos.x < -GRID_X || drone->state.pos.x > GRID_X ||
-                         drone->state.pos.y < -GRID_Y || drone->state.pos.y > GRID_Y ||
-                         drone->state.pos.z < -GRID_Z || drone->state.pos.z > GRID_Z;
-
-    if (out_of_bounds) {
-        env->rewards[0] -= 1;
-        env->episodic_return -= 1;
-        env->terminals[0] = 1;
-        add_log(env, 1.0f, 0.0f, 0.0f);
-        c_reset(env);
-        compute_observations(env);
-        return;
+    if (env->wind.nodes != NULL) {
+        advance_wind(&env->wind, DT);
+    }
+    for (int i = 0; i < n; i++) {
+        env->rewards[i] = 0;
+        env->terminals[i] = 0;
+        move_drone(&env->agents[i], &env->actions[4*i]);
+    }
+
+    if (n > 1) {
+        update_neighbors(env);
     }
 
-    // check for passing ring
-    Ring *ring = &env->ring_buffer[env->ring_idx];
-    float reward = check_ring(drone, ring);
-    env->rewards[0] += reward;
-    env->episodic_return += reward;
+    int crashed = 0;
+    bool finished = false;
+    for (int i = 0; i < n; i++) {
+        Drone *drone = &env->agents[i];
+        if (out_of_bounds(drone->state.pos)) {
+            env->rewards[i] -= 1;
+            env->episodic_return[i] -= 1;
+            env->terminals[i] = 1;
+            add_log(env, i, 1.0f, 0.0f, 0.0f);
+            crashed++;
+            continue;
+        }
+        if (env->collided[i]) {
+            env->rewards[i] -= 1;
+            env->episodic_return[i] -= 1;
+            env->terminals[i] = 1;
+            add_log(env, i, 0.0f, 1.0f, 0.0f);
+            crashed++;
+            continue;
+        }
 
-    if (reward > 0) {
-        env->score++;
-        env->ring_idx++;
-    } else if (reward < 0) {
-        env->terminals[0] = 1;
-        add_log(env, 0.0f, 1.0f, 0.0f);
-        c_reset(env);
+        // check for passing ring
+        Ring *ring = &env->ring_buffer[env->ring_idx[i]];
+        float reward = check_ring(drone, ring);
+        env->rewards[i] += reward;
+        env->episodic_return[i] += reward;
+
+        if (reward > 0) {
+            env->score[i]++;
+            env->ring_idx[i]++;
+            drone->target_pos = env->ring_buffer[env->ring_idx[i] % env->max_rings].pos;
+            finished |= env->ring_idx[i] == env->max_rings;
+        } else if (reward < 0) {
+            env->terminals[i] = 1;
+            add_log(env, i, 0.0f, 1.0f, 0.0f);
+            crashed++;
+        }
+    }
+    if (crashed == n) {
+        reset_episode(env);
         return;
     }
 
     // truncate
     env->moves_left -= 1;
-    if (env->moves_left == 0 || env->ring_idx == env->max_rings) {
-        env->terminals[0] = 1;
-        add_log(env, 0.0f, 0.0f, env->moves_left == 0 ? 1.0f : 0.0f);
-        c_reset(env);
+    if (env->moves_left == 0 || finished) {
+        for (int i = 0; i < n; i++) {
+            if (!env->terminals[i]) {
+                env->terminals[i] = 1;
+                add_log(env, i, 0.0f, 0.0f, env->moves_left == 0 ? 1.0f : 0.0f);
+            }
+        }
+        reset_episode(env);
         return;
     }
 
-    drone->prev_pos = drone->state.pos;
+    for (int i = 0; i < n; i++) {
+        if (env->terminals[i]) {
+            reset_racer(env, i);
+        } else {
+            env->agents[i].prev_pos = env->agents[i].state.pos;
+        }
+    }
+    if (crashed > 0) {
+        update_neighbors(env); // respawns moved
+    }
 
     compute_observations(env);
 }
 
+// Open loop candidates from racer 0's current state for sampling based
+// planners, ignoring any other racers. env itself is left untouched. actions holds B sequences of H steps
+// (B, H, 4). Each candidate flies its own copy of the drone and wind through
+// the same dynamics, bounds, ring and timeout checks as c_step. costs[b] is
+// minus the sum of the rewards c_step would give until the episode would
+// end, each step's including dist_weight times the distance reward
+// 1 - |pos - target| / MAX_DIST that tape_backward uses. finals, when not
+// NULL, gets each last state. The physics is the same move_drone per step,
+// so in C this is only about 1.3x c_step: what it saves is the observations
+// and, from Python, a vec_step round trip per step.
+void c_rollout(const DroneRace *env, int B, int H, const float *actions, float dist_weight,
+        float *costs, State *finals) {
+    for (int b = 0; b < B; b++) {
+        Drone drone = env->agents[0];
+        drone.tape = (Tape){0};
+        drone.recording = false;
+        WindField wind = env->wind;
+        if (drone.params.wind != NULL) {
+            drone.params.wind = &wind;
+        }
+        int ring_idx = env->ring_idx[0];
+        int moves_left = env->moves_left;
+        float reward = 0.0f;
+        for (int t = 0; t < H; t++) {
+            float atn[4];
+            memcpy(atn, &actions[((size_t)b * H + t) * 4], sizeof(atn));
+            if (wind.nodes != NULL) {
+                advance_wind(&wind, DT);
+            }
+            move_drone(&drone, atn);
+            if (out_of_bounds(drone.state.pos)) {
+                reward -= 1.0f;
+                break;
+            }
+            reward += dist_weight * (1.0f - norm3(sub3(drone.state.pos, drone.target_pos)) / MAX_DIST);
+            float ring = check_ring(&drone, &env->ring_buffer[ring_idx]);
+            reward += ring;
+            if (ring < 0.0f) {
+                break;
+            }
+            if (ring > 0.0f) {
+                ring_idx++;
+                drone.target_pos = env->ring_buffer[ring_idx % env->max_rings].pos;
+            }
+            moves_left--;
+            if (moves_left == 0 || ring_idx == env->max_rings) {
+                break;
+            }
+            drone.prev_pos = drone.state.pos;
+        }
+        costs[b] = -reward;
+        if (finals != NULL) {
+            finals[b] = drone.state;
+        }
+    }
+}
+
+// Names the first setting dst and src were made with differently, NULL if
+// src can be cloned into dst. c_clone sizes its copies by src and carries
+// its flight settings over, so they have to match.
+const char *clone_mismatch(const DroneRace *dst, const DroneRace *src) {
+    if (dst->num_agents != src->num_agents) return "num_drones";
+    if (dst->max_rings != src->max_rings) return "max_rings";
+    if (dst->max_moves != src->max_moves) return "max_moves";
+    if (dst->integrator != src->integrator) return "integrator";
+    if (dst->control != src->control) return "control";
+    if (dst->tape_len != src->tape_len) return "tape_len";
+    if (dst->wind_speed != src->wind_speed) return "wind_speed";
+    return NULL;
+}
+
+// Copies src's simulation state, random streams included, into dst so that
+// both continue identically under the same actions. The env struct, its
+// rings, racers and their progress are copied flat, dst keeps its own
+// buffers, log, client and tape storage. clone_mismatch must pass.
+void c_clone(DroneRace *dst, const DroneRace *src) {
+    DroneRace keep = *dst;
+    memcpy(dst, src, sizeof(DroneRace));
+    dst->observations = keep.observations;
+    dst->actions = keep.actions;
+    dst->rewards = keep.rewards;
+    dst->terminals = keep.terminals;
+    dst->log = keep.log;
+    dst->ring_buffer = keep.ring_buffer;
+    dst->agents = keep.agents;
+    dst->ring_idx = keep.ring_idx;
+    dst->score = keep.score;
+    dst->episodic_return = keep.episodic_return;
+    dst->start_tick = keep.start_tick;
+    dst->neighbor = keep.neighbor;
+    dst->collided = keep.collided;
+    dst->pos_x = keep.pos_x;
+    dst->pos_y = keep.pos_y;
+    dst->pos_z = keep.pos_z;
+    dst->client = keep.client;
+    dst->tape_len = keep.tape_len;
+    memcpy(dst->ring_buffer, src->ring_buffer, src->max_rings * sizeof(Ring));
+
+    int n = src->num_agents;
+    memcpy(dst->ring_idx, src->ring_idx, n * sizeof(int));
+    memcpy(dst->score, src->score, n * sizeof(int));
+    memcpy(dst->episodic_return, src->episodic_return, n * sizeof(float));
+    memcpy(dst->start_tick, src->start_tick, n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        copy_drone(&dst->agents[i], &src->agents[i], &dst->wind);
+    }
+    memcpy(dst->neighbor, src->neighbor, n * sizeof(int));
+    memcpy(dst->collided, src->collided, n * sizeof(bool));
+    compute_observations(dst);
+}
+
+// Writes the geometric expert's action for each racer's current ring into
+// env->actions. It flies blind to the other racers.
+void c_expert(DroneRace *env) {
+    for (int i = 0; i < env->num_agents; i++) {
+        Vec3 pos_d, vel_d;
+        ring_waypoint(&env->agents[i], &env->ring_buffer[env->ring_idx[i]], &pos_d, &vel_d);
+        expert_action(&env->agents[i], pos_d, vel_d, &env->actions[4*i]);
+    }
+}
+
 void c_close_client(Client *client) {
     CloseWindow();
     free(client);
 }
 
 void c_close(DroneRace *env) {
-    free(env->ring_buffer);
+    arena_free(env->ring_buffer);
+    for (int i = 0; i < env->num_agents; i++) {
+        free_tape(&env->agents[i].tape);
+    }
+    arena_free(env->agents);
+    arena_free(env->ring_idx);
+    arena_free(env->score);
+    arena_free(env->episodic_return);
+    arena_free(env->start_tick);
+    arena_free(env->neighbor);
+    arena_free(env->collided);
+    arena_free(env->pos_x);
+    arena_free(env->pos_y);
+    arena_free(env->pos_z);
+    free_wind(&env->wind);
 
     if (env->client != NULL) {
         c_close_client(env->client);
@@ -304,7 +617,7 @@ Client *make_client(DroneRace *env) {
     client->trail.index = 0;
     client->trail.count = 0;
     for (int j = 0; j < TRAIL_LENGTH; j++) {
-        client->trail.pos[j] = env->drone.state.pos;
+        client->trail.pos[j] = env->agents[0].state.pos;
     }
 
     return client;
@@ -328,8 +641,52 @@ void DrawRing3D(Ring ring, float thickness, Color entryColor, Color exitColor) {
     DrawCylinderWiresEx(center_pos, exit_end_pos, ring.radius, ring.radius, 32, exitColor);
 }
 
+// Body, rotors lit by the commanded rpm and velocity of one racer
+static void draw_racer(Drone *drone, const float *atn, Color body_color) {
+    // draws drone body
+    float r = drone->params.arm_len;
+    DrawSphere((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z}, r/2.0f, body_color);
+
+    const float rotor_radius = r / 4.0f;
+    const float visual_arm_len = 1.0f * drone->params.arm_len;
+
+    Vec3 rotor_offsets_body[4] = {{+r, 0.0f, 0.0f},
+                                  {-r, 0.0f, 0.0f},
+                                  {0.0f, +r, 0.0f},
+                                  {0.0f, -r, 0.0f}};
+
+    Color base_colors[4] = {ORANGE, PURPLE, LIME, SKYBLUE};
+
+    for (int i = 0; i < 4; i++) {
+        Vec3 world_off = quat_rotate(drone->state.quat, rotor_offsets_body[i]);
+
+        Vector3 rotor_pos = {drone->state.pos.x + world_off.x, drone->state.pos.y + world_off.y,
+                             drone->state.pos.z + world_off.z};
+
+        float rpm = (atn[i] + 1.0f) * 0.5f * drone->params.max_rpm;
+        float intensity = 0.75f + 0.25f * (rpm / drone->params.max_rpm);
+
+        Color rotor_color = (Color){(unsigned char)(base_colors[i].r * intensity),
+                                    (unsigned char)(base_colors[i].g * intensity),
+                                    (unsigned char)(base_colors[i].b * intensity), 255};
+
+        DrawSphere(rotor_pos, rotor_radius, rotor_color);
+
+        DrawCylinderEx((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z}, rotor_pos, 0.02f, 0.02f, 8,
+                       BLACK);
+    }
+
+    // draws line with direction and magnitude of velocity / 10
+    if (norm3(drone->state.vel) > 0.1f) {
+        DrawLine3D((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z},
+                   (Vector3){drone->state.pos.x + drone->state.vel.x * 0.1f, drone->state.pos.y + drone->state.vel.y * 0.1f,
+                             drone->state.pos.z + drone->state.vel.z * 0.1f},
+                   MAGENTA);
+    }
+}
+
 void c_render(DroneRace *env) {
-    Drone *drone = &env->drone;
+    Drone *drone = &env->agents[0];
     if (env->client == NULL) {
         env->client = make_client(env);
         if (env->client == NULL) {
@@ -352,7 +709,7 @@ void c_render(DroneRace *env) {
 
     Client *client = env->client;
 
-    client->trail.pos[client->trail.index] = env->drone.state.pos;
+    client->trail.pos[client->trail.index] = drone->state.pos;
     client->trail.index = (client->trail.index + 1) % TRAIL_LENGTH;
     if (client->trail.count < TRAIL_LENGTH) {
         client->trail.count++;
@@ -371,54 +728,18 @@ void c_render(DroneRace *env) {
     DrawCubeWires((Vector3){0.0f, 0.0f, 0.0f}, GRID_X * 2.0f, GRID_Y * 2.0f, GRID_Z * 2.0f,
                   WHITE);
 
-    // draws drone body
-    float r = drone->params.arm_len;
-    DrawSphere((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z}, r/2.0f, RED);
+    // draws drones, racer 0 in red
+    for (int i = 0; i < env->num_agents; i++) {
+        draw_racer(&env->agents[i], &env->actions[4*i], i == 0 ? RED : GOLD);
+    }
 
-    // draws rotors according to thrust
+    // rotor thrusts of racer 0
     float T[4];
     for (int i = 0; i < 4; i++) {
-        float rpm = (env->actions[i] + 1.0f) * 0.5f * drone->params.max_rpm;
+        float rpm = drone->state.rpms[i];
         T[i] = drone->params.k_thrust * rpm * rpm;
     }
 
-    const float rotor_radius = r / 4.0f;
-    const float visual_arm_len = 1.0f * drone->params.arm_len;
-
-    Vec3 rotor_offsets_body[4] = {{+r, 0.0f, 0.0f},
-                                  {-r, 0.0f, 0.0f},
-                                  {0.0f, +r, 0.0f},
-                                  {0.0f, -r, 0.0f}};
-
-    Color base_colors[4] = {ORANGE, PURPLE, LIME, SKYBLUE};
-
-    for (int i = 0; i < 4; i++) {
-        Vec3 world_off = quat_rotate(drone->state.quat, rotor_offsets_body[i]);
-
-        Vector3 rotor_pos = {drone->state.pos.x + world_off.x, drone->state.pos.y + world_off.y,
-                             drone->state.pos.z + world_off.z};
-
-        float rpm = (env->actions[i] + 1.0f) * 0.5f * drone->params.max_rpm;
-        float intensity = 0.75f + 0.25f * (rpm / drone->params.max_rpm);
-
-        Color rotor_color = (Color){(unsigned char)(base_colors[i].r * intensity),
-                                    (unsigned char)(base_colors[i].g * intensity),
-                                    (unsigned char)(base_colors[i].b * intensity), 255};
-
-        DrawSphere(rotor_pos, rotor_radius, rotor_color);
-
-        DrawCylinderEx((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z}, rotor_pos, 0.02f, 0.02f, 8,
-                       BLACK);
-    }
-
-    // draws line with direction and magnitude of velocity / 10
-    if (norm3(drone->state.vel) > 0.1f) {
-        DrawLine3D((Vector3){drone->state.pos.x, drone->state.pos.y, drone->state.pos.z},
-                   (Vector3){drone->state.pos.x + drone->state.vel.x * 0.1f, drone->state.pos.y + drone->state.vel.y * 0.1f,
-                             drone->state.pos.z + drone->state.vel.z * 0.1f},
-                   MAGENTA);
-    }
-
     if (client->trail.count > 2) {
         for (int j = 0; j < client->trail.count - 1; j++) {
             int idx0 = (client->trail.index - j - 1 + TRAIL_LENGTH) % TRAIL_LENGTH;
@@ -431,19 +752,25 @@ void c_render(DroneRace *env) {
         }
     }
 
-    // draws current and previous ring
+    // draws current and previous ring, or the whole track when racing others
     float ring_thickness = 0.2f;
-    DrawRing3D(env->ring_buffer[env->ring_idx], ring_thickness, GREEN, BLUE);
-    if (env->ring_idx > 0) {
-        DrawRing3D(env->ring_buffer[env->ring_idx - 1], ring_thickness, GREEN, BLUE);
+    if (env->num_agents > 1) {
+        for (int i = 0; i < env->max_rings; i++) {
+            DrawRing3D(env->ring_buffer[i], ring_thickness, GREEN, BLUE);
+        }
+    } else {
+        DrawRing3D(env->ring_buffer[env->ring_idx[0]], ring_thickness, GREEN, BLUE);
+        if (env->ring_idx[0] > 0) {
+            DrawRing3D(env->ring_buffer[env->ring_idx[0] - 1], ring_thickness, GREEN, BLUE);
+        }
     }
 
     EndMode3D();
 
     // Draw 2D stats
-    DrawText(TextFormat("Targets left: %d", env->max_rings - env->ring_idx), 10, 10, 20, WHITE);
+    DrawText(TextFormat("Targets left: %d", env->max_rings - env->ring_idx[0]), 10, 10, 20, WHITE);
     DrawText(TextFormat("Moves left: %d", env->moves_left), 10, 40, 20, WHITE);
-    DrawText(TextFormat("Episode Return: %.2f", env->episodic_return), 10, 70, 20, WHITE);
+    DrawText(TextFormat("Episode Return: %.2f", env->episodic_return[0]), 10, 70, 20, WHITE);
 
     DrawText("Motor Thrusts:", 10, 110, 20, WHITE);
     DrawText(TextFormat("Front: %.3f", T[0]), 10, 135, 18, ORANGE);
@@ -8,17 +8,26 @@ class DroneRace(pufferlib.PufferEnv):
     def __init__(
         self,
         num_envs=16,
+        num_drones=1,
         render_mode=None,
         report_interval=1,
         buf=None,
         seed=0,
         max_rings=10,
         max_moves=1000,
+        integrator=0,
+        control=0,
+        tape_len=0,
+        wind_speed=0.0,
+        dataset=None,
+        shard_steps=4096,
     ):
+        # Racers sharing a track also see their nearest opponent, see
+        # RACE_OPP_OBS in drone_race.h
         self.single_observation_space = gymnasium.spaces.Box(
             low=-1,
             high=1,
-            shape=(29,),
+            shape=(29 + (7 if num_drones > 1 else 0),),
             dtype=np.float32,
         )
 
@@ -26,7 +35,8 @@ class DroneRace(pufferlib.PufferEnv):
             low=-1, high=1, shape=(4,), dtype=np.float32
         )
 
-        self.num_agents = num_envs
+        self.tape_len = tape_len
+        self.num_agents = num_envs*num_drones
         self.render_mode = render_mode
         self.report_interval = report_interval
         self.tick = 0
@@ -36,19 +46,34 @@ class DroneRace(pufferlib.PufferEnv):
 
         c_envs = []
         for env_num in range(num_envs):
+            lo, hi = env_num*num_drones, (env_num+1)*num_drones
             c_envs.append(binding.env_init(
-                self.observations[env_num:(env_num+1)],
-                self.actions[env_num:(env_num+1)],
-                self.rewards[env_num:(env_num+1)],
-                self.terminals[env_num:(env_num+1)],
-                self.truncations[env_num:(env_num+1)],
+                self.observations[lo:hi],
+                self.actions[lo:hi],
+                self.rewards[lo:hi],
+                self.terminals[lo:hi],
+                self.truncations[lo:hi],
                 env_num,
                 report_interval=self.report_interval,
+                num_agents=num_drones,
                 max_rings=max_rings,
                 max_moves=max_moves,
+                integrator=integrator,
+                control=control,
+                tape_len=tape_len,
+                wind_speed=wind_speed,
             ))
 
+        self.num_c_envs = num_envs
         self.c_envs = binding.vectorize(*c_envs)
+        self.planner = None
+
+        # Streams every step to sharded files under this directory, read
+        # them back with dronedata.DroneDataset
+        self.dataset = None
+        if dataset is not None:
+            self.dataset = binding.dataset_open(self.c_envs, dataset,
+                self.single_observation_space.shape[0], shard_steps)
 
     def reset(self, seed=None):
         self.tick = 0
@@ -59,7 +84,10 @@ class DroneRace(pufferlib.PufferEnv):
         self.actions[:] = actions
 
         self.tick += 1
-        binding.vec_step(self.c_envs)
+        if self.dataset is None:
+            binding.vec_step(self.c_envs)
+        else:
+            binding.vec_record(self.c_envs, self.dataset, 1, False)
 
         info = []
         if self.tick % self.report_interval == 0:
@@ -69,10 +97,108 @@ class DroneRace(pufferlib.PufferEnv):
 
         return (self.observations, self.rewards, self.terminals, self.truncations, info)
 
+    def jacobians(self, dt=0.05):
+        '''Jacobians of the dynamics at each drone's state and last action.
+        Returns A (drones, 17, 17) and B (drones, 17, 4) for one RK4 step of
+        dt, or for the continuous time derivatives when dt is 0.'''
+        A = np.zeros((17, 17, self.num_agents), dtype=np.float32)
+        B = np.zeros((17, 4, self.num_agents), dtype=np.float32)
+        binding.vec_jacobians(self.c_envs, A, B, dt)
+        return np.moveaxis(A, 2, 0), np.moveaxis(B, 2, 0)
+
+    def backward(self, grad_states, dist_weight=0.0):
+        '''Backpropagates through the last tape_len steps of each drone, since
+        its last reset. grad_states (drones, tape_len, 17) holds dL/dstate
+        after each step, oldest first. dist_weight adds the gradient of
+        -dist_weight * the summed per-step distance rewards. Returns dL/dactions
+        (drones, tape_len, 4), zero before the reset. Needs tape_len > 0 and
+        the rk4 integrator.'''
+        grad_states = np.ascontiguousarray(grad_states, dtype=np.float32)
+        grad_actions = np.zeros((self.num_agents, self.tape_len, 4), dtype=np.float32)
+        binding.vec_backward(self.c_envs, grad_states, grad_actions, dist_weight)
+        return grad_actions
+
+    def expert_actions(self):
+        '''Actions of the built-in geometric (SE(3)) controller for the
+        current state, in the env's control mode. Also written into the
+        action buffer, so step(env.expert_actions()) flies the expert.'''
+        binding.vec_expert(self.c_envs)
+        return self.actions
+
+    def expert_rollout(self, steps):
+        '''Steps all envs under the expert for steps ticks without returning
+        to Python. Returns observations (steps, agents, obs) and the actions
+        (steps, agents, 4) taken from them.'''
+        obs = np.zeros((steps, *self.observations.shape), dtype=np.float32)
+        actions = np.zeros((steps, self.num_agents, 4), dtype=np.float32)
+        binding.vec_expert_rollout(self.c_envs, obs, actions)
+        return obs, actions
+
+    def expert_record(self, steps):
+        '''Streams steps ticks of expert play into the dataset without
+        returning to Python.'''
+        if self.dataset is None:
+            raise ValueError('expert_record needs the env created with a dataset path')
+        binding.vec_record(self.c_envs, self.dataset, steps, True)
+        self.tick += steps
+
+    def clone(self, src, dst=None, target=None):
+        '''Copies the live state of env src, random streams included, into
+        envs dst of target, so each continues exactly as src would under the
+        same actions. target defaults to this env and must be a DroneRace made
+        with the same settings, else ValueError is raised; dst defaults to all
+        of its envs but src.
+        Observations of the copies are updated, logs are not.'''
+        target = self if target is None else target
+        if dst is None:
+            dst = [i for i in range(target.num_c_envs) if target is not self or i != src]
+        binding.vec_clone(self.c_envs, src, target.c_envs, [int(d) for d in dst])
+
+    def rollout(self, actions, env=0, dist_weight=0.0, final_states=False):
+        '''Flies each action sequence in actions (candidates, horizon, 4) open
+        loop from the current state of env env, with the same dynamics, wind
+        and ring rewards as step, stopping where the episode would end. Env
+        env is left as it was. Returns the cost of each candidate, its summed
+        rewards negated, each step's including dist_weight times the distance
+        reward backward uses, and with final_states also each candidate's last
+        state (candidates, 17). Needs num_drones 1.'''
+        actions = np.ascontiguousarray(actions, dtype=np.float32)
+        costs = np.zeros(len(actions), dtype=np.float32)
+        finals = np.zeros((len(actions), 17), dtype=np.float32) if final_states else None
+        binding.vec_rollout(self.c_envs, env, actions, dist_weight, costs, finals)
+        return (costs, finals) if final_states else costs
+
+    def open_planner(self, horizon=30, samples=64, threads=1, temperature=0.05,
+            noise=0.1, dist_weight=0.05):
+        '''Starts the built-in MPPI planner, see droneplan.h. Each decision
+        scores samples noisy variants of the expert's next horizon actions
+        with rollout(..., dist_weight) and averages them with weights
+        exp(-(cost - min cost) / temperature). The defaults are tuned for
+        rpm control; noise is the std of the action perturbations. Needs
+        num_drones 1.'''
+        if self.planner is not None:
+            binding.planner_close(self.planner)
+        self.planner = binding.planner_open(horizon, samples, threads,
+            temperature, noise, dist_weight)
+
+    def planner_actions(self):
+        '''Actions of the MPPI planner for the current state, written into
+        the action buffer like expert_actions. Needs open_planner.'''
+        if self.planner is None:
+            raise ValueError('planner_actions needs open_planner first')
+        binding.vec_plan(self.c_envs, self.planner)
+        return self.actions
+
     def render(self):
         binding.vec_render(self.c_envs, 0)
 
     def close(self):
+        if self.planner is not None:
+            binding.planner_close(self.planner)
+            self.planner = None
+        if self.dataset is not None:
+            binding.dataset_close(self.dataset)
+            self.dataset = None
         binding.vec_close(self.c_envs)
 
 def test_performance(timeout=10, atn_cache=1024):
@@ -91,5 +217,25 @@ def test_performance(timeout=10, atn_cache=1024):
 
     print(f"SPS: {env.num_agents * tick / (time.time() - start)}")
 
+def test_clone_mismatch():
+    src = DroneRace(num_envs=2, wind_speed=5.0)
+    src.reset()
+    src.clone(0)
+    for settings in [dict(wind_speed=0.0), dict(tape_len=16), dict(num_drones=2), dict(max_moves=500)]:
+        kwargs = dict(num_envs=2, wind_speed=5.0)
+        kwargs.update(settings)
+        dst = DroneRace(**kwargs)
+        dst.reset()
+        try:
+            src.clone(0, target=dst)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError(f"clone into an env made with {settings} was not refused")
+        dst.close()
+    src.close()
+    print("clones between mismatched settings refused")
+
 if __name__ == "__main__":
+    test_clone_mismatch()
     test_performance()
@@ -0,0 +1,343 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Streaming dataset writer for offline RL and behavior cloning. Each step
+// is one record: the observations every action was taken from, the actions,
+// and the rewards and terminals they produced. The stepping thread copies
+// records into a single producer single consumer ring and a dedicated I/O
+// thread drains the ring into fixed size shards, so stepping only waits on
+// the disk when the ring is full.
+//
+// Shard layout, every section aligned to DATA_ALIGN so a reader can map each
+// one as an array:
+//
+//   DataShardHeader | observations (shard_steps, agents, obs_size) f32
+//                   | actions (shard_steps, agents, 4) f32
+//                   | rewards (shard_steps, agents) f32
+//                   | terminals (shard_steps, agents) u8
+//
+// header.steps counts the records written. index.json lists the finished
+// shards and is replaced as each one closes, so a run cut short still reads
+// back up to its last finished shard.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DATA_MAGIC 0x44445244 // "DRDD"
+#define DATA_VERSION 1
+#define DATA_ALIGN 4096
+#define DATA_ACT_SIZE 4
+#define DATA_RING_BYTES (64 << 20) // ring size, at least DATA_MIN_DEPTH records
+#define DATA_MIN_DEPTH 8
+#define DATA_POLL_NS 100000 // I/O thread sleep when the ring is empty
+#define DATA_PATH_LEN 4096
+
+#define DATA_OBS 0
+#define DATA_ACTIONS 1
+#define DATA_REWARDS 2
+#define DATA_TERMINALS 3
+#define DATA_SECTIONS 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t obs_size;
+    uint32_t num_agents;
+    uint64_t shard_steps;
+    uint64_t steps;
+    uint64_t offsets[DATA_SECTIONS]; // bytes from the start of the file
+} DataShardHeader;
+
+// One ring slot, filled in place by the producer
+typedef struct {
+    float* observations;
+    float* actions;
+    float* rewards;
+    unsigned char* terminals;
+} DataRecord;
+
+typedef struct {
+    char dir[DATA_PATH_LEN];
+    int obs_size;
+    int num_agents;
+    long shard_steps;
+    long depth;
+    size_t record_bytes[DATA_SECTIONS];
+
+    // Ring, one array per section so consecutive records are contiguous
+    // and go to disk in one write per section
+    unsigned char* ring[DATA_SECTIONS];
+    atomic_long head; // records committed, advanced by the producer
+    atomic_long tail; // records on disk, advanced by the I/O thread
+    atomic_bool closing;
+    atomic_int error; // errno of the first failed file operation
+    long stalls; // times the producer found the ring full
+    pthread_t thread;
+
+    // I/O thread only
+    int fd;
+    int shard;
+    long shard_step;
+    DataShardHeader header;
+} DataWriter;
+
+static inline size_t data_align(size_t n) { return (n + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN; }
+
+static void data_sleep(long ns) {
+    struct timespec ts = {0, ns};
+    nanosleep(&ts, NULL);
+}
+
+static bool data_pwrite(int fd, const void* buf, size_t n, size_t offset) {
+    const unsigned char* p = (const unsigned char*)buf;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, offset);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+    return true;
+}
+
+static void data_fail(DataWriter* w) {
+    int expected = 0;
+    atomic_compare_exchange_strong(&w->error, &expected, errno != 0 ? errno : EIO);
+}
+
+// Rewrites index.json for steps records through a rename, so readers never
+// see it half written
+static bool write_data_index(DataWriter* w, long steps) {
+    char path[DATA_PATH_LEN + 32], tmp[DATA_PATH_LEN + 32];
+    snprintf(path, sizeof(path), "%s/index.json", w->dir);
+    snprintf(tmp, sizeof(tmp), "%s/index.json.tmp", w->dir);
+    FILE* f = fopen(tmp, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fprintf(f, "{\"version\": %d, \"obs_size\": %d, \"num_agents\": %d, \"shard_steps\": %ld, "
+        "\"steps\": %ld, \"shards\": [", DATA_VERSION, w->obs_size, w->num_agents, w->shard_steps, steps);
+    for (int i = 0; (long)i * w->shard_steps < steps; i++) {
+        long n = steps - i * w->shard_steps;
+        n = n < w->shard_steps ? n : w->shard_steps;
+        fprintf(f, "%s{\"file\": \"shard_%05d.bin\", \"steps\": %ld}", i > 0 ? ", " : "", i, n);
+    }
+    fprintf(f, "]}\n");
+    bool ok = fclose(f) == 0;
+    return ok && rename(tmp, path) == 0;
+}
+
+static bool open_data_shard(DataWriter* w) {
+    char path[DATA_PATH_LEN + 32];
+    snprintf(path, sizeof(path), "%s/shard_%05d.bin", w->dir, w->shard);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        return false;
+    }
+    DataShardHeader* h = &w->header;
+    *h = (DataShardHeader){
+        .magic = DATA_MAGIC,
+        .version = DATA_VERSION,
+        .obs_size = w->obs_size,
+        .num_agents = w->num_agents,
+        .shard_steps = w->shard_steps,
+    };
+    size_t end = data_align(sizeof(DataShardHeader));
+    for (int s = 0; s < DATA_SECTIONS; s++) {
+        h->offsets[s] = end;
+        end = data_align(end + w->record_bytes[s] * w->shard_steps);
+    }
+    w->shard_step = 0;
+    return ftruncate(w->fd, end) == 0 && data_pwrite(w->fd, h, sizeof(*h), 0);
+}
+
+// Stamps the record count into the header and lists the shard in the index
+static bool close_data_shard(DataWriter* w) {
+    w->header.steps = w->shard_step;
+    bool ok = data_pwrite(w->fd, &w->header, sizeof(w->header), 0);
+    ok = close(w->fd) == 0 && ok;
+    w->fd = -1;
+    return ok && write_data_index(w, w->shard * w->shard_steps + w->shard_step);
+}
+
+// Writes n ring records starting at slot, which neither wrap the ring nor
+// run past the end of the shard
+static bool write_data_records(DataWriter* w, long slot, long n) {
+    for (int s = 0; s < DATA_SECTIONS; s++) {
+        size_t bytes = w->record_bytes[s];
+        if (!data_pwrite(w->fd, w->ring[s] + slot * bytes, n * bytes, w->header.offsets[s] + w->shard_step * bytes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* data_io_thread(void* arg) {
+    DataWriter* w = (DataWriter*)arg;
+    long tail = 0;
+    while (true) {
+        // closing is read before head, so every record committed before
+        // close is seen
+        bool closing = atomic_load(&w->closing);
+        long head = atomic_load_explicit(&w->head, memory_order_acquire);
+        if (head == tail) {
+            if (closing) {
+                break;
+            }
+            data_sleep(DATA_POLL_NS);
+            continue;
+        }
+        if (w->fd < 0 && !open_data_shard(w)) {
+            data_fail(w);
+            return NULL;
+        }
+        long slot = tail % w->depth;
+        long n = head - tail;
+        n = n < w->depth - slot ? n : w->depth - slot;
+        n = n < w->shard_steps - w->shard_step ? n : w->shard_steps - w->shard_step;
+        if (!write_data_records(w, slot, n)) {
+            data_fail(w);
+            return NULL;
+        }
+        w->shard_step += n;
+        tail += n;
+        atomic_store_explicit(&w->tail, tail, memory_order_release);
+        if (w->shard_step == w->shard_steps) {
+            if (!close_data_shard(w)) {
+                data_fail(w);
+                return NULL;
+            }
+            w->shard++;
+            w->shard_step = 0;
+        }
+    }
+    if (w->fd >= 0 && !close_data_shard(w)) {
+        data_fail(w);
+    }
+    return NULL;
+}
+
+// Creates dir if needed and starts the I/O thread. Returns NULL with errno
+// set on failure.
+DataWriter* open_data_writer(const char* dir, int obs_size, int num_agents, long shard_steps) {
+    if (strlen(dir) >= DATA_PATH_LEN || obs_size <= 0 || num_agents <= 0 || shard_steps <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return NULL;
+    }
+    DataWriter* w = (DataWriter*)calloc(1, sizeof(DataWriter));
+    if (w == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(w->dir, dir);
+    w->obs_size = obs_size;
+    w->num_agents = num_agents;
+    w->shard_steps = shard_steps;
+    w->record_bytes[DATA_OBS] = (size_t)num_agents * obs_size * sizeof(float);
+    w->record_bytes[DATA_ACTIONS] = (size_t)num_agents * DATA_ACT_SIZE * sizeof(float);
+    w->record_bytes[DATA_REWARDS] = (size_t)num_agents * sizeof(float);
+    w->record_bytes[DATA_TERMINALS] = (size_t)num_agents;
+    size_t record = 0;
+    for (int s = 0; s < DATA_SECTIONS; s++) {
+        record += w->record_bytes[s];
+    }
+    w->depth = DATA_RING_BYTES / record;
+    w->depth = w->depth > DATA_MIN_DEPTH ? w->depth : DATA_MIN_DEPTH;
+    bool allocated = true;
+    for (int s = 0; s < DATA_SECTIONS; s++) {
+        w->ring[s] = (unsigned char*)malloc(w->depth * w->record_bytes[s]);
+        allocated = allocated && w->ring[s] != NULL;
+    }
+    if (!allocated) {
+        for (int s = 0; s < DATA_SECTIONS; s++) {
+            free(w->ring[s]);
+        }
+        free(w);
+        errno = ENOMEM;
+        return NULL;
+    }
+    w->fd = -1;
+    if (!write_data_index(w, 0)) {
+        for (int s = 0; s < DATA_SECTIONS; s++) {
+            free(w->ring[s]);
+        }
+        free(w);
+        return NULL;
+    }
+    atomic_init(&w->head, 0);
+    atomic_init(&w->tail, 0);
+    atomic_init(&w->closing, false);
+    atomic_init(&w->error, 0);
+    int err = pthread_create(&w->thread, NULL, data_io_thread, w);
+    if (err != 0) {
+        for (int s = 0; s < DATA_SECTIONS; s++) {
+            free(w->ring[s]);
+        }
+        free(w);
+        errno = err;
+        return NULL;
+    }
+    return w;
+}
+
+// Points rec at the next free slot, waiting while the ring is full. Returns
+// false with errno set if the I/O thread has failed.
+bool data_reserve(DataWriter* w, DataRecord* rec) {
+    long head = atomic_load_explicit(&w->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&w->tail, memory_order_acquire) >= w->depth) {
+        w->stalls++;
+        while (head - atomic_load_explicit(&w->tail, memory_order_acquire) >= w->depth
+                && atomic_load(&w->error) == 0) {
+            data_sleep(DATA_POLL_NS / 10);
+        }
+    }
+    int err = atomic_load(&w->error);
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+    long slot = head % w->depth;
+    rec->observations = (float*)(w->ring[DATA_OBS] + slot * w->record_bytes[DATA_OBS]);
+    rec->actions = (float*)(w->ring[DATA_ACTIONS] + slot * w->record_bytes[DATA_ACTIONS]);
+    rec->rewards = (float*)(w->ring[DATA_REWARDS] + slot * w->record_bytes[DATA_REWARDS]);
+    rec->terminals = w->ring[DATA_TERMINALS] + slot * w->record_bytes[DATA_TERMINALS];
+    return true;
+}
+
+// Hands the reserved record to the I/O thread
+void data_commit(DataWriter* w) {
+    atomic_fetch_add_explicit(&w->head, 1, memory_order_release);
+}
+
+// Flushes the ring, finishes the last shard and frees the writer. Returns 0,
+// or the errno of the first failure.
+int close_data_writer(DataWriter* w) {
+    atomic_store(&w->closing, true);
+    pthread_join(w->thread, NULL);
+    int err = atomic_load(&w->error);
+    for (int s = 0; s < DATA_SECTIONS; s++) {
+        free(w->ring[s]);
+    }
+    free(w);
+    return err;
+}
@@ -0,0 +1,93 @@
+'''Reader for datasets streamed by the envs' dataset option, see dronedata.h.
+Every shard section is a numpy memmap, so nothing is read from disk until it
+is indexed and the page cache is shared between training processes.'''
+
+import json
+import os
+
+import numpy as np
+
+DATA_MAGIC = 0x44445244
+DATA_VERSION = 1
+
+SHARD_HEADER = np.dtype([
+    ('magic', '<u4'),
+    ('version', '<u4'),
+    ('obs_size', '<u4'),
+    ('num_agents', '<u4'),
+    ('shard_steps', '<u8'),
+    ('steps', '<u8'),
+    ('offsets', '<u8', (4,)),
+])
+
+
+def open_shard(path):
+    '''Maps one shard. Returns a dict of observations (steps, agents, obs),
+    actions (steps, agents, 4), rewards (steps, agents) and terminals
+    (steps, agents).'''
+    header = np.fromfile(path, dtype=SHARD_HEADER, count=1)[0]
+    if header['magic'] != DATA_MAGIC:
+        raise ValueError(f'{path} is not a dataset shard')
+    if header['version'] != DATA_VERSION:
+        raise ValueError(f'{path} has version {header["version"]}, expected {DATA_VERSION}')
+
+    steps = int(header['steps'])
+    agents = int(header['num_agents'])
+    shapes = [
+        ('observations', np.float32, (agents, int(header['obs_size']))),
+        ('actions', np.float32, (agents, 4)),
+        ('rewards', np.float32, (agents,)),
+        ('terminals', np.uint8, (agents,)),
+    ]
+    shard = {}
+    for (name, dtype, shape), offset in zip(shapes, header['offsets']):
+        shard[name] = np.memmap(path, dtype=dtype, mode='r', offset=int(offset), shape=(steps, *shape))
+    return shard
+
+
+class DroneDataset:
+    '''All shards listed in a dataset directory's index.json'''
+
+    def __init__(self, path):
+        with open(os.path.join(path, 'index.json')) as f:
+            index = json.load(f)
+        if index['version'] != DATA_VERSION:
+            raise ValueError(f'{path} has version {index["version"]}, expected {DATA_VERSION}')
+        self.obs_size = index['obs_size']
+        self.num_agents = index['num_agents']
+        self.shards = [open_shard(os.path.join(path, s['file'])) for s in index['shards']]
+        self.steps = sum(len(s['rewards']) for s in self.shards)
+        self.starts = np.cumsum([0] + [len(s['rewards']) for s in self.shards])
+
+    def __len__(self):
+        '''Transitions, one per agent per step'''
+        return self.steps * self.num_agents
+
+    def step(self, t):
+        '''Observations, actions, rewards and terminals of every agent at step t'''
+        i = np.searchsorted(self.starts, t, side='right') - 1
+        s = self.shards[i]
+        t -= self.starts[i]
+        return s['observations'][t], s['actions'][t], s['rewards'][t], s['terminals'][t]
+
+    def sample(self, batch_size, rng=np.random):
+        '''Uniform random transitions as (observations, actions, rewards,
+        terminals), gathered shard by shard to keep reads local'''
+        steps = np.sort(rng.randint(0, self.steps, batch_size))
+        agents = rng.randint(0, self.num_agents, batch_size)
+        obs = np.empty((batch_size, self.obs_size), dtype=np.float32)
+        actions = np.empty((batch_size, 4), dtype=np.float32)
+        rewards = np.empty(batch_size, dtype=np.float32)
+        terminals = np.empty(batch_size, dtype=np.uint8)
+        bounds = np.searchsorted(steps, self.starts)
+        for i, s in enumerate(self.shards):
+            lo, hi = bounds[i], bounds[i + 1]
+            if lo == hi:
+                continue
+            t = steps[lo:hi] - self.starts[i]
+            a = agents[lo:hi]
+            obs[lo:hi] = s['observations'][t, a]
+            actions[lo:hi] = s['actions'][t, a]
+            rewards[lo:hi] = s['rewards'][t, a]
+            terminals[lo:hi] = s['terminals'][t, a]
+        return obs, actions, rewards, terminals
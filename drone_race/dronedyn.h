@@ -0,0 +1,610 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Drone dynamics and fixed step integrators, templated on precision.
+// dronelib.h includes this once per variant:
+//
+//   #define REAL double
+//   #define REAL_FN(name) name##_d
+//   #include "dronedyn.h"
+//
+// The *_flat functions work on a flat REAL state laid out like State
+// (pos, vel, quat, omega, rpms). The *_step functions advance a float
+// State, doing all the arithmetic of one step in REAL. derivs_jac and
+// rk4_jac_flat give analytic Jacobians of derivs and of one rk4_flat step.
+//
+// The integrators sample the wind once, at the start of the step, and hold
+// it over every stage. The turbulence varies over metres and a step moves
+// the drone tens of centimetres, while a grid sample costs about as much as
+// the rest of a derivative evaluation. The Jacobians and the VJP follow the
+// held wind back to the position it was sampled at.
+
+#define S_POS 0
+#define S_VEL 3
+#define S_QUAT 6
+#define S_OMEGA 10
+#define S_RPM 13
+
+// Wind velocity to hold over a step from y, zero in still air
+static inline void REAL_FN(held_air)(const REAL* y, const Params* p, float air[3]) {
+    air[0] = air[1] = air[2] = 0.0f;
+    if (p->wind != NULL) {
+        sample_wind(p->wind, (float)y[S_POS], (float)y[S_POS + 1], (float)y[S_POS + 2], air);
+    }
+}
+
+// Its spatial gradient, grad[c][a] = d air_c / d pos_a
+static inline void REAL_FN(held_air_grad)(const REAL* y, const Params* p, float grad[3][3]) {
+    memset(grad, 0, 9 * sizeof(float));
+    if (p->wind != NULL) {
+        sample_wind_grad(p->wind, (float)y[S_POS], (float)y[S_POS + 1], (float)y[S_POS + 2], grad);
+    }
+}
+
+// Derivatives at y in air moving at air
+static inline void REAL_FN(derivs_held)(const REAL* y, const Params* p, const float* air,
+        const float* actions, REAL* dy) {
+    // first order rpm lag and motor thrusts
+    REAL rpm_dot[4];
+    REAL T[4];
+    REAL kt = p->k_thrust * p->thrust_scale;
+    for (int i = 0; i < 4; i++) {
+        REAL target = ((REAL)actions[i] + 1) * (REAL)0.5 * p->max_rpm;
+        rpm_dot[i] = (1 / (REAL)p->k_mot) * (target - y[S_RPM + i]);
+        T[i] = kt * y[S_RPM + i] * y[S_RPM + i];
+    }
+
+    // body frame thrust rotated to the world frame, q * (0, 0, 0, F) * q^-1
+    REAL qw = y[S_QUAT], qx = y[S_QUAT + 1], qy = y[S_QUAT + 2], qz = y[S_QUAT + 3];
+    REAL F = T[0] + T[1] + T[2] + T[3];
+    REAL tw = -qz * F, tx = qy * F, ty = -qx * F, tz = qw * F;
+    REAL Fx = -tw * qx + tx * qw - ty * qz + tz * qy;
+    REAL Fy = -tw * qy + tx * qz + ty * qw - tz * qx;
+    REAL Fz = -tw * qz - tx * qy + ty * qx + tz * qw;
+
+    // velocity rates with linear drag against the air
+    REAL b = p->b_drag;
+    dy[S_POS] = y[S_VEL];
+    dy[S_POS + 1] = y[S_VEL + 1];
+    dy[S_POS + 2] = y[S_VEL + 2];
+    dy[S_VEL] = (Fx - b * (y[S_VEL] - air[0])) / p->mass;
+    dy[S_VEL + 1] = (Fy - b * (y[S_VEL + 1] - air[1])) / p->mass;
+    dy[S_VEL + 2] = (Fz - b * (y[S_VEL + 2] - air[2])) / p->mass - p->gravity;
+
+    // quaternion rates, q * (0, omega) / 2
+    REAL wx = y[S_OMEGA], wy = y[S_OMEGA + 1], wz = y[S_OMEGA + 2];
+    dy[S_QUAT] = (REAL)0.5 * (-qx * wx - qy * wy - qz * wz);
+    dy[S_QUAT + 1] = (REAL)0.5 * (qw * wx + qy * wz - qz * wy);
+    dy[S_QUAT + 2] = (REAL)0.5 * (qw * wy - qx * wz + qz * wx);
+    dy[S_QUAT + 3] = (REAL)0.5 * (qw * wz + qx * wy - qy * wx);
+
+    // propeller, motor, damping and gyroscopic torques
+    REAL tau_x = p->arm_len * (T[1] - T[3]) - p->k_ang_damp * wx + (p->iyy - p->izz) * wy * wz;
+    REAL tau_y = p->arm_len * (T[2] - T[0]) - p->k_ang_damp * wy + (p->izz - p->ixx) * wz * wx;
+    REAL tau_z = p->k_drag * (T[0] - T[1] + T[2] - T[3]) - p->k_ang_damp * wz
+        + (p->ixx - p->iyy) * wx * wy
+        + p->j_mot * (rpm_dot[0] - rpm_dot[1] + rpm_dot[2] - rpm_dot[3]);
+    dy[S_OMEGA] = tau_x / p->ixx;
+    dy[S_OMEGA + 1] = tau_y / p->iyy;
+    dy[S_OMEGA + 2] = tau_z / p->izz;
+
+    for (int i = 0; i < 4; i++) {
+        dy[S_RPM + i] = rpm_dot[i];
+    }
+}
+
+// Derivatives at y in the wind at y's position
+static inline void REAL_FN(derivs)(const REAL* y, const Params* p, const float* actions, REAL* dy) {
+    float air[3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(derivs_held)(y, p, air, actions, dy);
+}
+
+static inline void REAL_FN(normalize_quat)(REAL* y) {
+    REAL* q = &y[S_QUAT];
+    REAL n = (REAL)sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (n > 0) {
+        for (int i = 0; i < 4; i++) {
+            q[i] /= n;
+        }
+    }
+}
+
+// out = y + h * k, with a unit quaternion
+static inline void REAL_FN(axpy)(REAL* out, const REAL* y, REAL h, const REAL* k) {
+    for (int i = 0; i < STATE_DIM; i++) {
+        out[i] = y[i] + h * k[i];
+    }
+    REAL_FN(normalize_quat)(out);
+}
+
+void REAL_FN(euler_flat)(REAL* y, const Params* p, const float* actions, REAL dt) {
+    REAL k[STATE_DIM];
+    float air[3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(derivs_held)(y, p, air, actions, k);
+    REAL_FN(axpy)(y, y, dt, k);
+}
+
+// Rates and motor speeds first, then the pose moves with the new rates
+void REAL_FN(semi_euler_flat)(REAL* y, const Params* p, const float* actions, REAL dt) {
+    REAL k[STATE_DIM];
+    float air[3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(derivs_held)(y, p, air, actions, k);
+    for (int i = S_VEL; i < S_VEL + 3; i++) {
+        y[i] += dt * k[i];
+    }
+    for (int i = S_OMEGA; i < STATE_DIM; i++) {
+        y[i] += dt * k[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        y[S_POS + i] += dt * y[S_VEL + i];
+    }
+    REAL qw = y[S_QUAT], qx = y[S_QUAT + 1], qy = y[S_QUAT + 2], qz = y[S_QUAT + 3];
+    REAL wx = y[S_OMEGA], wy = y[S_OMEGA + 1], wz = y[S_OMEGA + 2];
+    REAL half_dt = dt / 2;
+    y[S_QUAT] += half_dt * (-qx * wx - qy * wy - qz * wz);
+    y[S_QUAT + 1] += half_dt * (qw * wx + qy * wz - qz * wy);
+    y[S_QUAT + 2] += half_dt * (qw * wy - qx * wz + qz * wx);
+    y[S_QUAT + 3] += half_dt * (qw * wz + qx * wy - qy * wx);
+    REAL_FN(normalize_quat)(y);
+}
+
+// Explicit midpoint
+void REAL_FN(rk2_flat)(REAL* y, const Params* p, const float* actions, REAL dt) {
+    REAL k1[STATE_DIM], k2[STATE_DIM], tmp[STATE_DIM];
+    float air[3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(derivs_held)(y, p, air, actions, k1);
+    REAL_FN(axpy)(tmp, y, dt / 2, k1);
+    REAL_FN(derivs_held)(tmp, p, air, actions, k2);
+    REAL_FN(axpy)(y, y, dt, k2);
+}
+
+void REAL_FN(rk4_flat)(REAL* y, const Params* p, const float* actions, REAL dt) {
+    REAL k1[STATE_DIM], k2[STATE_DIM], k3[STATE_DIM], k4[STATE_DIM], tmp[STATE_DIM];
+    float air[3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(derivs_held)(y, p, air, actions, k1);
+    REAL_FN(axpy)(tmp, y, dt / 2, k1);
+    REAL_FN(derivs_held)(tmp, p, air, actions, k2);
+    REAL_FN(axpy)(tmp, y, dt / 2, k2);
+    REAL_FN(derivs_held)(tmp, p, air, actions, k3);
+    REAL_FN(axpy)(tmp, y, dt, k3);
+    REAL_FN(derivs_held)(tmp, p, air, actions, k4);
+    for (int i = 0; i < STATE_DIM; i++) {
+        y[i] += (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]) * (dt / 6);
+    }
+    REAL_FN(normalize_quat)(y);
+}
+
+// Jacobians of derivs, A = d dy / d y (STATE_DIM x STATE_DIM) and
+// B = d dy / d actions (STATE_DIM x 4), both row major
+void REAL_FN(derivs_jac)(const REAL* y, const Params* p, const float* actions, REAL* A, REAL* B) {
+    memset(A, 0, STATE_DIM * STATE_DIM * sizeof(REAL));
+    memset(B, 0, STATE_DIM * 4 * sizeof(REAL));
+#define JA(i, j) A[(i) * STATE_DIM + (j)]
+#define JB(i, j) B[(i) * 4 + (j)]
+    REAL inv_k_mot = 1 / (REAL)p->k_mot;
+    REAL drpm_da = (REAL)0.5 * p->max_rpm * inv_k_mot;
+    REAL kt = p->k_thrust * p->thrust_scale;
+    REAL T[4], dT[4];
+    for (int i = 0; i < 4; i++) {
+        T[i] = kt * y[S_RPM + i] * y[S_RPM + i];
+        dT[i] = 2 * kt * y[S_RPM + i];
+    }
+    REAL F = T[0] + T[1] + T[2] + T[3];
+
+    // position
+    for (int i = 0; i < 3; i++) {
+        JA(S_POS + i, S_VEL + i) = 1;
+    }
+
+    // drag against the wind at the drone's position
+    if (p->wind != NULL) {
+        float grad[3][3];
+        REAL_FN(held_air_grad)(y, p, grad);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                JA(S_VEL + i, S_POS + j) = p->b_drag * grad[i][j] / p->mass;
+            }
+        }
+    }
+
+    // velocity, thrust along u = R(q) e_z with linear drag
+    REAL qw = y[S_QUAT], qx = y[S_QUAT + 1], qy = y[S_QUAT + 2], qz = y[S_QUAT + 3];
+    REAL u[3] = {2 * (qx * qz + qw * qy), 2 * (qy * qz - qw * qx), qw * qw - qx * qx - qy * qy + qz * qz};
+    REAL du[3][4] = {
+        {2 * qy, 2 * qz, 2 * qw, 2 * qx},
+        {-2 * qx, -2 * qw, 2 * qz, 2 * qy},
+        {2 * qw, -2 * qx, -2 * qy, 2 * qz},
+    };
+    REAL inv_m = 1 / (REAL)p->mass;
+    for (int i = 0; i < 3; i++) {
+        JA(S_VEL + i, S_VEL + i) = -p->b_drag * inv_m;
+        for (int j = 0; j < 4; j++) {
+            JA(S_VEL + i, S_QUAT + j) = F * du[i][j] * inv_m;
+            JA(S_VEL + i, S_RPM + j) = u[i] * dT[j] * inv_m;
+        }
+    }
+
+    // quaternion, linear in q for fixed omega and in omega for fixed q
+    REAL wx = y[S_OMEGA], wy = y[S_OMEGA + 1], wz = y[S_OMEGA + 2];
+    REAL dq_dq[4][4] = {
+        {0, -wx, -wy, -wz},
+        {wx, 0, wz, -wy},
+        {wy, -wz, 0, wx},
+        {wz, wy, -wx, 0},
+    };
+    REAL dq_dw[4][3] = {
+        {-qx, -qy, -qz},
+        {qw, -qz, qy},
+        {qz, qw, -qx},
+        {-qy, qx, qw},
+    };
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            JA(S_QUAT + i, S_QUAT + j) = (REAL)0.5 * dq_dq[i][j];
+        }
+        for (int j = 0; j < 3; j++) {
+            JA(S_QUAT + i, S_OMEGA + j) = (REAL)0.5 * dq_dw[i][j];
+        }
+    }
+
+    // body rates
+    REAL c = p->k_ang_damp;
+    REAL ixx = p->ixx, iyy = p->iyy, izz = p->izz;
+    JA(S_OMEGA, S_OMEGA) = -c / ixx;
+    JA(S_OMEGA, S_OMEGA + 1) = (iyy - izz) * wz / ixx;
+    JA(S_OMEGA, S_OMEGA + 2) = (iyy - izz) * wy / ixx;
+    JA(S_OMEGA, S_RPM + 1) = p->arm_len * dT[1] / ixx;
+    JA(S_OMEGA, S_RPM + 3) = -p->arm_len * dT[3] / ixx;
+    JA(S_OMEGA + 1, S_OMEGA) = (izz - ixx) * wz / iyy;
+    JA(S_OMEGA + 1, S_OMEGA + 1) = -c / iyy;
+    JA(S_OMEGA + 1, S_OMEGA + 2) = (izz - ixx) * wx / iyy;
+    JA(S_OMEGA + 1, S_RPM) = -p->arm_len * dT[0] / iyy;
+    JA(S_OMEGA + 1, S_RPM + 2) = p->arm_len * dT[2] / iyy;
+    JA(S_OMEGA + 2, S_OMEGA) = (ixx - iyy) * wy / izz;
+    JA(S_OMEGA + 2, S_OMEGA + 1) = (ixx - iyy) * wx / izz;
+    JA(S_OMEGA + 2, S_OMEGA + 2) = -c / izz;
+    for (int i = 0; i < 4; i++) {
+        REAL sign = (i % 2 == 0) ? 1 : -1;
+        JA(S_OMEGA + 2, S_RPM + i) = sign * (p->k_drag * dT[i] - p->j_mot * inv_k_mot) / izz;
+        JB(S_OMEGA + 2, i) = sign * p->j_mot * drpm_da / izz;
+    }
+
+    // motors
+    for (int i = 0; i < 4; i++) {
+        JA(S_RPM + i, S_RPM + i) = -inv_k_mot;
+        JB(S_RPM + i, i) = drpm_da;
+    }
+#undef JA
+#undef JB
+}
+
+// Applies the Jacobian of normalize_quat at the unnormalized y to the
+// quaternion rows of the STATE_DIM x cols tangent M, then normalizes y
+static inline void REAL_FN(normalize_quat_tangent)(REAL* y, REAL* M, int cols) {
+    REAL* q = &y[S_QUAT];
+    REAL n = (REAL)sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (n <= 0) {
+        return;
+    }
+    REAL_FN(normalize_quat)(y);
+    for (int c = 0; c < cols; c++) {
+        // (I - q q^T) / n with the normalized q
+        REAL dot = 0;
+        for (int i = 0; i < 4; i++) {
+            dot += q[i] * M[(S_QUAT + i) * cols + c];
+        }
+        for (int i = 0; i < 4; i++) {
+            M[(S_QUAT + i) * cols + c] = (M[(S_QUAT + i) * cols + c] - q[i] * dot) / n;
+        }
+    }
+}
+
+// dk = A M + [0 | B] for the tangent M = d y / d (y0, actions), column by
+// column without forming A, which is mostly zeros. air is held from y0 and
+// grad is its gradient there, so it only moves with the position columns.
+static inline void REAL_FN(tangent_derivs)(const REAL* y, const REAL* M, const Params* p,
+        const float* air, const float grad[3][3], const float* actions, REAL* k, REAL* dk) {
+    const int cols = STATE_DIM + 4;
+    REAL_FN(derivs_held)(y, p, air, actions, k);
+
+    REAL inv_k_mot = 1 / (REAL)p->k_mot;
+    REAL drpm_da = (REAL)0.5 * p->max_rpm * inv_k_mot;
+    REAL kt = p->k_thrust * p->thrust_scale;
+    REAL T[4], dT[4];
+    for (int i = 0; i < 4; i++) {
+        T[i] = kt * y[S_RPM + i] * y[S_RPM + i];
+        dT[i] = 2 * kt * y[S_RPM + i];
+    }
+    REAL F = T[0] + T[1] + T[2] + T[3];
+    REAL qw = y[S_QUAT], qx = y[S_QUAT + 1], qy = y[S_QUAT + 2], qz = y[S_QUAT + 3];
+    REAL wx = y[S_OMEGA], wy = y[S_OMEGA + 1], wz = y[S_OMEGA + 2];
+    REAL ux = 2 * (qx * qz + qw * qy), uy = 2 * (qy * qz - qw * qx);
+    REAL uz = qw * qw - qx * qx - qy * qy + qz * qz;
+    REAL inv_m = 1 / (REAL)p->mass;
+    REAL b = p->b_drag, c = p->k_ang_damp, L = p->arm_len;
+    REAL ixx = p->ixx, iyy = p->iyy, izz = p->izz;
+
+#define T_(i) M[(i) * cols + col]
+#define D_(i) dk[(i) * cols + col]
+    for (int col = 0; col < cols; col++) {
+        REAL dthrust[4], drpm[4];
+        for (int i = 0; i < 4; i++) {
+            dthrust[i] = dT[i] * T_(S_RPM + i);
+            drpm[i] = -inv_k_mot * T_(S_RPM + i);
+        }
+        REAL dF = dthrust[0] + dthrust[1] + dthrust[2] + dthrust[3];
+        REAL tqw = T_(S_QUAT), tqx = T_(S_QUAT + 1), tqy = T_(S_QUAT + 2), tqz = T_(S_QUAT + 3);
+        REAL twx = T_(S_OMEGA), twy = T_(S_OMEGA + 1), twz = T_(S_OMEGA + 2);
+        REAL dux = 2 * (tqx * qz + qx * tqz + tqw * qy + qw * tqy);
+        REAL duy = 2 * (tqy * qz + qy * tqz - tqw * qx - qw * tqx);
+        REAL duz = 2 * (qw * tqw - qx * tqx - qy * tqy + qz * tqz);
+
+        D_(S_POS) = T_(S_VEL);
+        D_(S_POS + 1) = T_(S_VEL + 1);
+        D_(S_POS + 2) = T_(S_VEL + 2);
+        REAL dair[3];
+        for (int i = 0; i < 3; i++) {
+            dair[i] = col < 3 ? grad[i][S_POS + col] : 0;
+        }
+        D_(S_VEL) = (dF * ux + F * dux - b * (T_(S_VEL) - dair[0])) * inv_m;
+        D_(S_VEL + 1) = (dF * uy + F * duy - b * (T_(S_VEL + 1) - dair[1])) * inv_m;
+        D_(S_VEL + 2) = (dF * uz + F * duz - b * (T_(S_VEL + 2) - dair[2])) * inv_m;
+
+        D_(S_QUAT) = (REAL)0.5 * (-tqx * wx - tqy * wy - tqz * wz - qx * twx - qy * twy - qz * twz);
+        D_(S_QUAT + 1) = (REAL)0.5 * (tqw * wx + tqy * wz - tqz * wy + qw * twx + qy * twz - qz * twy);
+        D_(S_QUAT + 2) = (REAL)0.5 * (tqw * wy - tqx * wz + tqz * wx + qw * twy - qx * twz + qz * twx);
+        D_(S_QUAT + 3) = (REAL)0.5 * (tqw * wz + tqx * wy - tqy * wx + qw * twz + qx * twy - qy * twx);
+
+        D_(S_OMEGA) = (L * (dthrust[1] - dthrust[3]) - c * twx + (iyy - izz) * (twy * wz + wy * twz)) / ixx;
+        D_(S_OMEGA + 1) = (L * (dthrust[2] - dthrust[0]) - c * twy + (izz - ixx) * (twz * wx + wz * twx)) / iyy;
+        D_(S_OMEGA + 2) = (p->k_drag * (dthrust[0] - dthrust[1] + dthrust[2] - dthrust[3]) - c * twz
+            + (ixx - iyy) * (twx * wy + wx * twy)
+            + p->j_mot * (drpm[0] - drpm[1] + drpm[2] - drpm[3])) / izz;
+
+        for (int i = 0; i < 4; i++) {
+            D_(S_RPM + i) = drpm[i];
+        }
+    }
+#undef T_
+#undef D_
+
+    // direct action terms, B
+    for (int i = 0; i < 4; i++) {
+        REAL sign = (i % 2 == 0) ? 1 : -1;
+        dk[(S_RPM + i) * cols + STATE_DIM + i] += drpm_da;
+        dk[(S_OMEGA + 2) * cols + STATE_DIM + i] += sign * p->j_mot * drpm_da / izz;
+    }
+}
+
+// rk4_flat with forward mode derivatives. Advances y and writes the
+// Jacobians of the step, A = d y1 / d y0 and B = d y1 / d actions.
+void REAL_FN(rk4_jac_flat)(REAL* y, const Params* p, const float* actions, REAL dt, REAL* A, REAL* B) {
+    const int cols = STATE_DIM + 4;
+    REAL k[4][STATE_DIM], dk[4][STATE_DIM * (STATE_DIM + 4)];
+    REAL tmp[STATE_DIM], M[STATE_DIM * (STATE_DIM + 4)];
+    const REAL h[4] = {0, dt / 2, dt / 2, dt};
+    float air[3], grad[3][3];
+    REAL_FN(held_air)(y, p, air);
+    REAL_FN(held_air_grad)(y, p, grad);
+
+    for (int s = 0; s < 4; s++) {
+        if (s == 0) {
+            memcpy(tmp, y, sizeof(tmp));
+            memset(M, 0, sizeof(M));
+            for (int i = 0; i < STATE_DIM; i++) {
+                M[i * cols + i] = 1;
+            }
+        } else {
+            for (int i = 0; i < STATE_DIM; i++) {
+                tmp[i] = y[i] + h[s] * k[s - 1][i];
+                for (int c = 0; c < cols; c++) {
+                    M[i * cols + c] = (i == c) + h[s] * dk[s - 1][i * cols + c];
+                }
+            }
+            REAL_FN(normalize_quat_tangent)(tmp, M, cols);
+        }
+        REAL_FN(tangent_derivs)(tmp, M, p, air, grad, actions, k[s], dk[s]);
+    }
+
+    for (int i = 0; i < STATE_DIM; i++) {
+        y[i] += (k[0][i] + 2 * k[1][i] + 2 * k[2][i] + k[3][i]) * (dt / 6);
+        for (int c = 0; c < cols; c++) {
+            M[i * cols + c] = (i == c) + (dk[0][i * cols + c] + 2 * dk[1][i * cols + c]
+                + 2 * dk[2][i * cols + c] + dk[3][i * cols + c]) * (dt / 6);
+        }
+    }
+    REAL_FN(normalize_quat_tangent)(y, M, cols);
+    for (int i = 0; i < STATE_DIM; i++) {
+        memcpy(&A[i * STATE_DIM], &M[i * cols], STATE_DIM * sizeof(REAL));
+        memcpy(&B[i * 4], &M[i * cols + STATE_DIM], 4 * sizeof(REAL));
+    }
+}
+
+// Vector-Jacobian product of derivs_held for fixed air, adds g^T A to gy
+// and g^T B to ga
+static inline void REAL_FN(derivs_vjp)(const REAL* y, const Params* p, const float* actions,
+        const REAL* g, REAL* gy, REAL* ga) {
+    REAL inv_k_mot = 1 / (REAL)p->k_mot;
+    REAL drpm_da = (REAL)0.5 * p->max_rpm * inv_k_mot;
+    REAL kt = p->k_thrust * p->thrust_scale;
+    REAL F = 0;
+    for (int i = 0; i < 4; i++) {
+        F += kt * y[S_RPM + i] * y[S_RPM + i];
+    }
+    REAL qw = y[S_QUAT], qx = y[S_QUAT + 1], qy = y[S_QUAT + 2], qz = y[S_QUAT + 3];
+    REAL wx = y[S_OMEGA], wy = y[S_OMEGA + 1], wz = y[S_OMEGA + 2];
+    REAL u[3] = {2 * (qx * qz + qw * qy), 2 * (qy * qz - qw * qx), qw * qw - qx * qx - qy * qy + qz * qz};
+    REAL inv_m = 1 / (REAL)p->mass;
+    REAL c = p->k_ang_damp, L = p->arm_len;
+    REAL ixx = p->ixx, iyy = p->iyy, izz = p->izz;
+    REAL gT[4] = {0}, grpm_dot[4];
+
+    // position and velocity
+    REAL gF = 0, gu[3];
+    for (int i = 0; i < 3; i++) {
+        REAL gv = g[S_VEL + i] * inv_m;
+        gy[S_VEL + i] += g[S_POS + i] - p->b_drag * gv;
+        gF += u[i] * gv;
+        gu[i] = F * gv;
+    }
+    gy[S_QUAT] += 2 * (qy * gu[0] - qx * gu[1] + qw * gu[2]);
+    gy[S_QUAT + 1] += 2 * (qz * gu[0] - qw * gu[1] - qx * gu[2]);
+    gy[S_QUAT + 2] += 2 * (qw * gu[0] + qz * gu[1] - qy * gu[2]);
+    gy[S_QUAT + 3] += 2 * (qx * gu[0] + qy * gu[1] + qz * gu[2]);
+
+    // quaternion
+    REAL g0 = (REAL)0.5 * g[S_QUAT], g1 = (REAL)0.5 * g[S_QUAT + 1];
+    REAL g2 = (REAL)0.5 * g[S_QUAT + 2], g3 = (REAL)0.5 * g[S_QUAT + 3];
+    gy[S_QUAT] += wx * g1 + wy * g2 + wz * g3;
+    gy[S_QUAT + 1] += -wx * g0 - wz * g2 + wy * g3;
+    gy[S_QUAT + 2] += -wy * g0 + wz * g1 - wx * g3;
+    gy[S_QUAT + 3] += -wz * g0 - wy * g1 + wx * g2;
+    REAL gwx = -qx * g0 + qw * g1 + qz * g2 - qy * g3;
+    REAL gwy = -qy * g0 - qz * g1 + qw * g2 + qx * g3;
+    REAL gwz = -qz * g0 + qy * g1 - qx * g2 + qw * g3;
+
+    // body rates
+    REAL ax = g[S_OMEGA] / ixx, ay = g[S_OMEGA + 1] / iyy, az = g[S_OMEGA + 2] / izz;
+    gT[1] += L * ax;
+    gT[3] -= L * ax;
+    gwx -= c * ax;
+    gwy += (iyy - izz) * wz * ax;
+    gwz += (iyy - izz) * wy * ax;
+    gT[2] += L * ay;
+    gT[0] -= L * ay;
+    gwy -= c * ay;
+    gwz += (izz - ixx) * wx * ay;
+    gwx += (izz - ixx) * wz * ay;
+    gwz -= c * az;
+    gwx += (ixx - iyy) * wy * az;
+    gwy += (ixx - iyy) * wx * az;
+    gy[S_OMEGA] += gwx;
+    gy[S_OMEGA + 1] += gwy;
+    gy[S_OMEGA + 2] += gwz;
+
+    // motors
+    for (int i = 0; i < 4; i++) {
+        REAL sign = (i % 2 == 0) ? 1 : -1;
+        gT[i] += gF + sign * p->k_drag * az;
+        grpm_dot[i] = g[S_RPM + i] + sign * p->j_mot * az;
+        gy[S_RPM + i] += 2 * kt * y[S_RPM + i] * gT[i] - inv_k_mot * grpm_dot[i];
+        ga[i] += drpm_da * grpm_dot[i];
+    }
+}
+
+// Pulls g back through normalize_quat at the unnormalized y, in place
+static inline void REAL_FN(normalize_quat_vjp)(const REAL* y, REAL* g) {
+    const REAL* q = &y[S_QUAT];
+    REAL n = (REAL)sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (n <= 0) {
+        return;
+    }
+    // The Jacobian (I - q q^T / n^2) / n is symmetric
+    REAL dot = 0;
+    for (int i = 0; i < 4; i++) {
+        dot += q[i] * g[S_QUAT + i];
+    }
+    for (int i = 0; i < 4; i++) {
+        g[S_QUAT + i] = (g[S_QUAT + i] - q[i] * dot / (n * n)) / n;
+    }
+}
+
+// Reverse mode rk4_flat. Given g1 = dL/dy1 for the step from y0, writes
+// g0 = dL/dy0 and ga = dL/dactions. The stages are recomputed from y0, so
+// the caller only needs to keep the state at the start of each step. The
+// held wind's share of every stage goes back to y0's position at the end.
+void REAL_FN(rk4_vjp_flat)(const REAL* y0, const Params* p, const float* actions, REAL dt,
+        const REAL* g1, REAL* g0, REAL* ga) {
+    REAL k[4][STATE_DIM], pre[4][STATE_DIM], s[4][STATE_DIM];
+    const REAL h[4] = {0, dt / 2, dt / 2, dt};
+    const REAL w[4] = {dt / 6, dt / 3, dt / 3, dt / 6};
+    float air[3];
+    REAL_FN(held_air)(y0, p, air);
+
+    // forward, keeping the stage inputs before and after normalization
+    for (int st = 0; st < 4; st++) {
+        for (int i = 0; i < STATE_DIM; i++) {
+            pre[st][i] = st == 0 ? y0[i] : y0[i] + h[st] * k[st - 1][i];
+        }
+        memcpy(s[st], pre[st], sizeof(s[st]));
+        if (st > 0) {
+            REAL_FN(normalize_quat)(s[st]);
+        }
+        REAL_FN(derivs_held)(s[st], p, air, actions, k[st]);
+    }
+    REAL end[STATE_DIM];
+    for (int i = 0; i < STATE_DIM; i++) {
+        end[i] = y0[i] + w[0] * k[0][i] + w[1] * k[1][i] + w[2] * k[2][i] + w[3] * k[3][i];
+    }
+
+    // backward
+    REAL g[STATE_DIM], gk[STATE_DIM], gs[STATE_DIM];
+    memcpy(g, g1, sizeof(g));
+    REAL_FN(normalize_quat_vjp)(end, g);
+    memcpy(g0, g, sizeof(g));
+    for (int j = 0; j < 4; j++) {
+        ga[j] = 0;
+    }
+    REAL gk_carry[STATE_DIM] = {0}, gair[3] = {0};
+    for (int st = 3; st >= 0; st--) {
+        for (int i = 0; i < STATE_DIM; i++) {
+            gk[i] = w[st] * g[i] + gk_carry[i];
+            gs[i] = 0;
+        }
+        REAL_FN(derivs_vjp)(s[st], p, actions, gk, gs, ga);
+        for (int i = 0; i < 3; i++) {
+            gair[i] += p->b_drag * gk[S_VEL + i] / p->mass;
+        }
+        if (st > 0) {
+            REAL_FN(normalize_quat_vjp)(pre[st], gs);
+        }
+        for (int i = 0; i < STATE_DIM; i++) {
+            g0[i] += gs[i];
+            gk_carry[i] = h[st] * gs[i];
+        }
+    }
+    if (p->wind != NULL) {
+        float grad[3][3];
+        REAL_FN(held_air_grad)(y0, p, grad);
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++) {
+                g0[S_POS + j] += grad[i][j] * gair[i];
+            }
+        }
+    }
+}
+
+// Float State wrappers, one derivative evaluation count per variant
+#define REAL_STEP(method, evals)                                                              \
+    DRONE_KERNEL int REAL_FN(method##_step)(State* state, Params* params, float* actions, float dt, float* h) { \
+        REAL y[STATE_DIM];                                                                     \
+        float* s = (float*)state;                                                              \
+        for (int i = 0; i < STATE_DIM; i++) {                                                  \
+            y[i] = s[i];                                                                       \
+        }                                                                                      \
+        REAL_FN(method##_flat)(y, params, actions, dt);                                        \
+        for (int i = 0; i < STATE_DIM; i++) {                                                  \
+            s[i] = (float)y[i];                                                                \
+        }                                                                                      \
+        return evals;                                                                          \
+    }
+
+REAL_STEP(euler, 1)
+REAL_STEP(semi_euler, 1)
+REAL_STEP(rk2, 2)
+REAL_STEP(rk4, 4)
+
+#undef REAL_STEP
+#undef S_POS
+#undef S_VEL
+#undef S_QUAT
+#undef S_OMEGA
+#undef S_RPM
+#undef REAL
+#undef REAL_FN
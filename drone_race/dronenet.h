@@ -0,0 +1,1144 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Batched policy inference for the native demos. Reads the same weight
+// layout as puffernet's LinearContLSTM, either from a flat Weights buffer or
+// from a memory mapped weight file, but runs every agent of an env as
+// one batch: weights are repacked into K x N panels, once per weight file
+// and shared by the nets loaded from it, so each layer is a cache-blocked
+// GEMM, and activations and action sampling are flat loops over the batch
+// that the compiler vectorizes.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "puffernet.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#define NET_HIDDEN 128
+
+// GEMM blocking
+#define NET_MR 6   // agents per micro tile
+#define NET_NR 16  // output columns per micro tile
+#define NET_KC 256 // depth of a weight panel
+#define NET_NC 512 // output columns of a weight panel
+
+static inline int mini(int a, int b) { return a < b ? a : b; }
+
+// Reinterprets float bits without a memcpy, which blocks vectorization
+typedef union {
+    float f;
+    int32_t i;
+} FloatBits;
+
+// Cephes style expf, branch free so that loops over it vectorize
+static inline float fast_expf(float x) {
+    x = x < -87.0f ? -87.0f : x;
+    x = x > 88.0f ? 88.0f : x;
+
+    // Round to nearest with the 1.5*2^23 trick
+    float n = x * 1.44269504f + 12582912.0f;
+    n -= 12582912.0f;
+    float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+
+    float p = 1.9875691500e-4f;
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+
+    FloatBits scale = {.i = ((int32_t)n + 127) << 23};
+    return p * scale.f;
+}
+
+// Cephes style logf for x > 0
+static inline float fast_logf(float x) {
+    FloatBits bits = {.f = x};
+    int32_t e = ((bits.i >> 23) & 0xff) - 126;
+    bits.i = (bits.i & 0x007fffff) | 0x3f000000; // mantissa in [0.5, 1)
+    float m = bits.f;
+
+    bool small = m < 0.707106781f;
+    e = small ? e - 1 : e;
+    m = small ? m + m - 1.0f : m - 1.0f;
+
+    float z = m * m;
+    float y = 7.0376836292e-2f;
+    y = y * m - 1.1514610310e-1f;
+    y = y * m + 1.1676998740e-1f;
+    y = y * m - 1.2420140846e-1f;
+    y = y * m + 1.4249322787e-1f;
+    y = y * m - 1.6668057665e-1f;
+    y = y * m + 2.0000714765e-1f;
+    y = y * m - 2.4999993993e-1f;
+    y = y * m + 3.3333331174e-1f;
+    y = y * m * z;
+
+    float fe = (float)e;
+    y += -2.12194440e-4f * fe;
+    y += -0.5f * z;
+    return m + y + 0.693359375f * fe;
+}
+
+static inline float fast_sigmoid(float x) { return 1.0f / (1.0f + fast_expf(-x)); }
+
+static inline float fast_tanh(float x) { return 2.0f * fast_sigmoid(2.0f * x) - 1.0f; }
+
+// Counter based RNG: every sample is a hash of (seed, counter), so a batch
+// of uniforms has no serial dependency
+static inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in (0, 1]
+static inline float hash_uniform(uint32_t seed, uint32_t counter) {
+    return (float)((hash32(seed ^ hash32(counter)) >> 8) + 1) * (1.0f / 16777216.0f);
+}
+
+// Fills out[0..n) with standard normals using Box-Muller. The angle is
+// halved onto [-pi/2, pi/2] so plain Taylor polynomials are accurate and
+// the double angle formulas give the sin/cos pair without range reduction.
+void randn_batch(float* out, int n, uint32_t seed, uint32_t counter) {
+    int half = (n + 1) / 2;
+    for (int i = 0; i < half; i++) {
+        float u1 = hash_uniform(seed, counter + 2*i);
+        float u2 = hash_uniform(seed, counter + 2*i + 1);
+
+        float r = sqrtf(-2.0f * fast_logf(u1));
+        float x = (float)M_PI * (u2 - 0.5f);
+        float x2 = x * x;
+        float s = x * (1.0f + x2 * (-1.0f/6 + x2 * (1.0f/120 + x2 * (-1.0f/5040
+                      + x2 * (1.0f/362880 - x2 * (1.0f/39916800))))));
+        float c = 1.0f + x2 * (-0.5f + x2 * (1.0f/24 + x2 * (-1.0f/720
+                      + x2 * (1.0f/40320 + x2 * (-1.0f/3628800 + x2 * (1.0f/479001600))))));
+
+        out[i] = r * (c*c - s*s);
+        if (i + half < n) {
+            out[i + half] = r * (2.0f * s * c);
+        }
+    }
+}
+
+// Y[mr x nr] += X[mr x kc] * W[kc x nr]
+static inline void gemm_micro(const float* X, int ldx, const float* W, int ldw,
+        float* Y, int ldy, int mr, int nr, int kc) {
+#if defined(__AVX2__) && defined(__FMA__)
+    if (mr == NET_MR && nr == NET_NR) {
+        __m256 acc[NET_MR][2];
+        for (int r = 0; r < NET_MR; r++) {
+            acc[r][0] = _mm256_setzero_ps();
+            acc[r][1] = _mm256_setzero_ps();
+        }
+        for (int k = 0; k < kc; k++) {
+            __m256 w0 = _mm256_loadu_ps(&W[k*ldw]);
+            __m256 w1 = _mm256_loadu_ps(&W[k*ldw + 8]);
+            for (int r = 0; r < NET_MR; r++) {
+                __m256 x = _mm256_broadcast_ss(&X[r*ldx + k]);
+                acc[r][0] = _mm256_fmadd_ps(x, w0, acc[r][0]);
+                acc[r][1] = _mm256_fmadd_ps(x, w1, acc[r][1]);
+            }
+        }
+        for (int r = 0; r < NET_MR; r++) {
+            float* y = &Y[r*ldy];
+            _mm256_storeu_ps(y, _mm256_add_ps(_mm256_loadu_ps(y), acc[r][0]));
+            _mm256_storeu_ps(y + 8, _mm256_add_ps(_mm256_loadu_ps(y + 8), acc[r][1]));
+        }
+        return;
+    }
+#endif
+    float acc[NET_MR][NET_NR] = {{0}};
+    for (int k = 0; k < kc; k++) {
+        const float* w = &W[k*ldw];
+        for (int r = 0; r < mr; r++) {
+            float x = X[r*ldx + k];
+            for (int c = 0; c < nr; c++) {
+                acc[r][c] += x * w[c];
+            }
+        }
+    }
+    for (int r = 0; r < mr; r++) {
+        for (int c = 0; c < nr; c++) {
+            Y[r*ldy + c] += acc[r][c];
+        }
+    }
+}
+
+// Y[B x N] = X[B x K] * W[K x N] + bias, added onto Y when accumulating
+void gemm(const float* X, const float* W, const float* bias, float* Y,
+        int B, int K, int N, bool accumulate) {
+    for (int b = 0; b < B; b++) {
+        float* y = &Y[b*N];
+        for (int n = 0; n < N; n++) {
+            y[n] = (accumulate ? y[n] : 0.0f) + bias[n];
+        }
+    }
+
+    for (int k0 = 0; k0 < K; k0 += NET_KC) {
+        int kc = mini(NET_KC, K - k0);
+        for (int n0 = 0; n0 < N; n0 += NET_NC) {
+            int nc = mini(NET_NC, N - n0);
+            for (int b0 = 0; b0 < B; b0 += NET_MR) {
+                int mr = mini(NET_MR, B - b0);
+                for (int j = 0; j < nc; j += NET_NR) {
+                    int nr = mini(NET_NR, nc - j);
+                    gemm_micro(&X[b0*K + k0], K, &W[k0*N + n0 + j], N,
+                               &Y[b0*N + n0 + j], N, mr, nr, kc);
+                }
+            }
+        }
+    }
+}
+
+// Weight files. A header and tensor table followed by the tensor data:
+//
+//   WeightFileHeader | WeightTensor[num_tensors] | pad to WEIGHT_ALIGN | data
+//
+// Files are mapped read-only and shared, so every net, thread and process
+// using one file reads a single copy from the page cache and nothing is
+// loaded up front. Nets look tensors up by name and check their shapes, so a
+// policy trained for another observation size fails to load instead of being
+// misread. Rows of 2D int8 tensors are padded to WEIGHT_ALIGN bytes. Float
+// tensors written back to back in trainer order also form a flat Weights
+// view for puffernet. Opening checks the header and tensor table only, so it
+// touches no tensor data; the tools that write files verify the checksum
+// over everything with verify_weight_file.
+
+#define WEIGHT_MAGIC 0x46575244 // "DRWF"
+#define WEIGHT_VERSION 1
+#define WEIGHT_ALIGN 64
+#define WEIGHT_NAME_LEN 32
+#define WEIGHT_MAX_RANK 4
+
+#define WEIGHT_F32 0
+#define WEIGHT_I8 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_tensors;
+    uint32_t checksum; // FNV-1a of everything after the header
+    uint64_t data_offset;
+    uint64_t data_size;
+} WeightFileHeader;
+
+typedef struct {
+    char name[WEIGHT_NAME_LEN];
+    uint32_t dtype;
+    uint32_t rank;
+    uint32_t shape[WEIGHT_MAX_RANK];
+    uint64_t offset; // from the start of the data
+    uint64_t nbytes;
+} WeightTensor;
+
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    bool mapped;
+    const WeightFileHeader* header;
+    const WeightTensor* tensors;
+    const uint8_t* data;
+    Weights weights; // flat view, data is NULL unless every tensor is fp32 and contiguous
+    float** panels; // per tensor, its K x N gemm panel once a net has packed it, see weight_panel
+} WeightFile;
+
+static inline size_t align_up(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+static size_t weight_nbytes(uint32_t dtype, uint32_t rank, const uint32_t* shape) {
+    size_t rows = 1;
+    for (uint32_t i = 0; i + 1 < rank; i++) {
+        rows *= shape[i];
+    }
+    size_t cols = rank > 0 ? shape[rank - 1] : 1;
+    if (dtype == WEIGHT_I8) {
+        return rows * (rank > 1 ? align_up(cols, WEIGHT_ALIGN) : cols);
+    }
+    return rows * cols * sizeof(float);
+}
+
+// Describes a rank 1 (d1 == 0) or rank 2 tensor
+WeightTensor weight_tensor_desc(const char* name, uint32_t dtype, int d0, int d1) {
+    WeightTensor t = {0};
+    snprintf(t.name, WEIGHT_NAME_LEN, "%s", name);
+    t.dtype = dtype;
+    t.rank = d1 > 0 ? 2 : 1;
+    t.shape[0] = d0;
+    t.shape[1] = d1 > 0 ? d1 : 0;
+    t.nbytes = weight_nbytes(dtype, t.rank, t.shape);
+    return t;
+}
+
+// FNV-1a over 32 bit words, n is a multiple of 4
+static uint32_t weight_checksum(const uint8_t* bytes, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i += 4) {
+        uint32_t w;
+        memcpy(&w, bytes + i, 4);
+        h = (h ^ w) * 16777619u;
+    }
+    return h;
+}
+
+// Lays out a complete weight file in memory, filling in tensor offsets.
+// Each tensor starts on an align byte boundary.
+static uint8_t* build_weight_image(WeightTensor* tensors, const void** srcs, int n,
+        size_t align, size_t* size) {
+    size_t data_offset = align_up(sizeof(WeightFileHeader) + n*sizeof(WeightTensor), WEIGHT_ALIGN);
+    size_t end = 0;
+    for (int i = 0; i < n; i++) {
+        end = align_up(end, align);
+        tensors[i].offset = end;
+        end += tensors[i].nbytes;
+    }
+    size_t data_size = align_up(end, 4);
+    *size = data_offset + data_size;
+
+    uint8_t* image = (uint8_t*)calloc(1, *size);
+    memcpy(image + sizeof(WeightFileHeader), tensors, n*sizeof(WeightTensor));
+    for (int i = 0; i < n; i++) {
+        memcpy(image + data_offset + tensors[i].offset, srcs[i], tensors[i].nbytes);
+    }
+    WeightFileHeader header = {
+        .magic = WEIGHT_MAGIC,
+        .version = WEIGHT_VERSION,
+        .num_tensors = n,
+        .checksum = weight_checksum(image + sizeof(WeightFileHeader), *size - sizeof(WeightFileHeader)),
+        .data_offset = data_offset,
+        .data_size = data_size,
+    };
+    memcpy(image, &header, sizeof(WeightFileHeader));
+    return image;
+}
+
+int write_weight_file(const char* path, WeightTensor* tensors, const void** srcs, int n, size_t align) {
+    size_t size;
+    uint8_t* image = build_weight_image(tensors, srcs, n, align, &size);
+    FILE* file = fopen(path, "wb");
+    bool ok = file != NULL && fwrite(image, 1, size, file) == size;
+    if (file != NULL) {
+        ok = fclose(file) == 0 && ok;
+    }
+    free(image);
+    return ok ? 0 : -1;
+}
+
+// Validates the header and tensor table of file->base
+static bool check_weight_file(WeightFile* file, const char* path) {
+    const WeightFileHeader* h = (const WeightFileHeader*)file->base;
+    if (file->size < sizeof(WeightFileHeader) || h->magic != WEIGHT_MAGIC) {
+        fprintf(stderr, "%s is not a weight file\n", path);
+        return false;
+    }
+    if (h->version != WEIGHT_VERSION) {
+        fprintf(stderr, "%s has version %u, expected %u\n", path, h->version, WEIGHT_VERSION);
+        return false;
+    }
+    size_t table_end = sizeof(WeightFileHeader) + (size_t)h->num_tensors*sizeof(WeightTensor);
+    if (h->data_offset < table_end || h->data_offset % 4 != 0 || h->data_size % 4 != 0
+            || h->data_offset + h->data_size != file->size) {
+        fprintf(stderr, "%s is truncated\n", path);
+        return false;
+    }
+    file->header = h;
+    file->tensors = (const WeightTensor*)(file->base + sizeof(WeightFileHeader));
+    file->data = file->base + h->data_offset;
+    bool flat = true;
+    uint64_t end = 0;
+    for (uint32_t i = 0; i < h->num_tensors; i++) {
+        const WeightTensor* t = &file->tensors[i];
+        if (t->dtype > WEIGHT_I8 || t->rank < 1 || t->rank > WEIGHT_MAX_RANK
+                || t->nbytes != weight_nbytes(t->dtype, t->rank, t->shape)
+                || t->offset + t->nbytes > h->data_size) {
+            fprintf(stderr, "%s has a malformed tensor %.*s\n", path, WEIGHT_NAME_LEN, t->name);
+            return false;
+        }
+        flat = flat && t->dtype == WEIGHT_F32 && t->offset == end;
+        end = t->offset + t->nbytes;
+    }
+    if (flat) {
+        file->weights = (Weights){.data = (float*)file->data, .size = (int)(end / sizeof(float)), .idx = 0};
+    }
+    file->panels = (float**)calloc(h->num_tensors, sizeof(float*));
+    return true;
+}
+
+// Checks the header's checksum over the tensor table and all of the data,
+// reading the whole file
+bool verify_weight_file(const WeightFile* file, const char* path) {
+    if (weight_checksum(file->base + sizeof(WeightFileHeader), file->size - sizeof(WeightFileHeader))
+            != file->header->checksum) {
+        fprintf(stderr, "%s failed its checksum\n", path);
+        return false;
+    }
+    return true;
+}
+
+void close_weight_file(WeightFile* file) {
+    if (file == NULL) {
+        return;
+    }
+    if (file->panels != NULL) {
+        for (uint32_t i = 0; i < file->header->num_tensors; i++) {
+            free(file->panels[i]);
+        }
+        free(file->panels);
+    }
+#if !defined(__EMSCRIPTEN__)
+    if (file->mapped) {
+        munmap((void*)file->base, file->size);
+    } else
+#endif
+    free((void*)file->base);
+    free(file);
+}
+
+static uint8_t* read_whole_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    uint8_t* bytes = (uint8_t*)malloc(*size > 0 ? *size : 1);
+    if (fread(bytes, 1, *size, f) != *size) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(f);
+    return bytes;
+}
+
+// Maps a weight file read-only. Reads it into memory where mmap is unavailable.
+WeightFile* open_weight_file(const char* path) {
+    WeightFile* file = (WeightFile*)calloc(1, sizeof(WeightFile));
+#if defined(__EMSCRIPTEN__)
+    file->base = read_whole_file(path, &file->size);
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            file->base = (const uint8_t*)map;
+            file->size = st.st_size;
+            file->mapped = true;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    if (file->base == NULL) {
+        fprintf(stderr, "Error opening file %s\n", path);
+        free(file);
+        return NULL;
+    }
+    if (!check_weight_file(file, path)) {
+        close_weight_file(file);
+        return NULL;
+    }
+    return file;
+}
+
+const WeightTensor* find_weight_tensor(const WeightFile* file, const char* name) {
+    for (uint32_t i = 0; i < file->header->num_tensors; i++) {
+        if (strncmp(file->tensors[i].name, name, WEIGHT_NAME_LEN) == 0) {
+            return &file->tensors[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns the named tensor's data, or NULL with a message if it is missing
+// or its dtype or shape differ. d1 == 0 expects a rank 1 tensor.
+const void* weight_tensor(const WeightFile* file, const char* name, uint32_t dtype, int d0, int d1) {
+    const WeightTensor* t = find_weight_tensor(file, name);
+    if (t == NULL) {
+        fprintf(stderr, "Weights have no tensor %s\n", name);
+        return NULL;
+    }
+    uint32_t rank = d1 > 0 ? 2 : 1;
+    if (t->dtype != dtype || t->rank != rank || t->shape[0] != (uint32_t)d0
+            || (rank == 2 && t->shape[1] != (uint32_t)d1)) {
+        fprintf(stderr, "Tensor %s has shape [%u, %u] dtype %u, expected [%d, %d] dtype %u\n",
+            name, t->shape[0], t->rank > 1 ? t->shape[1] : 0, t->dtype, d0, d1, dtype);
+        return NULL;
+    }
+    return file->data + t->offset;
+}
+
+// Size of the flat weight file written by the trainer
+int linearcontlstm_num_weights(int input_dim, int hidden_dim, int num_actions) {
+    return num_actions
+        + input_dim*hidden_dim + hidden_dim
+        + hidden_dim*num_actions + num_actions
+        + hidden_dim + 1
+        + 8*hidden_dim*hidden_dim + 8*hidden_dim;
+}
+
+// LinearContLSTM tensors in the order the trainer flattens them
+#define POLICY_LOG_STD 0
+#define POLICY_ENCODER_W 1
+#define POLICY_ENCODER_B 2
+#define POLICY_ACTOR_W 3
+#define POLICY_ACTOR_B 4
+#define POLICY_VALUE_W 5
+#define POLICY_VALUE_B 6
+#define POLICY_LSTM_IH_W 7
+#define POLICY_LSTM_HH_W 8
+#define POLICY_LSTM_IH_B 9
+#define POLICY_LSTM_HH_B 10
+#define POLICY_TENSORS 11
+
+void linearcontlstm_tensors(WeightTensor* t, int input_dim, int num_actions) {
+    int H = NET_HIDDEN;
+    t[POLICY_LOG_STD] = weight_tensor_desc("log_std", WEIGHT_F32, num_actions, 0);
+    t[POLICY_ENCODER_W] = weight_tensor_desc("encoder.weight", WEIGHT_F32, H, input_dim);
+    t[POLICY_ENCODER_B] = weight_tensor_desc("encoder.bias", WEIGHT_F32, H, 0);
+    t[POLICY_ACTOR_W] = weight_tensor_desc("actor.weight", WEIGHT_F32, num_actions, H);
+    t[POLICY_ACTOR_B] = weight_tensor_desc("actor.bias", WEIGHT_F32, num_actions, 0);
+    t[POLICY_VALUE_W] = weight_tensor_desc("value.weight", WEIGHT_F32, 1, H);
+    t[POLICY_VALUE_B] = weight_tensor_desc("value.bias", WEIGHT_F32, 1, 0);
+    t[POLICY_LSTM_IH_W] = weight_tensor_desc("lstm.weight_ih", WEIGHT_F32, 4*H, H);
+    t[POLICY_LSTM_HH_W] = weight_tensor_desc("lstm.weight_hh", WEIGHT_F32, 4*H, H);
+    t[POLICY_LSTM_IH_B] = weight_tensor_desc("lstm.bias_ih", WEIGHT_F32, 4*H, 0);
+    t[POLICY_LSTM_HH_B] = weight_tensor_desc("lstm.bias_hh", WEIGHT_F32, 4*H, 0);
+}
+
+// Looks up every fp32 policy tensor with its expected shape
+static bool linearcontlstm_params(const WeightFile* file, const float** params,
+        int input_dim, int num_actions) {
+    WeightTensor t[POLICY_TENSORS];
+    linearcontlstm_tensors(t, input_dim, num_actions);
+    for (int i = 0; i < POLICY_TENSORS; i++) {
+        params[i] = (const float*)weight_tensor(file, t[i].name, WEIGHT_F32,
+            t[i].shape[0], t[i].shape[1]);
+        if (params[i] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Observation size of a policy file, read from its encoder
+int policy_input_dim(const WeightFile* file) {
+    const WeightTensor* t = find_weight_tensor(file, "encoder.weight");
+    return t != NULL && t->rank == 2 ? (int)t->shape[1] : -1;
+}
+
+// Opens a policy weight file. Raw float files from the trainer are accepted
+// too: their length is checked against input_dim (inferred when 0) and they
+// are wrapped in memory as a weight file.
+WeightFile* open_policy_weights(const char* path, int input_dim, int num_actions) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening file %s\n", path);
+        return NULL;
+    }
+    uint32_t magic = 0;
+    size_t got = fread(&magic, sizeof(uint32_t), 1, f);
+    fclose(f);
+    if (got == 1 && magic == WEIGHT_MAGIC) {
+        WeightFile* file = open_weight_file(path);
+        if (file != NULL && input_dim > 0 && policy_input_dim(file) != input_dim) {
+            fprintf(stderr, "%s expects %d observations, not %d\n", path, policy_input_dim(file), input_dim);
+            close_weight_file(file);
+            return NULL;
+        }
+        return file;
+    }
+
+    size_t size;
+    float* raw = (float*)read_whole_file(path, &size);
+    if (raw == NULL) {
+        fprintf(stderr, "Error reading file %s\n", path);
+        return NULL;
+    }
+    long num_weights = size / sizeof(float);
+    long fixed = linearcontlstm_num_weights(0, NET_HIDDEN, num_actions);
+    if (input_dim <= 0 && num_weights > fixed && (num_weights - fixed) % NET_HIDDEN == 0) {
+        input_dim = (num_weights - fixed) / NET_HIDDEN;
+    }
+    long expected = linearcontlstm_num_weights(input_dim, NET_HIDDEN, num_actions);
+    if (input_dim <= 0 || size % sizeof(float) != 0 || num_weights != expected) {
+        fprintf(stderr, "%s has %ld floats, expected %ld for %d observations\n",
+            path, num_weights, expected, input_dim);
+        free(raw);
+        return NULL;
+    }
+
+    WeightTensor t[POLICY_TENSORS];
+    const void* srcs[POLICY_TENSORS];
+    linearcontlstm_tensors(t, input_dim, num_actions);
+    const float* src = raw;
+    for (int i = 0; i < POLICY_TENSORS; i++) {
+        srcs[i] = src;
+        src += t[i].nbytes / sizeof(float);
+    }
+    WeightFile* file = (WeightFile*)calloc(1, sizeof(WeightFile));
+    file->base = build_weight_image(t, srcs, POLICY_TENSORS, sizeof(float), &file->size);
+    free(raw);
+    check_weight_file(file, path);
+    return file;
+}
+
+// Copies a row major [N x K] torch weight into a [K x N] panel
+static float* pack_weights(const float* src, int K, int N) {
+    float* dst = (float*)malloc(K*N*sizeof(float));
+    for (int n = 0; n < N; n++) {
+        for (int k = 0; k < K; k++) {
+            dst[k*N + n] = src[n*K + k];
+        }
+    }
+    return dst;
+}
+
+// Panel of the [N x K] tensor of file at src, packed by the first net that
+// asks and shared by every later one, so eval shards and demos built from
+// one file hold a single copy. It lives until the file closes. Nets are
+// built before any thread runs them, so there is no lock.
+static const float* weight_panel(WeightFile* file, const float* src, int K, int N) {
+    for (uint32_t i = 0; i < file->header->num_tensors; i++) {
+        if (file->data + file->tensors[i].offset == (const uint8_t*)src) {
+            if (file->panels[i] == NULL) {
+                file->panels[i] = pack_weights(src, K, N);
+            }
+            return file->panels[i];
+        }
+    }
+    return NULL;
+}
+
+// Packs src for one net, or shares its file's panel when file is not NULL
+static const float* net_panel(WeightFile* file, const float* src, int K, int N) {
+    return file != NULL ? weight_panel(file, src, K, N) : pack_weights(src, K, N);
+}
+
+typedef struct {
+    const float* weights; // K x N, the net's own unless shared from a weight file
+    const float* bias;    // N
+    float* output;        // batch_size x N
+    bool owns_weights;
+    int batch_size;
+    int input_dim;
+    int output_dim;
+} PackedLinear;
+
+void init_packed_linear(PackedLinear* layer, WeightFile* file, const float* weights, const float* bias,
+        int batch_size, int input_dim, int output_dim) {
+    layer->weights = net_panel(file, weights, input_dim, output_dim);
+    layer->owns_weights = file == NULL;
+    layer->bias = bias;
+    layer->output = (float*)calloc(batch_size*output_dim, sizeof(float));
+    layer->batch_size = batch_size;
+    layer->input_dim = input_dim;
+    layer->output_dim = output_dim;
+}
+
+void free_packed_linear(PackedLinear* layer) {
+    if (layer->owns_weights) {
+        free((void*)layer->weights);
+    }
+    free(layer->output);
+}
+
+static inline void packed_linear(PackedLinear* layer, const float* input) {
+    gemm(input, layer->weights, layer->bias, layer->output, layer->batch_size,
+         layer->input_dim, layer->output_dim, false);
+}
+
+typedef struct {
+    const float* weights_input; // input_size x 4*hidden_size, shared as in PackedLinear
+    const float* weights_state; // hidden_size x 4*hidden_size
+    bool owns_weights;
+    float* bias;          // bias_input + bias_state
+    float* zero_bias;
+    float* gates;         // batch_size x 4*hidden_size, torch order i, f, g, o
+    float* state_h;
+    float* state_c;
+    int batch_size;
+    int input_size;
+    int hidden_size;
+} PackedLSTM;
+
+void init_packed_lstm(PackedLSTM* layer, WeightFile* file, const float* weights_input,
+        const float* weights_state, const float* bias_input, const float* bias_state,
+        int batch_size, int input_size, int hidden_size) {
+    int G = 4*hidden_size;
+    layer->weights_input = net_panel(file, weights_input, input_size, G);
+    layer->weights_state = net_panel(file, weights_state, hidden_size, G);
+    layer->owns_weights = file == NULL;
+    layer->bias = (float*)malloc(G*sizeof(float));
+    for (int i = 0; i < G; i++) {
+        layer->bias[i] = bias_input[i] + bias_state[i];
+    }
+    layer->zero_bias = (float*)calloc(G, sizeof(float));
+    layer->gates = (float*)calloc(batch_size*G, sizeof(float));
+    layer->state_h = (float*)calloc(batch_size*hidden_size, sizeof(float));
+    layer->state_c = (float*)calloc(batch_size*hidden_size, sizeof(float));
+    layer->batch_size = batch_size;
+    layer->input_size = input_size;
+    layer->hidden_size = hidden_size;
+}
+
+void free_packed_lstm(PackedLSTM* layer) {
+    if (layer->owns_weights) {
+        free((void*)layer->weights_input);
+        free((void*)layer->weights_state);
+    }
+    free(layer->bias);
+    free(layer->zero_bias);
+    free(layer->gates);
+    free(layer->state_h);
+    free(layer->state_c);
+}
+
+void packed_lstm(PackedLSTM* layer, const float* input) {
+    int B = layer->batch_size;
+    int H = layer->hidden_size;
+    int G = 4*H;
+    gemm(input, layer->weights_input, layer->bias, layer->gates, B, layer->input_size, G, false);
+    gemm(layer->state_h, layer->weights_state, layer->zero_bias, layer->gates, B, H, G, true);
+
+    for (int b = 0; b < B; b++) {
+        const float* g = &layer->gates[b*G];
+        float* h = &layer->state_h[b*H];
+        float* c = &layer->state_c[b*H];
+        for (int i = 0; i < H; i++) {
+            float in_gate = fast_sigmoid(g[i]);
+            float forget_gate = fast_sigmoid(g[H + i]);
+            float cell_gate = fast_tanh(g[2*H + i]);
+            float out_gate = fast_sigmoid(g[3*H + i]);
+            c[i] = forget_gate * c[i] + in_gate * cell_gate;
+            h[i] = out_gate * fast_tanh(c[i]);
+        }
+    }
+}
+
+static inline void gelu_batch(float* restrict out, const float* restrict x, int n) {
+    for (int i = 0; i < n; i++) {
+        float v = x[i];
+        out[i] = 0.5f * v * (1.0f + fast_tanh(0.7978845608f * (v + 0.044715f * v * v * v)));
+    }
+}
+
+typedef struct LinearContLSTM LinearContLSTM;
+struct LinearContLSTM {
+    int num_agents;
+    int input_dim;
+    int num_actions;
+    const float *log_std;
+    float *std;
+    PackedLinear encoder;
+    float *gelu1;
+    PackedLSTM lstm;
+    PackedLinear actor;
+    PackedLinear value_fn;
+    float *noise;
+    uint32_t seed;
+    uint32_t counter;
+};
+
+
+static LinearContLSTM *init_linearcontlstm(WeightFile* file, const float** params, int num_agents,
+        int input_dim, int num_actions) {
+    LinearContLSTM *net = calloc(1, sizeof(LinearContLSTM));
+    net->num_agents = num_agents;
+    net->input_dim = input_dim;
+    net->num_actions = num_actions;
+    net->log_std = params[POLICY_LOG_STD];
+    net->std = (float*)calloc(num_actions, sizeof(float));
+    for (int i = 0; i < num_actions; i++) {
+        net->std[i] = expf(net->log_std[i]);
+    }
+    init_packed_linear(&net->encoder, file, params[POLICY_ENCODER_W], params[POLICY_ENCODER_B],
+        num_agents, input_dim, NET_HIDDEN);
+    net->gelu1 = (float*)calloc(num_agents*NET_HIDDEN, sizeof(float));
+    init_packed_linear(&net->actor, file, params[POLICY_ACTOR_W], params[POLICY_ACTOR_B],
+        num_agents, NET_HIDDEN, num_actions);
+    init_packed_linear(&net->value_fn, file, params[POLICY_VALUE_W], params[POLICY_VALUE_B],
+        num_agents, NET_HIDDEN, 1);
+    init_packed_lstm(&net->lstm, file, params[POLICY_LSTM_IH_W], params[POLICY_LSTM_HH_W],
+        params[POLICY_LSTM_IH_B], params[POLICY_LSTM_HH_B], num_agents, NET_HIDDEN, NET_HIDDEN);
+    net->noise = (float*)calloc(num_agents*num_actions + 1, sizeof(float));
+    net->seed = (uint32_t)rand();
+    net->counter = 0;
+    return net;
+}
+
+// Slices a flat puffernet Weights buffer, which must outlive the net
+LinearContLSTM *make_linearcontlstm(Weights *weights, int num_agents, int input_dim,
+                                    int logit_sizes[], int num_actions) {
+    int atn_sum = 0;
+    for (int i = 0; i < num_actions; i++) {
+        atn_sum += logit_sizes[i];
+    }
+    WeightTensor t[POLICY_TENSORS];
+    const float *params[POLICY_TENSORS];
+    linearcontlstm_tensors(t, input_dim, atn_sum);
+    for (int i = 0; i < POLICY_TENSORS; i++) {
+        params[i] = get_weights(weights, t[i].nbytes / sizeof(float));
+    }
+    return init_linearcontlstm(NULL, params, num_agents, input_dim, atn_sum);
+}
+
+// Builds a net from a weight file, which must outlive the net. Its weight
+// panels are the file's, shared with every other net loaded from it. Returns
+// NULL if any tensor is missing or has the wrong shape.
+LinearContLSTM *load_linearcontlstm(WeightFile *file, int num_agents, int input_dim, int num_actions) {
+    const float *params[POLICY_TENSORS];
+    if (!linearcontlstm_params(file, params, input_dim, num_actions)) {
+        return NULL;
+    }
+    return init_linearcontlstm(file, params, num_agents, input_dim, num_actions);
+}
+void free_linearcontlstm(LinearContLSTM *net) {
+    free(net->std);
+    free_packed_linear(&net->encoder);
+    free(net->gelu1);
+    free_packed_lstm(&net->lstm);
+    free_packed_linear(&net->actor);
+    free_packed_linear(&net->value_fn);
+    free(net->noise);
+    free(net);
+}
+
+// observations: num_agents x input_dim, actions: num_agents x num_actions
+void forward_linearcontlstm(LinearContLSTM *net, float *observations, float *actions) {
+    int B = net->num_agents;
+    int A = net->num_actions;
+    packed_linear(&net->encoder, observations);
+    gelu_batch(net->gelu1, net->encoder.output, B*NET_HIDDEN);
+    packed_lstm(&net->lstm, net->gelu1);
+    packed_linear(&net->actor, net->lstm.state_h);
+    packed_linear(&net->value_fn, net->lstm.state_h);
+
+    randn_batch(net->noise, B*A, net->seed, net->counter);
+    net->counter += B*A + 1;
+    for (int b = 0; b < B; b++) {
+        for (int i = 0; i < A; i++) {
+            actions[b*A + i] = net->actor.output[b*A + i] + net->std[i] * net->noise[b*A + i];
+        }
+    }
+}
+
+// Int8 inference. Weights are quantized offline with one scale per output
+// channel; activations are quantized per agent on the fly. Dot products
+// run on int8 lanes and accumulate in int32, then a single multiply by the
+// two scales brings them back to float.
+
+#define QUANT_ALIGN WEIGHT_ALIGN // rows padded to one AVX-512 register
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+static inline int quant_pad(int k) { return (k + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN; }
+
+// Signed dot product of two int8 rows of length K, a multiple of QUANT_ALIGN.
+// The unsigned x signed instructions get |a| and sign(a)*b, which keeps the
+// products exact since both operands stay within [-127, 127].
+static inline int32_t dot_i8(const int8_t* a, const int8_t* b, int K) {
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    __m512i acc = _mm512_setzero_si512();
+    for (int k = 0; k < K; k += 64) {
+        __m512i va = _mm512_loadu_si512((const void*)(a + k));
+        __m512i vb = _mm512_loadu_si512((const void*)(b + k));
+        __mmask64 neg = _mm512_movepi8_mask(va);
+        __m512i sb = _mm512_mask_sub_epi8(vb, neg, _mm512_setzero_si512(), vb);
+        acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(va), sb);
+    }
+    return _mm512_reduce_add_epi32(acc);
+#elif defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (int k = 0; k < K; k += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + k));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + k));
+        __m256i prod = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(prod, ones));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum = 0;
+    for (int k = 0; k < K; k++) {
+        sum += (int32_t)a[k] * (int32_t)b[k];
+    }
+    return sum;
+#endif
+}
+
+static inline int8_t quantize_value(float x, float inv_scale) {
+    float q = x * inv_scale;
+    q = q > 127.0f ? 127.0f : q;
+    q = q < -127.0f ? -127.0f : q;
+    return (int8_t)(q + (q >= 0.0f ? 0.5f : -0.5f));
+}
+
+// Symmetric per row quantization of x[rows x K] into out[rows x K_pad]
+void quantize_rows(const float* x, int rows, int K, int K_pad, int8_t* out, float* scales) {
+    for (int r = 0; r < rows; r++) {
+        const float* row = &x[r*K];
+        float max_abs = 0.0f;
+        for (int k = 0; k < K; k++) {
+            float a = fabsf(row[k]);
+            max_abs = a > max_abs ? a : max_abs;
+        }
+        float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+        float inv_scale = 1.0f / scale;
+        int8_t* q = &out[r*K_pad];
+        for (int k = 0; k < K; k++) {
+            q[k] = quantize_value(row[k], inv_scale);
+        }
+        memset(q + K, 0, K_pad - K);
+        scales[r] = scale;
+    }
+}
+
+typedef struct {
+    const int8_t* weights; // output_dim x input_pad
+    const float* scales;   // output_dim
+    const float* bias;     // output_dim
+    float* output;         // batch_size x output_dim
+    int batch_size;
+    int input_dim;
+    int input_pad;
+    int output_dim;
+} QuantLinear;
+
+// y = (xq . wq) * x_scale * w_scale + bias, added onto output when accumulating
+void quant_linear(QuantLinear* layer, const int8_t* xq, const float* x_scales, bool accumulate) {
+    int N = layer->output_dim;
+    int K = layer->input_pad;
+    for (int b = 0; b < layer->batch_size; b++) {
+        const int8_t* x = &xq[b*K];
+        float* y = &layer->output[b*N];
+        for (int n = 0; n < N; n++) {
+            float v = (float)dot_i8(x, &layer->weights[n*K], K) * x_scales[b] * layer->scales[n] + layer->bias[n];
+            y[n] = accumulate ? y[n] + v : v;
+        }
+    }
+}
+
+typedef struct QuantLinearContLSTM QuantLinearContLSTM;
+struct QuantLinearContLSTM {
+    int num_agents;
+    int input_dim;
+    int num_actions;
+    const float *log_std;
+    float *std;
+    QuantLinear encoder;
+    float *gelu1;
+    QuantLinear lstm_input;
+    QuantLinear lstm_state;
+    float *state_h;
+    float *state_c;
+    QuantLinear actor;
+    QuantLinear value_fn;
+    int8_t *xq;      // per agent quantized activations
+    float *x_scales;
+    float *noise;
+    uint32_t seed;
+    uint32_t counter;
+};
+
+
+// Layers of the int8 file, each stored as <name>.weight (int8), .scale and .bias
+#define QUANT_LAYERS 5
+static const char* QUANT_LAYER_NAMES[QUANT_LAYERS] = {
+    "encoder", "actor", "value", "lstm.input", "lstm.state"
+};
+
+// Converts an fp32 policy to int8 with per channel scales. The LSTM input
+// projection carries both LSTM biases and the recurrent one carries none.
+int save_quantized_weights(const WeightFile* fp32, int input_dim, int num_actions, const char* path) {
+    const float* params[POLICY_TENSORS];
+    if (!linearcontlstm_params(fp32, params, input_dim, num_actions)) {
+        return -1;
+    }
+    int H = NET_HIDDEN;
+    float* gate_bias = (float*)malloc(4*H*sizeof(float));
+    float* zero_bias = (float*)calloc(4*H, sizeof(float));
+    for (int i = 0; i < 4*H; i++) {
+        gate_bias[i] = params[POLICY_LSTM_IH_B][i] + params[POLICY_LSTM_HH_B][i];
+    }
+    const float* weights[QUANT_LAYERS] = {params[POLICY_ENCODER_W], params[POLICY_ACTOR_W],
+        params[POLICY_VALUE_W], params[POLICY_LSTM_IH_W], params[POLICY_LSTM_HH_W]};
+    const float* biases[QUANT_LAYERS] = {params[POLICY_ENCODER_B], params[POLICY_ACTOR_B],
+        params[POLICY_VALUE_B], gate_bias, zero_bias};
+    int rows[QUANT_LAYERS] = {H, num_actions, 1, 4*H, 4*H};
+    int cols[QUANT_LAYERS] = {input_dim, H, H, H, H};
+
+    WeightTensor t[1 + 3*QUANT_LAYERS];
+    const void* srcs[1 + 3*QUANT_LAYERS];
+    void* buffers[2*QUANT_LAYERS];
+    t[0] = weight_tensor_desc("log_std", WEIGHT_F32, num_actions, 0);
+    srcs[0] = params[POLICY_LOG_STD];
+    for (int l = 0; l < QUANT_LAYERS; l++) {
+        int8_t* q = (int8_t*)malloc(rows[l]*quant_pad(cols[l]));
+        float* scales = (float*)malloc(rows[l]*sizeof(float));
+        quantize_rows(weights[l], rows[l], cols[l], quant_pad(cols[l]), q, scales);
+        buffers[2*l] = q;
+        buffers[2*l + 1] = scales;
+
+        char name[WEIGHT_NAME_LEN];
+        snprintf(name, WEIGHT_NAME_LEN, "%s.weight", QUANT_LAYER_NAMES[l]);
+        t[1 + 3*l] = weight_tensor_desc(name, WEIGHT_I8, rows[l], cols[l]);
+        snprintf(name, WEIGHT_NAME_LEN, "%s.scale", QUANT_LAYER_NAMES[l]);
+        t[2 + 3*l] = weight_tensor_desc(name, WEIGHT_F32, rows[l], 0);
+        snprintf(name, WEIGHT_NAME_LEN, "%s.bias", QUANT_LAYER_NAMES[l]);
+        t[3 + 3*l] = weight_tensor_desc(name, WEIGHT_F32, rows[l], 0);
+        srcs[1 + 3*l] = q;
+        srcs[2 + 3*l] = scales;
+        srcs[3 + 3*l] = biases[l];
+    }
+    int err = write_weight_file(path, t, srcs, 1 + 3*QUANT_LAYERS, WEIGHT_ALIGN);
+
+    for (int i = 0; i < 2*QUANT_LAYERS; i++) {
+        free(buffers[i]);
+    }
+    free(gate_bias);
+    free(zero_bias);
+    return err;
+}
+
+// Points the layer at its int8 weights, scales and bias inside the file
+static bool load_quant_linear(const WeightFile* file, const char* layer_name, QuantLinear* layer,
+        int batch_size, int N, int K) {
+    char name[WEIGHT_NAME_LEN];
+    snprintf(name, WEIGHT_NAME_LEN, "%s.weight", layer_name);
+    layer->weights = (const int8_t*)weight_tensor(file, name, WEIGHT_I8, N, K);
+    snprintf(name, WEIGHT_NAME_LEN, "%s.scale", layer_name);
+    layer->scales = (const float*)weight_tensor(file, name, WEIGHT_F32, N, 0);
+    snprintf(name, WEIGHT_NAME_LEN, "%s.bias", layer_name);
+    layer->bias = (const float*)weight_tensor(file, name, WEIGHT_F32, N, 0);
+    layer->batch_size = batch_size;
+    layer->input_dim = K;
+    layer->input_pad = quant_pad(K);
+    layer->output_dim = N;
+    layer->output = (float*)calloc(batch_size*N, sizeof(float));
+    return layer->weights != NULL && layer->scales != NULL && layer->bias != NULL;
+}
+
+void free_quant_linearcontlstm(QuantLinearContLSTM *net) {
+    free(net->std);
+    free(net->encoder.output);
+    free(net->gelu1);
+    if (net->lstm_state.output != net->lstm_input.output) {
+        free(net->lstm_state.output);
+    }
+    free(net->lstm_input.output);
+    free(net->state_h);
+    free(net->state_c);
+    free(net->actor.output);
+    free(net->value_fn.output);
+    free(net->xq);
+    free(net->x_scales);
+    free(net->noise);
+    free(net);
+}
+
+// Builds an int8 net from a file written by save_quantized_weights, which
+// must outlive the net
+QuantLinearContLSTM *load_quant_linearcontlstm(const WeightFile* file, int num_agents, int input_dim, int num_actions) {
+    int H = NET_HIDDEN;
+    QuantLinearContLSTM *net = calloc(1, sizeof(QuantLinearContLSTM));
+    net->num_agents = num_agents;
+    net->input_dim = input_dim;
+    net->num_actions = num_actions;
+    net->log_std = (const float*)weight_tensor(file, "log_std", WEIGHT_F32, num_actions, 0);
+    bool ok = net->log_std != NULL;
+    ok = load_quant_linear(file, "encoder", &net->encoder, num_agents, H, input_dim) && ok;
+    ok = load_quant_linear(file, "actor", &net->actor, num_agents, num_actions, H) && ok;
+    ok = load_quant_linear(file, "value", &net->value_fn, num_agents, 1, H) && ok;
+    ok = load_quant_linear(file, "lstm.input", &net->lstm_input, num_agents, 4*H, H) && ok;
+    ok = load_quant_linear(file, "lstm.state", &net->lstm_state, num_agents, 4*H, H) && ok;
+    if (!ok) {
+        free_quant_linearcontlstm(net);
+        return NULL;
+    }
+    net->std = (float*)malloc(num_actions*sizeof(float));
+    for (int i = 0; i < num_actions; i++) {
+        net->std[i] = expf(net->log_std[i]);
+    }
+
+    // Recurrent projection accumulates into the input projection's gates
+    free(net->lstm_state.output);
+    net->lstm_state.output = net->lstm_input.output;
+
+    int max_pad = quant_pad(input_dim > H ? input_dim : H);
+    net->gelu1 = (float*)calloc(num_agents*H, sizeof(float));
+    net->state_h = (float*)calloc(num_agents*H, sizeof(float));
+    net->state_c = (float*)calloc(num_agents*H, sizeof(float));
+    net->xq = (int8_t*)calloc(num_agents*max_pad, 1);
+    net->x_scales = (float*)calloc(num_agents, sizeof(float));
+    net->noise = (float*)calloc(num_agents*num_actions + 1, sizeof(float));
+    net->seed = (uint32_t)rand();
+    return net;
+}
+
+void forward_quant_linearcontlstm(QuantLinearContLSTM *net, float *observations, float *actions) {
+    int B = net->num_agents;
+    int H = NET_HIDDEN;
+    int A = net->num_actions;
+
+    quantize_rows(observations, B, net->input_dim, net->encoder.input_pad, net->xq, net->x_scales);
+    quant_linear(&net->encoder, net->xq, net->x_scales, false);
+    gelu_batch(net->gelu1, net->encoder.output, B*H);
+
+    quantize_rows(net->gelu1, B, H, net->lstm_input.input_pad, net->xq, net->x_scales);
+    quant_linear(&net->lstm_input, net->xq, net->x_scales, false);
+    quantize_rows(net->state_h, B, H, net->lstm_state.input_pad, net->xq, net->x_scales);
+    quant_linear(&net->lstm_state, net->xq, net->x_scales, true);
+
+    for (int b = 0; b < B; b++) {
+        const float* g = &net->lstm_input.output[b*4*H];
+        float* h = &net->state_h[b*H];
+        float* c = &net->state_c[b*H];
+        for (int i = 0; i < H; i++) {
+            float in_gate = fast_sigmoid(g[i]);
+            float forget_gate = fast_sigmoid(g[H + i]);
+            float cell_gate = fast_tanh(g[2*H + i]);
+            float out_gate = fast_sigmoid(g[3*H + i]);
+            c[i] = forget_gate * c[i] + in_gate * cell_gate;
+            h[i] = out_gate * fast_tanh(c[i]);
+        }
+    }
+
+    quantize_rows(net->state_h, B, H, net->actor.input_pad, net->xq, net->x_scales);
+    quant_linear(&net->actor, net->xq, net->x_scales, false);
+    quant_linear(&net->value_fn, net->xq, net->x_scales, false);
+
+    randn_batch(net->noise, B*A, net->seed, net->counter);
+    net->counter += B*A + 1;
+    for (int b = 0; b < B; b++) {
+        for (int i = 0; i < A; i++) {
+            actions[b*A + i] = net->actor.output[b*A + i] + net->std[i] * net->noise[b*A + i];
+        }
+    }
+}
@@ -0,0 +1,451 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Model predictive path integral (MPPI) planner for DroneRace, a non-learned
+// baseline and a teacher for distillation. Every decision flies the geometric
+// expert over the horizon from the env's state, perturbs its actions with
+// gaussian noise into samples candidates, scores them as c_rollout would on
+// the env's own dynamics, wind and rings, and flies the first action of the
+// candidates' average weighted by exp(-(cost - min cost) / temperature).
+//
+// The expert is the nominal plan rather than the last decision's shifted
+// average: over a horizon too short to reach the next ring the costs barely
+// tell candidates apart, and a warm started plan drifts into hovering.
+//
+// Sampling and rollouts are split across threads, the calling thread taking
+// the first share, with a persistent pool so a decision costs no thread
+// creation. Each thread flies its share in lockstep under one copy of the
+// wind, which no candidate's actions change, and scores a step of all of
+// them in one pass over per candidate arrays, a register of candidates at a
+// time.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Planner Planner;
+
+typedef struct {
+    Planner* planner;
+    int id;
+    uint32_t rng; // this worker's candidate noise
+    pthread_t thread;
+
+    // The share being flown, one slot per candidate, see plan_rollouts
+    int share; // slots, a multiple of PLAN_LANES
+    Drone* drones;
+    float* pos; // (3, share), x, y and z rows, after the step
+    float* prev; // (3, share), before it
+    int* ring_idx;
+    int* live; // 0 once the candidate's episode would have ended
+    float* reward;
+} PlanWorker;
+
+struct Planner {
+    int horizon;
+    int samples;
+    int threads;
+    float temperature;
+    float noise; // std of the action perturbations
+    float dist_weight; // see c_rollout
+    float* candidates; // (samples, horizon, 4)
+    float* costs; // (samples,)
+    float* expert; // (horizon, 4), the nominal plan
+    PlanWorker* workers;
+
+    // Current decision, handed to the pool under lock
+    DroneRace* env;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    long generation;
+    int pending;
+    bool closing;
+};
+
+void close_planner(Planner* p);
+
+// Standard normal sample, Box-Muller on the worker's stream
+static inline float plan_normal(uint32_t* rng) {
+    float u1 = 1.0f - rng_uniform(rng, 0.0f, 1.0f);
+    float u2 = rng_uniform(rng, 0.0f, 1.0f);
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+// Flies the geometric expert closed loop from env's state over the horizon
+// on copies of the drone and wind, recording its actions into p->expert.
+// Replaying them open loop retraces the same path, so the expert is always
+// among the candidates.
+static void plan_expert(Planner* p, DroneRace* env) {
+    Drone drone = env->agents[0];
+    drone.tape = (Tape){0};
+    drone.recording = false;
+    WindField wind = env->wind;
+    if (drone.params.wind != NULL) {
+        drone.params.wind = &wind;
+    }
+    int ring_idx = env->ring_idx[0];
+    for (int t = 0; t < p->horizon; t++) {
+        Vec3 pos_d, vel_d;
+        float* action = &p->expert[t * 4];
+        ring_waypoint(&drone, &env->ring_buffer[ring_idx % env->max_rings], &pos_d, &vel_d);
+        expert_action(&drone, pos_d, vel_d, action);
+        if (wind.nodes != NULL) {
+            advance_wind(&wind, DT);
+        }
+        move_drone(&drone, action);
+        if (check_ring(&drone, &env->ring_buffer[ring_idx % env->max_rings]) > 0.0f) {
+            ring_idx++;
+            drone.target_pos = env->ring_buffer[ring_idx % env->max_rings].pos;
+        }
+        drone.prev_pos = drone.state.pos;
+    }
+}
+
+#define PLAN_LANES 4 // candidates scored side by side, one SSE register
+
+#if defined(__SSE2__)
+static inline __m128 plan_dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// Lanes of a where mask is set, of b elsewhere
+static inline __m128 plan_select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Lanes where a < b + offset, compared in double as check_ring does
+static inline __m128 plan_under(__m128 a, __m128 b, double offset) {
+    __m128d off = _mm_set1_pd(offset);
+    __m128d lo = _mm_cmplt_pd(_mm_cvtps_pd(a), _mm_add_pd(_mm_cvtps_pd(b), off));
+    __m128d hi = _mm_cmplt_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)),
+        _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(b, b)), off));
+    return _mm_shuffle_ps(_mm_castpd_ps(lo), _mm_castpd_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+}
+#endif
+
+// Scores one step of n candidates, n a multiple of PLAN_LANES and the rows
+// of pos and prev stride apart: bounds, the distance reward and the ring
+// each is flying at, with c_rollout's arithmetic and without its branches,
+// so a register of candidates is scored at once. Auto vectorization gives
+// up on the sqrts and divides at the default math flags, so the lanes are
+// written out as in sample_wind. A racer's target is always the ring it is
+// flying at, so that is where the distance is taken from. Candidates whose
+// episode ends stop being live, ones that pass their ring turn to the next.
+// Returns how many are live.
+static int plan_score(int n, int stride, const float* pos, const float* prev, float* reward,
+        int* ring_idx, int* live, const Ring* rings, int max_rings, float dist_weight,
+        bool timeout) {
+    const float* x = pos;
+    const float* y = pos + stride;
+    const float* z = pos + 2 * stride;
+    const float* px = prev;
+    const float* py = prev + stride;
+    const float* pz = prev + 2 * stride;
+#if defined(__SSE2__)
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128i still = _mm_setzero_si128();
+    for (int k = 0; k < n; k += PLAN_LANES) {
+        const Ring* r0 = &rings[ring_idx[k]];
+        const Ring* r1 = &rings[ring_idx[k + 1]];
+        const Ring* r2 = &rings[ring_idx[k + 2]];
+        const Ring* r3 = &rings[ring_idx[k + 3]];
+        #define PLAN_RING(f) _mm_setr_ps(r0->f, r1->f, r2->f, r3->f)
+        __m128 rx = PLAN_RING(pos.x), ry = PLAN_RING(pos.y), rz = PLAN_RING(pos.z);
+        __m128 nx = PLAN_RING(normal.x), ny = PLAN_RING(normal.y), nz = PLAN_RING(normal.z);
+        __m128 radius = PLAN_RING(radius);
+        #undef PLAN_RING
+        __m128 cx = _mm_loadu_ps(&x[k]), cy = _mm_loadu_ps(&y[k]), cz = _mm_loadu_ps(&z[k]);
+        __m128 qx = _mm_loadu_ps(&px[k]), qy = _mm_loadu_ps(&py[k]), qz = _mm_loadu_ps(&pz[k]);
+        __m128 oob = _mm_or_ps(_mm_cmplt_ps(cx, _mm_set1_ps(-GRID_X)), _mm_cmpgt_ps(cx, _mm_set1_ps(GRID_X)));
+        oob = _mm_or_ps(oob, _mm_or_ps(_mm_cmplt_ps(cy, _mm_set1_ps(-GRID_Y)), _mm_cmpgt_ps(cy, _mm_set1_ps(GRID_Y))));
+        oob = _mm_or_ps(oob, _mm_or_ps(_mm_cmplt_ps(cz, _mm_set1_ps(-GRID_Z)), _mm_cmpgt_ps(cz, _mm_set1_ps(GRID_Z))));
+        __m128 ex = _mm_sub_ps(cx, rx), ey = _mm_sub_ps(cy, ry), ez = _mm_sub_ps(cz, rz);
+        __m128 dist = _mm_mul_ps(_mm_set1_ps(dist_weight), _mm_sub_ps(one,
+            _mm_div_ps(_mm_sqrt_ps(plan_dot(ex, ey, ez, ex, ey, ez)), _mm_set1_ps(MAX_DIST))));
+
+        // check_ring
+        __m128 prev_dot = plan_dot(_mm_sub_ps(qx, rx), _mm_sub_ps(qy, ry), _mm_sub_ps(qz, rz), nx, ny, nz);
+        __m128 new_dot = plan_dot(ex, ey, ez, nx, ny, nz);
+        __m128 valid_dir = _mm_and_ps(_mm_cmplt_ps(prev_dot, zero), _mm_cmpgt_ps(new_dot, zero));
+        __m128 crossed = _mm_or_ps(valid_dir,
+            _mm_and_ps(_mm_cmpgt_ps(prev_dot, zero), _mm_cmplt_ps(new_dot, zero)));
+        __m128 dx = _mm_sub_ps(cx, qx), dy = _mm_sub_ps(cy, qy), dz = _mm_sub_ps(cz, qz);
+        __m128 t = _mm_div_ps(_mm_xor_ps(prev_dot, _mm_set1_ps(-0.0f)), plan_dot(nx, ny, nz, dx, dy, dz));
+        __m128 hx = _mm_sub_ps(_mm_add_ps(qx, _mm_mul_ps(dx, t)), rx);
+        __m128 hy = _mm_sub_ps(_mm_add_ps(qy, _mm_mul_ps(dy, t)), ry);
+        __m128 hz = _mm_sub_ps(_mm_add_ps(qz, _mm_mul_ps(dz, t)), rz);
+        __m128 miss = _mm_sqrt_ps(plan_dot(hx, hy, hz, hx, hy, hz));
+        __m128 through = _mm_and_ps(valid_dir, plan_under(miss, radius, -0.5));
+        __m128 clipped = _mm_andnot_ps(through, _mm_and_ps(crossed, plan_under(miss, radius, 0.5)));
+        __m128 passed = _mm_or_ps(_mm_and_ps(through, one), _mm_and_ps(clipped, _mm_set1_ps(-1.0f)));
+
+        // a set mask is -1, so subtracting through adds the ring passed
+        __m128i idx = _mm_loadu_si128((const __m128i*)&ring_idx[k]);
+        __m128i next = _mm_sub_epi32(idx, _mm_castps_si128(through));
+        __m128i ends = _mm_or_si128(_mm_castps_si128(_mm_or_ps(oob, clipped)),
+            _mm_or_si128(_mm_cmpeq_epi32(next, _mm_set1_epi32(max_rings)), _mm_set1_epi32(-(int)timeout)));
+        __m128i was = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)&live[k]), _mm_setzero_si128());
+        __m128i go_on = _mm_andnot_si128(ends, was);
+        __m128 r = _mm_loadu_ps(&reward[k]);
+        __m128 stepped = plan_select(oob, _mm_sub_ps(r, one), _mm_add_ps(_mm_add_ps(r, dist), passed));
+        _mm_storeu_ps(&reward[k], plan_select(_mm_castsi128_ps(was), stepped, r));
+        _mm_storeu_si128((__m128i*)&ring_idx[k],
+            _mm_or_si128(_mm_and_si128(go_on, next), _mm_andnot_si128(go_on, idx)));
+        _mm_storeu_si128((__m128i*)&live[k], _mm_srli_epi32(go_on, 31));
+        still = _mm_sub_epi32(still, go_on);
+    }
+    int lanes[PLAN_LANES];
+    _mm_storeu_si128((__m128i*)lanes, still);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        const Ring* ring = &rings[ring_idx[k]];
+        bool oob = (x[k] < -GRID_X) | (x[k] > GRID_X) | (y[k] < -GRID_Y) | (y[k] > GRID_Y)
+            | (z[k] < -GRID_Z) | (z[k] > GRID_Z);
+        float ex = x[k] - ring->pos.x, ey = y[k] - ring->pos.y, ez = z[k] - ring->pos.z;
+        float dist = dist_weight * (1.0f - sqrtf(ex * ex + ey * ey + ez * ez) / MAX_DIST);
+
+        // check_ring
+        float nx = ring->normal.x, ny = ring->normal.y, nz = ring->normal.z;
+        float prev_dot = (px[k] - ring->pos.x) * nx + (py[k] - ring->pos.y) * ny
+            + (pz[k] - ring->pos.z) * nz;
+        float new_dot = ex * nx + ey * ny + ez * nz;
+        bool valid_dir = (prev_dot < 0.0f) & (new_dot > 0.0f);
+        bool crossed = valid_dir | ((prev_dot > 0.0f) & (new_dot < 0.0f));
+        float dx = x[k] - px[k], dy = y[k] - py[k], dz = z[k] - pz[k];
+        float t = -prev_dot / (nx * dx + ny * dy + nz * dz);
+        float hx = (px[k] + dx * t) - ring->pos.x;
+        float hy = (py[k] + dy * t) - ring->pos.y;
+        float hz = (pz[k] + dz * t) - ring->pos.z;
+        float miss = sqrtf(hx * hx + hy * hy + hz * hz);
+        bool through = valid_dir & (miss < (ring->radius - 0.5));
+        bool clipped = crossed & !through & (miss < ring->radius + 0.5);
+        float passed = through ? 1.0f : (clipped ? -1.0f : 0.0f);
+
+        int next = ring_idx[k] + through;
+        bool ends = oob | clipped | (next == max_rings) | timeout;
+        int go_on = live[k] & !ends;
+        float stepped = oob ? reward[k] - 1.0f : reward[k] + dist + passed;
+        reward[k] = live[k] ? stepped : reward[k];
+        ring_idx[k] = go_on ? next : ring_idx[k];
+        live[k] = go_on;
+        count += go_on;
+    }
+    return count;
+#endif
+}
+
+// Flies candidates lo to hi of p in lockstep from racer 0's state and
+// writes their costs, the same as c_rollout gives them. The wind is
+// advanced once per step for all of them, and plan_score scores each step.
+static void plan_rollouts(Planner* p, PlanWorker* w, int lo, int hi) {
+    DroneRace* env = p->env;
+    int n = hi - lo;
+    int s = w->share;
+    WindField wind = env->wind;
+    for (int k = 0; k < n; k++) {
+        Drone* drone = &w->drones[k];
+        *drone = env->agents[0];
+        drone->tape = (Tape){0};
+        drone->recording = false;
+        if (drone->params.wind != NULL) {
+            drone->params.wind = &wind;
+        }
+        w->ring_idx[k] = env->ring_idx[0];
+        w->live[k] = 1;
+        w->reward[k] = 0.0f;
+    }
+    // slots past the last candidate fill out the last register, never live
+    int lanes = (n + PLAN_LANES - 1) / PLAN_LANES * PLAN_LANES;
+    for (int k = n; k < lanes; k++) {
+        w->ring_idx[k] = 0;
+        w->live[k] = 0;
+        w->reward[k] = 0.0f;
+    }
+    int live = n;
+    for (int t = 0; t < p->horizon && live > 0; t++) {
+        if (wind.nodes != NULL) {
+            advance_wind(&wind, DT);
+        }
+        for (int k = 0; k < n; k++) {
+            if (!w->live[k]) {
+                continue;
+            }
+            Drone* drone = &w->drones[k];
+            float atn[4];
+            memcpy(atn, &p->candidates[((size_t)(lo + k) * p->horizon + t) * 4], sizeof(atn));
+            w->prev[k] = drone->state.pos.x;
+            w->prev[s + k] = drone->state.pos.y;
+            w->prev[2 * s + k] = drone->state.pos.z;
+            move_drone(drone, atn);
+            w->pos[k] = drone->state.pos.x;
+            w->pos[s + k] = drone->state.pos.y;
+            w->pos[2 * s + k] = drone->state.pos.z;
+        }
+        live = plan_score(lanes, s, w->pos, w->prev, w->reward, w->ring_idx, w->live,
+            env->ring_buffer, env->max_rings, p->dist_weight, env->moves_left - (t + 1) == 0);
+    }
+    for (int k = 0; k < n; k++) {
+        p->costs[lo + k] = -w->reward[k];
+    }
+}
+
+// Samples and scores worker w's share of the candidates. Candidate 0 is the
+// unperturbed expert, so the update never loses it.
+static void plan_candidates(Planner* p, PlanWorker* w) {
+    int lo = (int)((long)p->samples * w->id / p->threads);
+    int hi = (int)((long)p->samples * (w->id + 1) / p->threads);
+    int n = p->horizon * 4;
+    for (int k = lo; k < hi; k++) {
+        float* c = &p->candidates[(size_t)k * n];
+        for (int i = 0; i < n; i++) {
+            float eps = k == 0 ? 0.0f : p->noise * plan_normal(&w->rng);
+            c[i] = clampf(p->expert[i] + eps, -1.0f, 1.0f);
+        }
+    }
+    plan_rollouts(p, w, lo, hi);
+}
+
+static void free_worker(PlanWorker* w) {
+    arena_free(w->drones);
+    free(w->pos);
+    free(w->prev);
+    free(w->ring_idx);
+    free(w->live);
+    free(w->reward);
+}
+
+static void* plan_worker_thread(void* arg) {
+    PlanWorker* w = (PlanWorker*)arg;
+    Planner* p = w->planner;
+    long seen = 0;
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->generation == seen && !p->closing) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        if (p->closing) {
+            break;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+        plan_candidates(p, w);
+        pthread_mutex_lock(&p->lock);
+        if (--p->pending == 0) {
+            pthread_cond_signal(&p->done);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Starts a planner using threads threads in total. Returns NULL on bad sizes
+// or if a thread could not be started.
+Planner* open_planner(int horizon, int samples, int threads, float temperature, float noise,
+        float dist_weight) {
+    if (horizon <= 0 || samples <= 0 || threads <= 0 || temperature <= 0.0f) {
+        return NULL;
+    }
+    Planner* p = (Planner*)calloc(1, sizeof(Planner));
+    p->horizon = horizon;
+    p->samples = samples;
+    p->threads = threads;
+    p->temperature = temperature;
+    p->noise = noise;
+    p->dist_weight = dist_weight;
+    p->candidates = (float*)calloc((size_t)samples * horizon * 4, sizeof(float));
+    p->costs = (float*)calloc(samples, sizeof(float));
+    p->expert = (float*)calloc((size_t)horizon * 4, sizeof(float));
+    p->workers = (PlanWorker*)calloc(threads, sizeof(PlanWorker));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    int share = (samples + threads - 1) / threads;
+    share = (share + PLAN_LANES - 1) / PLAN_LANES * PLAN_LANES; // whole registers
+    for (int t = 0; t < threads; t++) {
+        PlanWorker* w = &p->workers[t];
+        *w = (PlanWorker){.planner = p, .id = t, .rng = rng_seed(), .share = share};
+        w->drones = alloc_drones(share);
+        w->pos = (float*)calloc(3 * share, sizeof(float));
+        w->prev = (float*)calloc(3 * share, sizeof(float));
+        w->ring_idx = (int*)calloc(share, sizeof(int));
+        w->live = (int*)calloc(share, sizeof(int));
+        w->reward = (float*)calloc(share, sizeof(float));
+    }
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&p->workers[t].thread, NULL, plan_worker_thread, &p->workers[t]) != 0) {
+            for (int u = t; u < threads; u++) {
+                free_worker(&p->workers[u]);
+            }
+            p->threads = t; // only join the ones running
+            close_planner(p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+// Plans one decision for env and writes the action to fly into action
+void plan_action(Planner* p, DroneRace* env, float* action) {
+    plan_expert(p, env);
+    p->env = env;
+    if (p->threads > 1) {
+        pthread_mutex_lock(&p->lock);
+        p->pending = p->threads - 1;
+        p->generation++;
+        pthread_cond_broadcast(&p->start);
+        pthread_mutex_unlock(&p->lock);
+    }
+    plan_candidates(p, &p->workers[0]);
+    if (p->threads > 1) {
+        pthread_mutex_lock(&p->lock);
+        while (p->pending > 0) {
+            pthread_cond_wait(&p->done, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    float best = p->costs[0];
+    for (int k = 1; k < p->samples; k++) {
+        best = p->costs[k] < best ? p->costs[k] : best;
+    }
+    float total = 0.0f;
+    float mean[4] = {0};
+    for (int k = 0; k < p->samples; k++) {
+        float w = expf((best - p->costs[k]) / p->temperature);
+        const float* c = &p->candidates[(size_t)k * p->horizon * 4];
+        total += w;
+        for (int j = 0; j < 4; j++) {
+            mean[j] += w * c[j];
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        action[j] = mean[j] / total;
+    }
+}
+
+void close_planner(Planner* p) {
+    pthread_mutex_lock(&p->lock);
+    p->closing = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (int t = 1; t < p->threads; t++) {
+        pthread_join(p->workers[t].thread, NULL);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+    for (int t = 0; t < p->threads; t++) {
+        free_worker(&p->workers[t]);
+    }
+    free(p->candidates);
+    free(p->costs);
+    free(p->expert);
+    free(p->workers);
+    free(p);
+}
@@ -0,0 +1,45 @@
+// Native policy evaluation for DroneRace
+// Compile using: ./scripts/build_ocean.sh drone [local|fast], with eval.c as the entry point and -lpthread
+// Run with: ./eval weights.bin [num_envs] [episodes] [threads] [racers]
+//
+// Flies num_envs races of racers drones each, 1 by default, on a thread pool
+// with batched inference for enough rounds to finish the requested number of
+// episodes, then prints each metric with a 95% confidence interval. No
+// window is opened.
+
+#include "drone_race.h"
+
+#define Env DroneRace
+#include "drone_eval.h"
+
+static DroneRace *eval_make_env(int agents) {
+    DroneRace *env = arena_calloc(1, sizeof(DroneRace));
+    env->num_agents = agents; // init reads 0 as 1
+    env->max_moves = 1000;
+    env->max_rings = 10;
+    return env;
+}
+
+static int eval_num_agents(DroneRace *env) {
+    return env->num_agents;
+}
+
+static int eval_obs_size(DroneRace *env) {
+    return race_obs_size(env);
+}
+
+// log.score is cleared every step, rings_passed keeps every episode's rings
+static void eval_metrics(DroneRace *env, double *sums) {
+    sums[EVAL_PERF] = env->log.perf;
+    sums[EVAL_RINGS] = env->log.rings_passed;
+    sums[EVAL_COLLISION] = env->log.collision_rate;
+    sums[EVAL_OOB] = env->log.oob;
+    sums[EVAL_TIMEOUT] = env->log.timeout;
+    sums[EVAL_RETURN] = env->log.episode_return;
+    sums[EVAL_LENGTH] = env->log.episode_length;
+    sums[EVAL_EPISODES] = env->log.n;
+}
+
+int main(int argc, char **argv) {
+    return eval_main(argc, argv);
+}
@@ -0,0 +1,143 @@
+// Offline int8 quantizer and accuracy check for the DroneRace policy
+// Compile using: ./scripts/build_ocean.sh drone [local|fast], with quantize.c as the entry point
+// Run with: ./quantize weights.bin weights_int8.bin [observations.bin]
+//
+// Converts an fp32 policy (weight file or raw trainer output) to an int8
+// weight file with per channel scales, then
+// replays recorded observations through both the fp32 and int8 policies and
+// reports how far the int8 action means and values drift. Observations are a
+// raw float32 [steps x obs_size] file; without one, a trajectory is recorded
+// by flying DroneRace with the fp32 policy.
+
+#include "drone_race.h"
+#include "dronenet.h"
+#include <time.h>
+
+#define OBS_SIZE 29
+#define ACT_SIZE 4
+#define RECORD_STEPS 4096
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static float *record_observations(LinearContLSTM *net, int steps) {
+    DroneRace *env = calloc(1, sizeof(DroneRace));
+    env->max_moves = 1000;
+    env->max_rings = 10;
+    env->observations = (float *)calloc(OBS_SIZE, sizeof(float));
+    env->actions = (float *)calloc(ACT_SIZE, sizeof(float));
+    env->rewards = (float *)calloc(1, sizeof(float));
+    env->terminals = (unsigned char *)calloc(1, sizeof(unsigned char));
+    init(env);
+    c_reset(env);
+
+    float *obs = (float *)malloc(steps * OBS_SIZE * sizeof(float));
+    for (int t = 0; t < steps; t++) {
+        memcpy(&obs[t * OBS_SIZE], env->observations, OBS_SIZE * sizeof(float));
+        forward_linearcontlstm(net, env->observations, env->actions);
+        c_step(env);
+    }
+
+    c_close(env);
+    free(env->observations);
+    free(env->actions);
+    free(env->rewards);
+    free(env->terminals);
+    free(env);
+    return obs;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s weights.bin weights_int8.bin [observations.bin]\n", argv[0]);
+        return 1;
+    }
+    srand(time(NULL));
+
+    WeightFile *weights = open_policy_weights(argv[1], 0, ACT_SIZE);
+    if (weights == NULL || !verify_weight_file(weights, argv[1])) {
+        return 1;
+    }
+    int input_dim = policy_input_dim(weights);
+    if (save_quantized_weights(weights, input_dim, ACT_SIZE, argv[2]) != 0) {
+        fprintf(stderr, "Error writing %s\n", argv[2]);
+        return 1;
+    }
+    printf("Quantized %s (%d inputs) to %s\n", argv[1], input_dim, argv[2]);
+
+    // Accuracy check over a recorded trajectory
+    LinearContLSTM *net = load_linearcontlstm(weights, 1, input_dim, ACT_SIZE);
+    WeightFile *qweights = open_weight_file(argv[2]);
+    QuantLinearContLSTM *qnet = NULL;
+    if (qweights != NULL && verify_weight_file(qweights, argv[2])) {
+        qnet = load_quant_linearcontlstm(qweights, 1, input_dim, ACT_SIZE);
+    }
+    if (qnet == NULL) {
+        return 1;
+    }
+
+    float *obs = NULL;
+    int steps = 0;
+    if (argc > 3) {
+        FILE *file = fopen(argv[3], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Error opening file %s\n", argv[3]);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        steps = ftell(file) / (input_dim * sizeof(float));
+        rewind(file);
+        obs = (float *)malloc(steps * input_dim * sizeof(float));
+        steps = fread(obs, input_dim * sizeof(float), steps, file);
+        fclose(file);
+    } else if (input_dim == OBS_SIZE) {
+        steps = RECORD_STEPS;
+        obs = record_observations(net, steps);
+        free_linearcontlstm(net);
+        net = load_linearcontlstm(weights, 1, input_dim, ACT_SIZE);
+    } else {
+        fprintf(stderr, "Weights expect %d inputs but DroneRace observes %d, "
+            "pass recorded observations to check accuracy\n", input_dim, OBS_SIZE);
+        return 1;
+    }
+
+    // Both policies see the same observations so their LSTM states track
+    float actions[ACT_SIZE];
+    double max_err = 0.0, sum_err = 0.0, max_value_err = 0.0;
+    double fp32_time = 0.0, int8_time = 0.0;
+    for (int t = 0; t < steps; t++) {
+        float *o = &obs[t * input_dim];
+        double start = now_sec();
+        forward_linearcontlstm(net, o, actions);
+        fp32_time += now_sec() - start;
+
+        start = now_sec();
+        forward_quant_linearcontlstm(qnet, o, actions);
+        int8_time += now_sec() - start;
+
+        for (int i = 0; i < ACT_SIZE; i++) {
+            double err = fabs(net->actor.output[i] - qnet->actor.output[i]);
+            max_err = err > max_err ? err : max_err;
+            sum_err += err;
+        }
+        double value_err = fabs(net->value_fn.output[0] - qnet->value_fn.output[0]);
+        max_value_err = value_err > max_value_err ? value_err : max_value_err;
+    }
+
+    printf("Steps: %d\n", steps);
+    printf("Action mean abs error: %.5f (max %.5f, policy std %.4f)\n",
+        sum_err / (steps * ACT_SIZE), max_err, net->std[0]);
+    printf("Value max abs error: %.5f\n", max_value_err);
+    printf("Latency per step: fp32 %.2f us, int8 %.2f us\n",
+        1e6 * fp32_time / steps, 1e6 * int8_time / steps);
+
+    free(obs);
+    free_linearcontlstm(net);
+    free_quant_linearcontlstm(qnet);
+    close_weight_file(weights);
+    close_weight_file(qweights);
+    return 0;
+}
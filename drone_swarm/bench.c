@@ -0,0 +1,112 @@
+// Formation assignment benchmark for DroneSwarm
+// Compile using: ./scripts/build_ocean.sh drone [local|fast], with bench.c as the entry point
+// Run with: ./bench [repeats]
+//
+// Spawns swarms of each size as reset_agent does, lays out every formation
+// for them and matches the agents to its slots with the auction, the work
+// set_targets does at each episode reset. Reports the median and worst time
+// per assignment, whether every slot went to exactly one agent, and the
+// mean squared distance to the slots against handing them out by index.
+
+#include "drone_swarm.h"
+
+#define FORM_BENCH_SIZE_COUNT 3
+const int FORM_BENCH_SIZES[FORM_BENCH_SIZE_COUNT] = {64, 1024, 4096};
+#define FORM_BENCH_SHAPES 4
+const char* FORM_BENCH_NAMES[FORM_BENCH_SHAPES] = {"grid", "sphere", "flag", "text"};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// The layouts set_targets uses for the cube, orbit, flag and text tasks
+static void lay_out(Formation* f, int shape) {
+    if (shape == 0) {
+        formation_grid(f, 4.0f);
+    } else if (shape == 1) {
+        formation_sphere(f, 8.0f);
+    } else if (shape == 2) {
+        formation_bitmap(f, flag_color, 2.0f);
+    } else {
+        formation_text(f, FORMATION_TEXT, 1.0f);
+    }
+}
+
+// Mean squared distance from each agent to the slot slot_of gives it
+static double mean_sq_dist(const Formation* f, const Drone* agents, const int* slot_of, int n) {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        Vec3 d = sub3(slot_pos(f, slot_of[i]), agents[i].state.pos);
+        sum += dot3(d, d);
+    }
+    return sum / n;
+}
+
+int main(int argc, char **argv) {
+    int repeats = argc > 1 ? atoi(argv[1]) : 5;
+    srand(0);
+    uint32_t rng = rng_seed();
+
+    printf("Formation assignment at reset, median of %d spawns\n", repeats);
+    printf("%-7s %7s %10s %10s %8s %14s %14s\n",
+        "shape", "agents", "median ms", "worst ms", "invalid", "auction m^2", "by index m^2");
+    int max_n = FORM_BENCH_SIZES[FORM_BENCH_SIZE_COUNT - 1];
+    Drone *agents = alloc_drones(max_n);
+    int *ids = calloc(max_n, sizeof(int));
+    int *by_index = calloc(max_n, sizeof(int));
+    int *taken = calloc(max_n, sizeof(int));
+    double *ms = calloc(repeats, sizeof(double));
+    for (int i = 0; i < max_n; i++) {
+        ids[i] = i;
+        by_index[i] = i;
+    }
+
+    for (int shape = 0; shape < FORM_BENCH_SHAPES; shape++) {
+        for (int c = 0; c < FORM_BENCH_SIZE_COUNT; c++) {
+            int n = FORM_BENCH_SIZES[c];
+            Formation f;
+            init_formation(&f, n);
+            int invalid = 0;
+            double auction_cost = 0.0, index_cost = 0.0;
+            for (int r = 0; r < repeats; r++) {
+                for (int i = 0; i < n; i++) {
+                    agents[i].state.pos = (Vec3){
+                        rng_uniform(&rng, -MARGIN_X, MARGIN_X),
+                        rng_uniform(&rng, -MARGIN_Y, MARGIN_Y),
+                        rng_uniform(&rng, -MARGIN_Z, MARGIN_Z)
+                    };
+                }
+                lay_out(&f, shape);
+                double start = now_sec();
+                assign_formation(&f, agents, ids);
+                ms[r] = 1e3 * (now_sec() - start);
+
+                memset(taken, 0, n * sizeof(int));
+                for (int i = 0; i < n; i++) {
+                    int s = f.slot[i];
+                    invalid += s < 0 || s >= n || taken[s]++ > 0;
+                }
+                auction_cost += mean_sq_dist(&f, agents, f.slot, n) / repeats;
+                index_cost += mean_sq_dist(&f, agents, by_index, n) / repeats;
+            }
+            qsort(ms, repeats, sizeof(double), compare_doubles);
+            printf("%-7s %7d %10.2f %10.2f %8d %14.2f %14.2f\n", FORM_BENCH_NAMES[shape], n,
+                ms[repeats / 2], ms[repeats - 1], invalid, auction_cost, index_cost);
+            free_formation(&f);
+        }
+    }
+
+    arena_free(agents);
+    free(ids);
+    free(by_index);
+    free(taken);
+    free(ms);
+    return 0;
+}
@@ -1,4 +1,36 @@
+#include <Python.h>
+
 #include "drone_swarm.h"
+#include "dronedata.h"
+
+static PyObject *vec_jacobians(PyObject *self, PyObject *args);
+static PyObject *vec_backward(PyObject *self, PyObject *args);
+static PyObject *vec_expert(PyObject *self, PyObject *args);
+static PyObject *vec_expert_rollout(PyObject *self, PyObject *args);
+static PyObject *dataset_open(PyObject *self, PyObject *args);
+static PyObject *dataset_close(PyObject *self, PyObject *args);
+static PyObject *vec_record(PyObject *self, PyObject *args);
+static PyObject *vec_clone(PyObject *self, PyObject *args);
+static PyObject *kernel_isa_name(PyObject *self, PyObject *args);
+#define MY_METHODS \
+    {"vec_jacobians", vec_jacobians, METH_VARARGS, \
+        "Dynamics Jacobians (A, B) at each drone's state and last action"}, \
+    {"vec_backward", vec_backward, METH_VARARGS, \
+        "Gradients of the taped actions from gradients of the taped states"}, \
+    {"vec_expert", vec_expert, METH_VARARGS, \
+        "Writes the geometric expert's actions into the action buffer"}, \
+    {"vec_expert_rollout", vec_expert_rollout, METH_VARARGS, \
+        "Steps the envs under the expert, recording observations and actions"}, \
+    {"dataset_open", dataset_open, METH_VARARGS, \
+        "Starts a sharded dataset writer for the vec env's steps"}, \
+    {"dataset_close", dataset_close, METH_VARARGS, \
+        "Flushes and closes a dataset writer, returning its stats"}, \
+    {"vec_record", vec_record, METH_VARARGS, \
+        "Steps the envs, streaming each step into a dataset writer"}, \
+    {"vec_clone", vec_clone, METH_VARARGS, \
+        "Copies one env's live state into other envs, see c_clone"}, \
+    {"kernel_isa", kernel_isa_name, METH_NOARGS, \
+        "Instruction set of the physics kernels picked for this CPU"}
 
 #define Env DroneSwarm
 #include "../env_binding.h"
@@ -6,6 +38,12 @@
 static int my_init(Env *env, PyObject *args, PyObject *kwargs) {
     env->num_agents = unpack(kwargs, "num_agents");
     env->max_rings = unpack(kwargs, "max_rings");
+    env->integrator = unpack(kwargs, "integrator");
+    env->control = unpack(kwargs, "control");
+    env->tape_len = unpack(kwargs, "tape_len");
+    env->wind_speed = unpack(kwargs, "wind_speed");
+    env->aero = unpack(kwargs, "aero");
+    env->mixed_tasks = unpack(kwargs, "mixed_tasks");
     init(env);
     return 0;
 }
@@ -21,3 +59,374 @@ static int my_log(PyObject *dict, Log *log) {
     assign_to_dict(dict, "n", log->n);
     return 0;
 }
+
+static float *float_array(PyObject *obj, int d0, int d1, int d2, const char *name) {
+    if (!PyArray_Check(obj)) {
+        PyErr_Format(PyExc_TypeError, "%s must be a numpy array", name);
+        return NULL;
+    }
+    PyArrayObject *arr = (PyArrayObject *)obj;
+    if (PyArray_TYPE(arr) != NPY_FLOAT32 || !PyArray_IS_C_CONTIGUOUS(arr) || PyArray_NDIM(arr) != 3
+            || PyArray_DIM(arr, 0) != d0 || PyArray_DIM(arr, 1) != d1 || PyArray_DIM(arr, 2) != d2) {
+        PyErr_Format(PyExc_ValueError, "%s must be a contiguous float32 array of shape (%d, %d, %d)",
+            name, d0, d1, d2);
+        return NULL;
+    }
+    return (float *)PyArray_DATA(arr);
+}
+
+static void gather_drone(Drone *drone, float *atn, int n, int d, float *states, Params *params, float *actions) {
+    float *s = (float *)&drone->state;
+    for (int i = 0; i < STATE_DIM; i++) {
+        states[i * n + d] = s[i];
+    }
+    for (int j = 0; j < 4; j++) {
+        actions[j * n + d] = clampf(atn[j], -1.0f, 1.0f);
+    }
+    params[d] = drone->params;
+}
+
+// Observation rows across the vec env, one per drone
+static int vec_agents(VecEnv *vec) {
+    int n = 0;
+    for (int e = 0; e < vec->num_envs; e++) {
+        n += vec->envs[e]->num_agents;
+    }
+    return n;
+}
+
+static bool motor_control(Drone *drone, const char *name) {
+    if (drone->control != CONTROL_RPM) {
+        PyErr_Format(PyExc_ValueError, "%s differentiates the motor dynamics, set control to rpm (0)", name);
+        return false;
+    }
+    return true;
+}
+
+// vec_jacobians(c_envs, A, B, dt) fills A (STATE_DIM, STATE_DIM, drones) and
+// B (STATE_DIM, 4, drones) with the Jacobians of one rk4_step of dt, or of
+// compute_derivatives when dt is 0
+static PyObject *vec_jacobians(PyObject *self, PyObject *args) {
+    PyObject *handle, *a_obj, *b_obj;
+    float dt;
+    if (!PyArg_ParseTuple(args, "OOOf", &handle, &a_obj, &b_obj, &dt)) {
+        return NULL;
+    }
+    VecEnv *vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int n = 0;
+    for (int e = 0; e < vec->num_envs; e++) {
+        n += vec->envs[e]->num_agents;
+        if (vec->envs[e]->num_agents > 0 && !motor_control(&vec->envs[e]->agents[0], "vec_jacobians")) {
+            return NULL;
+        }
+    }
+    float *A = float_array(a_obj, STATE_DIM, STATE_DIM, n, "A");
+    float *B = float_array(b_obj, STATE_DIM, 4, n, "B");
+    if (A == NULL || B == NULL) {
+        return NULL;
+    }
+
+    float *states = (float *)calloc(STATE_DIM * n, sizeof(float));
+    float *actions = (float *)calloc(4 * n, sizeof(float));
+    Params *params = (Params *)calloc(n, sizeof(Params));
+    int d = 0;
+    for (int e = 0; e < vec->num_envs; e++) {
+        Env *env = vec->envs[e];
+        for (int i = 0; i < env->num_agents; i++, d++) {
+            gather_drone(&env->agents[i], &env->actions[4 * i], n, d, states, params, actions);
+        }
+    }
+    if (dt == 0.0f) {
+        derivative_jacobians(n, states, params, actions, A, B);
+    } else {
+        rk4_jacobians(n, states, params, actions, dt, A, B);
+    }
+    free(states);
+    free(actions);
+    free(params);
+    Py_RETURN_NONE;
+}
+
+static bool backward_drone(Drone *drone, const float *grad_states, float dist_weight, float *grad_actions) {
+    if (!motor_control(drone, "vec_backward")) {
+        return false;
+    }
+    if (drone->integrator != INTEGRATOR_RK4 && drone->integrator != INTEGRATOR_RK4_D) {
+        PyErr_SetString(PyExc_ValueError, "vec_backward differentiates RK4, set integrator to rk4");
+        return false;
+    }
+    tape_backward(drone, grad_states, dist_weight, grad_actions);
+    return true;
+}
+
+// vec_backward(c_envs, grad_states, grad_actions, dist_weight) backpropagates
+// grad_states (drones, tape_len, STATE_DIM) through each drone's tape into
+// grad_actions (drones, tape_len, 4), see tape_backward
+static PyObject *vec_backward(PyObject *self, PyObject *args) {
+    PyObject *handle, *gs_obj, *ga_obj;
+    float dist_weight;
+    if (!PyArg_ParseTuple(args, "OOOf", &handle, &gs_obj, &ga_obj, &dist_weight)) {
+        return NULL;
+    }
+    VecEnv *vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int T = vec->envs[0]->tape_len;
+    if (T <= 0) {
+        PyErr_SetString(PyExc_ValueError, "vec_backward needs envs created with tape_len > 0");
+        return NULL;
+    }
+    int n = 0;
+    for (int e = 0; e < vec->num_envs; e++) {
+        n += vec->envs[e]->num_agents;
+    }
+    float *grad_states = float_array(gs_obj, n, T, STATE_DIM, "grad_states");
+    float *grad_actions = float_array(ga_obj, n, T, 4, "grad_actions");
+    if (grad_states == NULL || grad_actions == NULL) {
+        return NULL;
+    }
+    int d = 0;
+    for (int e = 0; e < vec->num_envs; e++) {
+        Env *env = vec->envs[e];
+        for (int i = 0; i < env->num_agents; i++, d++) {
+            if (!backward_drone(&env->agents[i], &grad_states[d * T * STATE_DIM], dist_weight,
+                    &grad_actions[d * T * 4])) {
+                return NULL;
+            }
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+// vec_expert(c_envs) writes the expert's actions for the current state, see
+// c_expert
+static PyObject *vec_expert(PyObject *self, PyObject *args) {
+    VecEnv *vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    for (int e = 0; e < vec->num_envs; e++) {
+        c_expert(vec->envs[e]);
+    }
+    Py_RETURN_NONE;
+}
+
+// vec_expert_rollout(c_envs, observations, actions) steps every env under the
+// expert for T steps, storing the observations each action was taken from in
+// observations (T, agents, obs_size) and the actions in actions (T, agents, 4)
+static PyObject *vec_expert_rollout(PyObject *self, PyObject *args) {
+    PyObject *handle, *obs_obj, *atn_obj;
+    if (!PyArg_ParseTuple(args, "OOO", &handle, &obs_obj, &atn_obj)) {
+        return NULL;
+    }
+    VecEnv *vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    if (!PyArray_Check(obs_obj) || PyArray_NDIM((PyArrayObject *)obs_obj) != 3) {
+        PyErr_SetString(PyExc_ValueError, "observations must be a 3D numpy array");
+        return NULL;
+    }
+    int T = PyArray_DIM((PyArrayObject *)obs_obj, 0);
+    int obs_size = PyArray_DIM((PyArrayObject *)obs_obj, 2);
+    int n = vec_agents(vec);
+    float *observations = float_array(obs_obj, T, n, obs_size, "observations");
+    float *actions = float_array(atn_obj, T, n, 4, "actions");
+    if (observations == NULL || actions == NULL) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (int t = 0; t < T; t++) {
+        int a = 0;
+        for (int e = 0; e < vec->num_envs; e++) {
+            Env *env = vec->envs[e];
+            int agents = env->num_agents;
+            c_expert(env);
+            memcpy(&observations[((long)t * n + a) * obs_size], env->observations, agents * obs_size * sizeof(float));
+            memcpy(&actions[((long)t * n + a) * 4], env->actions, agents * 4 * sizeof(float));
+            c_step(env);
+            a += agents;
+        }
+    }
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static DataWriter *unpack_writer(PyObject *obj) {
+    DataWriter *w = PyLong_Check(obj) ? (DataWriter *)PyLong_AsVoidPtr(obj) : NULL;
+    if (w == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Invalid dataset handle");
+    }
+    return w;
+}
+
+// dataset_open(c_envs, path, obs_size, shard_steps) starts a writer for
+// records of every agent in the vec env, see dronedata.h
+static PyObject *dataset_open(PyObject *self, PyObject *args) {
+    PyObject *handle;
+    const char *path;
+    int obs_size;
+    long shard_steps;
+    if (!PyArg_ParseTuple(args, "Osil", &handle, &path, &obs_size, &shard_steps)) {
+        return NULL;
+    }
+    VecEnv *vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    DataWriter *w = open_data_writer(path, obs_size, vec_agents(vec), shard_steps);
+    if (w == NULL) {
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    }
+    return PyLong_FromVoidPtr(w);
+}
+
+// dataset_close(handle) returns {"steps", "stalls"}, raising if any write failed
+static PyObject *dataset_close(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    if (!PyArg_ParseTuple(args, "O", &obj)) {
+        return NULL;
+    }
+    DataWriter *w = unpack_writer(obj);
+    if (w == NULL) {
+        return NULL;
+    }
+    long steps = atomic_load(&w->head);
+    long stalls = w->stalls;
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = close_data_writer(w);
+    Py_END_ALLOW_THREADS
+    if (err != 0) {
+        errno = err;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return Py_BuildValue("{s:l,s:l}", "steps", steps, "stalls", stalls);
+}
+
+// vec_record(c_envs, handle, steps, expert) steps every env steps times like
+// vec_step, first filling the actions from the expert if set, and streams
+// each step's observations, actions, rewards and terminals to the writer
+static PyObject *vec_record(PyObject *self, PyObject *args) {
+    PyObject *handle, *obj;
+    int steps, expert;
+    if (!PyArg_ParseTuple(args, "OOip", &handle, &obj, &steps, &expert)) {
+        return NULL;
+    }
+    VecEnv *vec = unpack_vecenv(args);
+    DataWriter *w = unpack_writer(obj);
+    if (!vec || !w) {
+        return NULL;
+    }
+    if (w->num_agents != vec_agents(vec)) {
+        PyErr_Format(PyExc_ValueError, "dataset records %d agents, the envs have %d", w->num_agents, vec_agents(vec));
+        return NULL;
+    }
+
+    bool ok = true;
+    Py_BEGIN_ALLOW_THREADS
+    for (int t = 0; t < steps; t++) {
+        DataRecord rec;
+        if (!data_reserve(w, &rec)) {
+            ok = false;
+            break;
+        }
+        int a = 0;
+        for (int e = 0; e < vec->num_envs; e++) {
+            Env *env = vec->envs[e];
+            if (expert) {
+                c_expert(env);
+            }
+            memcpy(&rec.observations[a * w->obs_size], env->observations, env->num_agents * w->obs_size * sizeof(float));
+            memcpy(&rec.actions[a * 4], env->actions, env->num_agents * 4 * sizeof(float));
+            c_step(env);
+            memcpy(&rec.rewards[a], env->rewards, env->num_agents * sizeof(float));
+            memcpy(&rec.terminals[a], env->terminals, env->num_agents);
+            a += env->num_agents;
+        }
+        data_commit(w);
+    }
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+static bool clone_compatible(const Env *dst, const Env *src) {
+    const char *setting = clone_mismatch(dst, src);
+    if (setting != NULL) {
+        PyErr_Format(PyExc_ValueError, "vec_clone needs envs made with the same settings, %s differs", setting);
+        return false;
+    }
+    return true;
+}
+
+// vec_clone(src_envs, src, dst_envs, dst) copies env src of src_envs into
+// every env of dst_envs listed in dst, a sequence of indices. The vecs may be
+// the same, cloning an env onto itself is a no-op.
+static PyObject *vec_clone(PyObject *self, PyObject *args) {
+    PyObject *src_handle, *dst_handle, *dst_obj;
+    int src_idx;
+    if (!PyArg_ParseTuple(args, "OiOO", &src_handle, &src_idx, &dst_handle, &dst_obj)) {
+        return NULL;
+    }
+    VecEnv *src_vec = unpack_vecenv(args);
+    PyObject *dst_args = PyTuple_Pack(1, dst_handle);
+    VecEnv *dst_vec = dst_args != NULL ? unpack_vecenv(dst_args) : NULL;
+    Py_XDECREF(dst_args);
+    if (!src_vec || !dst_vec) {
+        return NULL;
+    }
+    if (src_idx < 0 || src_idx >= src_vec->num_envs) {
+        PyErr_Format(PyExc_IndexError, "source env %d out of range for %d envs", src_idx, src_vec->num_envs);
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast(dst_obj, "dst must be a sequence of env indices");
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t k = PySequence_Fast_GET_SIZE(seq);
+    int *dst = (int *)malloc((k > 0 ? k : 1) * sizeof(int));
+    Env *src = src_vec->envs[src_idx];
+    for (Py_ssize_t i = 0; i < k; i++) {
+        long d = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (d == -1 && PyErr_Occurred()) {
+            break;
+        }
+        if (d < 0 || d >= dst_vec->num_envs) {
+            PyErr_Format(PyExc_IndexError, "env %ld out of range for %d envs", d, dst_vec->num_envs);
+            break;
+        }
+        if (!clone_compatible(dst_vec->envs[d], src)) {
+            break;
+        }
+        dst[i] = (int)d;
+    }
+    Py_DECREF(seq);
+    if (PyErr_Occurred()) {
+        free(dst);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < k; i++) {
+        Env *env = dst_vec->envs[dst[i]];
+        if (env != src) {
+            c_clone(env, src);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    free(dst);
+    Py_RETURN_NONE;
+}
+
+// kernel_isa() names the kernel clones the loader picked, see DRONE_KERNEL
+static PyObject *kernel_isa_name(PyObject *self, PyObject *args) {
+    return PyUnicode_FromString(kernel_isa());
+}
@@ -11,7 +11,13 @@
 #include <time.h>
 
 #include "raylib.h"
+#include "rlgl.h"
 #include "dronelib.h"
+#include "dronetraj.h"
+#include "droneform.h"
+
+#define SWARM_OBS 41 // per agent, the same rows for every task
+#define SWARM_LANES 16 // agents scanned side by side in nearest_lane, as FORM_LANES
 
 #define TASK_IDLE 0
 #define TASK_HOVER 1
@@ -20,30 +26,80 @@
 #define TASK_CUBE 4
 #define TASK_CONGO 5
 #define TASK_FLAG 6
-#define TASK_RACE 7
-#define TASK_N 8
+#define TASK_TEXT 7
+#define TASK_RACE 8
+#define TASK_N 9
 
 char* TASK_NAMES[TASK_N] = {
     "Idle", "Hover", "Orbit", "Follow",
-    "Cube", "Congo", "FLAG", "Race"
+    "Cube", "Congo", "FLAG", "Text", "Race"
 };
 
-#define R (Color){255, 0, 0, 255}
-#define W (Color){255, 255, 255, 255}
-#define B (Color){0, 0, 255, 255}
-Color FLAG_COLORS[64] = {
-    B, B, B, B, R, R, R, R,
-    B, B, B, B, W, W, W, W,
-    B, B, B, B, R, R, R, R,
-    B, B, B, B, W, W, W, W,
-    R, R, R, R, R, R, R, R,
-    W, W, W, W, W, W, W, W,
-    R, R, R, R, R, R, R, R,
-    W, W, W, W, W, W, W, W
-};
-#undef R
-#undef W
-#undef B
+#define FORMATION_TEXT "PUFFER"
+
+// Tasks drawn per agent when mixed_tasks is set
+#define TASK_MIX_N 4
+static const int TASK_MIX[TASK_MIX_N] = {TASK_RACE, TASK_HOVER, TASK_ORBIT, TASK_FOLLOW};
+
+static inline bool has_formation(int task) {
+    return task == TASK_ORBIT || task == TASK_CUBE || task == TASK_FLAG || task == TASK_TEXT;
+}
+
+#if defined(__EMSCRIPTEN__)
+#define GLSL_VERSION "#version 100\n"
+#define GLSL_IN "attribute"
+#define GLSL_VARYING_OUT "varying"
+#define GLSL_VARYING_IN "varying"
+#define GLSL_FRAG_DECL ""
+#define GLSL_FRAG_COLOR "gl_FragColor"
+#define GLSL_PRECISION "precision mediump float;\n"
+#else
+#define GLSL_VERSION "#version 330\n"
+#define GLSL_IN "in"
+#define GLSL_VARYING_OUT "out"
+#define GLSL_VARYING_IN "in"
+#define GLSL_FRAG_DECL "out vec4 finalColor;\n"
+#define GLSL_FRAG_COLOR "finalColor"
+#define GLSL_PRECISION ""
+#endif
+
+// Per-instance transform and color, shaded with a fixed directional light
+static const char* INSTANCE_VS =
+    GLSL_VERSION
+    GLSL_IN " vec3 vertexPosition;\n"
+    GLSL_IN " vec3 vertexNormal;\n"
+    GLSL_IN " mat4 instanceTransform;\n"
+    GLSL_IN " vec4 instanceColor;\n"
+    "uniform mat4 mvp;\n"
+    GLSL_VARYING_OUT " vec4 fragColor;\n"
+    GLSL_VARYING_OUT " vec3 fragNormal;\n"
+    "void main() {\n"
+    "    fragColor = instanceColor;\n"
+    "    fragNormal = mat3(instanceTransform)*vertexNormal;\n"
+    "    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);\n"
+    "}\n";
+
+static const char* INSTANCE_FS =
+    GLSL_VERSION
+    GLSL_PRECISION
+    GLSL_VARYING_IN " vec4 fragColor;\n"
+    GLSL_VARYING_IN " vec3 fragNormal;\n"
+    GLSL_FRAG_DECL
+    "void main() {\n"
+    "    float light = 0.6 + 0.4*max(dot(normalize(fragNormal), vec3(0.32, 0.48, 0.82)), 0.0);\n"
+    "    " GLSL_FRAG_COLOR " = vec4(fragColor.rgb*light, fragColor.a);\n"
+    "}\n";
+
+// One mesh drawn N times with a single DrawMeshInstanced call. Colors live in
+// a per-instance vertex buffer attached to the mesh VAO, updated once per frame.
+typedef struct {
+    Mesh mesh;
+    Matrix* transforms;
+    Color* colors;
+    unsigned int color_vbo;
+    int capacity;
+    int count;
+} InstanceBatch;
 
 typedef struct Client Client;
 struct Client {
@@ -59,8 +115,70 @@ struct Client {
 
     // Trailing path buffer (for rendering only)
     Trail* trails;
+
+    // Per-drone body color, replaced by the slot's color in the flag task
+    Color* colors;
+
+    // Instanced rendering, falls back to immediate mode if the shader fails
+    bool instanced;
+    Shader shader;
+    Material material;
+    InstanceBatch bodies;
+    InstanceBatch rotors;
+    InstanceBatch arms;
+    InstanceBatch targets;
 };
 
+// The agents' positions, targets and reward terms as separate arrays in
+// by_task order, so each task group is a contiguous range of every array.
+// Gathered once a step after the agents fly, and the nearest neighbours
+// found then serve both the rewards and the observations.
+typedef struct {
+    float* x; // position
+    float* y;
+    float* z;
+    float* tx; // target
+    float* ty;
+    float* tz;
+    float* near_d2; // squared distance to the nearest other agent, INFINITY alone
+    int* near; // that agent's index in agents, -1 alone
+    float* dist; // distance reward, see reward_lanes
+    float* density; // -1 within a metre of the nearest agent, else 0
+    float* abs; // the agent's last abs reward when gathered, this step's after reward_lanes
+    float* delta; // change in abs, the step's shaped reward
+} SwarmLanes;
+
+void init_lanes(SwarmLanes* l, int n) {
+    l->x = (float*)arena_calloc(n, sizeof(float));
+    l->y = (float*)arena_calloc(n, sizeof(float));
+    l->z = (float*)arena_calloc(n, sizeof(float));
+    l->tx = (float*)arena_calloc(n, sizeof(float));
+    l->ty = (float*)arena_calloc(n, sizeof(float));
+    l->tz = (float*)arena_calloc(n, sizeof(float));
+    l->near_d2 = (float*)arena_calloc(n, sizeof(float));
+    l->near = (int*)arena_calloc(n, sizeof(int));
+    l->dist = (float*)arena_calloc(n, sizeof(float));
+    l->density = (float*)arena_calloc(n, sizeof(float));
+    l->abs = (float*)arena_calloc(n, sizeof(float));
+    l->delta = (float*)arena_calloc(n, sizeof(float));
+}
+
+void free_lanes(SwarmLanes* l) {
+    arena_free(l->x);
+    arena_free(l->y);
+    arena_free(l->z);
+    arena_free(l->tx);
+    arena_free(l->ty);
+    arena_free(l->tz);
+    arena_free(l->near_d2);
+    arena_free(l->near);
+    arena_free(l->dist);
+    arena_free(l->density);
+    arena_free(l->abs);
+    arena_free(l->delta);
+    *l = (SwarmLanes){0};
+}
+
 typedef struct {
     float *observations;
     float *actions;
@@ -71,21 +189,57 @@ typedef struct {
     int tick;
     int report_interval;
 
-    int task;
+    int task; // every agent's task unless mixed_tasks
+    int mixed_tasks; // draw each agent's task from TASK_MIX instead
     int num_agents;
     Drone* agents;
+    int* tasks; // per agent
+    int* by_task; // agent indices grouped by task, see group_tasks
+    int* task_rank; // each agent's position within its group
+    int task_start[TASK_N + 1]; // group t is by_task[task_start[t]] up to by_task[task_start[t + 1]]
+    Trajectory* trajs; // each agent's target, see dronetraj.h
+    Formation formations[TASK_N]; // slots of the orbit, cube, flag and text groups
+    SwarmLanes lanes;
 
     int max_rings;
     Ring* ring_buffer;
+    int integrator;
+    int control; // CONTROL_*, what the actions command
+    int tape_len;
+    float wind_speed; // m/s, 0 for still air
+    WindField wind;
+    int aero; // downwash and ground effect
+    AeroGrid aero_grid;
+    uint32_t rng; // tasks, targets, rings, spawns and wind, see rng_next
 
     Client *client;
 } DroneSwarm;
 
 void init(DroneSwarm *env) {
-    env->agents = calloc(env->num_agents, sizeof(Drone));
-    env->ring_buffer = calloc(env->max_rings, sizeof(Ring));
+    log_kernels();
+    env->agents = alloc_drones(env->num_agents);
+    env->tasks = arena_calloc(env->num_agents, sizeof(int));
+    env->by_task = arena_calloc(env->num_agents, sizeof(int));
+    env->task_rank = arena_calloc(env->num_agents, sizeof(int));
+    env->trajs = arena_calloc(env->num_agents, sizeof(Trajectory));
+    init_lanes(&env->lanes, env->num_agents);
+    for (int t = 0; t < TASK_N; t++) {
+        if (has_formation(t)) {
+            init_formation(&env->formations[t], env->num_agents);
+        }
+    }
+    env->ring_buffer = arena_calloc(env->max_rings, sizeof(Ring));
     env->log = (Log){0};
     env->tick = 0;
+    for (int i = 0; i < env->num_agents; i++) {
+        init_drone_tape(&env->agents[i], env->tape_len);
+    }
+    if (env->wind_speed > 0.0f) {
+        init_wind(&env->wind, env->wind_speed);
+    }
+    if (env->aero) {
+        init_aero_grid(&env->aero_grid, env->num_agents);
+    }
 }
 
 void add_log(DroneSwarm *env, int idx, bool oob) {
@@ -104,275 +258,396 @@ void add_log(DroneSwarm *env, int idx, bool oob) {
     agent->episode_return = 0.0f;
 }
 
-Drone* nearest_drone(DroneSwarm* env, Drone *agent) {
-    float min_dist = 999999.0f;
-    Drone *nearest = NULL;
-    for (int i = 0; i < env->num_agents; i++) {
-        Drone *other = &env->agents[i];
-        if (other == agent) {
+// Copies agent by_task[k]'s position, target and last abs reward into lane k
+static inline void gather_lane(DroneSwarm* env, int k) {
+    SwarmLanes* l = &env->lanes;
+    Drone* agent = &env->agents[env->by_task[k]];
+    l->x[k] = agent->state.pos.x;
+    l->y[k] = agent->state.pos.y;
+    l->z[k] = agent->state.pos.z;
+    l->tx[k] = agent->target_pos.x;
+    l->ty[k] = agent->target_pos.y;
+    l->tz[k] = agent->target_pos.z;
+    l->abs[k] = agent->last_abs_reward;
+}
+
+void gather_lanes(DroneSwarm* env) {
+    for (int k = 0; k < env->num_agents; k++) {
+        gather_lane(env, k);
+    }
+}
+
+// Nearest other agent to lane k over all n lanes. Each of SWARM_LANES lanes
+// keeps its own best over every SWARM_LANES-th agent, a loop the kernel
+// clones vectorize at their width, and the lanes merge at the end, ties
+// going to the earlier agent as a plain scan would.
+static inline void nearest_lane(SwarmLanes* l, const int* by_task, int n, int k) {
+    float px = l->x[k], py = l->y[k], pz = l->z[k];
+    float lane_best[SWARM_LANES];
+    int lane_near[SWARM_LANES];
+    for (int m = 0; m < SWARM_LANES; m++) {
+        lane_best[m] = INFINITY;
+        lane_near[m] = -1;
+    }
+    int j = 0;
+    for (; j + SWARM_LANES <= n; j += SWARM_LANES) {
+        for (int m = 0; m < SWARM_LANES; m++) {
+            float dx = l->x[j + m] - px;
+            float dy = l->y[j + m] - py;
+            float dz = l->z[j + m] - pz;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            int closer = (d2 < lane_best[m]) & (j + m != k);
+            lane_best[m] = closer ? d2 : lane_best[m];
+            lane_near[m] = closer ? j + m : lane_near[m];
+        }
+    }
+    float best = INFINITY;
+    int near = -1;
+    for (int m = 0; m < SWARM_LANES; m++) {
+        if (lane_best[m] < best || (lane_best[m] == best && lane_near[m] < near)) {
+            best = lane_best[m];
+            near = lane_near[m];
+        }
+    }
+    for (; j < n; j++) {
+        float dx = l->x[j] - px;
+        float dy = l->y[j] - py;
+        float dz = l->z[j] - pz;
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if (j != k && d2 < best) {
+            best = d2;
+            near = j;
+        }
+    }
+    l->near_d2[k] = best;
+    l->near[k] = near < 0 ? -1 : by_task[near];
+}
+
+// Every lane's nearest other agent, all pairs once a step
+DRONE_KERNEL void update_nearest(DroneSwarm* env) {
+    for (int k = 0; k < env->num_agents; k++) {
+        nearest_lane(&env->lanes, env->by_task, env->num_agents, k);
+    }
+}
+
+// Lane k's agent respawned: regathers it, rescans its nearest, and fixes up
+// the lanes it is now nearest to or was nearest to and has left
+static void respawn_lane(DroneSwarm* env, int k) {
+    SwarmLanes* l = &env->lanes;
+    int i = env->by_task[k];
+    gather_lane(env, k);
+    nearest_lane(l, env->by_task, env->num_agents, k);
+    for (int j = 0; j < env->num_agents; j++) {
+        if (j == k) {
             continue;
         }
-        float dx = agent->state.pos.x - other->state.pos.x;
-        float dy = agent->state.pos.y - other->state.pos.y;
-        float dz = agent->state.pos.z - other->state.pos.z;
-        float dist = sqrtf(dx*dx + dy*dy + dz*dz);
-        if (dist < min_dist) {
-            min_dist = dist;
-            nearest = other;
+        float dx = l->x[j] - l->x[k];
+        float dy = l->y[j] - l->y[k];
+        float dz = l->z[j] - l->z[k];
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if (d2 < l->near_d2[j]) {
+            l->near_d2[j] = d2;
+            l->near[j] = i;
+        } else if (l->near[j] == i) {
+            nearest_lane(l, env->by_task, env->num_agents, j);
         }
     }
-    if (nearest == NULL) {
-        int x = 0;
+}
 
+#define REWARD_LANES 4 // lanes scored side by side, one SSE register
+
+// Reward terms of lanes lo to hi: the distance reward toward the target, -1
+// within a metre of the nearest agent if collide is set, and their sum's
+// change since the agent's last reward. The same for every task, so one pass
+// covers every group. Auto vectorization gives up on the sqrt and divide at
+// the default math flags, so the lanes are written out as in plan_score.
+DRONE_KERNEL void reward_lanes(SwarmLanes* l, int lo, int hi, bool collide) {
+    int k = lo;
+#if defined(__SSE2__)
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 hit = _mm_set1_ps(collide ? -1.0f : 0.0f);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    for (; k + REWARD_LANES <= hi; k += REWARD_LANES) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&l->x[k]), _mm_loadu_ps(&l->tx[k]));
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&l->y[k]), _mm_loadu_ps(&l->ty[k]));
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(&l->z[k]), _mm_loadu_ps(&l->tz[k]));
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 dist = _mm_sub_ps(one, _mm_div_ps(_mm_sqrt_ps(d2), _mm_set1_ps(MAX_DIST)));
+        __m128 density = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(&l->near_d2[k]), one), hit);
+        __m128 abs = _mm_add_ps(dist, density);
+        // Prevent negative dist and density from making a positive reward
+        __m128 both = _mm_and_ps(_mm_cmplt_ps(dist, zero), _mm_cmplt_ps(density, zero));
+        abs = _mm_xor_ps(abs, _mm_and_ps(both, sign));
+        _mm_storeu_ps(&l->dist[k], dist);
+        _mm_storeu_ps(&l->density[k], density);
+        _mm_storeu_ps(&l->delta[k], _mm_sub_ps(abs, _mm_loadu_ps(&l->abs[k])));
+        _mm_storeu_ps(&l->abs[k], abs);
+    }
+#endif
+    for (; k < hi; k++) {
+        float dx = l->x[k] - l->tx[k];
+        float dy = l->y[k] - l->ty[k];
+        float dz = l->z[k] - l->tz[k];
+        float dist = 1.0f - sqrtf(dx*dx + dy*dy + dz*dz) / MAX_DIST;
+        float density = collide && l->near_d2[k] < 1.0f ? -1.0f : 0.0f;
+        float abs = dist + density;
+        // Prevent negative dist and density from making a positive reward
+        if (dist < 0.0f && density < 0.0f) {
+            abs *= -1.0f;
+        }
+        l->dist[k] = dist;
+        l->density[k] = density;
+        l->delta[k] = abs - l->abs[k];
+        l->abs[k] = abs;
     }
-    return nearest;
 }
 
-void compute_observations(DroneSwarm *env) {
-    int idx = 0;
-    for (int i = 0; i < env->num_agents; i++) {
+// Books lane k's reward terms into its agent and returns the shaped reward
+static inline float book_reward(DroneSwarm* env, int k) {
+    SwarmLanes* l = &env->lanes;
+    Drone* agent = &env->agents[env->by_task[k]];
+    agent->last_collision_reward = l->density[k];
+    agent->last_target_reward = l->dist[k];
+    agent->last_abs_reward = l->abs[k];
+    agent->collisions += l->density[k] < 0.0f ? 1.0f : 0.0f;
+    agent->episode_length++;
+    agent->score += l->abs[k];
+    return l->delta[k];
+}
+
+// Writes the rows every task shares into obs, SWARM_OBS - 6 floats, and
+// returns where the ring rows go. k is the agent's lane, for its nearest.
+static inline float* observe_flight(DroneSwarm *env, Drone *agent, int k, Quat q_inv, float *obs) {
+    Vec3 linear_vel_body = quat_rotate(q_inv, agent->state.vel);
+    Vec3 drone_up_world = quat_rotate(agent->state.quat, (Vec3){0.0f, 0.0f, 1.0f});
+
+    // TODO: Need abs observations now right?
+    *obs++ = linear_vel_body.x / agent->params.max_vel;
+    *obs++ = linear_vel_body.y / agent->params.max_vel;
+    *obs++ = linear_vel_body.z / agent->params.max_vel;
+
+    *obs++ = agent->state.omega.x / agent->params.max_omega;
+    *obs++ = agent->state.omega.y / agent->params.max_omega;
+    *obs++ = agent->state.omega.z / agent->params.max_omega;
+
+    *obs++ = drone_up_world.x;
+    *obs++ = drone_up_world.y;
+    *obs++ = drone_up_world.z;
+
+    *obs++ = agent->state.quat.w;
+    *obs++ = agent->state.quat.x;
+    *obs++ = agent->state.quat.y;
+    *obs++ = agent->state.quat.z;
+
+    *obs++ = agent->state.rpms[0] / agent->params.max_rpm;
+    *obs++ = agent->state.rpms[1] / agent->params.max_rpm;
+    *obs++ = agent->state.rpms[2] / agent->params.max_rpm;
+    *obs++ = agent->state.rpms[3] / agent->params.max_rpm;
+
+    *obs++ = agent->state.pos.x / GRID_X;
+    *obs++ = agent->state.pos.y / GRID_Y;
+    *obs++ = agent->state.pos.z / GRID_Z;
+
+    *obs++ = agent->spawn_pos.x / GRID_X;
+    *obs++ = agent->spawn_pos.y / GRID_Y;
+    *obs++ = agent->spawn_pos.z / GRID_Z;
+
+    float dx = agent->target_pos.x - agent->state.pos.x;
+    float dy = agent->target_pos.y - agent->state.pos.y;
+    float dz = agent->target_pos.z - agent->state.pos.z;
+    *obs++ = clampf(dx, -1.0f, 1.0f);
+    *obs++ = clampf(dy, -1.0f, 1.0f);
+    *obs++ = clampf(dz, -1.0f, 1.0f);
+    *obs++ = dx / GRID_X;
+    *obs++ = dy / GRID_Y;
+    *obs++ = dz / GRID_Z;
+
+    *obs++ = agent->last_collision_reward;
+    *obs++ = agent->last_target_reward;
+    *obs++ = agent->last_abs_reward;
+
+    // Multiagent obs
+    int near = env->lanes.near[k];
+    if (near >= 0) {
+        Drone* nearest = &env->agents[near];
+        *obs++ = clampf(nearest->state.pos.x - agent->state.pos.x, -1.0f, 1.0f);
+        *obs++ = clampf(nearest->state.pos.y - agent->state.pos.y, -1.0f, 1.0f);
+        *obs++ = clampf(nearest->state.pos.z - agent->state.pos.z, -1.0f, 1.0f);
+    } else {
+        *obs++ = 0.0f;
+        *obs++ = 0.0f;
+        *obs++ = 0.0f;
+    }
+    return obs;
+}
+
+// Racers see their current ring in the body frame
+static inline void observe_race(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        int i = env->by_task[k];
         Drone *agent = &env->agents[i];
+        Quat q_inv = quat_inverse(agent->state.quat);
+        float *obs = observe_flight(env, agent, k, q_inv, &env->observations[i*SWARM_OBS]);
+
+        Ring ring = env->ring_buffer[agent->ring_idx];
+        Vec3 to_ring = quat_rotate(q_inv, sub3(ring.pos, agent->state.pos));
+        Vec3 ring_norm = quat_rotate(q_inv, ring.normal);
+        obs[0] = to_ring.x / GRID_X;
+        obs[1] = to_ring.y / GRID_Y;
+        obs[2] = to_ring.z / GRID_Z;
+        obs[3] = ring_norm.x;
+        obs[4] = ring_norm.y;
+        obs[5] = ring_norm.z;
+    }
+}
 
+// Every other task has no ring, its ring rows stay zero
+static inline void observe_track(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        int i = env->by_task[k];
+        Drone *agent = &env->agents[i];
         Quat q_inv = quat_inverse(agent->state.quat);
-        Vec3 linear_vel_body = quat_rotate(q_inv, agent->state.vel);
-        Vec3 drone_up_world = quat_rotate(agent->state.quat, (Vec3){0.0f, 0.0f, 1.0f});
-
-        // TODO: Need abs observations now right?
-        env->observations[idx++] = linear_vel_body.x / agent->params.max_vel;
-        env->observations[idx++] = linear_vel_body.y / agent->params.max_vel;
-        env->observations[idx++] = linear_vel_body.z / agent->params.max_vel;
-
-        env->observations[idx++] = agent->state.omega.x / agent->params.max_omega;
-        env->observations[idx++] = agent->state.omega.y / agent->params.max_omega;
-        env->observations[idx++] = agent->state.omega.z / agent->params.max_omega;
-
-        env->observations[idx++] = drone_up_world.x;
-        env->observations[idx++] = drone_up_world.y;
-        env->observations[idx++] = drone_up_world.z;
-
-        env->observations[idx++] = agent->state.quat.w;
-        env->observations[idx++] = agent->state.quat.x;
-        env->observations[idx++] = agent->state.quat.y;
-        env->observations[idx++] = agent->state.quat.z;
-
-        env->observations[idx++] = agent->state.rpms[0] / agent->params.max_rpm;
-        env->observations[idx++] = agent->state.rpms[1] / agent->params.max_rpm;
-        env->observations[idx++] = agent->state.rpms[2] / agent->params.max_rpm;
-        env->observations[idx++] = agent->state.rpms[3] / agent->params.max_rpm;
-
-        env->observations[idx++] = agent->state.pos.x / GRID_X;
-        env->observations[idx++] = agent->state.pos.y / GRID_Y;
-        env->observations[idx++] = agent->state.pos.z / GRID_Z;
-
-        env->observations[idx++] = agent->spawn_pos.x / GRID_X;
-        env->observations[idx++] = agent->spawn_pos.y / GRID_Y;
-        env->observations[idx++] = agent->spawn_pos.z / GRID_Z;
-
-        float dx = agent->target_pos.x - agent->state.pos.x;
-        float dy = agent->target_pos.y - agent->state.pos.y;
-        float dz = agent->target_pos.z - agent->state.pos.z;
-        env->observations[idx++] = clampf(dx, -1.0f, 1.0f);
-        env->observations[idx++] = clampf(dy, -1.0f, 1.0f);
-        env->observations[idx++] = clampf(dz, -1.0f, 1.0f);
-        env->observations[idx++] = dx / GRID_X;
-        env->observations[idx++] = dy / GRID_Y;
-        env->observations[idx++] = dz / GRID_Z;
-
-        env->observations[idx++] = agent->last_collision_reward;
-        env->observations[idx++] = agent->last_target_reward;
-        env->observations[idx++] = agent->last_abs_reward;
-
-        // Multiagent obs
-        Drone* nearest = nearest_drone(env, agent);
-        if (env->num_agents > 1) {
-            env->observations[idx++] = clampf(nearest->state.pos.x - agent->state.pos.x, -1.0f, 1.0f);
-            env->observations[idx++] = clampf(nearest->state.pos.y - agent->state.pos.y, -1.0f, 1.0f);
-            env->observations[idx++] = clampf(nearest->state.pos.z - agent->state.pos.z, -1.0f, 1.0f);
-        } else {
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
+        float *obs = observe_flight(env, agent, k, q_inv, &env->observations[i*SWARM_OBS]);
+        for (int j = 0; j < 6; j++) {
+            obs[j] = 0.0f;
         }
+    }
+}
 
-        // Ring obs
-        if (env->task == TASK_RACE) {
-            Ring ring = env->ring_buffer[agent->ring_idx];
-            Vec3 to_ring = quat_rotate(q_inv, sub3(ring.pos, agent->state.pos));
-            Vec3 ring_norm = quat_rotate(q_inv, ring.normal);
-            env->observations[idx++] = to_ring.x / GRID_X;
-            env->observations[idx++] = to_ring.y / GRID_Y;
-            env->observations[idx++] = to_ring.z / GRID_Z;
-            env->observations[idx++] = ring_norm.x;
-            env->observations[idx++] = ring_norm.y;
-            env->observations[idx++] = ring_norm.z;
+// Group by group over by_task, so no agent checks its task
+DRONE_KERNEL void compute_observations(DroneSwarm *env) {
+    for (int t = 0; t < TASK_N; t++) {
+        int lo = env->task_start[t];
+        int hi = env->task_start[t + 1];
+        if (t == TASK_RACE) {
+            observe_race(env, lo, hi);
         } else {
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
-            env->observations[idx++] = 0.0f;
+            observe_track(env, lo, hi);
         }
     }
 }
 
-void move_target(DroneSwarm* env, Drone *agent) {
-    agent->target_pos.x += agent->target_vel.x;
-    agent->target_pos.y += agent->target_vel.y;
-    agent->target_pos.z += agent->target_vel.z;
-    if (agent->target_pos.x < -GRID_X || agent->target_pos.x > GRID_X) {
-        agent->target_vel.x = -agent->target_vel.x;
-    }
-    if (agent->target_pos.y < -GRID_Y || agent->target_pos.y > GRID_Y) {
-        agent->target_vel.y = -agent->target_vel.y;
-    }
-    if (agent->target_pos.z < -GRID_Z || agent->target_pos.z > GRID_Z) {
-        agent->target_vel.z = -agent->target_vel.z;
-    }
-}
+// Ticks each congo agent leads the one before it along the leader's curve
+#define CONGO_LEAD_TICKS 40
 
+// A random moving curve: bouncing line, circle, Lissajous or spline
 void set_target_idle(DroneSwarm* env, int idx) {
-    Drone *agent = &env->agents[idx];
-    agent->target_pos = (Vec3){rndf(-MARGIN_X, MARGIN_X), rndf(-MARGIN_Y, MARGIN_Y), rndf(-MARGIN_Z, MARGIN_Z)};
-    agent->target_vel = (Vec3){rndf(-V_TARGET, V_TARGET), rndf(-V_TARGET, V_TARGET), rndf(-V_TARGET, V_TARGET)};
+    int kind = TRAJ_LINE + rng_next(&env->rng) % (TRAJ_N - TRAJ_LINE);
+    env->trajs[idx] = random_traj(kind, &env->rng);
 }
 
 void set_target_hover(DroneSwarm* env, int idx) {
-    Drone *agent = &env->agents[idx];
-    agent->target_pos = agent->state.pos;
-    agent->target_vel = (Vec3){0.0f, 0.0f, 0.0f};
+    env->trajs[idx] = static_traj(env->agents[idx].state.pos);
 }
 
-void set_target_orbit(DroneSwarm* env, int idx) {
-    // Fibbonacci sphere algorithm
-    float R = 8.0f;
-    float phi = PI * (sqrt(5.0f) - 1.0f);
-    float y = 1.0f - 2*((float)idx / (float)env->num_agents);
-    float radius = sqrtf(1.0f - y*y);
-
-    float theta = phi * idx;
-
-    float x = cos(theta) * radius;
-    float z = sin(theta) * radius;
+// Sits on the slot the auction gave the agent within its group's formation,
+// see set_targets
+void set_target_formation(DroneSwarm* env, int idx) {
+    Formation* f = &env->formations[env->tasks[idx]];
+    env->trajs[idx] = static_traj(slot_pos(f, f->slot[env->task_rank[idx]]));
+}
 
-    Drone *agent = &env->agents[idx];
-    agent->target_pos = (Vec3){R*x, R*z, R*y}; // convert to z up 
-    agent->target_vel = (Vec3){0.0f, 0.0f, 0.0f};
+// First agent of the agent's task group, which leads follow and congo
+static inline int group_leader(DroneSwarm* env, int idx) {
+    return env->by_task[env->task_start[env->tasks[idx]]];
 }
 
+// The group's first agent leads on a random curve, the rest sit on its target
 void set_target_follow(DroneSwarm* env, int idx) {
-    Drone* agent = &env->agents[idx];
-    if (idx == 0) {
+    int leader = group_leader(env, idx);
+    if (idx == leader) {
         set_target_idle(env, idx);
     } else {
-        agent->target_pos = env->agents[0].target_pos;
-        agent->target_vel = env->agents[0].target_vel;
+        env->trajs[idx] = env->trajs[leader];
     }
 }
 
-void set_target_cube(DroneSwarm* env, int idx) {
-    Drone* agent = &env->agents[idx];
-    float z = idx / 16;
-    idx = idx % 16;
-    float x = (float)(idx % 4);
-    float y = (float)(idx / 4);
-    agent->target_pos = (Vec3){4*x - 6, 4*y - 6, 4*z - 6};
-    agent->target_vel = (Vec3){0.0f, 0.0f, 0.0f};
-}
-
+// The group's first agent leads on a random curve, each agent after it runs
+// CONGO_LEAD_TICKS ahead of the one before on the same curve
 void set_target_congo(DroneSwarm* env, int idx) {
-    if (idx == 0) {
+    int leader = group_leader(env, idx);
+    if (idx == leader) {
         set_target_idle(env, idx);
         return;
     }
-    Drone* follow = &env->agents[idx - 1];
-    Drone* lead = &env->agents[idx];
-    lead->target_pos = follow->target_pos;
-    lead->target_vel = follow->target_vel;
-
-    // TODO: Slow hack
-    for (int i = 0; i < 40; i++) {
-        move_target(env, lead);
-    }
-}
-
-void set_target_flag(DroneSwarm* env, int idx) {
-    Drone* agent = &env->agents[idx];
-    float x = (float)(idx % 8);
-    float y = (float)(idx / 8);
-    x = 2.0f*x - 7;
-    y = 5 - 1.5f*y;
-    agent->target_pos = (Vec3){0.0f, x, y};
-    agent->target_vel = (Vec3){0.0f, 0.0f, 0.0f};
+    env->trajs[idx] = env->trajs[leader];
+    env->trajs[idx].t0 += (float)CONGO_LEAD_TICKS * env->task_rank[idx];
 }
 
 void set_target_race(DroneSwarm* env, int idx) {
-    Drone* agent = &env->agents[idx];
-    agent->target_pos = env->ring_buffer[agent->ring_idx].pos;
-    agent->target_vel = (Vec3){0.0f, 0.0f, 0.0f};
+    env->trajs[idx] = static_traj(env->ring_buffer[env->agents[idx].ring_idx].pos);
 }
 
+// Picks agent idx's trajectory for its task and places its target on it
 void set_target(DroneSwarm* env, int idx) {
-    if (env->task == TASK_IDLE) {
+    int task = env->tasks[idx];
+    if (task == TASK_IDLE) {
         set_target_idle(env, idx);
-    } else if (env->task == TASK_HOVER) {
+    } else if (task == TASK_HOVER) {
         set_target_hover(env, idx);
-    } else if (env->task == TASK_ORBIT) {
-        set_target_orbit(env, idx);
-    } else if (env->task == TASK_FOLLOW) {
+    } else if (task == TASK_FOLLOW) {
         set_target_follow(env, idx);
-    } else if (env->task == TASK_CUBE) {
-        set_target_cube(env, idx);
-    } else if (env->task == TASK_CONGO) {
+    } else if (task == TASK_CONGO) {
         set_target_congo(env, idx);
-    } else if (env->task == TASK_FLAG) {
-        set_target_flag(env, idx);
-    } else if (env->task == TASK_RACE) {
+    } else if (has_formation(task)) {
+        set_target_formation(env, idx);
+    } else if (task == TASK_RACE) {
         set_target_race(env, idx);
     }
+    Drone* agent = &env->agents[idx];
+    traj_eval(&env->trajs[idx], env->tick, &agent->target_pos, &agent->target_vel);
 }
 
-float compute_reward(DroneSwarm* env, Drone *agent, bool collision) {
-    // Distance reward
-    float dx = (agent->state.pos.x - agent->target_pos.x);
-    float dy = (agent->state.pos.y - agent->target_pos.y);
-    float dz = (agent->state.pos.z - agent->target_pos.z);
-    float dist = sqrtf(dx*dx + dy*dy + dz*dz);
-    float dist_reward = 1.0 - dist/MAX_DIST;
-    //dist = clampf(dist, 0.0f, 1.0f);
-    //float dist_reward = 1.0f - dist;
-
-    // Density penalty
-    float density_reward = 0.0f;
-    if (collision && env->num_agents > 1) {
-        Drone *nearest = nearest_drone(env, agent);
-        dx = agent->state.pos.x - nearest->state.pos.x;
-        dy = agent->state.pos.y - nearest->state.pos.y;
-        dz = agent->state.pos.z - nearest->state.pos.z;
-        float min_dist = sqrtf(dx*dx + dy*dy + dz*dz);
-        if (min_dist < 1.0f) {
-            density_reward = -1.0f;
-            agent->collisions += 1.0f;
-        }
+// Counting sort of the agents by task into by_task. Per task loops then run
+// over one contiguous group each with the task's branch taken once, and the
+// groups keep the agents' order so a single task swarm stays in index order.
+void group_tasks(DroneSwarm* env) {
+    int count[TASK_N] = {0};
+    for (int i = 0; i < env->num_agents; i++) {
+        count[env->tasks[i]]++;
     }
-
-    float abs_reward = dist_reward + density_reward;
-
-    // Prevent negative dist and density from making a positive reward
-    if (dist_reward < 0.0f && density_reward < 0.0f) {
-        abs_reward *= -1.0f;
+    env->task_start[0] = 0;
+    for (int t = 0; t < TASK_N; t++) {
+        env->task_start[t + 1] = env->task_start[t] + count[t];
     }
+    int next[TASK_N];
+    memcpy(next, env->task_start, sizeof(next));
+    for (int i = 0; i < env->num_agents; i++) {
+        int t = env->tasks[i];
+        env->task_rank[i] = next[t] - env->task_start[t];
+        env->by_task[next[t]++] = i;
+    }
+}
 
-    float delta_reward = abs_reward - agent->last_abs_reward;
-
-    agent->last_collision_reward = density_reward;
-    agent->last_target_reward = dist_reward;
-    agent->last_abs_reward = abs_reward;
-
-    agent->episode_length++;
-    agent->score += abs_reward;
+static inline int task_count(const DroneSwarm* env, int task) {
+    return env->task_start[task + 1] - env->task_start[task];
+}
 
-    return delta_reward;
+// Lays out each task group's formation, if it has one, sized to the group,
+// matches the group's agents to its slots from where they are now, and sets
+// every agent's target. Groups run in order, so leaders come first.
+void set_targets(DroneSwarm* env) {
+    for (int t = 0; t < TASK_N; t++) {
+        int lo = env->task_start[t];
+        int hi = env->task_start[t + 1];
+        if (has_formation(t) && hi > lo) {
+            Formation* f = &env->formations[t];
+            f->n = hi - lo;
+            if (t == TASK_ORBIT) {
+                formation_sphere(f, 8.0f);
+            } else if (t == TASK_CUBE) {
+                formation_grid(f, 4.0f);
+            } else if (t == TASK_FLAG) {
+                formation_bitmap(f, flag_color, 2.0f);
+            } else {
+                formation_text(f, FORMATION_TEXT, 1.0f);
+            }
+            assign_formation(f, env->agents, &env->by_task[lo]);
+        }
+        for (int k = lo; k < hi; k++) {
+            set_target(env, env->by_task[k]);
+        }
+    }
 }
 
 void reset_agent(DroneSwarm* env, Drone *agent, int idx) {
@@ -384,124 +659,324 @@ void reset_agent(DroneSwarm* env, Drone *agent, int idx) {
 
     //float size = 0.2f;
     //init_drone(agent, size, 0.0f);
-    float size = rndf(0.1f, 0.4);
+    float size = rng_uniform(&env->rng, 0.1f, 0.4f);
     init_drone(agent, size, 0.1f);
+    set_integrator(agent, env->integrator);
+    set_control(agent, env->control);
+    clear_tape(&agent->tape);
+    if (env->wind.nodes != NULL) {
+        agent->params.wind = &env->wind;
+    }
 
     agent->state.pos = (Vec3){
-        rndf(-MARGIN_X, MARGIN_X),
-        rndf(-MARGIN_Y, MARGIN_Y),
-        rndf(-MARGIN_Z, MARGIN_Z)
+        rng_uniform(&env->rng, -MARGIN_X, MARGIN_X),
+        rng_uniform(&env->rng, -MARGIN_Y, MARGIN_Y),
+        rng_uniform(&env->rng, -MARGIN_Z, MARGIN_Z)
     };
     agent->prev_pos = agent->state.pos;
     agent->spawn_pos = agent->state.pos;
+}
 
-    compute_reward(env, agent, env->task != TASK_RACE);
+// Baseline rewards of lanes lo to hi, which makes the first step's shaped
+// reward the change from where the agents start. Racers start clear of
+// the penalty as they always have.
+static void start_rewards(DroneSwarm* env, int lo, int hi, int task) {
+    reward_lanes(&env->lanes, lo, hi, task != TASK_RACE);
+    for (int k = lo; k < hi; k++) {
+        book_reward(env, k);
+    }
 }
 
-void c_reset(DroneSwarm *env) {
+// New episode for every agent, drawn from the env's own streams
+void reset_episode(DroneSwarm *env) {
     env->tick = 0;
     //env->task = rand() % (TASK_N - 1);
     
-    if (rand() % 4) {
+    if (rng_next(&env->rng) % 4) {
         env->task = TASK_RACE;
     } else {
-        env->task = rand() % (TASK_N - 1);
+        env->task = rng_next(&env->rng) % (TASK_N - 1);
     }
     
     //env->task = TASK_RACE;
     //env->task = TASK_HOVER;
     //env->task = TASK_FLAG;
+    for (int i = 0; i < env->num_agents; i++) {
+        env->tasks[i] = env->mixed_tasks ? TASK_MIX[rng_next(&env->rng) % TASK_MIX_N] : env->task;
+    }
+    group_tasks(env);
+
+    if (env->wind.nodes != NULL) {
+        reset_wind(&env->wind, &env->rng);
+    }
 
     for (int i = 0; i < env->num_agents; i++) {
-        Drone *agent = &env->agents[i];
-        reset_agent(env, agent, i);
-        set_target(env, i);
+        reset_agent(env, &env->agents[i], i);
     }
 
     for (int i = 0; i < env->max_rings; i++) {
         Ring *ring = &env->ring_buffer[i];
         *ring = (Ring){0};
     }
-    if (env->task == TASK_RACE) {
+    if (task_count(env, TASK_RACE) > 0) {
         float ring_radius = 2.0f;
-        reset_rings(env->ring_buffer, env->max_rings, ring_radius);
+        reset_rings(env->ring_buffer, env->max_rings, ring_radius, &env->rng);
 
-        // start drone at least MARGIN away from the first ring
-        for (int i = 0; i < env->num_agents; i++) {
-            Drone *drone = &env->agents[i];
+        // start racers at least MARGIN away from the first ring
+        for (int k = env->task_start[TASK_RACE]; k < env->task_start[TASK_RACE + 1]; k++) {
+            Drone *drone = &env->agents[env->by_task[k]];
             do {
                 drone->state.pos = (Vec3){
-                    rndf(-MARGIN_X, MARGIN_X), 
-                    rndf(-MARGIN_Y, MARGIN_Y), 
-                    rndf(-MARGIN_Z, MARGIN_Z)
+                    rng_uniform(&env->rng, -MARGIN_X, MARGIN_X),
+                    rng_uniform(&env->rng, -MARGIN_Y, MARGIN_Y),
+                    rng_uniform(&env->rng, -MARGIN_Z, MARGIN_Z)
                 };
             } while (norm3(sub3(drone->state.pos, env->ring_buffer[0].pos)) < 2.0f*ring_radius);
         }
     }
- 
+    set_targets(env);
+    gather_lanes(env);
+    update_nearest(env);
+    for (int t = 0; t < TASK_N; t++) {
+        start_rewards(env, env->task_start[t], env->task_start[t + 1], t);
+    }
+
     compute_observations(env);
 }
 
+// Reseeds the env's streams from rand(), so seeding before a reset keeps
+// working, and starts an episode
+void c_reset(DroneSwarm *env) {
+    env->rng = rng_seed();
+    for (int i = 0; i < env->num_agents; i++) {
+        env->agents[i].rng = rng_seed();
+    }
+    reset_episode(env);
+}
+
+static inline bool lane_out_of_bounds(const SwarmLanes* l, int k) {
+    return l->x[k] < -GRID_X || l->x[k] > GRID_X ||
+           l->y[k] < -GRID_Y || l->y[k] > GRID_Y ||
+           l->z[k] < -GRID_Z || l->z[k] > GRID_Z;
+}
+
+// Books lane k's step reward and ends its episode out of bounds, where the
+// agent respawns with a fresh baseline, or at the horizon
+static inline void settle_agent(DroneSwarm *env, int k, float reward) {
+    int i = env->by_task[k];
+    Drone *agent = &env->agents[i];
+    env->rewards[i] += reward;
+    agent->episode_return += reward;
+
+    if (lane_out_of_bounds(&env->lanes, k)) {
+        env->rewards[i] -= 1;
+        env->terminals[i] = 1;
+        add_log(env, i, true);
+        reset_agent(env, agent, i);
+        respawn_lane(env, k);
+        start_rewards(env, k, k + 1, env->tasks[i]);
+    } else if (env->tick >= HORIZON - 1) {
+        env->terminals[i] = 1;
+        add_log(env, i, false);
+    }
+}
+
+// Racers earn the delta reward plus each ring they pass, which moves
+// their target on to the next ring and rebases their reward on it
+static void settle_race(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        int i = env->by_task[k];
+        Drone *agent = &env->agents[i];
+        float reward = book_reward(env, k);
+        float passed_ring = check_ring(agent, &env->ring_buffer[agent->ring_idx]);
+        if (passed_ring > 0) {
+            agent->ring_idx = (agent->ring_idx + 1) % env->max_rings;
+            env->log.rings_passed += 1.0f;
+            set_target(env, i);
+            gather_lane(env, k);
+            reward_lanes(&env->lanes, k, k + 1, true);
+            book_reward(env, k);
+        }
+        reward += passed_ring;
+
+        settle_agent(env, k, reward);
+    }
+}
+
+// Every other task earns the delta reward toward its moving target
+static void settle_track(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        settle_agent(env, k, book_reward(env, k));
+    }
+}
+
+// The physics stays one drone at a time in move_drone, the drones being
+// AoS with per drone integrators and tapes. What runs once for the swarm is
+// the rest of the step: the nearest neighbours and the reward terms go over
+// the SoA lanes, and only the bookkeeping that differs is split by group.
 void c_step(DroneSwarm *env) {
     env->tick = (env->tick + 1) % HORIZON;
+    if (env->wind.nodes != NULL) {
+        advance_wind(&env->wind, DT);
+    }
+    if (env->aero) {
+        update_aero(&env->aero_grid, env->agents, env->num_agents);
+    }
+    eval_targets(env->trajs, env->agents, env->num_agents, env->tick);
     for (int i = 0; i < env->num_agents; i++) {
-        Drone *agent = &env->agents[i];
         env->rewards[i] = 0;
         env->terminals[i] = 0;
+        move_drone(&env->agents[i], &env->actions[4*i]);
+    }
+    gather_lanes(env);
+    update_nearest(env);
+    reward_lanes(&env->lanes, 0, env->num_agents, true);
+    for (int t = 0; t < TASK_N; t++) {
+        int lo = env->task_start[t];
+        int hi = env->task_start[t + 1];
+        if (t == TASK_RACE) {
+            settle_race(env, lo, hi);
+        } else {
+            settle_track(env, lo, hi);
+        }
+    }
+    if (env->tick >= HORIZON - 1) {
+        reset_episode(env);
+    }
 
-        float* atn = &env->actions[4*i];
-        move_drone(agent, atn);
-
-        // check out of bounds
-        bool out_of_bounds = agent->state.pos.x < -GRID_X || agent->state.pos.x > GRID_X ||
-                             agent->state.pos.y < -GRID_Y || agent->state.pos.y > GRID_Y ||
-                             agent->state.pos.z < -GRID_Z || agent->state.pos.z > GRID_Z;
+    compute_observations(env);
+}
 
-        move_target(env, agent);
+// Names the first setting dst and src were made with differently, NULL if
+// src can be cloned into dst. c_clone sizes its copies by src and carries
+// its flight settings over, so they have to match. The aero grid in
+// particular only exists in envs made with aero.
+const char *clone_mismatch(const DroneSwarm *dst, const DroneSwarm *src) {
+    if (dst->num_agents != src->num_agents) return "num_drones";
+    if (dst->max_rings != src->max_rings) return "max_rings";
+    if (dst->mixed_tasks != src->mixed_tasks) return "mixed_tasks";
+    if (dst->integrator != src->integrator) return "integrator";
+    if (dst->control != src->control) return "control";
+    if (dst->tape_len != src->tape_len) return "tape_len";
+    if (dst->wind_speed != src->wind_speed) return "wind_speed";
+    if (dst->aero != src->aero) return "aero";
+    return NULL;
+}
 
-        float reward = 0.0f;
-        if (env->task == TASK_RACE) {
-            Ring *ring = &env->ring_buffer[agent->ring_idx];
-            reward = compute_reward(env, agent, true);
-            float passed_ring = check_ring(agent, ring);
-            if (passed_ring > 0) {
-                agent->ring_idx = (agent->ring_idx + 1) % env->max_rings;
-                env->log.rings_passed += 1.0f;
-                set_target(env, i);
-                compute_reward(env, agent, true);
-            }
-            reward += passed_ring;
-        } else {
-            // Delta reward
-            reward = compute_reward(env, agent, true);
+// Copies src's simulation state, random streams included, into dst so that
+// both continue identically under the same actions. The env struct, rings,
+// task groups, target trajectories and drones are copied flat, dst keeps its own buffers, log, client, tape
+// storage, lanes and aero grid, and finds its nearest neighbours anew. clone_mismatch must pass.
+void c_clone(DroneSwarm *dst, const DroneSwarm *src) {
+    DroneSwarm keep = *dst;
+    memcpy(dst, src, sizeof(DroneSwarm));
+    dst->observations = keep.observations;
+    dst->actions = keep.actions;
+    dst->rewards = keep.rewards;
+    dst->terminals = keep.terminals;
+    dst->log = keep.log;
+    dst->agents = keep.agents;
+    dst->tasks = keep.tasks;
+    dst->by_task = keep.by_task;
+    dst->task_rank = keep.task_rank;
+    dst->trajs = keep.trajs;
+    memcpy(dst->formations, keep.formations, sizeof(keep.formations));
+    dst->lanes = keep.lanes;
+    dst->ring_buffer = keep.ring_buffer;
+    dst->tape_len = keep.tape_len;
+    dst->aero = keep.aero; // never step an aero grid dst doesn't have
+    dst->aero_grid = keep.aero_grid;
+    dst->client = keep.client;
+    memcpy(dst->ring_buffer, src->ring_buffer, src->max_rings * sizeof(Ring));
+    memcpy(dst->tasks, src->tasks, src->num_agents * sizeof(int));
+    memcpy(dst->by_task, src->by_task, src->num_agents * sizeof(int));
+    memcpy(dst->task_rank, src->task_rank, src->num_agents * sizeof(int));
+    memcpy(dst->trajs, src->trajs, src->num_agents * sizeof(Trajectory));
+    for (int t = 0; t < TASK_N; t++) {
+        if (has_formation(t)) {
+            copy_formation(&dst->formations[t], &src->formations[t]);
         }
+    }
+    for (int i = 0; i < src->num_agents; i++) {
+        copy_drone(&dst->agents[i], &src->agents[i], &dst->wind);
+    }
+    gather_lanes(dst);
+    update_nearest(dst);
+    compute_observations(dst);
+}
 
-        env->rewards[i] += reward;
-        agent->episode_return += reward;
-
-        if (out_of_bounds) {
-            env->rewards[i] -= 1;
-            env->terminals[i] = 1;
-            add_log(env, i, true);
-            reset_agent(env, agent, i);
-        } else if (env->tick >= HORIZON - 1) {
-            env->terminals[i] = 1;
-            add_log(env, i, false);
-        }
+// Racers fly at their current ring
+static void expert_race(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        int i = env->by_task[k];
+        Drone *agent = &env->agents[i];
+        Vec3 pos_d = agent->target_pos;
+        Vec3 vel_d = scalmul3(agent->target_vel, 1.0f / DT);
+        ring_waypoint(agent, &env->ring_buffer[agent->ring_idx], &pos_d, &vel_d);
+        expert_action(agent, pos_d, vel_d, &env->actions[4*i]);
     }
-    if (env->tick >= HORIZON - 1) {
-        c_reset(env);
+}
+
+// Every other task tracks the moving target
+static void expert_track(DroneSwarm *env, int lo, int hi) {
+    for (int k = lo; k < hi; k++) {
+        int i = env->by_task[k];
+        Drone *agent = &env->agents[i];
+        Vec3 vel_d = scalmul3(agent->target_vel, 1.0f / DT);
+        expert_action(agent, agent->target_pos, vel_d, &env->actions[4*i]);
     }
+}
 
-    compute_observations(env);
+// Writes the geometric expert's actions into env->actions, group by group
+void c_expert(DroneSwarm *env) {
+    for (int t = 0; t < TASK_N; t++) {
+        int lo = env->task_start[t];
+        int hi = env->task_start[t + 1];
+        if (t == TASK_RACE) {
+            expert_race(env, lo, hi);
+        } else {
+            expert_track(env, lo, hi);
+        }
+    }
+}
+
+void free_instance_batch(InstanceBatch* batch) {
+    rlUnloadVertexBuffer(batch->color_vbo);
+    UnloadMesh(batch->mesh);
+    free(batch->transforms);
+    free(batch->colors);
 }
 
 void c_close_client(Client *client) {
+    if (client->instanced) {
+        free_instance_batch(&client->bodies);
+        free_instance_batch(&client->rotors);
+        free_instance_batch(&client->arms);
+        free_instance_batch(&client->targets);
+        UnloadMaterial(client->material); // also unloads the shader
+    }
     CloseWindow();
+    free(client->trails);
+    free(client->colors);
     free(client);
 }
 
 void c_close(DroneSwarm *env) {
+    for (int i = 0; i < env->num_agents; i++) {
+        free_tape(&env->agents[i].tape);
+    }
+    free_wind(&env->wind);
+    free_aero_grid(&env->aero_grid);
+    arena_free(env->tasks);
+    arena_free(env->by_task);
+    arena_free(env->task_rank);
+    arena_free(env->trajs);
+    free_lanes(&env->lanes);
+    arena_free(env->ring_buffer);
+    arena_free(env->agents);
+    for (int t = 0; t < TASK_N; t++) {
+        free_formation(&env->formations[t]);
+    }
     if (env->client != NULL) {
         c_close_client(env->client);
     }
@@ -557,6 +1032,77 @@ void handle_camera_controls(Client *client) {
     }
 }
 
+// Model matrix mapping the unit mesh Y axis onto `axis` with lengths (s, len, s)
+static Matrix instance_matrix(Vec3 pos, Vec3 axis, float len, float s) {
+    Vec3 y = axis;
+    Vec3 ref = fabsf(y.z) < 0.9f ? (Vec3){0.0f, 0.0f, 1.0f} : (Vec3){1.0f, 0.0f, 0.0f};
+    Vec3 x = {y.y*ref.z - y.z*ref.y, y.z*ref.x - y.x*ref.z, y.x*ref.y - y.y*ref.x};
+    x = scalmul3(x, 1.0f / norm3(x));
+    Vec3 z = {x.y*y.z - x.z*y.y, x.z*y.x - x.x*y.z, x.x*y.y - x.y*y.x};
+
+    Matrix m = {0};
+    m.m0 = x.x*s;   m.m4 = y.x*len; m.m8 = z.x*s;  m.m12 = pos.x;
+    m.m1 = x.y*s;   m.m5 = y.y*len; m.m9 = z.y*s;  m.m13 = pos.y;
+    m.m2 = x.z*s;   m.m6 = y.z*len; m.m10 = z.z*s; m.m14 = pos.z;
+    m.m15 = 1.0f;
+    return m;
+}
+
+static Matrix sphere_matrix(Vec3 pos, float radius) {
+    return instance_matrix(pos, (Vec3){0.0f, 1.0f, 0.0f}, radius, radius);
+}
+
+void init_instance_batch(InstanceBatch* batch, Mesh mesh, int capacity, int color_loc) {
+    batch->mesh = mesh;
+    batch->capacity = capacity;
+    batch->count = 0;
+    batch->transforms = (Matrix*)calloc(capacity, sizeof(Matrix));
+    batch->colors = (Color*)calloc(capacity, sizeof(Color));
+
+    rlEnableVertexArray(mesh.vaoId);
+    batch->color_vbo = rlLoadVertexBuffer(batch->colors, capacity*sizeof(Color), true);
+    rlSetVertexAttribute(color_loc, 4, RL_UNSIGNED_BYTE, true, 0, 0);
+    rlEnableVertexAttribute(color_loc);
+    rlSetVertexAttributeDivisor(color_loc, 1);
+    rlDisableVertexArray();
+}
+
+static inline void push_instance(InstanceBatch* batch, Matrix transform, Color color) {
+    batch->transforms[batch->count] = transform;
+    batch->colors[batch->count] = color;
+    batch->count++;
+}
+
+void draw_instance_batch(InstanceBatch* batch, Material material) {
+    if (batch->count == 0) {
+        return;
+    }
+    rlUpdateVertexBuffer(batch->color_vbo, batch->colors, batch->count*sizeof(Color), 0);
+    DrawMeshInstanced(batch->mesh, material, batch->transforms, batch->count);
+    batch->count = 0;
+}
+
+void init_instancing(Client* client, int num_agents) {
+    client->shader = LoadShaderFromMemory(INSTANCE_VS, INSTANCE_FS);
+    client->instanced = client->shader.id != rlGetShaderIdDefault();
+    if (!client->instanced) {
+        TraceLog(LOG_WARNING, "Instancing shader failed, using immediate mode\n");
+        return;
+    }
+    client->shader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(client->shader, "mvp");
+    client->shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(client->shader, "instanceTransform");
+    int color_loc = GetShaderLocationAttrib(client->shader, "instanceColor");
+
+    client->material = LoadMaterialDefault();
+    client->material.shader = client->shader;
+
+    // Unit meshes, scaled per instance
+    init_instance_batch(&client->bodies, GenMeshSphere(1.0f, 8, 12), num_agents, color_loc);
+    init_instance_batch(&client->rotors, GenMeshSphere(1.0f, 6, 8), 4*num_agents, color_loc);
+    init_instance_batch(&client->arms, GenMeshCylinder(1.0f, 1.0f, 6), 4*num_agents, color_loc);
+    init_instance_batch(&client->targets, GenMeshSphere(1.0f, 8, 12), num_agents, color_loc);
+}
+
 Client *make_client(DroneSwarm *env) {
     Client *client = (Client *)calloc(1, sizeof(Client));
 
@@ -599,6 +1145,14 @@ Client *make_client(DroneSwarm *env) {
         }
     }
 
+    // Golden angle hues
+    client->colors = (Color*)calloc(env->num_agents, sizeof(Color));
+    for (int i = 0; i < env->num_agents; i++) {
+        client->colors[i] = ColorFromHSV(fmodf(137.508f * i, 360.0f), 0.7f, 0.95f);
+    }
+
+    init_instancing(client, env->num_agents);
+
     return client;
 }
 
@@ -625,6 +1179,110 @@ void DrawRing3D(Ring ring, float thickness, Color entryColor, Color exitColor) {
     DrawCylinderWiresEx(center_pos, exit_end_pos, ring.radius, ring.radius, 32, exitColor);
 }
 
+// Rotor brightness follows the motor rpm
+static inline Color rotor_color(Color base, float rpm_frac) {
+    float intensity = 0.75f + 0.25f * rpm_frac;
+    return (Color){(unsigned char)(base.r * intensity),
+                   (unsigned char)(base.g * intensity),
+                   (unsigned char)(base.b * intensity), 255};
+}
+
+static inline Color drone_color(DroneSwarm *env, Client *client, int i) {
+    if (env->tasks[i] == TASK_FLAG) {
+        Formation* f = &env->formations[TASK_FLAG];
+        return f->colors[f->slot[env->task_rank[i]]];
+    }
+    return client->colors[i];
+}
+
+static inline Vec3 rotor_offset(Drone* agent, int j) {
+    const float visual_arm_len = agent->params.arm_len * 4.0f;
+    Vec3 rotor_offsets_body[4] = {{+visual_arm_len, 0.0f, 0.0f},
+                                  {-visual_arm_len, 0.0f, 0.0f},
+                                  {0.0f, +visual_arm_len, 0.0f},
+                                  {0.0f, -visual_arm_len, 0.0f}};
+    return quat_rotate(agent->state.quat, rotor_offsets_body[j]);
+}
+
+// Fills the instance buffers and issues one draw call per mesh
+void draw_drones_instanced(DroneSwarm *env, Client *client) {
+    for (int i = 0; i < env->num_agents; i++) {
+        Drone *agent = &env->agents[i];
+        Color body_color = drone_color(env, client, i);
+        push_instance(&client->bodies, sphere_matrix(agent->state.pos, 0.3f), body_color);
+
+        for (int j = 0; j < 4; j++) {
+            Vec3 world_off = rotor_offset(agent, j);
+            Vec3 rotor_pos = add3(agent->state.pos, world_off);
+            push_instance(&client->rotors, sphere_matrix(rotor_pos, 0.15f),
+                          rotor_color(body_color, agent->state.rpms[j] / agent->params.max_rpm));
+
+            float arm_len = norm3(world_off);
+            if (arm_len > 0.0f) {
+                Vec3 axis = scalmul3(world_off, 1.0f / arm_len);
+                push_instance(&client->arms, instance_matrix(agent->state.pos, axis, arm_len, 0.02f), BLACK);
+            }
+        }
+    }
+
+    draw_instance_batch(&client->bodies, client->material);
+    draw_instance_batch(&client->rotors, client->material);
+    draw_instance_batch(&client->arms, client->material);
+}
+
+void draw_drones_immediate(DroneSwarm *env, Client *client) {
+    for (int i = 0; i < env->num_agents; i++) {
+        Drone *agent = &env->agents[i];
+        Vector3 body_pos = {agent->state.pos.x, agent->state.pos.y, agent->state.pos.z};
+
+        // draws drone body
+        Color body_color = drone_color(env, client, i);
+        DrawSphere(body_pos, 0.3f, body_color);
+
+        // draws rotors according to thrust
+        for (int j = 0; j < 4; j++) {
+            Vec3 rotor = add3(agent->state.pos, rotor_offset(agent, j));
+            Vector3 rotor_pos = {rotor.x, rotor.y, rotor.z};
+            DrawSphere(rotor_pos, 0.15f, rotor_color(body_color, agent->state.rpms[j] / agent->params.max_rpm));
+            DrawCylinderEx(body_pos, rotor_pos, 0.02f, 0.02f, 8, BLACK);
+        }
+    }
+}
+
+// Velocity lines and trails for all drones go through a single RL_LINES batch
+void draw_lines(DroneSwarm *env, Client *client) {
+    Color trail_base = (Color){0, 187, 187, 255};
+
+    rlBegin(RL_LINES);
+    for (int i = 0; i < env->num_agents; i++) {
+        Drone *agent = &env->agents[i];
+        Trail *trail = &client->trails[i];
+        rlCheckRenderBatchLimit(2*TRAIL_LENGTH);
+
+        // draws line with direction and magnitude of velocity / 10
+        if (norm3(agent->state.vel) > 0.1f) {
+            Vec3 tip = add3(agent->state.pos, scalmul3(agent->state.vel, 0.1f));
+            rlColor4ub(MAGENTA.r, MAGENTA.g, MAGENTA.b, MAGENTA.a);
+            rlVertex3f(agent->state.pos.x, agent->state.pos.y, agent->state.pos.z);
+            rlVertex3f(tip.x, tip.y, tip.z);
+        }
+
+        // Draw trailing path
+        if (trail->count <= 2) {
+            continue;
+        }
+        for (int j = 0; j < trail->count - 1; j++) {
+            int idx0 = (trail->index - j - 1 + TRAIL_LENGTH) % TRAIL_LENGTH;
+            int idx1 = (trail->index - j - 2 + TRAIL_LENGTH) % TRAIL_LENGTH;
+            float alpha = (float)(TRAIL_LENGTH - j) / (float)trail->count * 0.8f; // fade out
+            Color trail_color = ColorAlpha(trail_base, alpha);
+            rlColor4ub(trail_color.r, trail_color.g, trail_color.b, trail_color.a);
+            rlVertex3f(trail->pos[idx0].x, trail->pos[idx0].y, trail->pos[idx0].z);
+            rlVertex3f(trail->pos[idx1].x, trail->pos[idx1].y, trail->pos[idx1].z);
+        }
+    }
+    rlEnd();
+}
 
 void c_render(DroneSwarm *env) {
     if (env->client == NULL) {
@@ -645,15 +1303,19 @@ void c_render(DroneSwarm *env) {
         exit(0);
     }
 
+    // Cycles every agent through the same task, leaving mixed tasks
     if (IsKeyPressed(KEY_SPACE)) {
         env->task = (env->task + 1) % TASK_N;
+        env->mixed_tasks = 0;
         for (int i = 0; i < env->num_agents; i++) {
-            set_target(env, i);
+            env->tasks[i] = env->task;
         }
+        group_tasks(env);
         if (env->task == TASK_RACE) {
             float ring_radius = 2.0f;
-            reset_rings(env->ring_buffer, env->max_rings, ring_radius);
+            reset_rings(env->ring_buffer, env->max_rings, ring_radius, &env->rng);
         }
+        set_targets(env);
     }
 
     handle_camera_controls(env->client);
@@ -683,77 +1345,15 @@ void c_render(DroneSwarm *env) {
     DrawCubeWires((Vector3){0.0f, 0.0f, 0.0f}, GRID_X * 2.0f,
         GRID_Y * 2.0f, GRID_Z * 2.0f, WHITE);
 
-    for (int i = 0; i < env->num_agents; i++) {
-        Drone *agent = &env->agents[i];
-
-        // draws drone body
-        Color body_color = FLAG_COLORS[i];
-        DrawSphere((Vector3){agent->state.pos.x, agent->state.pos.y, agent->state.pos.z}, 0.3f, body_color);
-
-        // draws rotors according to thrust
-        float T[4];
-        for (int j = 0; j < 4; j++) {
-            float rpm = (env->actions[4*i + j] + 1.0f) * 0.5f * agent->params.max_rpm;
-            T[j] = agent->params.k_thrust * rpm * rpm;
-        }
-
-        const float rotor_radius = 0.15f;
-        const float visual_arm_len = agent->params.arm_len * 4.0f;
-
-        Vec3 rotor_offsets_body[4] = {{+visual_arm_len, 0.0f, 0.0f},
-                                      {-visual_arm_len, 0.0f, 0.0f},
-                                      {0.0f, +visual_arm_len, 0.0f},
-                                      {0.0f, -visual_arm_len, 0.0f}};
-
-        //Color base_colors[4] = {ORANGE, PURPLE, LIME, SKYBLUE};
-        Color base_colors[4] = {body_color, body_color, body_color, body_color};
-
-        for (int j = 0; j < 4; j++) {
-            Vec3 world_off = quat_rotate(agent->state.quat, rotor_offsets_body[j]);
-
-            Vector3 rotor_pos = {agent->state.pos.x + world_off.x, agent->state.pos.y + world_off.y,
-                                 agent->state.pos.z + world_off.z};
-
-            float rpm = (env->actions[4*i + j] + 1.0f) * 0.5f * agent->params.max_rpm;
-            float intensity = 0.75f + 0.25f * (rpm / agent->params.max_rpm);
-
-            Color rotor_color = (Color){(unsigned char)(base_colors[j].r * intensity),
-                                        (unsigned char)(base_colors[j].g * intensity),
-                                        (unsigned char)(base_colors[j].b * intensity), 255};
-
-            DrawSphere(rotor_pos, rotor_radius, rotor_color);
-
-            DrawCylinderEx((Vector3){agent->state.pos.x, agent->state.pos.y, agent->state.pos.z}, rotor_pos, 0.02f, 0.02f, 8,
-                           BLACK);
-        }
-
-        // draws line with direction and magnitude of velocity / 10
-        if (norm3(agent->state.vel) > 0.1f) {
-            DrawLine3D((Vector3){agent->state.pos.x, agent->state.pos.y, agent->state.pos.z},
-                       (Vector3){agent->state.pos.x + agent->state.vel.x * 0.1f, agent->state.pos.y + agent->state.vel.y * 0.1f,
-                                 agent->state.pos.z + agent->state.vel.z * 0.1f},
-                       MAGENTA);
-        }
-
-        // Draw trailing path
-        Trail *trail = &client->trails[i];
-        if (trail->count <= 2) {
-            continue;
-        }
-        for (int j = 0; j < trail->count - 1; j++) {
-            int idx0 = (trail->index - j - 1 + TRAIL_LENGTH) % TRAIL_LENGTH;
-            int idx1 = (trail->index - j - 2 + TRAIL_LENGTH) % TRAIL_LENGTH;
-            float alpha = (float)(TRAIL_LENGTH - j) / (float)trail->count * 0.8f; // fade out
-            Color trail_color = ColorAlpha((Color){0, 187, 187, 255}, alpha);
-            DrawLine3D((Vector3){trail->pos[idx0].x, trail->pos[idx0].y, trail->pos[idx0].z},
-                       (Vector3){trail->pos[idx1].x, trail->pos[idx1].y, trail->pos[idx1].z},
-                       trail_color);
-        }
-
+    if (client->instanced) {
+        draw_drones_instanced(env, client);
+    } else {
+        draw_drones_immediate(env, client);
     }
+    draw_lines(env, client);
 
     // Rings
-    if (env->task == TASK_RACE) {
+    if (task_count(env, TASK_RACE) > 0) {
         float ring_thickness = 0.2f;
         for (int i = 0; i < env->max_rings; i++) {
             Ring ring = env->ring_buffer[i];
@@ -762,10 +1362,17 @@ void c_render(DroneSwarm *env) {
     }
 
     if (IsKeyDown(KEY_TAB)) {
+        Color target_color = (Color){0, 255, 255, 100};
         for (int i = 0; i < env->num_agents; i++) {
-            Drone *agent = &env->agents[i];
-            Vec3 target_pos = agent->target_pos;
-            DrawSphere((Vector3){target_pos.x, target_pos.y, target_pos.z}, 0.45f, (Color){0, 255, 255, 100});
+            Vec3 target_pos = env->agents[i].target_pos;
+            if (client->instanced) {
+                push_instance(&client->targets, sphere_matrix(target_pos, 0.45f), target_color);
+            } else {
+                DrawSphere((Vector3){target_pos.x, target_pos.y, target_pos.z}, 0.45f, target_color);
+            }
+        }
+        if (client->instanced) {
+            draw_instance_batch(&client->targets, client->material);
         }
     }
 
@@ -773,7 +1380,8 @@ void c_render(DroneSwarm *env) {
 
     DrawText("Left click + drag: Rotate camera", 10, 10, 16, PUFF_WHITE);
     DrawText("Mouse wheel: Zoom in/out", 10, 30, 16, PUFF_WHITE);
-    DrawText(TextFormat("Task: %s", TASK_NAMES[env->task]), 10, 50, 16, PUFF_WHITE);
+    DrawText(TextFormat("Task: %s", env->mixed_tasks ? "Mixed" : TASK_NAMES[env->task]), 10, 50, 16, PUFF_WHITE);
+    DrawText(TextFormat("Drones: %d  FPS: %d", env->num_agents, GetFPS()), 10, 70, 16, PUFF_WHITE);
 
     EndDrawing();
 }
@@ -10,6 +10,14 @@ class DroneSwarm(pufferlib.PufferEnv):
         num_envs=16,
         num_drones=64,
         max_rings=5,
+        integrator=0,
+        control=0,
+        tape_len=0,
+        wind_speed=0.0,
+        aero=False,
+        mixed_tasks=False,
+        dataset=None,
+        shard_steps=4096,
         render_mode=None,
         report_interval=1024,
         buf=None,
@@ -26,6 +34,7 @@ class DroneSwarm(pufferlib.PufferEnv):
             low=-1, high=1, shape=(4,), dtype=np.float32
         )
 
+        self.tape_len = tape_len
         self.num_agents = num_envs*num_drones
         self.render_mode = render_mode
         self.report_interval = report_interval
@@ -45,10 +54,24 @@ class DroneSwarm(pufferlib.PufferEnv):
                 i,
                 num_agents=num_drones,
                 max_rings=max_rings,
+                integrator=integrator,
+                control=control,
+                tape_len=tape_len,
+                wind_speed=wind_speed,
+                aero=int(aero),
+                mixed_tasks=int(mixed_tasks),
             ))
 
+        self.num_c_envs = num_envs
         self.c_envs = binding.vectorize(*c_envs)
 
+        # Streams every step to sharded files under this directory, read
+        # them back with dronedata.DroneDataset
+        self.dataset = None
+        if dataset is not None:
+            self.dataset = binding.dataset_open(self.c_envs, dataset,
+                self.single_observation_space.shape[0], shard_steps)
+
     def reset(self, seed=None):
         self.tick = 0
         binding.vec_reset(self.c_envs, seed)
@@ -58,7 +81,10 @@ class DroneSwarm(pufferlib.PufferEnv):
         self.actions[:] = actions
 
         self.tick += 1
-        binding.vec_step(self.c_envs)
+        if self.dataset is None:
+            binding.vec_step(self.c_envs)
+        else:
+            binding.vec_record(self.c_envs, self.dataset, 1, False)
 
         info = []
         if self.tick % self.report_interval == 0:
@@ -68,10 +94,70 @@ class DroneSwarm(pufferlib.PufferEnv):
 
         return (self.observations, self.rewards, self.terminals, self.truncations, info)
 
+    def jacobians(self, dt=0.05):
+        '''Jacobians of the dynamics at each drone's state and last action.
+        Returns A (drones, 17, 17) and B (drones, 17, 4) for one RK4 step of
+        dt, or for the continuous time derivatives when dt is 0.'''
+        A = np.zeros((17, 17, self.num_agents), dtype=np.float32)
+        B = np.zeros((17, 4, self.num_agents), dtype=np.float32)
+        binding.vec_jacobians(self.c_envs, A, B, dt)
+        return np.moveaxis(A, 2, 0), np.moveaxis(B, 2, 0)
+
+    def backward(self, grad_states, dist_weight=0.0):
+        '''Backpropagates through the last tape_len steps of each drone, since
+        its last reset. grad_states (drones, tape_len, 17) holds dL/dstate
+        after each step, oldest first. dist_weight adds the gradient of
+        -dist_weight * the summed per-step distance rewards. Returns dL/dactions
+        (drones, tape_len, 4), zero before the reset. Needs tape_len > 0 and
+        the rk4 integrator.'''
+        grad_states = np.ascontiguousarray(grad_states, dtype=np.float32)
+        grad_actions = np.zeros((self.num_agents, self.tape_len, 4), dtype=np.float32)
+        binding.vec_backward(self.c_envs, grad_states, grad_actions, dist_weight)
+        return grad_actions
+
+    def expert_actions(self):
+        '''Actions of the built-in geometric (SE(3)) controller for the
+        current state, in the env's control mode. Also written into the
+        action buffer, so step(env.expert_actions()) flies the expert.'''
+        binding.vec_expert(self.c_envs)
+        return self.actions
+
+    def expert_rollout(self, steps):
+        '''Steps all envs under the expert for steps ticks without returning
+        to Python. Returns observations (steps, agents, obs) and the actions
+        (steps, agents, 4) taken from them.'''
+        obs = np.zeros((steps, *self.observations.shape), dtype=np.float32)
+        actions = np.zeros((steps, self.num_agents, 4), dtype=np.float32)
+        binding.vec_expert_rollout(self.c_envs, obs, actions)
+        return obs, actions
+
+    def expert_record(self, steps):
+        '''Streams steps ticks of expert play into the dataset without
+        returning to Python.'''
+        if self.dataset is None:
+            raise ValueError('expert_record needs the env created with a dataset path')
+        binding.vec_record(self.c_envs, self.dataset, steps, True)
+        self.tick += steps
+
+    def clone(self, src, dst=None, target=None):
+        '''Copies the live state of env src, random streams included, into
+        envs dst of target, so each continues exactly as src would under the
+        same actions. target defaults to this env and must be a DroneSwarm made
+        with the same settings, else ValueError is raised; dst defaults to all
+        of its envs but src.
+        Observations of the copies are updated, logs are not.'''
+        target = self if target is None else target
+        if dst is None:
+            dst = [i for i in range(target.num_c_envs) if target is not self or i != src]
+        binding.vec_clone(self.c_envs, src, target.c_envs, [int(d) for d in dst])
+
     def render(self):
         binding.vec_render(self.c_envs, 0)
 
     def close(self):
+        if self.dataset is not None:
+            binding.dataset_close(self.dataset)
+            self.dataset = None
         binding.vec_close(self.c_envs)
 
 def test_performance(timeout=10, atn_cache=1024):
@@ -90,5 +176,25 @@ def test_performance(timeout=10, atn_cache=1024):
 
     print(f"SPS: {env.num_agents * tick / (time.time() - start)}")
 
+def test_clone_mismatch():
+    src = DroneSwarm(num_envs=2, aero=True, wind_speed=5.0, mixed_tasks=True)
+    src.reset()
+    src.clone(0)
+    for settings in [dict(aero=False), dict(wind_speed=0.0), dict(tape_len=16), dict(mixed_tasks=False)]:
+        kwargs = dict(num_envs=2, aero=True, wind_speed=5.0, mixed_tasks=True)
+        kwargs.update(settings)
+        dst = DroneSwarm(**kwargs)
+        dst.reset()
+        try:
+            src.clone(0, target=dst)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError(f"clone into an env made with {settings} was not refused")
+        dst.close()
+    src.close()
+    print("clones between mismatched settings refused")
+
 if __name__ == "__main__":
+    test_clone_mismatch()
     test_performance()
@@ -0,0 +1,326 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Formations for DroneSwarm. Each generator lays out one slot per agent for
+// any number of agents: a grid filling the arena's proportions, a Fibonacci
+// sphere, a flag drawn from a bitmap function, or text in a 3x5 pixel font.
+// Agents are then matched to slots by an auction (Bertsekas, with epsilon
+// scaling) that minimizes the summed squared distance to the slots, rather
+// than picking slots by index and sending drones across each other's paths.
+//
+// The auction keeps slot positions and prices as separate arrays so each bid
+// is one linear scan, vectorized in the kernel clones, and the prices carry
+// over between scaling phases. Include after dronelib.h.
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FORM_EPS 0.1f // final auction epsilon in m^2, the summed squared distance is within n * FORM_EPS of optimal
+#define FORM_EPS_SCALE 4.0f // epsilon reduction per auction phase
+#define FORM_FILL 0.8f // fraction of the arena margins a formation may span
+
+typedef struct {
+    int n;
+    float* x; // slot positions
+    float* y;
+    float* z;
+    Color* colors; // slot colors, white unless the generator draws a picture
+    int* slot; // agent, by position in assign_formation's ids, -> slot
+    int* owner; // slot -> agent
+    float* w; // |slot|^2 plus the slot's auction price
+    int* queue;
+} Formation;
+
+void init_formation(Formation* f, int n) {
+    f->n = n;
+    f->x = (float*)arena_calloc(n, sizeof(float));
+    f->y = (float*)arena_calloc(n, sizeof(float));
+    f->z = (float*)arena_calloc(n, sizeof(float));
+    f->colors = (Color*)arena_calloc(n, sizeof(Color));
+    f->slot = (int*)arena_calloc(n, sizeof(int));
+    f->owner = (int*)arena_calloc(n, sizeof(int));
+    f->w = (float*)arena_calloc(n, sizeof(float));
+    f->queue = (int*)arena_calloc(n, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        f->slot[i] = i;
+    }
+}
+
+// Copies src's slots and assignment into dst, both allocated for as many agents
+void copy_formation(Formation* dst, const Formation* src) {
+    dst->n = src->n;
+    memcpy(dst->x, src->x, src->n * sizeof(float));
+    memcpy(dst->y, src->y, src->n * sizeof(float));
+    memcpy(dst->z, src->z, src->n * sizeof(float));
+    memcpy(dst->colors, src->colors, src->n * sizeof(Color));
+    memcpy(dst->slot, src->slot, src->n * sizeof(int));
+}
+
+void free_formation(Formation* f) {
+    arena_free(f->x);
+    arena_free(f->y);
+    arena_free(f->z);
+    arena_free(f->colors);
+    arena_free(f->slot);
+    arena_free(f->owner);
+    arena_free(f->w);
+    arena_free(f->queue);
+    *f = (Formation){0};
+}
+
+static inline void set_slot(Formation* f, int s, Vec3 pos, Color color) {
+    f->x[s] = pos.x;
+    f->y[s] = pos.y;
+    f->z[s] = pos.z;
+    f->colors[s] = color;
+}
+
+static inline Vec3 slot_pos(const Formation* f, int s) {
+    return (Vec3){f->x[s], f->y[s], f->z[s]};
+}
+
+// Grid with side ceil(cbrt(n)) around the origin, spaced spacing apart or
+// closer where the arena is too small. 64 agents fill a 4 x 4 x 4 cube.
+void formation_grid(Formation* f, float spacing) {
+    int side = (int)ceilf(cbrtf((float)f->n) - 1e-4f);
+    float gap = side > 1 ? 1.0f / (side - 1) : 0.0f;
+    Vec3 step = {
+        fminf(spacing, 2.0f * FORM_FILL * MARGIN_X * gap),
+        fminf(spacing, 2.0f * FORM_FILL * MARGIN_Y * gap),
+        fminf(spacing, 2.0f * FORM_FILL * MARGIN_Z * gap),
+    };
+    float half = 0.5f * (side - 1);
+    for (int s = 0; s < f->n; s++) {
+        int x = s % side;
+        int y = (s / side) % side;
+        int z = s / (side * side);
+        set_slot(f, s, (Vec3){step.x * (x - half), step.y * (y - half), step.z * (z - half)}, WHITE);
+    }
+}
+
+// Fibonacci sphere of the given radius around the origin
+void formation_sphere(Formation* f, float radius) {
+    float phi = PI * (sqrtf(5.0f) - 1.0f);
+    for (int s = 0; s < f->n; s++) {
+        float y = 1.0f - 2.0f * ((float)s / (float)f->n);
+        float r = sqrtf(1.0f - y * y);
+        float theta = phi * s;
+        set_slot(f, s, (Vec3){radius * cosf(theta) * r, radius * sinf(theta) * r, radius * y}, WHITE); // z up
+    }
+}
+
+// Color of a picture at u, v in [0, 1), v down
+typedef Color (*BitmapFn)(float u, float v);
+
+// Stars and stripes: blue canton over the top left quarter, four red and
+// four white stripes. On 64 agents this is the original 8 x 8 flag.
+Color flag_color(float u, float v) {
+    if (u < 0.5f && v < 0.5f) {
+        return (Color){0, 0, 255, 255};
+    }
+    return (int)(v * 8.0f) % 2 == 0 ? (Color){255, 0, 0, 255} : (Color){255, 255, 255, 255};
+}
+
+// Picture in the x = 0 plane facing +x, sampled on a near square grid of
+// n cells spaced spacing apart horizontally and 0.75 * spacing vertically,
+// shrunk to fit the arena
+void formation_bitmap(Formation* f, BitmapFn bitmap, float spacing) {
+    int cols = (int)ceilf(sqrtf((float)f->n));
+    int rows = (f->n + cols - 1) / cols;
+    float dy = spacing;
+    float dz = 0.75f * spacing;
+    float fit = fminf(2.0f * FORM_FILL * MARGIN_Y / fmaxf(dy * (cols - 1), 1e-6f),
+        2.0f * FORM_FILL * MARGIN_Z / fmaxf(dz * (rows - 1), 1e-6f));
+    fit = fminf(fit, 1.0f);
+    dy *= fit;
+    dz *= fit;
+    for (int s = 0; s < f->n; s++) {
+        int c = s % cols;
+        int r = s / cols;
+        Vec3 pos = {0.0f, dy * (c - 0.5f * (cols - 1)), dz * (0.5f * (rows - 1) - r)};
+        set_slot(f, s, pos, bitmap((float)c / cols, (float)r / rows));
+    }
+}
+
+// 3x5 pixel font, rows top to bottom, for A-Z and 0-9
+static const char* FORM_FONT[36] = {
+    "010101111101101", "110101110101110", "011100100100011", "110101101101110", // A B C D
+    "111100110100111", "111100110100100", "011100101101011", "101101111101101", // E F G H
+    "111010010010111", "001001001101010", "101101110101101", "100100100100111", // I J K L
+    "101111111101101", "110101101101101", "010101101101010", "110101110100100", // M N O P
+    "010101101110011", "110101110101101", "011100010001110", "111010010010010", // Q R S T
+    "101101101101111", "101101101101010", "101101111111101", "101101010101101", // U V W X
+    "101101010010010", "111001010100111", "111101101101111", "010110010010111", // Y Z 0 1
+    "110001010100111", "110001010001110", "101101111001001", "111100110001110", // 2 3 4 5
+    "011100111101111", "111001010010010", "111101111101111", "111101111001110", // 6 7 8 9
+};
+
+static const char* font_glyph(char c) {
+    if (c >= 'a' && c <= 'z') {
+        c -= 'a' - 'A';
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return FORM_FONT[c - 'A'];
+    }
+    if (c >= '0' && c <= '9') {
+        return FORM_FONT[26 + c - '0'];
+    }
+    return NULL; // space and anything unknown
+}
+
+// Text in the x = 0 plane facing +x. Lit pixels are split into k x k dots
+// until there are at least n, and n of them are picked evenly.
+void formation_text(Formation* f, const char* text, float spacing) {
+    int len = (int)strlen(text);
+    int cols = 4 * len - 1;
+    int lit = 0;
+    for (int i = 0; i < len; i++) {
+        const char* g = font_glyph(text[i]);
+        for (int p = 0; g != NULL && p < 15; p++) {
+            lit += g[p] == '1';
+        }
+    }
+    if (lit == 0) {
+        formation_grid(f, spacing);
+        return;
+    }
+    int k = (int)ceilf(sqrtf((float)f->n / lit) - 1e-4f);
+    k = k > 1 ? k : 1;
+    float pitch = fminf(fminf(spacing * k, 2.0f * FORM_FILL * MARGIN_Y / cols), 2.0f * FORM_FILL * MARGIN_Z / 5.0f);
+    float dot = pitch / k;
+    long total = (long)lit * k * k;
+    long next = 0; // index among all dots of the next slot's dot
+    int s = 0;
+    long d = 0;
+    for (int i = 0; i < len && s < f->n; i++) {
+        const char* g = font_glyph(text[i]);
+        for (int p = 0; g != NULL && p < 15 && s < f->n; p++) {
+            if (g[p] != '1') {
+                continue;
+            }
+            int col = 4 * i + p % 3;
+            int row = p / 3;
+            for (int sub = 0; sub < k * k && s < f->n; sub++, d++) {
+                if (d < next) {
+                    continue;
+                }
+                float y = pitch * (col - 0.5f * (cols - 1)) + dot * (sub % k - 0.5f * (k - 1));
+                float z = pitch * (2.0f - row) - dot * (sub / k - 0.5f * (k - 1));
+                set_slot(f, s, (Vec3){0.0f, y, z}, WHITE);
+                s++;
+                next = s * total / f->n;
+            }
+        }
+    }
+}
+
+#define FORM_LANES 16 // slots scanned side by side, two AVX2 or one AVX-512 register
+
+// Best and second best value 2 p . s - w[s] over all slots, where w holds
+// |s|^2 plus the slot's price: the squared distance up to the agent's own
+// constant |p|^2, so a bid is three multiply adds per slot. Each lane keeps
+// its own best, second and index over every FORM_LANES-th slot, a loop the
+// kernel clones vectorize at their width, and the lanes merge at the end.
+DRONE_KERNEL static int best_slot(const Formation* f, Vec3 p, float* best_v, float* second_v) {
+    float px = 2.0f * p.x, py = 2.0f * p.y, pz = 2.0f * p.z;
+    float lane_best[FORM_LANES], lane_second[FORM_LANES];
+    int lane_slot[FORM_LANES];
+    for (int k = 0; k < FORM_LANES; k++) {
+        lane_best[k] = -FLT_MAX;
+        lane_second[k] = -FLT_MAX;
+        lane_slot[k] = 0;
+    }
+    int s = 0;
+    for (; s + FORM_LANES <= f->n; s += FORM_LANES) {
+        for (int k = 0; k < FORM_LANES; k++) {
+            float v = px * f->x[s + k] + py * f->y[s + k] + pz * f->z[s + k] - f->w[s + k];
+            float lower = v < lane_best[k] ? v : lane_best[k];
+            lane_second[k] = lane_second[k] > lower ? lane_second[k] : lower;
+            lane_slot[k] = v > lane_best[k] ? s + k : lane_slot[k];
+            lane_best[k] = v > lane_best[k] ? v : lane_best[k];
+        }
+    }
+    float best = -FLT_MAX, second = -FLT_MAX;
+    int best_s = 0;
+    for (int k = 0; k < FORM_LANES; k++) {
+        if (lane_best[k] > best) {
+            second = best > lane_second[k] ? best : lane_second[k];
+            best = lane_best[k];
+            best_s = lane_slot[k];
+        } else {
+            second = second > lane_best[k] ? second : lane_best[k];
+        }
+    }
+    for (; s < f->n; s++) {
+        float v = px * f->x[s] + py * f->y[s] + pz * f->z[s] - f->w[s];
+        if (v > best) {
+            second = best;
+            best = v;
+            best_s = s;
+        } else if (v > second) {
+            second = v;
+        }
+    }
+    *best_v = best;
+    *second_v = f->n > 1 ? second : best;
+    return best_s;
+}
+
+// One auction phase at epsilon eps: every agent starts unassigned and bids
+// for its best slot by the gap to its second best plus eps, evicting the
+// previous owner, until all hold a slot.
+static void auction_phase(Formation* f, const Drone* agents, const int* ids, float eps) {
+    int n = f->n;
+    int head = 0, count = n;
+    for (int i = 0; i < n; i++) {
+        f->slot[i] = -1;
+        f->owner[i] = -1;
+        f->queue[i] = i;
+    }
+    while (count > 0) {
+        int i = f->queue[head];
+        head = (head + 1) % n;
+        count--;
+        float best, second;
+        int s = best_slot(f, agents[ids[i]].state.pos, &best, &second);
+        f->w[s] += best - second + eps;
+        int prev = f->owner[s];
+        f->owner[s] = i;
+        f->slot[i] = s;
+        if (prev >= 0) {
+            f->slot[prev] = -1;
+            f->queue[(head + count) % n] = prev;
+            count++;
+        }
+    }
+}
+
+// Matches the agents agents[ids[0]] to agents[ids[n - 1]] to slots minimizing
+// the summed squared distance to within n * FORM_EPS, filling f->slot by
+// position in ids. Squared distances rather than distances are what keep
+// the straight paths from agents to their slots apart.
+//
+// The bids run one after another on the env's thread and the number of bids
+// grows faster than n, so this is not a millisecond reset at scale: bench.c
+// has 64 agents at 0.1 ms, 1024 at 12 to 15 ms and 4096 at 200 to 230 ms
+// per formation, which then dominates every reset of a large swarm.
+void assign_formation(Formation* f, const Drone* agents, const int* ids) {
+    float reach = 0.0f;
+    for (int s = 0; s < f->n; s++) {
+        Vec3 pos = slot_pos(f, s);
+        f->w[s] = dot3(pos, pos);
+        Vec3 d = sub3(pos, agents[ids[s]].state.pos);
+        reach = fmaxf(reach, dot3(d, d));
+    }
+    float eps = fmaxf(reach / (FORM_EPS_SCALE * FORM_EPS_SCALE), FORM_EPS);
+    while (true) {
+        auction_phase(f, agents, ids, eps);
+        if (eps <= FORM_EPS) {
+            break;
+        }
+        eps = fmaxf(eps / FORM_EPS_SCALE, FORM_EPS);
+    }
+}
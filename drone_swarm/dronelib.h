@@ -5,6 +5,7 @@
 #include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,65 @@
 
 #include "raylib.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The physics, observation and neighbor kernels are compiled once per x86
+// level and the loader picks the best clone the CPU supports, so one build
+// runs AVX-512 code on nodes that have it and SSE4.2 code on older ones.
+// AVX-512F carries FMA, so contraction is off to keep every clone rounding
+// like the others: a node's ISA never changes its rollouts. Other targets and
+// compilers without target_clones get plain functions for the compile flags.
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define KERNEL_CLONES 1
+#define DRONE_KERNEL \
+    __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default"), optimize("fp-contract=off")))
+#endif
+#endif
+#ifndef DRONE_KERNEL
+#define KERNEL_CLONES 0
+#define DRONE_KERNEL
+#endif
+
+// Kernel set the loader picked for this CPU, checked in the same order
+static const char* kernel_isa(void) {
+#if KERNEL_CLONES
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512f";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return "sse4.2";
+    }
+    return "default";
+#else
+    return "compile flags";
+#endif
+}
+
+// Says which kernel set runs, once per process from the first env init,
+// when DRONE_LOG_KERNELS is set to anything but 0. The bindings also return
+// it from kernel_isa().
+static void log_kernels(void) {
+    static bool logged = false;
+    if (!logged) {
+        logged = true;
+        const char* flag = getenv("DRONE_LOG_KERNELS");
+        if (flag != NULL && flag[0] != '\0' && strcmp(flag, "0") != 0) {
+            fprintf(stderr, "drone: %s kernels\n", kernel_isa());
+        }
+    }
+}
+
 // Visualisation properties
 #define WIDTH 1080
 #define HEIGHT 720
@@ -46,6 +106,65 @@
 #define DT 0.05f
 #define DT_RNG 0.0f
 
+// Integrators, chosen per drone
+#define INTEGRATOR_RK4 0  // fixed step
+#define INTEGRATOR_RK45 1 // Dormand-Prince 5(4), adaptive
+#define INTEGRATOR_RK23 2 // Bogacki-Shampine 3(2), adaptive
+#define INTEGRATOR_EXP_RK4 3   // exact motor lag, RK4 rigid body
+#define INTEGRATOR_EXP_EULER 4 // exact motor lag, semi-implicit Euler rigid body
+#define INTEGRATOR_EULER 5
+#define INTEGRATOR_SEMI_EULER 6
+#define INTEGRATOR_RK2 7
+#define INTEGRATOR_EULER_D 8 // double precision variants
+#define INTEGRATOR_SEMI_EULER_D 9
+#define INTEGRATOR_RK2_D 10
+#define INTEGRATOR_RK4_D 11
+#define INTEGRATOR_N 12
+
+// Adaptive step size control
+#define ADAPT_RTOL 1e-3f
+#define ADAPT_ATOL 1e-3f
+#define ADAPT_MIN_STEP 1e-4f
+#define ADAPT_SAFETY 0.9f
+
+// Wind
+#define WIND_CELL 2.0f         // m between grid nodes
+#define WIND_SMOOTH_PASSES 3   // box blurs of the white noise grid
+#define WIND_TURBULENCE 0.3f   // turbulence rms, fraction of wind strength
+#define WIND_GUST 0.3f         // gust rms, fraction of wind strength
+#define WIND_GUST_TAU 2.0f     // s, gust correlation time
+#define WIND_BANK 16           // turbulence grids shared by all envs
+#define WIND_BANK_SEED 0x9e3779b9u // the bank's own stream, so making it never draws from rand()
+
+// Control modes, what the four actions command
+#define CONTROL_RPM 0  // motor rpm targets
+#define CONTROL_RATE 1 // collective thrust and body rates, tracked by rate_control
+#define CONTROL_N 2
+
+// Rate controller
+#define RATE_HZ 500.0f   // inner loop and physics rate in CONTROL_RATE
+#define RATE_MAX 3.0f    // rad/s, body rate at full action
+#define RATE_KP 50.0f    // 1/s, rate error to angular acceleration
+#define RATE_KI 10.0f    // 1/s^2
+#define RATE_I_MAX 0.5f  // rad, integrated rate error clamp
+
+// Geometric tracking expert
+#define EXPERT_KX 1.5f        // 1/s^2, position error to acceleration
+#define EXPERT_KV 1.5f        // 1/s, velocity error to acceleration
+#define EXPERT_KR 4.0f        // 1/s, attitude error to body rate
+#define EXPERT_KW 8.0f        // 1/s, body rate error to angular acceleration
+#define EXPERT_MAX_ACC 6.0f   // m/s^2, commanded acceleration besides gravity
+#define EXPERT_MAX_SPEED 4.0f // m/s, approach speed towards far targets
+#define EXPERT_SPEED 2.0f     // m/s through rings
+#define EXPERT_LEAD 1.5f      // m, lookahead along a ring's axis
+
+// Downwash and ground effect
+#define AERO_CELL 2.0f        // m, index cell width, at least the widest downwash cone
+#define DOWNWASH_RANGE 3.0f   // m below the rotor plane
+#define DOWNWASH_SPREAD 0.25f // growth of the wake radius per m of depth
+#define DOWNWASH_LOSS 0.5f    // thrust lost at the wake center below an equal drone
+#define AERO_MIN_SCALE 0.2f   // floor on the downwash thrust scale
+
 // Corner to corner distance
 #define MAX_DIST sqrtf((2*GRID_X)*(2*GRID_X) + (2*GRID_Y)*(2*GRID_Y) + (2*GRID_Z)*(2*GRID_Z))
 
@@ -82,6 +201,25 @@ static inline float rndf(float a, float b) {
     return a + ((float)rand() / (float)RAND_MAX) * (b - a);
 }
 
+// Envs and drones draw from their own xorshift streams rather than rand(),
+// so a cloned env replays exactly the draws of its source
+static inline uint32_t rng_next(uint32_t* rng) {
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+// Uniform in [a, b)
+static inline float rng_uniform(uint32_t* rng, float a, float b) {
+    return a + (float)(rng_next(rng) >> 8) * (1.0f / 16777216.0f) * (b - a);
+}
+
+// Nonzero stream seed from rand(), so srand still seeds every stream
+static inline uint32_t rng_seed(void) { return (uint32_t)rand() | 1u; }
+
 static inline Vec3 add3(Vec3 a, Vec3 b) { return (Vec3){a.x + b.x, a.y + b.y, a.z + b.z}; }
 
 static inline Quat add_quat(Quat a, Quat b) { return (Quat){a.w + b.w, a.x + b.x, a.y + b.y, a.z + b.z}; }
@@ -96,6 +234,10 @@ static inline float dot3(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z *
 
 static inline float norm3(Vec3 a) { return sqrtf(dot3(a, a)); }
 
+static inline Vec3 cross3(Vec3 a, Vec3 b) {
+    return (Vec3){a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
 static inline void clamp3(Vec3 *vec, float min, float max) {
     vec->x = clampf(vec->x, min, max);
     vec->y = clampf(vec->y, min, max);
@@ -138,10 +280,10 @@ static inline Vec3 quat_rotate(Quat q, Vec3 v) {
 
 static inline Quat quat_inverse(Quat q) { return (Quat){q.w, -q.x, -q.y, -q.z}; }
 
-Quat rndquat() {
-    float u1 = rndf(0.0f, 1.0f);
-    float u2 = rndf(0.0f, 1.0f);
-    float u3 = rndf(0.0f, 1.0f);
+Quat rndquat(uint32_t* rng) {
+    float u1 = rng_uniform(rng, 0.0f, 1.0f);
+    float u2 = rng_uniform(rng, 0.0f, 1.0f);
+    float u3 = rng_uniform(rng, 0.0f, 1.0f);
 
     float sqrt_1_minus_u1 = sqrtf(1.0f - u1);
     float sqrt_u1 = sqrtf(u1);
@@ -165,14 +307,14 @@ typedef struct {
     float radius;
 } Ring;
 
-Ring rndring(float radius) {
+Ring rndring(float radius, uint32_t* rng) {
     Ring ring;
 
-    ring.pos.x = rndf(-GRID_X + 2*radius, GRID_X - 2*radius);
-    ring.pos.y = rndf(-GRID_Y + 2*radius, GRID_Y - 2*radius);
-    ring.pos.z = rndf(-GRID_Z + 2*radius, GRID_Z - 2*radius);
+    ring.pos.x = rng_uniform(rng, -GRID_X + 2*radius, GRID_X - 2*radius);
+    ring.pos.y = rng_uniform(rng, -GRID_Y + 2*radius, GRID_Y - 2*radius);
+    ring.pos.z = rng_uniform(rng, -GRID_Z + 2*radius, GRID_Z - 2*radius);
 
-    ring.orientation = rndquat();
+    ring.orientation = rndquat(rng);
 
     Vec3 base_normal = {0.0f, 0.0f, 1.0f};
     ring.normal = quat_rotate(ring.orientation, base_normal);
@@ -196,6 +338,9 @@ typedef struct {
     float rpms[4]; // motor RPMs
 } State;
 
+// State and StateDerivative are also read as flat arrays in the same order
+#define STATE_DIM 17
+
 typedef struct {
     Vec3 vel;       // Derivative of position
     Vec3 v_dot;       // Derivative of velocity
@@ -204,6 +349,302 @@ typedef struct {
     float rpm_dot[4]; // Derivative of motor RPMs
 } StateDerivative;
 
+// Per-episode wind over the GRID_* volume. A periodic grid of smoothed
+// noise gives the turbulence, frozen in the air and carried by the mean
+// wind, and a first order (Dryden-style) OU gust is shared by the whole
+// volume. Turbulence grids are generated once into a bank shared by every
+// env, each episode picks one at a random offset, so resets stay cheap.
+// Nodes are stored as (x, y, z, 0) so one node is one SSE load, and each
+// axis repeats its first plane at the end so the far corners of a cell are
+// fixed strides from the near one, with no wrap.
+typedef struct {
+    const float* nodes; // (nx + 1) * (ny + 1) * (nz + 1) nodes, x fastest, unit rms
+    int nx, ny, nz;
+    int sy, sz; // node strides along y and z
+    float strength;   // m/s, 0 disables wind
+    float turbulence; // m/s rms of the grid
+    Vec3 mean;
+    Vec3 gust;
+    Vec3 offset; // distance the turbulence has drifted with the mean wind
+    float shift[4]; // grid coordinate of the origin, kept > n so it truncates, then a 0 pad
+    float gust_dt, gust_decay, gust_noise; // OU update for the last dt
+    uint32_t rng; // gust stream, see rng_next
+} WindField;
+
+// Made by the first init_wind and freed by the last free_wind. Not thread
+// safe, like the arena.
+static float* wind_bank = NULL;
+static int wind_users = 0;
+
+static inline int wrapi(int i, int n) {
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+// Wraps x into [-period / 2, period / 2), for x at most a period outside
+static inline float wrapf(float x, float period) {
+    return x >= 0.5f * period ? x - period : x < -0.5f * period ? x + period : x;
+}
+
+// Box blur along one axis of a periodic grid, radius one node
+static void blur_wind(float* nodes, float* tmp, const int n[3], int axis) {
+    int stride[3] = {1, n[0], n[0] * n[1]};
+    for (int k = 0; k < n[2]; k++) {
+        for (int j = 0; j < n[1]; j++) {
+            for (int i = 0; i < n[0]; i++) {
+                int idx[3] = {i, j, k};
+                int at = i + n[0] * (j + n[1] * k);
+                int lo = at + (wrapi(idx[axis] - 1, n[axis]) - idx[axis]) * stride[axis];
+                int hi = at + (wrapi(idx[axis] + 1, n[axis]) - idx[axis]) * stride[axis];
+                for (int c = 0; c < 3; c++) {
+                    tmp[4 * at + c] = (nodes[4 * lo + c] + nodes[4 * at + c] + nodes[4 * hi + c]) / 3.0f;
+                }
+            }
+        }
+    }
+    memcpy(nodes, tmp, 4 * n[0] * n[1] * n[2] * sizeof(float));
+}
+
+// Smoothed noise with unit rms per component drawn from rng, written padded
+// into out
+static void make_turbulence(float* out, const int n[3], uint32_t* rng) {
+    int count = n[0] * n[1] * n[2];
+    float* nodes = calloc(4 * count, sizeof(float));
+    for (int i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            nodes[4 * i + c] = rng_uniform(rng, -1.0f, 1.0f);
+        }
+        nodes[4 * i + 3] = 0.0f;
+    }
+    float* tmp = calloc(4 * count, sizeof(float));
+    for (int pass = 0; pass < WIND_SMOOTH_PASSES; pass++) {
+        for (int axis = 0; axis < 3; axis++) {
+            blur_wind(nodes, tmp, n, axis);
+        }
+    }
+    free(tmp);
+
+    double ss = 0.0;
+    for (int i = 0; i < 4 * count; i++) {
+        ss += nodes[i] * nodes[i];
+    }
+    float scale = 1.0f / sqrtf(ss / (3.0 * count));
+    int at = 0;
+    for (int k = 0; k <= n[2]; k++) {
+        for (int j = 0; j <= n[1]; j++) {
+            for (int i = 0; i <= n[0]; i++, at++) {
+                const float* node = &nodes[4 * (i % n[0] + n[0] * (j % n[1] + n[1] * (k % n[2])))];
+                for (int c = 0; c < 4; c++) {
+                    out[4 * at + c] = scale * node[c];
+                }
+            }
+        }
+    }
+    free(nodes);
+}
+
+void init_wind(WindField* wind, float strength) {
+    *wind = (WindField){0};
+    wind->nx = (int)(2.0f * GRID_X / WIND_CELL + 0.5f);
+    wind->ny = (int)(2.0f * GRID_Y / WIND_CELL + 0.5f);
+    wind->nz = (int)(2.0f * GRID_Z / WIND_CELL + 0.5f);
+    wind->strength = strength;
+    wind->turbulence = WIND_TURBULENCE * strength;
+
+    wind->sy = wind->nx + 1;
+    wind->sz = (wind->nx + 1) * (wind->ny + 1);
+
+    int n[3] = {wind->nx, wind->ny, wind->nz};
+    int count = wind->sz * (wind->nz + 1);
+    if (wind_bank == NULL) {
+        uint32_t rng = WIND_BANK_SEED;
+        wind_bank = calloc(4 * count * WIND_BANK, sizeof(float));
+        for (int b = 0; b < WIND_BANK; b++) {
+            make_turbulence(&wind_bank[4 * count * b], n, &rng);
+        }
+    }
+    wind_users++;
+    wind->nodes = wind_bank;
+}
+
+void free_wind(WindField* wind) {
+    if (wind->nodes != NULL && --wind_users == 0) {
+        free(wind_bank);
+        wind_bank = NULL;
+    }
+    wind->nodes = NULL;
+}
+
+static void update_wind_shift(WindField* wind) {
+    wind->shift[0] = (GRID_X - wind->offset.x) / WIND_CELL + wind->nx;
+    wind->shift[1] = (GRID_Y - wind->offset.y) / WIND_CELL + wind->ny;
+    wind->shift[2] = (GRID_Z - wind->offset.z) / WIND_CELL + wind->nz;
+}
+
+// New turbulence, mean wind and gust for an episode, drawn from rng
+void reset_wind(WindField* wind, uint32_t* rng) {
+    int count = wind->sz * (wind->nz + 1);
+    wind->nodes = &wind_bank[4 * count * (rng_next(rng) % WIND_BANK)];
+
+    float heading = rng_uniform(rng, 0.0f, 2.0f * (float)M_PI);
+    float speed = rng_uniform(rng, 0.0f, wind->strength);
+    wind->mean = (Vec3){speed * cosf(heading), speed * sinf(heading), 0.0f};
+    wind->gust = (Vec3){0.0f, 0.0f, 0.0f};
+    wind->offset = (Vec3){rng_uniform(rng, -GRID_X, GRID_X), rng_uniform(rng, -GRID_Y, GRID_Y),
+        rng_uniform(rng, -GRID_Z, GRID_Z)};
+    wind->rng = rng_next(rng) | 1u;
+    update_wind_shift(wind);
+}
+
+// Uniform in [-1, 1)
+static inline float wind_noise(WindField* wind) {
+    return rng_uniform(&wind->rng, -1.0f, 1.0f);
+}
+
+// Advances the gust and drifts the turbulence by one env step
+void advance_wind(WindField* wind, float dt) {
+    if (dt != wind->gust_dt) {
+        wind->gust_dt = dt;
+        wind->gust_decay = expf(-dt / WIND_GUST_TAU);
+        // scaled for uniform noise with unit variance
+        float d = wind->gust_decay;
+        wind->gust_noise = WIND_GUST * wind->strength * sqrtf(3.0f * (1.0f - d * d));
+    }
+    float decay = wind->gust_decay, noise = wind->gust_noise;
+    wind->gust.x = decay * wind->gust.x + noise * wind_noise(wind);
+    wind->gust.y = decay * wind->gust.y + noise * wind_noise(wind);
+    wind->gust.z = decay * wind->gust.z + noise * wind_noise(wind);
+    // the grid is periodic, keep the offset within one period
+    wind->offset.x = wrapf(wind->offset.x + wind->mean.x * dt, 2.0f * GRID_X);
+    wind->offset.y = wrapf(wind->offset.y + wind->mean.y * dt, 2.0f * GRID_Y);
+    wind->offset.z = wrapf(wind->offset.z + wind->mean.z * dt, 2.0f * GRID_Z);
+    update_wind_shift(wind);
+}
+
+// Grid cell and fractions of the turbulence at a position, returning the
+// index of the cell's near corner. f takes 4 floats, the last is scratch.
+// The offset is wrapped to one period, so for positions within a period of
+// the volume the grid coordinate is positive and under 3n, where truncation
+// floors it and two conditional subtracts wrap it without a division.
+// Anything further out takes the slow path.
+static inline int wind_cell(const WindField* wind, float x, float y, float z, float* f) {
+#if defined(__SSE2__)
+    __m128 g = _mm_add_ps(_mm_mul_ps(_mm_setr_ps(x, y, z, 0.0f), _mm_set1_ps(1.0f / WIND_CELL)),
+        _mm_loadu_ps(wind->shift));
+    __m128i i = _mm_cvttps_epi32(g);
+    __m128 fr = _mm_sub_ps(g, _mm_cvtepi32_ps(i));
+    __m128i n = _mm_setr_epi32(wind->nx, wind->ny, wind->nz, 1);
+    i = _mm_sub_epi32(i, _mm_andnot_si128(_mm_cmpgt_epi32(n, i), n));
+    i = _mm_sub_epi32(i, _mm_andnot_si128(_mm_cmpgt_epi32(n, i), n));
+    __m128i inside = _mm_andnot_si128(_mm_cmplt_epi32(i, _mm_setzero_si128()), _mm_cmpgt_epi32(n, i));
+    int outside = _mm_movemask_ps(_mm_cmplt_ps(g, _mm_setzero_ps())) | (_mm_movemask_epi8(inside) != 0xffff);
+    _mm_storeu_ps(f, fr);
+    if (!outside) {
+        return _mm_cvtsi128_si32(i) + wind->sy * _mm_cvtsi128_si32(_mm_shuffle_epi32(i, 0x55))
+            + wind->sz * _mm_cvtsi128_si32(_mm_shuffle_epi32(i, 0xaa));
+    }
+    float gs[4];
+    _mm_storeu_ps(gs, g);
+    int n3[3] = {wind->nx, wind->ny, wind->nz};
+    int at[3];
+    for (int a = 0; a < 3; a++) {
+        float fl = floorf(gs[a]);
+        f[a] = gs[a] - fl;
+        at[a] = wrapi((int)fl, n3[a]);
+    }
+#else
+    float g[3] = {
+        x / WIND_CELL + wind->shift[0],
+        y / WIND_CELL + wind->shift[1],
+        z / WIND_CELL + wind->shift[2],
+    };
+    int n[3] = {wind->nx, wind->ny, wind->nz};
+    int at[3];
+    for (int a = 0; a < 3; a++) {
+        int i = (int)g[a];
+        i -= (float)i > g[a];
+        f[a] = g[a] - (float)i;
+        i -= i >= n[a] ? n[a] : 0;
+        i -= i >= n[a] ? n[a] : 0;
+        if ((unsigned)i >= (unsigned)n[a]) {
+            i = wrapi(i, n[a]);
+        }
+        at[a] = i;
+    }
+#endif
+    return at[0] + wind->sy * at[1] + wind->sz * at[2];
+}
+
+// Trilinear wind velocity at a position, in m/s. Each step waits on the
+// sample at its start, so the corners are weighted and summed as a
+// tree, the weights computed while the nodes load, rather than lerped one
+// axis after the other.
+static inline void sample_wind(const WindField* wind, float x, float y, float z, float out[3]) {
+    float f[4];
+    const float* n = &wind->nodes[4 * wind_cell(wind, x, y, z, f)];
+    int sy = 4 * wind->sy, sz = 4 * wind->sz;
+#if defined(__SSE2__)
+    #define WIND_TERM(i, j, k, wx, wyz) _mm_mul_ps(_mm_loadu_ps(&n[4 * i + sy * j + sz * k]), _mm_mul_ps(wx, wyz))
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 fr = _mm_loadu_ps(f);
+    __m128 x1 = _mm_shuffle_ps(fr, fr, 0x00), y1 = _mm_shuffle_ps(fr, fr, 0x55), z1 = _mm_shuffle_ps(fr, fr, 0xaa);
+    __m128 x0 = _mm_sub_ps(one, x1), y0 = _mm_sub_ps(one, y1), z0 = _mm_sub_ps(one, z1);
+    __m128 y0z0 = _mm_mul_ps(y0, z0), y1z0 = _mm_mul_ps(y1, z0), y0z1 = _mm_mul_ps(y0, z1), y1z1 = _mm_mul_ps(y1, z1);
+    __m128 w = _mm_add_ps(
+        _mm_add_ps(_mm_add_ps(WIND_TERM(0, 0, 0, x0, y0z0), WIND_TERM(1, 0, 0, x1, y0z0)),
+                   _mm_add_ps(WIND_TERM(0, 1, 0, x0, y1z0), WIND_TERM(1, 1, 0, x1, y1z0))),
+        _mm_add_ps(_mm_add_ps(WIND_TERM(0, 0, 1, x0, y0z1), WIND_TERM(1, 0, 1, x1, y0z1)),
+                   _mm_add_ps(WIND_TERM(0, 1, 1, x0, y1z1), WIND_TERM(1, 1, 1, x1, y1z1))));
+    w = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(wind->turbulence), w), _mm_setr_ps(
+        wind->mean.x + wind->gust.x, wind->mean.y + wind->gust.y, wind->mean.z + wind->gust.z, 0.0f));
+    float v[4];
+    _mm_storeu_ps(v, w);
+    out[0] = v[0];
+    out[1] = v[1];
+    out[2] = v[2];
+    #undef WIND_TERM
+#else
+    float term[8][3];
+    for (int corner = 0; corner < 8; corner++) {
+        int i = corner & 1, j = (corner >> 1) & 1, k = corner >> 2;
+        float weight = (i ? f[0] : 1.0f - f[0]) * ((j ? f[1] : 1.0f - f[1]) * (k ? f[2] : 1.0f - f[2]));
+        const float* node = &n[4 * i + sy * j + sz * k];
+        for (int c = 0; c < 3; c++) {
+            term[corner][c] = node[c] * weight;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        float w = ((term[0][c] + term[1][c]) + (term[2][c] + term[3][c]))
+            + ((term[4][c] + term[5][c]) + (term[6][c] + term[7][c]));
+        out[c] = wind->turbulence * w + (c == 0 ? wind->mean.x + wind->gust.x
+            : c == 1 ? wind->mean.y + wind->gust.y : wind->mean.z + wind->gust.z);
+    }
+#endif
+}
+
+// Spatial gradient of the wind, grad[c][a] = d wind_c / d pos_a
+static inline void sample_wind_grad(const WindField* wind, float x, float y, float z, float grad[3][3]) {
+    float f[4];
+    const float* n = &wind->nodes[4 * wind_cell(wind, x, y, z, f)];
+    int sy = 4 * wind->sy, sz = 4 * wind->sz;
+    memset(grad, 0, 9 * sizeof(float));
+    for (int corner = 0; corner < 8; corner++) {
+        int ijk[3] = {corner & 1, (corner >> 1) & 1, corner >> 2};
+        float wt[3], dwt[3];
+        for (int a = 0; a < 3; a++) {
+            wt[a] = ijk[a] ? f[a] : 1.0f - f[a];
+            dwt[a] = (ijk[a] ? 1.0f : -1.0f) / WIND_CELL;
+        }
+        const float* node = &n[4 * ijk[0] + sy * ijk[1] + sz * ijk[2]];
+        for (int c = 0; c < 3; c++) {
+            float v = wind->turbulence * node[c];
+            grad[c][0] += dwt[0] * wt[1] * wt[2] * v;
+            grad[c][1] += wt[0] * dwt[1] * wt[2] * v;
+            grad[c][2] += wt[0] * wt[1] * dwt[2] * v;
+        }
+    }
+}
+
 typedef struct {
     // Physical properties. Modeled as part of the drone
     // to make domain randomization easier.
@@ -222,72 +663,206 @@ typedef struct {
     float max_omega; // rad/s
     float k_mot; // s
     float j_mot; // kgm^2
+
+    // Downwash and ground effect, set each step by update_aero
+    float thrust_scale; // 1 in free air
+
+    // Environment, shared by the drones of an env
+    const WindField* wind; // NULL in still air
 } Params;
 
+// Advances the state by dt, returns the number of derivative evaluations.
+// h is the adaptive step size, unused by fixed step integrators.
+typedef int (*IntegratorStep)(State* state, Params* params, float* actions, float dt, float* h);
+
+// Ring buffer of the most recent steps since the last reset, for gradients
+// by tape_backward. The state before each step is the only checkpoint, the
+// RK4 stages are recomputed in the backward pass.
 typedef struct {
-    // core state and parameters
-    State state;
-    Params params;
+    State* states;  // state before each step
+    float* actions; // clamped actions of each step
+    float* dts;
+    Vec3* targets;  // target_pos before each step
+    float* scales;  // params.thrust_scale of each step, downwash changes it
+    int capacity;   // 0 disables recording
+    int len;        // steps recorded, up to capacity
+    int head;       // next slot to write
+} Tape;
+
+// Env buffers come from a process wide arena of 2 MB chunks, so the envs of
+// a vec env built one after another sit next to each other in memory and,
+// with transparent huge pages, behind a few TLB entries instead of hundreds
+// of scattered 4 KB pages. Every allocation starts on a cache line and is
+// padded to whole lines, so envs stepped on different threads never write to
+// a shared line. A chunk is released once everything in it is freed. Not
+// thread safe, envs are built and closed from one thread.
+#define CACHE_LINE 64
+#define ARENA_CHUNK (2 << 20)
 
-    // helpers for ring/swarm logic
-    Vec3 spawn_pos;
+typedef struct {
+    size_t size; // bytes, a multiple of ARENA_CHUNK
+    size_t used;
+    int live; // allocations not yet freed
+} ArenaChunk;
+
+static ArenaChunk* arena_chunk = NULL; // chunk being filled
+
+// Plain heap allocations instead, to compare against. Only change it while
+// no arena allocation is live.
+static bool arena_heap = false;
+
+static inline size_t round_up(size_t bytes, size_t to) {
+    return (bytes + to - 1) / to * to;
+}
+
+// Zeroed storage for count items of size bytes, release with arena_free.
+// Chunks are ARENA_CHUNK aligned and every allocation starts in its chunk's
+// first ARENA_CHUNK bytes, so a pointer finds its chunk by masking. An
+// allocation too big for one chunk gets a larger chunk of its own that
+// nothing else is appended to, which keeps that true.
+static void* arena_calloc(size_t count, size_t size) {
+    size_t bytes = round_up(count * size > 0 ? count * size : 1, CACHE_LINE);
+    if (arena_heap) {
+        void* ptr = aligned_alloc(CACHE_LINE, bytes);
+        if (ptr != NULL) {
+            memset(ptr, 0, bytes);
+        }
+        return ptr;
+    }
+    bool oversize = CACHE_LINE + bytes > ARENA_CHUNK;
+    ArenaChunk* chunk = arena_chunk;
+    if (oversize || chunk == NULL || chunk->used + bytes > chunk->size) {
+        size_t chunk_size = round_up(CACHE_LINE + bytes, ARENA_CHUNK);
+        chunk = (ArenaChunk*)aligned_alloc(ARENA_CHUNK, chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+#if defined(MADV_HUGEPAGE)
+        madvise(chunk, chunk_size, MADV_HUGEPAGE);
+#endif
+        *chunk = (ArenaChunk){.size = chunk_size, .used = CACHE_LINE};
+        if (!oversize) {
+            arena_chunk = chunk; // the last one lives on until its allocations are freed
+        }
+    }
+    unsigned char* ptr = (unsigned char*)chunk + chunk->used;
+    chunk->used += bytes;
+    chunk->live++;
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+static void arena_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (arena_heap) {
+        free(ptr);
+        return;
+    }
+    ArenaChunk* chunk = (ArenaChunk*)((uintptr_t)ptr & ~(uintptr_t)(ARENA_CHUNK - 1));
+    if (--chunk->live == 0) {
+        if (chunk == arena_chunk) {
+            arena_chunk = NULL;
+        }
+        free(chunk);
+    }
+}
+
+// Split by how often a step touches each field into cache line aligned
+// blocks: the hot block is everything move_drone reads or writes, with the
+// recording flag standing in for the tape, the warm block what targets,
+// rewards and observations use every env step, the cold block what only
+// resets, settings and the tape use. 320 bytes, five lines, of which a step
+// touches the first three. Params and State alone take 140 bytes, more than
+// two lines, and every derivative evaluation reads both.
+// Arrays of drones need line aligned storage, see alloc_drones.
+
+typedef struct {
+    // hot: core state and parameters
+    _Alignas(CACHE_LINE) Params params;
+    State state;
     Vec3 prev_pos;
-    Vec3 target_pos;
+    IntegratorStep step; // set with set_integrator
+    float h; // adaptive step size, carried between policy steps
+    int control; // inner loop, set with set_control
+    uint32_t rng; // domain randomization and dt jitter, seeded by init_drone if 0
+    Vec3 rate_integral; // integrated body rate error, rad
+    bool recording; // steps go to the tape, see init_drone_tape
+
+    // warm: helpers for ring/swarm logic and running episode stats
+    _Alignas(CACHE_LINE) Vec3 target_pos;
     Vec3 target_vel;
-
-    // logging utils
+    Vec3 spawn_pos;
     float last_abs_reward;
     float last_target_reward;
     float last_collision_reward;
     float episode_return;
-    float collisions;
     int episode_length;
     float score;
     int ring_idx;
+
+    // cold: gradient tape, settings and rare logging
+    _Alignas(CACHE_LINE) Tape tape;
+    int integrator; // INTEGRATOR_*, see step
+    float collisions;
 } Drone;
 
+// Zeroed storage for n drones, release with arena_free
+static inline Drone* alloc_drones(int n) {
+    return (Drone*)arena_calloc(n, sizeof(Drone));
+}
+
+void set_integrator(Drone* drone, int integrator);
+void set_control(Drone* drone, int control);
+
 
 void init_drone(Drone* drone, float size, float dr) {
+    uint32_t* rng = &drone->rng;
+    if (*rng == 0) {
+        *rng = rng_seed();
+    }
     drone->params.arm_len = size / 2.0f;
 
     // m ~ x^3
     float mass_scale = powf(drone->params.arm_len, 3.0f) / powf(BASE_ARM_LEN, 3.0f);
-    drone->params.mass = BASE_MASS * mass_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.mass = BASE_MASS * mass_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     // I ~ mx^2
     float base_Iscale = BASE_MASS * BASE_ARM_LEN * BASE_ARM_LEN;
     float I_scale = drone->params.mass * powf(drone->params.arm_len, 2.0f) / base_Iscale;
-    drone->params.ixx = BASE_IXX * I_scale * rndf(1.0f - dr, 1.0f + dr);
-    drone->params.iyy = BASE_IYY * I_scale * rndf(1.0f - dr, 1.0f + dr);
-    drone->params.izz = BASE_IZZ * I_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.ixx = BASE_IXX * I_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
+    drone->params.iyy = BASE_IYY * I_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
+    drone->params.izz = BASE_IZZ * I_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     // k_thrust ~ m/l
     float k_thrust_scale = (drone->params.mass * drone->params.arm_len) / (BASE_MASS * BASE_ARM_LEN);
-    drone->params.k_thrust = BASE_K_THRUST * k_thrust_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.k_thrust = BASE_K_THRUST * k_thrust_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     // k_ang_damp ~ I
     float base_avg_inertia = (BASE_IXX + BASE_IYY + BASE_IZZ) / 3.0f;
     float avg_inertia = (drone->params.ixx + drone->params.iyy + drone->params.izz) / 3.0f;
     float avg_inertia_scale = avg_inertia / base_avg_inertia;
-    drone->params.k_ang_damp = BASE_K_ANG_DAMP * avg_inertia_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.k_ang_damp = BASE_K_ANG_DAMP * avg_inertia_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     // drag ~ x^2
     float drag_scale = powf(drone->params.arm_len, 2.0f) / powf(BASE_ARM_LEN, 2.0f);
-    drone->params.k_drag = BASE_K_DRAG * drag_scale * rndf(1.0f - dr, 1.0f + dr);
-    drone->params.b_drag = BASE_B_DRAG * drag_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.k_drag = BASE_K_DRAG * drag_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
+    drone->params.b_drag = BASE_B_DRAG * drag_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     // Small gravity randomization
-    drone->params.gravity = BASE_GRAVITY * rndf(0.99f, 1.01f);
+    drone->params.gravity = BASE_GRAVITY * rng_uniform(rng, 0.99f, 1.01f);
 
     // RPM ~ 1/x
     float rpm_scale = (BASE_ARM_LEN) / (drone->params.arm_len);
-    drone->params.max_rpm = BASE_MAX_RPM * rpm_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.max_rpm = BASE_MAX_RPM * rpm_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
 
     drone->params.max_vel = BASE_MAX_VEL;
     drone->params.max_omega = BASE_MAX_OMEGA;
 
-    drone->params.k_mot = BASE_K_MOT * rndf(1.0f - dr, 1.0f + dr);
-    drone->params.j_mot = BASE_J_MOT * I_scale * rndf(1.0f - dr, 1.0f + dr);
+    drone->params.k_mot = BASE_K_MOT * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
+    drone->params.j_mot = BASE_J_MOT * I_scale * rng_uniform(rng, 1.0f - dr, 1.0f + dr);
+    drone->params.thrust_scale = 1.0f;
     
     for (int i = 0; i < 4; i++) {
         drone->state.rpms[i] = 0.0f;
@@ -297,164 +872,660 @@ void init_drone(Drone* drone, float size, float dr) {
     drone->state.vel = (Vec3){0.0f, 0.0f, 0.0f};
     drone->state.omega = (Vec3){0.0f, 0.0f, 0.0f};
     drone->state.quat = (Quat){1.0f, 0.0f, 0.0f, 0.0f};
+    drone->h = DT;
+    set_integrator(drone, drone->integrator);
+    set_control(drone, drone->control);
 }
 
+// Fixed step integrators, generated in float and double
+#define REAL float
+#define REAL_FN(name) name##_f
+#include "dronedyn.h"
+#define REAL double
+#define REAL_FN(name) name##_d
+#include "dronedyn.h"
+
 void compute_derivatives(State* state, Params* params, float* actions, StateDerivative* derivatives) {
-    // first order rpm lag
-    float target_rpms[4];
+    derivs_f((const float*)state, params, actions, (float*)derivatives);
+}
+
+// compute_derivatives in the wind held over a step, see held_air
+static inline void held_derivatives(const State* state, Params* params, const float* air,
+        float* actions, StateDerivative* derivatives) {
+    derivs_held_f((const float*)state, params, air, actions, (float*)derivatives);
+}
+
+static void step(State* initial, StateDerivative* deriv, float dt, State* output) {
+    output->pos = add3(initial->pos, scalmul3(deriv->vel, dt));
+    output->vel = add3(initial->vel, scalmul3(deriv->v_dot, dt));
+    output->quat = add_quat(initial->quat, scalmul_quat(deriv->q_dot, dt));
+    output->omega = add3(initial->omega, scalmul3(deriv->w_dot, dt));
     for (int i = 0; i < 4; i++) {
-        target_rpms[i] = (actions[i] + 1.0f) * 0.5f * params->max_rpm;
+        output->rpms[i] = initial->rpms[i] + deriv->rpm_dot[i] * dt;
     }
+    quat_normalize(&output->quat);
+}
 
-    // rpm rates
-    float rpm_dot[4];
-    for (int i = 0; i < 4; i++) {
-        rpm_dot[i] = (1.0f / params->k_mot) * (target_rpms[i] - state->rpms[i]);
+void rk4_step(State* state, Params* params, float* actions, float dt) {
+    rk4_step_f(state, params, actions, dt, NULL);
+}
+
+// Batched Jacobians over n drones, all arrays structure of arrays with the
+// drone index fastest: states[i * n + d] is element i of drone d's State,
+// actions[j * n + d] its action j, A[(i * STATE_DIM + j) * n + d] and
+// B[(i * 4 + j) * n + d] the Jacobian entries. params holds one Params per
+// drone. Actions are used as given, move_drone clamps them first.
+
+// Jacobians of compute_derivatives
+void derivative_jacobians(int n, const float* states, const Params* params, const float* actions,
+        float* A, float* B) {
+    float y[STATE_DIM], a[4], jac_a[STATE_DIM * STATE_DIM], jac_b[STATE_DIM * 4];
+    for (int d = 0; d < n; d++) {
+        for (int i = 0; i < STATE_DIM; i++) {
+            y[i] = states[i * n + d];
+        }
+        for (int j = 0; j < 4; j++) {
+            a[j] = actions[j * n + d];
+        }
+        derivs_jac_f(y, &params[d], a, jac_a, jac_b);
+        for (int i = 0; i < STATE_DIM * STATE_DIM; i++) {
+            A[i * n + d] = jac_a[i];
+        }
+        for (int i = 0; i < STATE_DIM * 4; i++) {
+            B[i * n + d] = jac_b[i];
+        }
     }
+}
 
-    // motor thrusts
-    float T[4];
-    for (int i = 0; i < 4; i++) {
-        T[i] = params->k_thrust * powf(state->rpms[i], 2.0f);
+// Jacobians of one rk4_step of dt, without the velocity and rate clamps
+// that move_drone applies afterwards
+void rk4_jacobians(int n, const float* states, const Params* params, const float* actions, float dt,
+        float* A, float* B) {
+    float y[STATE_DIM], a[4], jac_a[STATE_DIM * STATE_DIM], jac_b[STATE_DIM * 4];
+    for (int d = 0; d < n; d++) {
+        for (int i = 0; i < STATE_DIM; i++) {
+            y[i] = states[i * n + d];
+        }
+        for (int j = 0; j < 4; j++) {
+            a[j] = actions[j * n + d];
+        }
+        rk4_jac_flat_f(y, &params[d], a, dt, jac_a, jac_b);
+        for (int i = 0; i < STATE_DIM * STATE_DIM; i++) {
+            A[i * n + d] = jac_a[i];
+        }
+        for (int i = 0; i < STATE_DIM * 4; i++) {
+            B[i * n + d] = jac_b[i];
+        }
     }
+}
 
-    // body frame net force
-    Vec3 F_prop_body = {0.0f, 0.0f, T[0] + T[1] + T[2] + T[3]};
+// Embedded Runge-Kutta pair. The last stage is evaluated at the new state
+// (first same as last), so its derivative starts the next step.
+typedef struct {
+    int stages;
+    float exponent;  // 1 / (order of the embedded solution + 1)
+    float a[7][6];   // a[stages - 1] holds the solution weights
+    float e[7];      // solution weights minus embedded weights
+} EmbeddedTableau;
+
+static const EmbeddedTableau DORMAND_PRINCE = {
+    .stages = 7,
+    .exponent = 0.2f,
+    .a = {
+        {0},
+        {1.0f/5.0f},
+        {3.0f/40.0f, 9.0f/40.0f},
+        {44.0f/45.0f, -56.0f/15.0f, 32.0f/9.0f},
+        {19372.0f/6561.0f, -25360.0f/2187.0f, 64448.0f/6561.0f, -212.0f/729.0f},
+        {9017.0f/3168.0f, -355.0f/33.0f, 46732.0f/5247.0f, 49.0f/176.0f, -5103.0f/18656.0f},
+        {35.0f/384.0f, 0.0f, 500.0f/1113.0f, 125.0f/192.0f, -2187.0f/6784.0f, 11.0f/84.0f},
+    },
+    .e = {71.0f/57600.0f, 0.0f, -71.0f/16695.0f, 71.0f/1920.0f, -17253.0f/339200.0f, 22.0f/525.0f, -1.0f/40.0f},
+};
 
-    // body frame force -> world frame force
-    Vec3 F_prop = quat_rotate(state->quat, F_prop_body);
+static const EmbeddedTableau BOGACKI_SHAMPINE = {
+    .stages = 4,
+    .exponent = 1.0f/3.0f,
+    .a = {
+        {0},
+        {1.0f/2.0f},
+        {0.0f, 3.0f/4.0f},
+        {2.0f/9.0f, 1.0f/3.0f, 4.0f/9.0f},
+    },
+    .e = {-5.0f/72.0f, 1.0f/12.0f, 1.0f/9.0f, -1.0f/8.0f},
+};
 
-    // world frame linear drag
-    Vec3 F_aero;
-    F_aero.x = -params->b_drag * state->vel.x;
-    F_aero.y = -params->b_drag * state->vel.y;
-    F_aero.z = -params->b_drag * state->vel.z;
+// Advances the state by dt in as many internal steps as the tolerance
+// needs, starting from and updating the step size h. Steps never exceed dt
+// since the actions change between policy steps. Returns the number of
+// derivative evaluations.
+DRONE_KERNEL int embedded_rk_step(const EmbeddedTableau* tab, State* state, Params* params,
+        float* actions, float dt, float* h) {
+    StateDerivative k[7];
+    State stage;
+    float* y = (float*)state;
+    float* ys = (float*)&stage;
+    int evals = 1;
+    float air[3];
+    held_air_f(y, params, air);
+    held_derivatives(state, params, air, actions, &k[0]);
+
+    float t = 0.0f;
+    while (t < dt) {
+        float step_size = fminf(*h, dt - t);
+        for (int s = 1; s < tab->stages; s++) {
+            for (int i = 0; i < STATE_DIM; i++) {
+                float sum = 0.0f;
+                for (int j = 0; j < s; j++) {
+                    sum += tab->a[s][j] * ((float*)&k[j])[i];
+                }
+                ys[i] = y[i] + step_size * sum;
+            }
+            quat_normalize(&stage.quat);
+            held_derivatives(&stage, params, air, actions, &k[s]);
+            evals++;
+        }
 
-    // velocity rates, a = F/m
-    Vec3 v_dot;
-    v_dot.x = (F_prop.x + F_aero.x) / params->mass;
-    v_dot.y = (F_prop.y + F_aero.y) / params->mass;
-    v_dot.z = ((F_prop.z + F_aero.z) / params->mass) - params->gravity;
+        // Largest error relative to the mixed tolerance
+        float err = 0.0f;
+        for (int i = 0; i < STATE_DIM; i++) {
+            float e = 0.0f;
+            for (int j = 0; j < tab->stages; j++) {
+                e += tab->e[j] * ((float*)&k[j])[i];
+            }
+            float scale = ADAPT_ATOL + ADAPT_RTOL * fmaxf(fabsf(y[i]), fabsf(ys[i]));
+            err = fmaxf(err, fabsf(step_size * e) / scale);
+        }
 
-    // quaternion rates
-    Quat omega_q = {0.0f, state->omega.x, state->omega.y, state->omega.z};
-    Quat q_dot = quat_mul(state->quat, omega_q);
-    q_dot.w *= 0.5f;
-    q_dot.x *= 0.5f;
-    q_dot.y *= 0.5f;
-    q_dot.z *= 0.5f;
-
-    // body frame torques
-    Vec3 Tau_prop;
-    Tau_prop.x = params->arm_len*(T[1] - T[3]);
-    Tau_prop.y = params->arm_len*(T[2] - T[0]);
-    Tau_prop.z = params->k_drag*(T[0] - T[1] + T[2] - T[3]);
-
-    // torque from chaging motor speeds
-    float Tau_mot_z = params->j_mot * (rpm_dot[0] - rpm_dot[1] + rpm_dot[2] - rpm_dot[3]);
-
-    // torque from angular damping
-    Vec3 Tau_aero;
-    Tau_aero.x = -params->k_ang_damp * state->omega.x;
-    Tau_aero.y = -params->k_ang_damp * state->omega.y;
-    Tau_aero.z = -params->k_ang_damp * state->omega.z;
-    
-    // gyroscopic torque
-    Vec3 Tau_iner;
-    Tau_iner.x = (params->iyy - params->izz) * state->omega.y * state->omega.z;
-    Tau_iner.y = (params->izz - params->ixx) * state->omega.z * state->omega.x;
-    Tau_iner.z = (params->ixx - params->iyy) * state->omega.x * state->omega.y;
-
-    // angular velocity rates
-    Vec3 w_dot;
-    w_dot.x = (Tau_prop.x + Tau_aero.x + Tau_iner.x) / params->ixx;
-    w_dot.y = (Tau_prop.y + Tau_aero.y + Tau_iner.y) / params->iyy;
-    w_dot.z = (Tau_prop.z + Tau_aero.z + Tau_iner.z + Tau_mot_z) / params->izz;
-
-    derivatives->vel = state->vel;
-    derivatives->v_dot = v_dot;
-    derivatives->q_dot = q_dot;
-    derivatives->w_dot = w_dot;
-    for (int i = 0; i < 4; i++) {
-        derivatives->rpm_dot[i] = rpm_dot[i];
+        if (err <= 1.0f || step_size <= ADAPT_MIN_STEP) {
+            t = step_size == dt - t ? dt : t + step_size;
+            *state = stage;
+            k[0] = k[tab->stages - 1];
+        }
+        float factor = err > 0.0f ? ADAPT_SAFETY * powf(err, -tab->exponent) : 5.0f;
+        *h = clampf(step_size * clampf(factor, 0.2f, 5.0f), ADAPT_MIN_STEP, dt);
     }
+    return evals;
 }
 
-static void step(State* initial, StateDerivative* deriv, float dt, State* output) {
-    output->pos = add3(initial->pos, scalmul3(deriv->vel, dt));
-    output->vel = add3(initial->vel, scalmul3(deriv->v_dot, dt));
-    output->quat = add_quat(initial->quat, scalmul_quat(deriv->q_dot, dt));
-    output->omega = add3(initial->omega, scalmul3(deriv->w_dot, dt));
+// The motor lag is linear with a constant target over a policy step, so
+// rpm(t) = target + (rpm0 - target) * exp(-t / k_mot) exactly. The split
+// integrators evaluate the rigid body derivatives with the motors set to
+// this solution, which removes the motor time constant from the step size
+// limit. compute_derivatives then also returns the exact rpm rates.
+static void exact_rpms(State* state, const float rpm0[4], Params* params, float* actions, float t) {
+    float decay = expf(-t / params->k_mot);
     for (int i = 0; i < 4; i++) {
-        output->rpms[i] = initial->rpms[i] + deriv->rpm_dot[i] * dt;
+        float target = (actions[i] + 1.0f) * 0.5f * params->max_rpm;
+        state->rpms[i] = target + (rpm0[i] - target) * decay;
     }
-    quat_normalize(&output->quat);
 }
 
-void rk4_step(State* state, Params* params, float* actions, float dt) {
+// RK4 on position, velocity, attitude and body rates with exact motors
+DRONE_KERNEL int exp_rk4_step(State* state, Params* params, float* actions, float dt, float* h) {
     StateDerivative k1, k2, k3, k4;
     State temp_state;
+    float rpm0[4] = {state->rpms[0], state->rpms[1], state->rpms[2], state->rpms[3]};
+    float air[3];
+    held_air_f((const float*)state, params, air);
 
-    compute_derivatives(state, params, actions, &k1);
+    held_derivatives(state, params, air, actions, &k1);
 
     step(state, &k1, dt * 0.5f, &temp_state);
-    compute_derivatives(&temp_state, params, actions, &k2);
+    exact_rpms(&temp_state, rpm0, params, actions, dt * 0.5f);
+    held_derivatives(&temp_state, params, air, actions, &k2);
 
     step(state, &k2, dt * 0.5f, &temp_state);
-    compute_derivatives(&temp_state, params, actions, &k3);
+    exact_rpms(&temp_state, rpm0, params, actions, dt * 0.5f);
+    held_derivatives(&temp_state, params, air, actions, &k3);
 
     step(state, &k3, dt, &temp_state);
-    compute_derivatives(&temp_state, params, actions, &k4);
+    exact_rpms(&temp_state, rpm0, params, actions, dt);
+    held_derivatives(&temp_state, params, air, actions, &k4);
 
+    // Rigid body part of the flat state, the motors come last
+    float* y = (float*)state;
     float dt_6 = dt / 6.0f;
+    for (int i = 0; i < STATE_DIM - 4; i++) {
+        y[i] += (((float*)&k1)[i] + 2.0f * ((float*)&k2)[i] + 2.0f * ((float*)&k3)[i] + ((float*)&k4)[i]) * dt_6;
+    }
+    exact_rpms(state, rpm0, params, actions, dt);
+    quat_normalize(&state->quat);
+    return 4;
+}
+
+// Semi-implicit Euler with exact motors: one derivative evaluation at the
+// midpoint motor speeds, rates are updated first and then move the pose
+DRONE_KERNEL int exp_euler_step(State* state, Params* params, float* actions, float dt, float* h) {
+    StateDerivative k;
+    State mid = *state;
+    float rpm0[4] = {state->rpms[0], state->rpms[1], state->rpms[2], state->rpms[3]};
+    float air[3];
+    held_air_f((const float*)state, params, air);
+    exact_rpms(&mid, rpm0, params, actions, dt * 0.5f);
+    held_derivatives(&mid, params, air, actions, &k);
+
+    state->vel = add3(state->vel, scalmul3(k.v_dot, dt));
+    state->omega = add3(state->omega, scalmul3(k.w_dot, dt));
+    state->pos = add3(state->pos, scalmul3(state->vel, dt));
+    Quat omega_q = {0.0f, state->omega.x, state->omega.y, state->omega.z};
+    Quat q_dot = scalmul_quat(quat_mul(state->quat, omega_q), 0.5f);
+    state->quat = add_quat(state->quat, scalmul_quat(q_dot, dt));
+    quat_normalize(&state->quat);
+    exact_rpms(state, rpm0, params, actions, dt);
+    return 1;
+}
+
+int rk45_step(State* state, Params* params, float* actions, float dt, float* h) {
+    return embedded_rk_step(&DORMAND_PRINCE, state, params, actions, dt, h);
+}
+
+int rk23_step(State* state, Params* params, float* actions, float dt, float* h) {
+    return embedded_rk_step(&BOGACKI_SHAMPINE, state, params, actions, dt, h);
+}
+
+typedef struct {
+    const char* name;
+    IntegratorStep step;
+} Integrator;
+
+const Integrator INTEGRATORS[INTEGRATOR_N] = {
+    [INTEGRATOR_RK4] = {"rk4", rk4_step_f},
+    [INTEGRATOR_RK45] = {"rk45", rk45_step},
+    [INTEGRATOR_RK23] = {"rk23", rk23_step},
+    [INTEGRATOR_EXP_RK4] = {"exprk4", exp_rk4_step},
+    [INTEGRATOR_EXP_EULER] = {"expeul", exp_euler_step},
+    [INTEGRATOR_EULER] = {"euler", euler_step_f},
+    [INTEGRATOR_SEMI_EULER] = {"semieul", semi_euler_step_f},
+    [INTEGRATOR_RK2] = {"rk2", rk2_step_f},
+    [INTEGRATOR_EULER_D] = {"euler_d", euler_step_d},
+    [INTEGRATOR_SEMI_EULER_D] = {"semieul_d", semi_euler_step_d},
+    [INTEGRATOR_RK2_D] = {"rk2_d", rk2_step_d},
+    [INTEGRATOR_RK4_D] = {"rk4_d", rk4_step_d},
+};
+
+// Picks the drone's integrator once, so stepping never branches on it.
+// Unknown ids fall back to RK4.
+void set_integrator(Drone* drone, int integrator) {
+    if (integrator < 0 || integrator >= INTEGRATOR_N) {
+        integrator = INTEGRATOR_RK4;
+    }
+    drone->integrator = integrator;
+    drone->step = INTEGRATORS[integrator].step;
+}
 
-    state->pos.x += (k1.vel.x + 2.0f * k2.vel.x + 2.0f * k3.vel.x + k4.vel.x) * dt_6;
-    state->pos.y += (k1.vel.y + 2.0f * k2.vel.y + 2.0f * k3.vel.y + k4.vel.y) * dt_6;
-    state->pos.z += (k1.vel.z + 2.0f * k2.vel.z + 2.0f * k3.vel.z + k4.vel.z) * dt_6;
+// Advances the drone by dt with its integrator. Returns the number of
+// derivative evaluations.
+int integrate_drone(Drone* drone, float* actions, float dt) {
+    return drone->step(&drone->state, &drone->params, actions, dt, &drone->h);
+}
 
-    state->vel.x += (k1.v_dot.x + 2.0f * k2.v_dot.x + 2.0f * k3.v_dot.x + k4.v_dot.x) * dt_6;
-    state->vel.y += (k1.v_dot.y + 2.0f * k2.v_dot.y + 2.0f * k3.v_dot.y + k4.v_dot.y) * dt_6;
-    state->vel.z += (k1.v_dot.z + 2.0f * k2.v_dot.z + 2.0f * k3.v_dot.z + k4.v_dot.z) * dt_6;
+// Picks what the actions command, unknown ids fall back to CONTROL_RPM
+void set_control(Drone* drone, int control) {
+    if (control < 0 || control >= CONTROL_N) {
+        control = CONTROL_RPM;
+    }
+    drone->control = control;
+    drone->rate_integral = (Vec3){0.0f, 0.0f, 0.0f};
+}
 
-    state->quat.w += (k1.q_dot.w + 2.0f * k2.q_dot.w + 2.0f * k3.q_dot.w + k4.q_dot.w) * dt_6;
-    state->quat.x += (k1.q_dot.x + 2.0f * k2.q_dot.x + 2.0f * k3.q_dot.x + k4.q_dot.x) * dt_6;
-    state->quat.y += (k1.q_dot.y + 2.0f * k2.q_dot.y + 2.0f * k3.q_dot.y + k4.q_dot.y) * dt_6;
-    state->quat.z += (k1.q_dot.z + 2.0f * k2.q_dot.z + 2.0f * k3.q_dot.z + k4.q_dot.z) * dt_6;
+// Torques for the angular acceleration acc at body rates w, inverting the
+// damping and gyroscopic terms of the rotational dynamics
+static inline Vec3 torques(const Params* p, Vec3 w, Vec3 acc) {
+    return (Vec3){
+        p->ixx * acc.x + p->k_ang_damp * w.x - (p->iyy - p->izz) * w.y * w.z,
+        p->iyy * acc.y + p->k_ang_damp * w.y - (p->izz - p->ixx) * w.z * w.x,
+        p->izz * acc.z + p->k_ang_damp * w.z - (p->ixx - p->iyy) * w.x * w.y,
+    };
+}
 
-    state->omega.x += (k1.w_dot.x + 2.0f * k2.w_dot.x + 2.0f * k3.w_dot.x + k4.w_dot.x) * dt_6;
-    state->omega.y += (k1.w_dot.y + 2.0f * k2.w_dot.y + 2.0f * k3.w_dot.y + k4.w_dot.y) * dt_6;
-    state->omega.z += (k1.w_dot.z + 2.0f * k2.w_dot.z + 2.0f * k3.w_dot.z + k4.w_dot.z) * dt_6;
+// Motor commands for collective thrust F and torques tau, reached after h
+// through the motor lag. Inverts tau_x = L (T1 - T3), tau_y = L (T2 - T0)
+// and tau_z = k_drag (T0 - T1 + T2 - T3). Yaw only gets the headroom left
+// by roll and pitch within the thrusts each motor can reach in h, since the
+// large speed split it asks for would otherwise saturate motors and pull
+// the collective thrust off. Roll and pitch are held to what the motors
+// reach in h only when lagged, for a single command over a policy step. A
+// loop rerun every inner step leaves them at zero to full thrust, where
+// the next step catches up on what the lag held back.
+static void mix_motors(const Drone* drone, float F, Vec3 tau, float h, bool lagged, float* motors) {
+    const Params* p = &drone->params;
+    float decay = expf(-h / p->k_mot);
+    float max_t = p->k_thrust * p->max_rpm * p->max_rpm;
+    float T[4] = {
+        0.25f * F - tau.y / (2.0f * p->arm_len),
+        0.25f * F + tau.x / (2.0f * p->arm_len),
+        0.25f * F + tau.y / (2.0f * p->arm_len),
+        0.25f * F - tau.x / (2.0f * p->arm_len),
+    };
+    float lo[4], hi[4];
+    for (int i = 0; i < 4; i++) {
+        float rpm = drone->state.rpms[i];
+        float rpm_hi = p->max_rpm - (p->max_rpm - rpm) * decay;
+        lo[i] = p->k_thrust * rpm * rpm * decay * decay;
+        hi[i] = p->k_thrust * rpm_hi * rpm_hi;
+        T[i] = lagged ? clampf(T[i], lo[i], hi[i]) : clampf(T[i], 0.0f, max_t);
+        lo[i] = fminf(lo[i], T[i]);
+        hi[i] = fmaxf(hi[i], T[i]);
+    }
+    float yaw = tau.z / (4.0f * p->k_drag);
+    float up = fminf(fminf(hi[0] - T[0], hi[2] - T[2]), fminf(T[1] - lo[1], T[3] - lo[3]));
+    float down = fminf(fminf(T[0] - lo[0], T[2] - lo[2]), fminf(hi[1] - T[1], hi[3] - T[3]));
+    yaw = clampf(yaw, -down, up);
 
     for (int i = 0; i < 4; i++) {
-        state->rpms[i] += (k1.rpm_dot[i] + 2.0f * k2.rpm_dot[i] + 2.0f * k3.rpm_dot[i] + k4.rpm_dot[i]) * dt_6;
+        float t = T[i] + (i % 2 == 0 ? yaw : -yaw);
+        float rpm = sqrtf(fmaxf(t, 0.0f) / p->k_thrust);
+        float target = (rpm - drone->state.rpms[i] * decay) / (1.0f - decay);
+        motors[i] = clampf(2.0f * target / p->max_rpm - 1.0f, -1.0f, 1.0f);
     }
+}
 
-    quat_normalize(&state->quat);
+// PI body rate controller for CONTROL_RATE, run every inner step of h.
+// actions[0] maps [-1, 1] to zero to full collective thrust and actions[1..3]
+// to body rates of +-RATE_MAX. Yaw comes from rotor drag and is weak. Uses
+// the drone's own parameters, but not thrust_scale, which it cannot sense.
+void rate_control(Drone* drone, const float* actions, float h, float* motors) {
+    Params* p = &drone->params;
+    float max_t = p->k_thrust * p->max_rpm * p->max_rpm;
+    float F = (actions[0] + 1.0f) * 0.5f * 4.0f * max_t;
+    Vec3 w = drone->state.omega;
+    Vec3 err = sub3(scalmul3((Vec3){actions[1], actions[2], actions[3]}, RATE_MAX), w);
+    drone->rate_integral = add3(drone->rate_integral, scalmul3(err, h));
+    clamp3(&drone->rate_integral, -RATE_I_MAX, RATE_I_MAX);
+    Vec3 acc = add3(scalmul3(err, RATE_KP), scalmul3(drone->rate_integral, RATE_KI));
+
+    mix_motors(drone, F, torques(p, w, acc), h, false, motors);
 }
 
-void move_drone(Drone* drone, float* actions) {
+// Flies one policy step of dt in CONTROL_RATE, with rate_control and the
+// drone's integrator at RATE_HZ. Returns the number of derivative evaluations.
+int fly_rates(Drone* drone, const float* actions, float dt) {
+    int substeps = (int)ceilf(dt * RATE_HZ - 1e-3f);
+    substeps = substeps < 1 ? 1 : substeps;
+    float h = dt / substeps;
+    float motors[4];
+    int evals = 0;
+    for (int i = 0; i < substeps; i++) {
+        rate_control(drone, actions, h, motors);
+        evals += integrate_drone(drone, motors, h);
+    }
+    return evals;
+}
+
+void init_tape(Tape* tape, int capacity) {
+    *tape = (Tape){0};
+    if (capacity <= 0) {
+        return;
+    }
+    tape->states = calloc(capacity, sizeof(State));
+    tape->actions = calloc(4 * capacity, sizeof(float));
+    tape->dts = calloc(capacity, sizeof(float));
+    tape->targets = calloc(capacity, sizeof(Vec3));
+    tape->scales = calloc(capacity, sizeof(float));
+    tape->capacity = capacity;
+}
+
+// Gives drone a tape of capacity steps, 0 for none, and records from the
+// next step on. Clearing recording pauses the tape.
+void init_drone_tape(Drone* drone, int capacity) {
+    init_tape(&drone->tape, capacity);
+    drone->recording = drone->tape.capacity > 0;
+}
+
+void free_tape(Tape* tape) {
+    free(tape->states);
+    free(tape->actions);
+    free(tape->dts);
+    free(tape->targets);
+    free(tape->scales);
+    *tape = (Tape){0};
+}
+
+// Gradients do not flow across a reset
+void clear_tape(Tape* tape) {
+    tape->len = 0;
+    tape->head = 0;
+}
+
+// Copies src, including its random stream, into dst for a cloned env. dst
+// keeps its own tape storage, restarted empty, and uses its env's wind.
+static inline void copy_drone(Drone* dst, const Drone* src, const WindField* wind) {
+    Tape tape = dst->tape;
+    memcpy(dst, src, sizeof(Drone));
+    dst->tape = tape;
+    dst->recording = tape.capacity > 0;
+    clear_tape(&dst->tape);
+    dst->params.wind = src->params.wind != NULL ? wind : NULL;
+}
+
+static void record_step(Tape* tape, Drone* drone, float* actions, float dt) {
+    int i = tape->head;
+    tape->states[i] = drone->state;
+    memcpy(&tape->actions[4 * i], actions, 4 * sizeof(float));
+    tape->dts[i] = dt;
+    tape->targets[i] = drone->target_pos;
+    tape->scales[i] = drone->params.thrust_scale;
+    tape->head = (i + 1) % tape->capacity;
+    tape->len = tape->len < tape->capacity ? tape->len + 1 : tape->capacity;
+}
+
+// Backpropagates through the taped steps of drone, which must integrate
+// with RK4 (float or double) for the gradients to be exact.
+//
+// Row t of the capacity x STATE_DIM grad_states is dL/dstate after the
+// t-th of the last capacity steps, oldest first, so the last row is the
+// current state. Rows older than the tape are ignored and their rows of
+// grad_actions (capacity x 4) are zeroed. dist_weight adds the gradient of
+// -dist_weight * sum of the per-step distance rewards 1 - |pos - target| /
+// MAX_DIST, with the target the drone was moving to when the reward was
+// taken. Ring rewards are piecewise constant in the state, so they have no
+// gradient. Each step is differentiated with the thrust_scale it flew with. Velocity and rate clamps that were hit block the gradient.
+// Gradients are with respect to the clamped actions.
+void tape_backward(Drone* drone, const float* grad_states, float dist_weight, float* grad_actions) {
+    Tape* tape = &drone->tape;
+    int T = tape->capacity;
+    memset(grad_actions, 0, 4 * T * sizeof(float));
+    float g[STATE_DIM] = {0}, g0[STATE_DIM];
+    const State* next = &drone->state;
+    Vec3 target = drone->target_pos;
+    Params params = drone->params;
+
+    for (int t = T - 1; t >= T - tape->len; t--) {
+        int slot = (tape->head - (T - t) + T) % T;
+        for (int i = 0; i < STATE_DIM; i++) {
+            g[i] += grad_states[t * STATE_DIM + i];
+        }
+        if (dist_weight != 0.0f) {
+            Vec3 d = sub3(next->pos, target);
+            float dist = norm3(d);
+            if (dist > 0.0f) {
+                float scale = dist_weight / (MAX_DIST * dist);
+                g[0] += scale * d.x;
+                g[1] += scale * d.y;
+                g[2] += scale * d.z;
+            }
+        }
+
+        const float* v = &next->vel.x;
+        const float* w = &next->omega.x;
+        for (int i = 0; i < 3; i++) {
+            if (fabsf(v[i]) >= drone->params.max_vel) {
+                g[3 + i] = 0.0f;
+            }
+            if (fabsf(w[i]) >= drone->params.max_omega) {
+                g[10 + i] = 0.0f;
+            }
+        }
+
+        params.thrust_scale = tape->scales[slot];
+        rk4_vjp_flat_f((const float*)&tape->states[slot], &params, &tape->actions[4 * slot],
+            tape->dts[slot], g, g0, &grad_actions[4 * t]);
+        memcpy(g, g0, sizeof(g));
+        next = &tape->states[slot];
+        target = tape->targets[slot];
+    }
+}
+
+// Returns the number of derivative evaluations
+DRONE_KERNEL int move_drone(Drone* drone, float* actions) {
     // clamp actions
     clamp4(actions, -1.0f, 1.0f);
 
     // Domain randomized dt
-    float dt = DT * rndf(1.0f - DT_RNG, 1.0 + DT_RNG);
+    float dt = DT * rng_uniform(&drone->rng, 1.0f - DT_RNG, 1.0f + DT_RNG);
+
+    if (drone->recording) {
+        record_step(&drone->tape, drone, actions, dt);
+    }
 
     // update drone state
     drone->prev_pos = drone->state.pos;
-    rk4_step(&drone->state, &drone->params, actions, dt);
+    int evals;
+    if (drone->control == CONTROL_RATE) {
+        evals = fly_rates(drone, actions, dt);
+    } else {
+        evals = integrate_drone(drone, actions, dt);
+    }
 
     // clamp and normalise for observations
     clamp3(&drone->state.vel, -drone->params.max_vel, drone->params.max_vel);
     clamp3(&drone->state.omega, -drone->params.max_omega, drone->params.max_omega);
+    return evals;
 }
 
-void reset_rings(Ring* ring_buffer, int num_rings, float ring_radius) {
-    ring_buffer[0] = rndring(ring_radius);
+// Uniform grid of vertical columns over the arena, rebuilt every step by
+// counting sort, so a downwash query visits the 3x3 columns around a drone
+// instead of every other drone
+typedef struct {
+    int nx, ny;
+    int capacity;    // drones
+    int* cell_start; // nx * ny + 1 offsets into items
+    int* items;      // drone indices grouped by column
+    int* cell;       // column of each drone
+    float* scale;    // thrust scales of the step being built
+} AeroGrid;
+
+void init_aero_grid(AeroGrid* grid, int capacity) {
+    grid->nx = (int)ceilf(2.0f * GRID_X / AERO_CELL);
+    grid->ny = (int)ceilf(2.0f * GRID_Y / AERO_CELL);
+    grid->capacity = capacity;
+    grid->cell_start = arena_calloc(grid->nx * grid->ny + 1, sizeof(int));
+    grid->items = arena_calloc(capacity, sizeof(int));
+    grid->cell = arena_calloc(capacity, sizeof(int));
+    grid->scale = arena_calloc(capacity, sizeof(float));
+}
+
+void free_aero_grid(AeroGrid* grid) {
+    arena_free(grid->cell_start);
+    arena_free(grid->items);
+    arena_free(grid->cell);
+    arena_free(grid->scale);
+    *grid = (AeroGrid){0};
+}
+
+static inline int aero_column(const AeroGrid* grid, float v, float half, int n) {
+    int i = (int)floorf((v + half) / AERO_CELL);
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+void build_aero_grid(AeroGrid* grid, const Drone* drones, int n) {
+    int cells = grid->nx * grid->ny;
+    memset(grid->cell_start, 0, (cells + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int cx = aero_column(grid, drones[i].state.pos.x, GRID_X, grid->nx);
+        int cy = aero_column(grid, drones[i].state.pos.y, GRID_Y, grid->ny);
+        grid->cell[i] = cx + grid->nx * cy;
+        grid->cell_start[grid->cell[i] + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+    }
+    // cell_start[c] is the write cursor for column c - 1 until the pass ends
+    for (int i = 0; i < n; i++) {
+        grid->items[grid->cell_start[grid->cell[i]]++] = i;
+    }
+    for (int c = cells; c > 0; c--) {
+        grid->cell_start[c] = grid->cell_start[c - 1];
+    }
+    grid->cell_start[0] = 0;
+}
+
+// Cheeseman-Bennett thrust ratio over the floor at -GRID_Z, rotor radius
+// taken as half the arm and the height held at half a radius or more
+static inline float ground_effect(const Drone* drone) {
+    float radius = 0.5f * drone->params.arm_len;
+    float height = drone->state.pos.z + GRID_Z;
+    height = height > 0.5f * radius ? height : 0.5f * radius;
+    float r = radius / (4.0f * height);
+    return 1.0f / (1.0f - r * r);
+}
+
+// Fraction of below's thrust taken by the wake of above. The wake is a
+// vertical cone that widens with depth and carries above's thrust, so the
+// loss falls with the wake area and with distance from its axis.
+static inline float downwash_loss(const Drone* above, const Drone* below) {
+    float depth = above->state.pos.z - below->state.pos.z;
+    if (depth <= 0.0f || depth > DOWNWASH_RANGE) {
+        return 0.0f;
+    }
+    float wake = above->params.arm_len + DOWNWASH_SPREAD * depth;
+    float dx = above->state.pos.x - below->state.pos.x;
+    float dy = above->state.pos.y - below->state.pos.y;
+    float r2 = (dx * dx + dy * dy) / (wake * wake);
+    if (r2 >= 1.0f) {
+        return 0.0f;
+    }
+    const Params* p = &above->params;
+    float thrust = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        thrust += p->k_thrust * p->thrust_scale * above->state.rpms[i] * above->state.rpms[i];
+    }
+    float weight = below->params.mass * below->params.gravity;
+    float cover = below->params.arm_len < wake ? below->params.arm_len / wake : 1.0f;
+    return DOWNWASH_LOSS * (thrust / weight) * cover * cover * (1.0f - r2);
+}
+
+// Sets every drone's thrust_scale from the wakes above it and the floor,
+// held for the next step. Cost is linear in drones for a bounded density.
+DRONE_KERNEL void update_aero(AeroGrid* grid, Drone* drones, int n) {
+    build_aero_grid(grid, drones, n);
+    // Wakes use the scales of the last step, so the order is irrelevant
+    for (int i = 0; i < n; i++) {
+        Drone* below = &drones[i];
+        int cx = grid->cell[i] % grid->nx;
+        int cy = grid->cell[i] / grid->nx;
+        float loss = 0.0f;
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            if (y < 0 || y >= grid->ny) {
+                continue;
+            }
+            int x0 = cx > 0 ? cx - 1 : 0;
+            int x1 = cx < grid->nx - 1 ? cx + 1 : cx;
+            // columns x0..x1 of a row are contiguous in items
+            int end = grid->cell_start[x1 + grid->nx * y + 1];
+            for (int k = grid->cell_start[x0 + grid->nx * y]; k < end; k++) {
+                int j = grid->items[k];
+                if (j != i) {
+                    loss += downwash_loss(&drones[j], below);
+                }
+            }
+        }
+        float scale = loss < 1.0f - AERO_MIN_SCALE ? 1.0f - loss : AERO_MIN_SCALE;
+        grid->scale[i] = scale * ground_effect(below);
+    }
+    for (int i = 0; i < n; i++) {
+        drones[i].params.thrust_scale = grid->scale[i];
+    }
+}
+
+void reset_rings(Ring* ring_buffer, int num_rings, float ring_radius, uint32_t* rng) {
+    ring_buffer[0] = rndring(ring_radius, rng);
     
     // ensure rings are spaced at least 2*ring_radius apart
     for (int i = 1; i < num_rings; i++) {
         do {
-            ring_buffer[i] = rndring(ring_radius);
+            ring_buffer[i] = rndring(ring_radius, rng);
         }  while (norm3(sub3(ring_buffer[i].pos, ring_buffer[i - 1].pos)) < 2.0f*ring_radius);
     }   
 }
@@ -487,3 +1558,99 @@ float check_ring(Drone* drone, Ring* ring) {
     }
     return 0.0f;
 }
+
+// Lee, Leok and McClamroch's geometric tracking controller on SE(3), as an
+// expert for imitation. Writes the actions that fly drone to pos_d at vel_d
+// in its control mode: collective thrust and body rates in CONTROL_RATE,
+// otherwise motor commands that reach the wanted thrusts by the end of the
+// policy step. Heading is left free, since yaw authority is small. Gains are
+// low enough for the 20 Hz policy rate and the 0.1 s motor lag.
+void expert_action(const Drone* drone, Vec3 pos_d, Vec3 vel_d, float* actions) {
+    const Params* p = &drone->params;
+    const State* s = &drone->state;
+    Vec3 b1 = quat_rotate(s->quat, (Vec3){1.0f, 0.0f, 0.0f});
+    Vec3 b2 = quat_rotate(s->quat, (Vec3){0.0f, 1.0f, 0.0f});
+    Vec3 b3 = quat_rotate(s->quat, (Vec3){0.0f, 0.0f, 1.0f});
+
+    // PD on position, with the approach speed capped so far targets don't
+    // wind up speeds the drone can't brake from
+    Vec3 approach = scalmul3(sub3(pos_d, s->pos), EXPERT_KX / EXPERT_KV);
+    float v = norm3(approach);
+    if (v > EXPERT_MAX_SPEED) {
+        approach = scalmul3(approach, EXPERT_MAX_SPEED / v);
+    }
+    Vec3 acc = scalmul3(sub3(add3(vel_d, approach), s->vel), EXPERT_KV);
+
+    // Thrust vector for the wanted acceleration, also cancelling gravity
+    // and the linear drag at vel_d
+    float a = norm3(acc);
+    if (a > EXPERT_MAX_ACC) {
+        acc = scalmul3(acc, EXPERT_MAX_ACC / a);
+    }
+    acc.z += p->gravity;
+    Vec3 F = add3(scalmul3(acc, p->mass), scalmul3(vel_d, p->b_drag));
+    float f = dot3(F, b3);
+
+    // Desired attitude tilts b3 onto F and keeps the current heading
+    Vec3 b3d = scalmul3(F, 1.0f / norm3(F));
+    Vec3 b2d = cross3(b3d, b1);
+    float n = norm3(b2d);
+    b2d = n > 1e-6f ? scalmul3(b2d, 1.0f / n) : b2;
+    Vec3 b1d = cross3(b2d, b3d);
+
+    // e_R = vee(Rd^T R - R^T Rd) / 2
+    Vec3 e_r = {
+        0.5f * (dot3(b3d, b2) - dot3(b3, b2d)),
+        0.5f * (dot3(b1d, b3) - dot3(b1, b3d)),
+        0.5f * (dot3(b2d, b1) - dot3(b2, b1d)),
+    };
+
+    float max_t = p->k_thrust * p->max_rpm * p->max_rpm;
+    if (drone->control == CONTROL_RATE) {
+        actions[0] = clampf(2.0f * f / (4.0f * max_t) - 1.0f, -1.0f, 1.0f);
+        actions[1] = clampf(-EXPERT_KR * e_r.x / RATE_MAX, -1.0f, 1.0f);
+        actions[2] = clampf(-EXPERT_KR * e_r.y / RATE_MAX, -1.0f, 1.0f);
+        actions[3] = 0.0f;
+        return;
+    }
+
+    // At the policy rate the drone's damping does most of the rate control.
+    // Yaw torque is left out, the large rotor speed differences it needs
+    // upset the thrust over a step through the motor lag.
+    Vec3 w = s->omega;
+    Vec3 ang = scalmul3(sub3(scalmul3(e_r, -EXPERT_KR), w), EXPERT_KW);
+    Vec3 tau = torques(p, w, ang);
+    tau.z = 0.0f;
+    mix_motors(drone, f, tau, DT, true, actions);
+}
+
+// Waypoint that flies drone through ring from its entry side: a point on
+// the ring's axis EXPERT_LEAD ahead of the drone, held short of the plane
+// until the drone is near the axis and passed at up to EXPERT_SPEED. From
+// the exit side the drone first moves clear of the rim, then around.
+void ring_waypoint(const Drone* drone, const Ring* ring, Vec3* pos_d, Vec3* vel_d) {
+    Vec3 n = ring->normal;
+    Vec3 d = sub3(drone->state.pos, ring->pos);
+    float along = dot3(d, n);
+    Vec3 lateral = sub3(d, scalmul3(n, along));
+    float lat = norm3(lateral);
+
+    if (along < 0.0f) {
+        // Stay a metre short of the plane until close to the axis
+        float limit = lat < 0.5f * ring->radius ? 1.0f : -1.0f;
+        float ahead = along + EXPERT_LEAD < limit ? along + EXPERT_LEAD : limit;
+        *pos_d = add3(ring->pos, scalmul3(n, ahead));
+        float aligned = 1.0f - lat / ring->radius;
+        *vel_d = scalmul3(n, EXPERT_SPEED * (aligned > 0.0f ? aligned : 0.0f));
+        return;
+    }
+
+    // Any direction off the axis will do when on it
+    Vec3 side = lat > 1e-3f ? scalmul3(lateral, 1.0f / lat) : cross3(n, fabsf(n.z) < 0.9f
+        ? (Vec3){0.0f, 0.0f, 1.0f} : (Vec3){1.0f, 0.0f, 0.0f});
+    side = scalmul3(side, 1.0f / norm3(side));
+    float clear = ring->radius + 1.5f;
+    float back = lat < ring->radius + 1.0f ? (along > 1.0f ? along : 1.0f) : -1.5f;
+    *pos_d = add3(ring->pos, add3(scalmul3(n, back), scalmul3(side, clear)));
+    *vel_d = (Vec3){0.0f, 0.0f, 0.0f};
+}
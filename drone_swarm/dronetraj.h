@@ -0,0 +1,162 @@
+// Originally made by Sam Turner and Finlay Sanders, 2025.
+// Included in pufferlib under the original project's MIT license.
+// https://github.com/stmio/drone
+
+// Target trajectories for DroneSwarm. Every agent's target is a parametric
+// curve evaluated in closed form at the env tick, so a target anywhere along
+// its path costs the same as one step of it. Formations share a leader's
+// curve and differ only in their tick offset: followers sit on the leader's
+// target, a congo line leads by a fixed number of ticks per agent.
+//
+// Positions are in meters and velocities in meters per tick, like
+// Drone.target_vel. Include after dronelib.h.
+
+#include <math.h>
+
+#define TRAJ_STATIC 0 // fixed at origin
+#define TRAJ_LINE 1 // constant velocity from origin, bouncing off the arena walls
+#define TRAJ_CIRCLE 2 // horizontal circle of radius amp.x around origin
+#define TRAJ_LISSAJOUS 3 // origin + amp * sin(freq * t + phase) per axis
+#define TRAJ_SPLINE 4 // closed Catmull-Rom loop through the waypoints
+#define TRAJ_N 5
+
+#define TRAJ_WAYPOINTS 4
+
+typedef struct {
+    int kind;
+    float t0; // ticks added to the env tick
+    Vec3 origin;
+    Vec3 vel; // per tick, TRAJ_LINE
+    Vec3 amp;
+    Vec3 freq; // radians per tick, freq.x for TRAJ_CIRCLE
+    Vec3 phase;
+    Vec3 waypoints[TRAJ_WAYPOINTS];
+    float segment_ticks; // ticks between waypoints
+} Trajectory;
+
+static inline Trajectory static_traj(Vec3 pos) {
+    return (Trajectory){.kind = TRAJ_STATIC, .origin = pos};
+}
+
+// Position and velocity along one axis of a line bouncing between -bound
+// and bound: the unfolded line is a triangle wave of period 4 * bound
+static inline void bounce_axis(float p0, float v, float bound, float t, float* p, float* dp) {
+    float period = 4.0f * bound;
+    float u = fmodf(p0 + bound + v * t, period);
+    u = u < 0.0f ? u + period : u;
+    bool forward = u < 2.0f * bound;
+    *p = forward ? u - bound : 3.0f * bound - u;
+    *dp = forward ? v : -v;
+}
+
+// Catmull-Rom point and tangent on the segment from p1 to p2 at s in [0, 1]
+static inline void catmull_rom(Vec3 p0, Vec3 p1, Vec3 p2, Vec3 p3, float s, Vec3* pos, Vec3* tangent) {
+    float s2 = s * s;
+    float s3 = s2 * s;
+    float c0 = -0.5f * s3 + s2 - 0.5f * s;
+    float c1 = 1.5f * s3 - 2.5f * s2 + 1.0f;
+    float c2 = -1.5f * s3 + 2.0f * s2 + 0.5f * s;
+    float c3 = 0.5f * s3 - 0.5f * s2;
+    float d0 = -1.5f * s2 + 2.0f * s - 0.5f;
+    float d1 = 4.5f * s2 - 5.0f * s;
+    float d2 = -4.5f * s2 + 4.0f * s + 0.5f;
+    float d3 = 1.5f * s2 - s;
+    *pos = add3(add3(scalmul3(p0, c0), scalmul3(p1, c1)), add3(scalmul3(p2, c2), scalmul3(p3, c3)));
+    *tangent = add3(add3(scalmul3(p0, d0), scalmul3(p1, d1)), add3(scalmul3(p2, d2), scalmul3(p3, d3)));
+}
+
+// Target position and per tick velocity of traj at env tick t
+static inline void traj_eval(const Trajectory* traj, float t, Vec3* pos, Vec3* vel) {
+    t += traj->t0;
+    switch (traj->kind) {
+    case TRAJ_LINE:
+        bounce_axis(traj->origin.x, traj->vel.x, GRID_X, t, &pos->x, &vel->x);
+        bounce_axis(traj->origin.y, traj->vel.y, GRID_Y, t, &pos->y, &vel->y);
+        bounce_axis(traj->origin.z, traj->vel.z, GRID_Z, t, &pos->z, &vel->z);
+        break;
+    case TRAJ_CIRCLE: {
+        float a = traj->freq.x * t + traj->phase.x;
+        float r = traj->amp.x;
+        *pos = add3(traj->origin, (Vec3){r * cosf(a), r * sinf(a), 0.0f});
+        *vel = (Vec3){-r * traj->freq.x * sinf(a), r * traj->freq.x * cosf(a), 0.0f};
+        break;
+    }
+    case TRAJ_LISSAJOUS: {
+        Vec3 a = {traj->freq.x * t + traj->phase.x, traj->freq.y * t + traj->phase.y,
+            traj->freq.z * t + traj->phase.z};
+        *pos = add3(traj->origin, (Vec3){traj->amp.x * sinf(a.x), traj->amp.y * sinf(a.y), traj->amp.z * sinf(a.z)});
+        *vel = (Vec3){traj->amp.x * traj->freq.x * cosf(a.x), traj->amp.y * traj->freq.y * cosf(a.y),
+            traj->amp.z * traj->freq.z * cosf(a.z)};
+        break;
+    }
+    case TRAJ_SPLINE: {
+        float u = fmodf(t / traj->segment_ticks, (float)TRAJ_WAYPOINTS);
+        u = u < 0.0f ? u + TRAJ_WAYPOINTS : u;
+        int i = (int)u;
+        i = i < TRAJ_WAYPOINTS ? i : TRAJ_WAYPOINTS - 1;
+        const Vec3* w = traj->waypoints;
+        Vec3 tangent;
+        catmull_rom(w[(i + TRAJ_WAYPOINTS - 1) % TRAJ_WAYPOINTS], w[i], w[(i + 1) % TRAJ_WAYPOINTS],
+            w[(i + 2) % TRAJ_WAYPOINTS], u - i, pos, &tangent);
+        *vel = scalmul3(tangent, 1.0f / traj->segment_ticks);
+        break;
+    }
+    default:
+        *pos = traj->origin;
+        *vel = (Vec3){0.0f, 0.0f, 0.0f};
+    }
+}
+
+// Moves every agent's target to its trajectory at env tick t
+static inline void eval_targets(const Trajectory* trajs, Drone* agents, int n, float t) {
+    for (int i = 0; i < n; i++) {
+        traj_eval(&trajs[i], t, &agents[i].target_pos, &agents[i].target_vel);
+    }
+}
+
+// A moving curve of the given kind that stays inside the arena margins and
+// travels at about V_TARGET
+static Trajectory random_traj(int kind, uint32_t* rng) {
+    Trajectory traj = {.kind = kind};
+    Vec3 margin = {MARGIN_X, MARGIN_Y, MARGIN_Z};
+    if (kind == TRAJ_LINE) {
+        traj.origin = (Vec3){rng_uniform(rng, -MARGIN_X, MARGIN_X), rng_uniform(rng, -MARGIN_Y, MARGIN_Y),
+            rng_uniform(rng, -MARGIN_Z, MARGIN_Z)};
+        traj.vel = (Vec3){rng_uniform(rng, -V_TARGET, V_TARGET), rng_uniform(rng, -V_TARGET, V_TARGET),
+            rng_uniform(rng, -V_TARGET, V_TARGET)};
+    } else if (kind == TRAJ_CIRCLE) {
+        float r = rng_uniform(rng, 2.0f, 8.0f);
+        traj.amp.x = r;
+        traj.origin = (Vec3){rng_uniform(rng, -MARGIN_X + r, MARGIN_X - r),
+            rng_uniform(rng, -MARGIN_Y + r, MARGIN_Y - r), rng_uniform(rng, -MARGIN_Z, MARGIN_Z)};
+        traj.freq.x = (rng_next(rng) & 1 ? 1.0f : -1.0f) * V_TARGET / r;
+        traj.phase.x = rng_uniform(rng, 0.0f, 2.0f * PI);
+    } else if (kind == TRAJ_LISSAJOUS) {
+        float* amp = &traj.amp.x;
+        float* freq = &traj.freq.x;
+        float* phase = &traj.phase.x;
+        float* m = &margin.x;
+        for (int j = 0; j < 3; j++) {
+            amp[j] = rng_uniform(rng, 0.2f, 0.5f) * m[j];
+            freq[j] = rng_uniform(rng, 0.6f, 1.0f) * V_TARGET / amp[j];
+            phase[j] = rng_uniform(rng, 0.0f, 2.0f * PI);
+        }
+        traj.origin = (Vec3){rng_uniform(rng, -MARGIN_X + traj.amp.x, MARGIN_X - traj.amp.x),
+            rng_uniform(rng, -MARGIN_Y + traj.amp.y, MARGIN_Y - traj.amp.y),
+            rng_uniform(rng, -MARGIN_Z + traj.amp.z, MARGIN_Z - traj.amp.z)};
+    } else if (kind == TRAJ_SPLINE) {
+        // Catmull-Rom stays within the waypoints' hull up to a small overshoot
+        float length = 0.0f;
+        for (int k = 0; k < TRAJ_WAYPOINTS; k++) {
+            traj.waypoints[k] = (Vec3){rng_uniform(rng, -0.8f * MARGIN_X, 0.8f * MARGIN_X),
+                rng_uniform(rng, -0.8f * MARGIN_Y, 0.8f * MARGIN_Y), rng_uniform(rng, -0.8f * MARGIN_Z, 0.8f * MARGIN_Z)};
+            if (k > 0) {
+                length += norm3(sub3(traj.waypoints[k], traj.waypoints[k - 1]));
+            }
+        }
+        length += norm3(sub3(traj.waypoints[0], traj.waypoints[TRAJ_WAYPOINTS - 1]));
+        traj.segment_ticks = fmaxf(length / (TRAJ_WAYPOINTS * V_TARGET), 1.0f);
+        traj.origin = traj.waypoints[0];
+    }
+    return traj;
+}